@@ -0,0 +1,496 @@
+/**
+ * @file uart-bridge-bench.c
+ * @brief Round-trip benchmark for the uart-bridge daemon
+ *
+ * Starts uart-bridge on a pseudo-terminal that stands in for the STM32
+ * UART, answers every command from the pty master side, and measures
+ * command round-trip latency as seen by 1..N concurrent socket clients.
+ * With -p each client keeps several tagged commands in flight at once.
+ *
+ * With -d the daemon is started on that device instead, typically the
+ * pty of uart-bridge-sim, and negotiates framing and line rate as with
+ * the real STM32; -m picks the command to time. ERROR answers count as
+ * failed.
+ *
+ * -G checks instead that an EVT:GPIO edge from the STM32 drops the
+ * daemon's cached GPIO_GET level: the GPIO_GET after the edge must reach
+ * the built-in responder again. The exit status reports the result.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <termios.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "uart-protocol.h"
+
+#define DEFAULT_DAEMON      "/usr/bin/uart-bridge"
+#define DEFAULT_REQUESTS    1000
+#define DEFAULT_MAX_CLIENTS 32
+#define MAX_PIPELINE        64
+
+typedef struct {
+    int index;
+    int requests;
+    uint64_t *samples;
+    int failed;
+} bench_client_t;
+
+static int pty_master = -1;
+static int service_us = 0;
+static int pipeline = 1;
+static char socket_path[96];
+static const char *command = CMD_PING;  /* -m: NAME[:params] */
+static int gpio_gets = 0;               /* GPIO_GET lines the responder answered */
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @brief Fake STM32: answer each received line on the pty master
+ */
+static void *responder_thread(void *arg) {
+    char buf[4096];
+    char line[MAX_MESSAGE_LENGTH];
+    size_t line_len = 0;
+
+    (void)arg;
+
+    for (;;) {
+        ssize_t n = read(pty_master, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+
+        for (ssize_t i = 0; i < n; i++) {
+            if (buf[i] != MESSAGE_DELIMITER) {
+                if (line_len < sizeof(line) - 1) {
+                    line[line_len++] = buf[i];
+                }
+                continue;
+            }
+
+            char reply[64];
+            const char *id;
+            int len;
+
+            line[line_len] = '\0';
+            line_len = 0;
+
+            if (strncmp(line, CMD_GPIO_GET, strlen(CMD_GPIO_GET)) == 0) {
+                __atomic_add_fetch(&gpio_gets, 1, __ATOMIC_RELAXED);
+            }
+
+            if (service_us > 0) {
+                usleep(service_us);
+            }
+
+            /* Echo the request ID, if any, like the firmware does */
+            id = strchr(line, REQUEST_ID_SEPARATOR);
+            len = snprintf(reply, sizeof(reply), "%s%.*s\n",
+                           strncmp(line, CMD_PING, strlen(CMD_PING)) == 0 ? RESP_PONG : RESP_OK,
+                           id ? (int)strcspn(id, ":") : 0, id ? id : "");
+            (void)!write(pty_master, reply, len);
+        }
+    }
+
+    return NULL;
+}
+
+static int connect_bridge(void) {
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Send the command tagged #<id> for request number i
+ */
+static int send_command(int fd, int i) {
+    char cmd[MAX_MESSAGE_LENGTH];
+    size_t name_len = strcspn(command, ":");
+    int len = snprintf(cmd, sizeof(cmd), "%.*s%c%d%s\n", (int)name_len, command,
+                       REQUEST_ID_SEPARATOR, i % MAX_PIPELINE + 1, command + name_len);
+
+    return write(fd, cmd, len) == len ? 0 : -1;
+}
+
+/**
+ * @brief Wait until the daemon has set up the link and answers a PING
+ * @return 0, or -1 if it did not within timeout_ms
+ */
+static int wait_link(int timeout_ms) {
+    char reply[64];
+
+    for (int waited = 0; waited < timeout_ms; waited += 50) {
+        int fd = connect_bridge();
+
+        if (fd >= 0) {
+            ssize_t n = write(fd, "PING#1\n", 7) == 7 ? read(fd, reply, sizeof(reply)) : -1;
+
+            close(fd);
+            if (n > 0 && strncmp(reply, RESP_PONG, strlen(RESP_PONG)) == 0) {
+                return 0;
+            }
+        }
+        usleep(50000);
+    }
+    return -1;
+}
+
+/**
+ * @brief Read one line from the daemon, skipping unsolicited ones unless
+ *        they start with prefix
+ * @return Line length without the delimiter, or -1 after 2 s
+ */
+static int read_reply(int fd, const char *prefix, char *line, size_t size) {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    size_t len = 0;
+    char c;
+
+    for (;;) {
+        if (poll(&pfd, 1, 2000) <= 0 || read(fd, &c, 1) != 1) {
+            return -1;
+        }
+        if (c != MESSAGE_DELIMITER) {
+            if (len < size - 1) {
+                line[len++] = c;
+            }
+            continue;
+        }
+        line[len] = '\0';
+        if (prefix != NULL ? strncmp(line, prefix, strlen(prefix)) == 0
+                           : strncmp(line, RESP_EVT, strlen(RESP_EVT)) != 0) {
+            return (int)len;
+        }
+        len = 0;
+    }
+}
+
+static bool exchange(int fd, const char *cmd, char *reply, size_t size) {
+    size_t len = strlen(cmd);
+
+    return write(fd, cmd, len) == (ssize_t)len && read_reply(fd, NULL, reply, size) > 0 &&
+           strncmp(reply, RESP_ERROR, strlen(RESP_ERROR)) != 0;
+}
+
+/**
+ * @brief -G: GPIO_GET, GPIO_GET (cached), EVT:GPIO, GPIO_GET (must go out)
+ * @return 0 if the edge dropped the cached level
+ */
+static int check_gpio_event(void) {
+    static const char edge[] = "EVT:GPIO,C,13,1,1000,0\n";
+    char reply[MAX_MESSAGE_LENGTH];
+    int fd = connect_bridge();
+    int cached, refreshed;
+
+    if (fd < 0 || !exchange(fd, "SUBSCRIBE:EVT:GPIO\n", reply, sizeof(reply)) ||
+        !exchange(fd, "GPIO_WATCH#1:C,13,3\n", reply, sizeof(reply)) ||
+        !exchange(fd, "GPIO_GET#2:C,13\n", reply, sizeof(reply)) ||
+        !exchange(fd, "GPIO_GET#3:C,13\n", reply, sizeof(reply))) {
+        fprintf(stderr, "GPIO_WATCH/GPIO_GET through uart-bridge failed: %s\n", reply);
+        return 1;
+    }
+    cached = __atomic_load_n(&gpio_gets, __ATOMIC_RELAXED);
+
+    /* The daemon drops the cached level before it publishes the event */
+    if (write(pty_master, edge, sizeof(edge) - 1) != sizeof(edge) - 1 ||
+        read_reply(fd, RESP_EVT, reply, sizeof(reply)) < 0 ||
+        !exchange(fd, "GPIO_GET#4:C,13\n", reply, sizeof(reply))) {
+        fprintf(stderr, "EVT:GPIO was not passed on\n");
+        return 1;
+    }
+    refreshed = __atomic_load_n(&gpio_gets, __ATOMIC_RELAXED);
+    close(fd);
+
+    printf("GPIO_GET reaching the UART: %d before the edge (1 expected), %d after (2 expected)\n",
+           cached, refreshed);
+    return cached == 1 && refreshed == 2 ? 0 : 1;
+}
+
+/**
+ * @brief One client: keep `pipeline` tagged PINGs outstanding until done
+ */
+static void *client_thread(void *arg) {
+    bench_client_t *bc = arg;
+    uint64_t sent_at[MAX_PIPELINE];
+    char buf[MAX_MESSAGE_LENGTH];
+    size_t buf_len = 0;
+    int sent = 0, received = 0;
+    int fd = connect_bridge();
+
+    if (fd < 0) {
+        bc->failed = bc->requests;
+        return NULL;
+    }
+
+    while (received < bc->requests) {
+        char *nl;
+        ssize_t n;
+
+        while (sent < bc->requests && sent - received < pipeline) {
+            sent_at[sent % MAX_PIPELINE] = now_ns();
+            if (send_command(fd, sent) < 0) {
+                goto out;
+            }
+            sent++;
+        }
+
+        n = read(fd, buf + buf_len, sizeof(buf) - buf_len);
+        if (n <= 0) {
+            goto out;
+        }
+        buf_len += n;
+
+        while ((nl = memchr(buf, MESSAGE_DELIMITER, buf_len)) != NULL) {
+            char *id = memchr(buf, REQUEST_ID_SEPARATOR, nl - buf);
+            size_t consumed = nl - buf + 1;
+
+            if (id != NULL && strncmp(buf, RESP_ERROR, strlen(RESP_ERROR)) != 0) {
+                int slot = atoi(id + 1) - 1;
+                bc->samples[received] = now_ns() - sent_at[slot % MAX_PIPELINE];
+            } else {
+                bc->failed++;
+            }
+            received++;
+
+            memmove(buf, buf + consumed, buf_len - consumed);
+            buf_len -= consumed;
+        }
+    }
+
+out:
+    bc->failed += bc->requests - received;
+    close(fd);
+    return NULL;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void run_round(int nclients, int requests) {
+    pthread_t threads[nclients];
+    bench_client_t bc[nclients];
+    size_t total = (size_t)nclients * requests;
+    uint64_t *samples = calloc(total, sizeof(uint64_t));
+    uint64_t start, elapsed;
+    size_t valid = 0;
+    int failed = 0;
+
+    if (samples == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return;
+    }
+
+    start = now_ns();
+    for (int i = 0; i < nclients; i++) {
+        bc[i].index = i;
+        bc[i].requests = requests;
+        bc[i].samples = samples + (size_t)i * requests;
+        bc[i].failed = 0;
+        pthread_create(&threads[i], NULL, client_thread, &bc[i]);
+    }
+    for (int i = 0; i < nclients; i++) {
+        pthread_join(threads[i], NULL);
+        failed += bc[i].failed;
+    }
+    elapsed = now_ns() - start;
+
+    /* Failed requests leave zero samples behind; drop them */
+    for (size_t i = 0; i < total; i++) {
+        if (samples[i] != 0) {
+            samples[valid++] = samples[i];
+        }
+    }
+    qsort(samples, valid, sizeof(uint64_t), compare_u64);
+
+    if (valid == 0) {
+        printf("%7d  %10s  %10s  %10s  %10s  %6d\n", nclients, "-", "-", "-", "-", failed);
+    } else {
+        printf("%7d  %10.1f  %10.1f  %10.1f  %10.0f  %6d\n", nclients,
+               samples[valid / 2] / 1000.0,
+               samples[(valid * 99) / 100] / 1000.0,
+               samples[valid - 1] / 1000.0,
+               valid / (elapsed / 1e9),
+               failed);
+    }
+
+    free(samples);
+}
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [-x daemon] [-d device] [-m command] [-c max_clients] [-n requests]\n"
+           "       [-p depth] [-t service_us] [-G]\n", prog);
+    printf("  -x  uart-bridge binary (default: %s)\n", DEFAULT_DAEMON);
+    printf("  -c  largest number of concurrent clients (default: %d)\n", DEFAULT_MAX_CLIENTS);
+    printf("  -n  requests per client per round (default: %d)\n", DEFAULT_REQUESTS);
+    printf("  -p  commands each client keeps in flight, 1-%d (default: 1)\n", MAX_PIPELINE);
+    printf("  -t  emulated STM32 service time per command in us (default: 0)\n");
+    printf("  -d  run the daemon on this device (uart-bridge-sim) instead of a built-in pty\n");
+    printf("  -m  command to time, without request ID (default: %s)\n", CMD_PING);
+    printf("  -G  check that EVT:GPIO drops the cached GPIO_GET level, then exit\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *daemon_path = DEFAULT_DAEMON;
+    const char *device = NULL;
+    int max_clients = DEFAULT_MAX_CLIENTS;
+    int requests = DEFAULT_REQUESTS;
+    pthread_t responder;
+    struct termios tty;
+    int pty_slave = -1;
+    bool gpio_check = false;
+    pid_t pid;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "x:d:m:c:n:p:t:Gh")) != -1) {
+        switch (opt) {
+            case 'x': daemon_path = optarg; break;
+            case 'd': device = optarg; break;
+            case 'm': command = optarg; break;
+            case 'c': max_clients = atoi(optarg); break;
+            case 'n': requests = atoi(optarg); break;
+            case 'p': pipeline = atoi(optarg); break;
+            case 't': service_us = atoi(optarg); break;
+            case 'G': gpio_check = true; break;
+            default:
+                print_usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (max_clients < 1 || requests < 1 || pipeline < 1 || pipeline > MAX_PIPELINE ||
+        strlen(command) > MAX_MESSAGE_LENGTH - 16 || (gpio_check && device != NULL)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Pseudo-terminal standing in for the STM32 UART */
+    if (device == NULL) {
+        pty_master = posix_openpt(O_RDWR | O_NOCTTY);
+        if (pty_master < 0 || grantpt(pty_master) < 0 || unlockpt(pty_master) < 0) {
+            perror("posix_openpt");
+            return 1;
+        }
+
+        /* Hold the slave open so the master never sees EIO between opens */
+        pty_slave = open(ptsname(pty_master), O_RDWR | O_NOCTTY);
+        if (pty_slave < 0) {
+            perror("open pty slave");
+            return 1;
+        }
+        tcgetattr(pty_slave, &tty);
+        cfmakeraw(&tty);
+        tcsetattr(pty_slave, TCSANOW, &tty);
+    }
+
+    snprintf(socket_path, sizeof(socket_path), "/tmp/uart-bridge-bench.%d.sock", (int)getpid());
+
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (pid == 0) {
+        if (device != NULL) {
+            execl(daemon_path, daemon_path, "-d", device, "-s", socket_path, (char *)NULL);
+        } else {
+            /* The responder only speaks ASCII, so keep the daemon from switching;
+             * -G keeps GPIO_GET answers long enough to tell a cached one apart */
+            execl(daemon_path, daemon_path, "-a", "-d", ptsname(pty_master), "-s", socket_path,
+                  gpio_check ? "-c" : (char *)NULL, "GPIO_GET=5000", (char *)NULL);
+        }
+        perror("exec uart-bridge");
+        _exit(127);
+    }
+
+    /* Wait up to 2 s for the daemon socket to come up */
+    for (int i = 0; i < 200; i++) {
+        int fd = connect_bridge();
+        if (fd >= 0) {
+            close(fd);
+            break;
+        }
+        usleep(10000);
+    }
+
+    if (device == NULL) {
+        pthread_create(&responder, NULL, responder_thread, NULL);
+        if (gpio_check) {
+            /* Link setup first; commands meanwhile are answered BUSY */
+            int status = wait_link(5000) < 0 ? 1 : check_gpio_event();
+
+            kill(pid, SIGTERM);
+            waitpid(pid, NULL, 0);
+            return status;
+        }
+        printf("uart-bridge round-trip benchmark (%d requests/client, pipeline %d, service %d us)\n",
+               requests, pipeline, service_us);
+    } else {
+        /* PROTO and SET_BAUD first; commands meanwhile are answered BUSY */
+        if (wait_link(5000) < 0) {
+            fprintf(stderr, "uart-bridge did not bring up the link on %s\n", device);
+            kill(pid, SIGTERM);
+            waitpid(pid, NULL, 0);
+            return 1;
+        }
+        printf("uart-bridge round-trip benchmark on %s (%s, %d requests/client, pipeline %d)\n",
+               device, command, requests, pipeline);
+    }
+    printf("%7s  %10s  %10s  %10s  %10s  %6s\n",
+           "clients", "p50 [us]", "p99 [us]", "max [us]", "cmds/s", "failed");
+
+    for (int n = 1; n <= max_clients; n *= 2) {
+        run_round(n, requests);
+        if (n < max_clients && n * 2 > max_clients) {
+            run_round(max_clients, requests);
+        }
+    }
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    if (device == NULL) {
+        close(pty_slave);
+        close(pty_master);
+    }
+    return 0;
+}
@@ -0,0 +1,422 @@
+/**
+ * @file uart-bridge-client.c
+ * @brief Client library for the uart-bridge daemon (libuartbridge)
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "uart-protocol.h"
+#include "uart-bridge-client.h"
+
+#define CLIENT_RX_BUFFER 16384
+
+struct uart_bridge {
+    int fd;                             /* Daemon socket */
+    int efd;                            /* Ring doorbell, -1 without ring */
+    uart_ring_t *ring;
+    size_t ring_map_len;
+    uint32_t ring_size;                 /* Checked copy of ring->size */
+    uint16_t next_id;
+    int passed_fds[2];                  /* Last descriptors received, -1 = none */
+    char rx_buf[CLIENT_RX_BUFFER];      /* Socket data not handed out yet */
+    size_t rx_len;
+};
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Milliseconds left until deadline, for poll(); deadline 0 = no limit */
+static int time_left(uint64_t deadline) {
+    uint64_t now;
+
+    if (deadline == 0) {
+        return -1;
+    }
+    now = now_ms();
+    return now >= deadline ? 0 : (int)(deadline - now);
+}
+
+static void close_passed_fds(uart_bridge_t *ub) {
+    for (int i = 0; i < 2; i++) {
+        if (ub->passed_fds[i] >= 0) {
+            close(ub->passed_fds[i]);
+            ub->passed_fds[i] = -1;
+        }
+    }
+}
+
+/**
+ * @brief Drop the oldest buffered line to make room
+ */
+static void discard_oldest(uart_bridge_t *ub) {
+    char *nl = memchr(ub->rx_buf, MESSAGE_DELIMITER, ub->rx_len);
+    size_t len = nl ? (size_t)(nl - ub->rx_buf) + 1 : ub->rx_len;
+
+    memmove(ub->rx_buf, ub->rx_buf + len, ub->rx_len - len);
+    ub->rx_len -= len;
+}
+
+/**
+ * @brief Read what the socket has, collecting passed descriptors
+ * @return Bytes read, 0 if none were waiting, -1 on error or EOF
+ */
+static int receive(uart_bridge_t *ub) {
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    struct iovec iov;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+    };
+    ssize_t n;
+
+    if (ub->rx_len == sizeof(ub->rx_buf)) {
+        discard_oldest(ub);
+    }
+    iov.iov_base = ub->rx_buf + ub->rx_len;
+    iov.iov_len = sizeof(ub->rx_buf) - ub->rx_len;
+
+    do {
+        n = recvmsg(ub->fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        return errno == EAGAIN ? 0 : -1;
+    }
+    if (n == 0) {
+        return -1;
+    }
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            int fds[2];
+
+            memcpy(fds, CMSG_DATA(cmsg), (count < 2 ? count : 2) * sizeof(int));
+            close_passed_fds(ub);
+            for (size_t i = 0; i < count && i < 2; i++) {
+                ub->passed_fds[i] = fds[i];
+            }
+        }
+    }
+
+    ub->rx_len += n;
+    return (int)n;
+}
+
+/**
+ * @brief Wait for socket data (and the doorbell, if given)
+ * @return 1 if something arrived, 0 on timeout, -1 on error or EOF
+ */
+static int wait_input(uart_bridge_t *ub, int efd, uint64_t deadline) {
+    struct pollfd pfd[2] = {
+        { .fd = ub->fd, .events = POLLIN },
+        { .fd = efd, .events = POLLIN },
+    };
+    int n = poll(pfd, efd >= 0 ? 2 : 1, time_left(deadline));
+
+    if (n < 0) {
+        return errno == EINTR ? 1 : -1;
+    }
+    if (n == 0) {
+        return 0;
+    }
+    if (efd >= 0 && (pfd[1].revents & POLLIN)) {
+        uint64_t count;
+        (void)!read(efd, &count, sizeof(count));
+    }
+    if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+        return receive(ub) < 0 ? -1 : 1;
+    }
+    return 1;
+}
+
+/**
+ * @brief Take a buffered line out of the receive buffer
+ *
+ * With id != REQUEST_ID_NONE only the response carrying that ID is taken.
+ * Otherwise the oldest untagged (unsolicited) line is; tagged lines met on
+ * the way answer commands that were given up on and are dropped.
+ *
+ * @return Line length, or -1 if no such line is buffered
+ */
+static int take_line(uart_bridge_t *ub, uint16_t id, char *line, size_t size) {
+    size_t off = 0;
+
+    while (off < ub->rx_len) {
+        char *start = ub->rx_buf + off;
+        char *nl = memchr(start, MESSAGE_DELIMITER, ub->rx_len - off);
+        size_t len, name_len;
+        const char *tag;
+        bool take;
+
+        if (nl == NULL) {
+            break;
+        }
+        len = nl - start;
+        name_len = strcspn(start, ":\n");
+        tag = memchr(start, REQUEST_ID_SEPARATOR, name_len);
+
+        if (id == REQUEST_ID_NONE) {
+            take = tag == NULL;
+        } else {
+            take = tag != NULL && strtoul(tag + 1, NULL, 10) == id;
+        }
+
+        if (take && line != NULL && size > 0) {
+            size_t n = len < size - 1 ? len : size - 1;
+            memcpy(line, start, n);
+            line[n] = '\0';
+        }
+        if (take || (id == REQUEST_ID_NONE && tag != NULL)) {
+            memmove(start, nl + 1, ub->rx_len - off - len - 1);
+            ub->rx_len -= len + 1;
+            if (take) {
+                return (int)len;
+            }
+            continue;
+        }
+        off += len + 1;
+    }
+    return -1;
+}
+
+/* Copy out of the ring data area, wrapping at the end */
+static void ring_read(const uart_bridge_t *ub, uint32_t pos, void *out, size_t len) {
+    uint32_t off = pos & (ub->ring_size - 1);
+    size_t first = ub->ring_size - off < len ? ub->ring_size - off : len;
+
+    memcpy(out, ub->ring->data + off, first);
+    memcpy((uint8_t *)out + first, ub->ring->data, len - first);
+}
+
+/**
+ * @brief Pop one message from the ring
+ * @return Line length, 0 if the ring is empty, -1 if it is corrupt
+ */
+static int ring_pop(uart_bridge_t *ub, char *line, size_t size) {
+    uint32_t tail = ub->ring->tail;
+    uint32_t head = __atomic_load_n(&ub->ring->head, __ATOMIC_ACQUIRE);
+    uint16_t len;
+    size_t n;
+
+    if (head == tail) {
+        return 0;
+    }
+    ring_read(ub, tail, &len, sizeof(len));
+    if (head - tail > ub->ring_size || sizeof(len) + len > head - tail) {
+        return -1;
+    }
+
+    n = len < size - 1 ? len : size - 1;
+    ring_read(ub, tail + sizeof(len), line, n);
+    line[n] = '\0';
+    __atomic_store_n(&ub->ring->tail, tail + sizeof(len) + len, __ATOMIC_RELEASE);
+    return (int)n;
+}
+
+uart_bridge_t *uart_bridge_open(const char *socket_path) {
+    struct sockaddr_un addr;
+    uart_bridge_t *ub = calloc(1, sizeof(*ub));
+
+    if (ub == NULL) {
+        return NULL;
+    }
+    ub->efd = -1;
+    ub->passed_fds[0] = ub->passed_fds[1] = -1;
+    ub->next_id = 1;
+
+    ub->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (ub->fd < 0) {
+        free(ub);
+        return NULL;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path ? socket_path : UART_BRIDGE_SOCKET,
+            sizeof(addr.sun_path) - 1);
+    if (connect(ub->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        int err = errno;
+        close(ub->fd);
+        free(ub);
+        errno = err;
+        return NULL;
+    }
+    return ub;
+}
+
+void uart_bridge_close(uart_bridge_t *ub) {
+    if (ub == NULL) {
+        return;
+    }
+    if (ub->ring != NULL) {
+        munmap(ub->ring, ub->ring_map_len);
+    }
+    if (ub->efd >= 0) {
+        close(ub->efd);
+    }
+    close_passed_fds(ub);
+    close(ub->fd);
+    free(ub);
+}
+
+int uart_bridge_command(uart_bridge_t *ub, const char *command, char *reply,
+                        size_t size, int timeout_ms) {
+    uint64_t deadline = timeout_ms < 0 ? 0 : now_ms() + timeout_ms;
+    char line[MAX_MESSAGE_LENGTH];
+    /* NAME, then any '!' / '@ms' and ":params", which go after the ID */
+    size_t name_len = strcspn(command, "!@:");
+    uint16_t id = ub->next_id;
+    int len;
+
+    ub->next_id = ub->next_id == REQUEST_ID_MAX ? 1 : ub->next_id + 1;
+    len = snprintf(line, sizeof(line), "%.*s%c%u%s%c", (int)name_len, command,
+                   REQUEST_ID_SEPARATOR, id, command + name_len, MESSAGE_DELIMITER);
+    if (len < 0 || (size_t)len >= sizeof(line) || send(ub->fd, line, len, MSG_NOSIGNAL) != len) {
+        return -1;
+    }
+
+    for (;;) {
+        int rc;
+
+        len = take_line(ub, id, line, sizeof(line));
+        if (len >= 0) {
+            break;
+        }
+        rc = wait_input(ub, -1, deadline);
+        if (rc <= 0) {
+            return -1;
+        }
+    }
+
+    if (reply != NULL && size > 0) {
+        snprintf(reply, size, "%s", line);
+    }
+    return strncmp(line, RESP_OK, strlen(RESP_OK)) == 0 &&
+           (line[2] == REQUEST_ID_SEPARATOR || line[2] == FIELD_SEPARATOR || line[2] == '\0') ? 0 : 1;
+}
+
+static int subscription(uart_bridge_t *ub, const char *verb, const char *filter) {
+    char command[MAX_MESSAGE_LENGTH];
+
+    snprintf(command, sizeof(command), "%s%c%s", verb, FIELD_SEPARATOR, filter);
+    return uart_bridge_command(ub, command, NULL, 0, 1000) == 0 ? 0 : -1;
+}
+
+int uart_bridge_subscribe(uart_bridge_t *ub, const char *filter) {
+    return subscription(ub, CMD_SUBSCRIBE, filter);
+}
+
+int uart_bridge_unsubscribe(uart_bridge_t *ub, const char *filter) {
+    return subscription(ub, CMD_UNSUBSCRIBE, filter);
+}
+
+int uart_bridge_ring(uart_bridge_t *ub, size_t bytes) {
+    char command[32];
+    char reply[MAX_MESSAGE_LENGTH];
+    const char *value;
+    unsigned long size;
+    uart_ring_t *ring;
+    size_t map_len;
+
+    if (ub->ring != NULL) {
+        return (int)ub->ring_size;
+    }
+
+    snprintf(command, sizeof(command), "%s%c%zu", CMD_RING, FIELD_SEPARATOR, bytes);
+    close_passed_fds(ub);
+    if (uart_bridge_command(ub, command, reply, sizeof(reply), 1000) != 0) {
+        return -1;
+    }
+
+    /* OK#id:size, with the memfd and the eventfd attached */
+    value = strchr(reply, FIELD_SEPARATOR);
+    size = value ? strtoul(value + 1, NULL, 10) : 0;
+    if (size < UART_RING_MIN || size > UART_RING_MAX || (size & (size - 1)) != 0 ||
+        ub->passed_fds[0] < 0 || ub->passed_fds[1] < 0) {
+        close_passed_fds(ub);
+        return -1;
+    }
+
+    map_len = sizeof(uart_ring_t) + size;
+    ring = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, ub->passed_fds[0], 0);
+    if (ring == MAP_FAILED || ring->magic != UART_RING_MAGIC || ring->size != size) {
+        if (ring != MAP_FAILED) {
+            munmap(ring, map_len);
+        }
+        close_passed_fds(ub);
+        return -1;
+    }
+
+    close(ub->passed_fds[0]);
+    ub->passed_fds[0] = -1;
+    ub->efd = ub->passed_fds[1];
+    ub->passed_fds[1] = -1;
+    ub->ring = ring;
+    ub->ring_map_len = map_len;
+    ub->ring_size = (uint32_t)size;
+    return (int)size;
+}
+
+int uart_bridge_next(uart_bridge_t *ub, char *line, size_t size, int timeout_ms) {
+    uint64_t deadline = timeout_ms <= 0 ? 0 : now_ms() + timeout_ms;
+
+    if (size == 0) {
+        return -1;
+    }
+
+    for (;;) {
+        int len = take_line(ub, REQUEST_ID_NONE, line, size);
+        int rc;
+
+        /* Lines already on the socket predate the switch to the ring */
+        if (len >= 0) {
+            return len;
+        }
+        if (ub->ring != NULL) {
+            len = ring_pop(ub, line, size);
+            if (len != 0) {
+                return len;
+            }
+        }
+        if (timeout_ms == 0 || (deadline != 0 && time_left(deadline) == 0)) {
+            return 0;
+        }
+
+        if (ub->ring != NULL) {
+            /* Tell the daemon to ring, then look once more so no wakeup is lost */
+            __atomic_store_n(&ub->ring->sleeping, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&ub->ring->head, __ATOMIC_SEQ_CST) != ub->ring->tail) {
+                __atomic_store_n(&ub->ring->sleeping, 0, __ATOMIC_RELAXED);
+                continue;
+            }
+        }
+        rc = wait_input(ub, ub->efd, deadline);
+        if (ub->ring != NULL) {
+            __atomic_store_n(&ub->ring->sleeping, 0, __ATOMIC_RELAXED);
+        }
+        if (rc < 0) {
+            return -1;
+        }
+    }
+}
+
+unsigned long uart_bridge_dropped(const uart_bridge_t *ub) {
+    return ub->ring ? __atomic_load_n(&ub->ring->dropped, __ATOMIC_RELAXED) : 0;
+}
@@ -0,0 +1,118 @@
+/**
+ * @file uart-bridge-client.h
+ * @brief Client library for the uart-bridge daemon (libuartbridge)
+ *
+ * Commands and their responses always travel over the daemon's Unix
+ * socket. Unsolicited messages (ADC_DATA blocks, EVT events) arrive on the
+ * socket too, unless the client asks for a shared memory ring:
+ *
+ *   RING#1:65536   ->   OK#1:65536   (+ memfd and eventfd via SCM_RIGHTS)
+ *
+ * From then on the daemon copies every message matching the client's
+ * SUBSCRIBE filters straight into the ring, and writes the eventfd only
+ * when the client has said it is about to sleep. A busy consumer reads
+ * messages without any system call.
+ *
+ * uart_bridge_next() hides the difference: it returns the next message
+ * from whichever transport carries it.
+ *
+ * Example:
+ *
+ *   uart_bridge_t *ub = uart_bridge_open(NULL);
+ *   uart_bridge_ring(ub, 65536);
+ *   uart_bridge_subscribe(ub, "ADC_DATA");
+ *   uart_bridge_command(ub, "ADC_STREAM:1,1000", NULL, 0, 1000);
+ *   while (uart_bridge_next(ub, line, sizeof(line), -1) > 0) { ... }
+ */
+
+#ifndef UART_BRIDGE_CLIENT_H
+#define UART_BRIDGE_CLIENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define UART_BRIDGE_SOCKET "/var/run/uart-bridge.sock"
+
+/* Shared ring, laid out by the daemon at the start of the memfd */
+#define UART_RING_MAGIC     0x55425231  /* "UBR1" */
+#define UART_RING_MIN       4096
+#define UART_RING_MAX       (1u << 20)
+
+/*
+ * Records are a 16-bit native-endian length followed by the message line
+ * (no delimiter), written byte by byte modulo size with no padding. head
+ * and tail are free-running byte counters; head - tail bytes are in use.
+ * Producer and consumer fields sit on separate cache lines.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t size;                      /* Data bytes, a power of two */
+    uint32_t dropped;                   /* Messages that did not fit (daemon) */
+    uint32_t reserved0[13];
+    uint32_t head;                      /* Written by the daemon */
+    uint32_t reserved1[15];
+    uint32_t tail;                      /* Written by the client */
+    uint32_t sleeping;                  /* Set by the client before waiting, cleared by the daemon */
+    uint32_t reserved2[14];
+    uint8_t data[];
+} uart_ring_t;
+
+typedef struct uart_bridge uart_bridge_t;
+
+/**
+ * @brief Connect to the daemon
+ * @param socket_path Socket, NULL for UART_BRIDGE_SOCKET
+ * @return Handle, or NULL with errno set
+ */
+uart_bridge_t *uart_bridge_open(const char *socket_path);
+
+/**
+ * @brief Disconnect and release the ring, if any
+ */
+void uart_bridge_close(uart_bridge_t *ub);
+
+/**
+ * @brief Send a command and wait for its response
+ *
+ * The command is given without request ID ("GPIO_SET:C,13,1", or
+ * "I2C_READ@50:1,0x50,0,4" with a deadline); the library tags it and
+ * waits for the matching response line.
+ *
+ * @param reply Receives the response line (may be NULL)
+ * @param timeout_ms Time to wait, -1 for no limit
+ * @return 0 for OK, 1 for any other response (ERROR...), -1 on failure
+ */
+int uart_bridge_command(uart_bridge_t *ub, const char *command, char *reply,
+                        size_t size, int timeout_ms);
+
+/**
+ * @brief SUBSCRIBE / UNSUBSCRIBE a topic filter
+ * @return 0 on success, -1 otherwise
+ */
+int uart_bridge_subscribe(uart_bridge_t *ub, const char *filter);
+int uart_bridge_unsubscribe(uart_bridge_t *ub, const char *filter);
+
+/**
+ * @brief Switch unsolicited messages to a shared memory ring
+ * @param bytes Requested ring size, rounded up to a power of two
+ * @return Actual ring size, or -1 (the socket keeps carrying them)
+ */
+int uart_bridge_ring(uart_bridge_t *ub, size_t bytes);
+
+/**
+ * @brief Wait for the next unsolicited message
+ * @param line Receives the message line, NUL-terminated
+ * @param timeout_ms Time to wait, 0 to poll, -1 for no limit
+ * @return Line length, 0 on timeout, -1 on error or disconnect
+ */
+int uart_bridge_next(uart_bridge_t *ub, char *line, size_t size, int timeout_ms);
+
+/**
+ * @brief Messages the daemon had to drop for this client so far
+ *
+ * Only messages lost in the ring are known here; drops on the socket path
+ * show up as seq gaps.
+ */
+unsigned long uart_bridge_dropped(const uart_bridge_t *ub);
+
+#endif /* UART_BRIDGE_CLIENT_H */
@@ -0,0 +1,1343 @@
+/**
+ * @file uart-bridge-sim.c
+ * @brief STM32 stand-in for running uart-bridge without hardware
+ *
+ * Opens a pseudo-terminal pair and answers the uart-protocol.h command set
+ * on the master side the way the recovery firmware does: ASCII or binary
+ * framing (PROTO), SET_BAUD with its verify timeout, BATCH, the binary
+ * STATUS snapshot, ADC_STREAM blocks, GPIO_WATCH edges and TELEMETRY
+ * deltas. uart-bridge is pointed at the slave side with -d.
+ *
+ * So that timings mean something on a plain Linux box:
+ *  - both directions are paced at the current line rate, 10 bits per
+ *    byte; the pty is read only as fast as the line would deliver, so the
+ *    daemon's TIOCOUTQ sees a backlog as on a real UART;
+ *  - each command takes a service time (-t). High-priority commands run
+ *    on one timeline and preempt the normal ones on another, like the
+ *    protocol thread and the bulk work queue; more than 8 normal commands
+ *    waiting are answered BUSY;
+ *  - -e flips a random bit in that many bytes per million, both ways.
+ *
+ * PROFILE reports the modelled time in SIM_SYSCLK_HZ cycles: the wait for
+ * a timeline as dispatch, the service time as execute. Parsing, encoding
+ * and sending cost the simulator nothing and count as 0. THREADS reports
+ * the service time run on each timeline as the CPU time of the protocol
+ * thread and the work queue, the rest as idle; stack high-water marks are
+ * fixed figures and the heap is never used.
+ *
+ * Peripherals are simulated: GPIO outputs read back (and raise EVT:GPIO
+ * on watched pins), each I2C address is a 256-byte register file, ADC
+ * channels return a slow triangle wave with some noise.
+ *
+ * Replies are queued as results and encoded only when they go out on the
+ * line, so a framing change (PROTO, RESET) takes effect in wire order.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "uart-protocol.h"
+
+#define SIM_PORT_MASK       0x9F        /* Ports A-E and H, as on the STM32F411 */
+#define SIM_PORTS           8
+#define SIM_PINS            16
+#define SIM_I2C_BUSES       3
+#define SIM_I2C_ADDRS       128
+#define SIM_ADC_CHANNELS    19
+#define SIM_PWM_CHANNELS    4
+#define SIM_PWM_PERIOD      1000
+#define SIM_DATA_MAX        128         /* Largest data part: STATUS, ADC_DATA, TLM */
+#define SIM_PENDING         256         /* Results waiting for their service time */
+#define SIM_TX_QUEUE        65536       /* Bytes waiting for the line, a power of two */
+#define SIM_TX_MARKS        8
+#define SIM_BULK_QUEUE      8           /* CONFIG_BRIDGE_BULK_QUEUE */
+#define SIM_TX_BUFFERS      3           /* CONFIG_BRIDGE_TX_BUFFERS */
+#define SIM_ADC_BLOCKS      4           /* CONFIG_BRIDGE_ADC_STREAM_BLOCKS */
+#define SIM_KEYFRAME_MS     1000        /* CONFIG_BRIDGE_TELEMETRY_KEYFRAME_MS */
+#define SIM_BURST_US        1000        /* Line time moved per read or write at most */
+#define SIM_KERNEL_VERSION  0x030700    /* Zephyr 3.7.0 */
+#define SIM_SYSCLK_HZ       100000000
+#define SIM_PROFILE_OPCODES (OP_THREADS + 1)
+#define SIM_HEAP_SIZE       4096        /* CONFIG_HEAP_MEM_POOL_SIZE */
+
+/* What happens once a reply has been handed to the line or has left it */
+enum {
+    AFTER_NONE,
+    AFTER_PROTO,                        /* Switch framing, arg = PROTO_* */
+    AFTER_BAUD,                         /* Switch line rate, arg = rate */
+    AFTER_RESET,                        /* Reboot: ASCII at UART_BAUDRATE */
+};
+
+/* Outcome of a command or an unsolicited message, framed when it is sent */
+typedef struct {
+    uint64_t due_us;
+    uint16_t id;
+    uint8_t opcode;
+    uint8_t nargs;
+    uint8_t after;
+    bool normal;                        /* Counts against the bulk queue */
+    uint32_t after_arg;
+    uint32_t args[MAX_FRAME_ARGS];
+    uint16_t data_len;
+    uint8_t data[SIM_DATA_MAX];
+} sim_result_t;
+
+typedef void (*sim_handler_t)(const uint32_t *args, int nargs, sim_result_t *res);
+
+typedef struct {
+    sim_handler_t handler;
+    uint8_t min_args;
+    uint8_t max_args;
+    bool batch;                         /* Allowed inside BATCH */
+} sim_cmd_t;
+
+/* One direction of the emulated line */
+typedef struct {
+    uint64_t at_us;                     /* Last refill */
+    double credit;                      /* Bytes the line may carry now */
+} sim_line_t;
+
+/* Line rate change or reboot waiting for the reply before it to leave */
+typedef struct {
+    uint64_t offset;                    /* tx_sent value that triggers it */
+    uint8_t after;
+    uint32_t arg;
+} sim_mark_t;
+
+static int pty_master = -1;
+static volatile bool running = true;
+static bool verbose = false;
+static const char *link_path = NULL;
+
+/* Options */
+static uint32_t service_us[256];        /* By opcode */
+static uint32_t error_ppm = 0;
+static bool paced = true;
+static uint64_t rng_state = 0x2545F4914F6CDD1Dull;
+
+/* Link */
+static bool binary_mode = false;
+static uint32_t baudrate = UART_BAUDRATE;
+static uint32_t previous_baudrate = UART_BAUDRATE;
+static uint64_t baud_verify_us = 0;     /* Revert unless a command arrives by then */
+static sim_line_t rx_line, tx_line;
+static uint8_t rx_buf[MAX_FRAME_LENGTH];
+static size_t rx_len = 0;
+static bool rx_overflow = false;
+
+static uint8_t tx_queue[SIM_TX_QUEUE];
+static size_t tx_start = 0, tx_len = 0;
+static uint64_t tx_sent = 0;            /* Bytes written to the pty, free-running */
+static uint64_t tx_queued = 0;          /* Bytes put in tx_queue, free-running */
+static sim_mark_t tx_marks[SIM_TX_MARKS];
+static int tx_mark_count = 0;
+
+static sim_result_t pending[SIM_PENDING];       /* Sorted by due_us */
+static int pending_count = 0;
+static int bulk_waiting = 0;
+static uint64_t busy_high_us = 0, busy_bulk_us = 0;
+static uint64_t run_high_us = 0, run_bulk_us = 0;      /* Service time since boot */
+
+/* THREADS: the two timelines, then idle; stack sizes as in the firmware */
+static const struct {
+    const char *name;
+    uint32_t stack_size;
+    uint32_t stack_used;
+} sim_threads[] = {
+    { "bridge",      2048, 704 },
+    { "bridge_bulk", 2048, 912 },
+    { "idle",        320,  64 },
+};
+#define SIM_THREADS (sizeof(sim_threads) / sizeof(sim_threads[0]))
+
+/* Board */
+static uint64_t boot_us;
+static uint8_t reset_cause = UART_RESET_POWER_ON;
+static uint16_t gpio_levels[SIM_PORTS];
+static uint8_t gpio_watch[SIM_PORTS][SIM_PINS];        /* GPIO_WATCH_* */
+static uint32_t gpio_event_seq = 0;
+static uint8_t i2c_regs[SIM_I2C_BUSES][SIM_I2C_ADDRS][256];
+static uint16_t pwm_duty[SIM_PWM_CHANNELS];
+
+static struct {
+    bool active;
+    uint32_t channel;
+    uint32_t rate;
+    uint32_t remaining;                 /* Samples, 0 = until stopped */
+    uint32_t seq;
+    uint64_t sample_us;                 /* Time of the next sample */
+} adc_stream;
+
+static struct {
+    uint32_t period_ms;                 /* 0 = off */
+    uint32_t ports, channels, deadband;
+    uint32_t seq;
+    uint64_t next_us;
+    uint64_t keyframe_us;
+    uint64_t sampled;                   /* Bit per field */
+    uint32_t value[UART_TLM_FIELDS];
+    uint32_t sent[UART_TLM_FIELDS];
+} tlm;
+
+static struct {
+    uint64_t rx_bytes, tx_bytes;
+    uint64_t commands;
+    uint64_t corrupted;                 /* Bytes with a bit flipped by -e */
+    uint32_t rx_overruns;
+    uint32_t crc_errors;
+    uint32_t errors[UART_ERR_COUNT];
+    uint32_t jobs_max_used;             /* Bulk job pool peak, as the slab tracks it */
+    uint32_t jobs_exhausted;
+    uint32_t adc_max_used;              /* ADC block pool peak */
+    uint64_t dropped;                   /* Results that found the queue full */
+} stats;
+
+/* PROFILE histograms, as profile.c keeps them */
+static struct {
+    uint32_t max;
+    uint32_t buckets[UART_PROFILE_BUCKETS];
+} profile[SIM_PROFILE_OPCODES][UART_PROFILE_PHASES];
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static uint32_t sim_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)(rng_state >> 16);
+}
+
+/**
+ * @brief Flip a random bit in about error_ppm of every million bytes
+ */
+static void corrupt(uint8_t *data, size_t len) {
+    if (error_ppm == 0) {
+        return;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (sim_random() % 1000000 < error_ppm) {
+            data[i] ^= 1u << (sim_random() % 8);
+            stats.corrupted++;
+        }
+    }
+}
+
+/**
+ * @brief Bytes the line can carry right now (unlimited without pacing)
+ */
+static size_t line_credit(sim_line_t *line, uint64_t now) {
+    double cap = (double)baudrate / 10 * SIM_BURST_US / 1000000;
+
+    if (!paced) {
+        return SIZE_MAX;
+    }
+    if (cap < 16) {
+        cap = 16;
+    }
+    line->credit += (double)(now - line->at_us) * baudrate / 10 / 1000000;
+    line->at_us = now;
+    if (line->credit > cap) {
+        line->credit = cap;
+    }
+    return line->credit >= 1 ? (size_t)line->credit : 0;
+}
+
+static void line_use(sim_line_t *line, size_t bytes) {
+    if (paced) {
+        line->credit -= bytes;
+    }
+}
+
+/**
+ * @brief Microseconds until the line can carry a byte
+ */
+static uint64_t line_wait_us(const sim_line_t *line) {
+    double missing = 1 - line->credit;
+
+    return missing <= 0 ? 0 : (uint64_t)(missing * 10 * 1000000 / baudrate) + 1;
+}
+
+/* ---- Results, framing and the transmit queue ---- */
+
+/**
+ * @brief Encode a result in the current framing
+ * @return Bytes written to out, or -1
+ */
+static int sim_encode(const sim_result_t *res, uint8_t *out, size_t size) {
+    char params[MAX_MESSAGE_LENGTH - 16];
+    size_t len = 0;
+    size_t i = 0;
+
+    if (binary_mode) {
+        return uart_frame_encode(res->opcode, res->id, res->args, res->nargs,
+                                 res->data, res->data_len, out, size);
+    }
+
+    params[0] = '\0';
+    if (res->opcode == OP_EVT) {
+        if (uart_event_format(res->args, res->nargs, params, sizeof(params)) < 0) {
+            return -1;
+        }
+    } else {
+        /* ERROR:name[,detail...], otherwise NAME:arg,...[,hex] */
+        if (res->opcode == OP_ERROR) {
+            len = snprintf(params, sizeof(params), "%s",
+                           uart_error_name(res->nargs > 0 ? res->args[0] : UART_ERR_NONE));
+            i = 1;
+        }
+        for (; i < res->nargs && len < sizeof(params) - 12; i++) {
+            len += snprintf(params + len, sizeof(params) - len, "%s%u",
+                            len == 0 ? "" : ",", res->args[i]);
+        }
+        if (res->data_len > 0) {
+            if (len + 1 + 2 * res->data_len >= sizeof(params)) {
+                return -1;
+            }
+            if (len > 0) {
+                params[len++] = PARAM_SEPARATOR;
+            }
+            len += uart_hex_encode(res->data, res->data_len, params + len);
+            params[len] = '\0';
+        }
+    }
+    return build_message(uart_opcode_name(res->opcode), res->id,
+                         params[0] ? params : NULL, (char *)out, size);
+}
+
+static void tx_put(const uint8_t *data, size_t len) {
+    if (len > SIM_TX_QUEUE - tx_len) {
+        stats.dropped++;
+        return;
+    }
+    for (size_t i = 0; i < len; i++) {
+        tx_queue[(tx_start + tx_len + i) & (SIM_TX_QUEUE - 1)] = data[i];
+    }
+    tx_len += len;
+    tx_queued += len;
+}
+
+static void apply_reset(void);
+
+static void apply_after(uint8_t after, uint32_t arg) {
+    switch (after) {
+    case AFTER_PROTO:
+        binary_mode = arg == PROTO_BINARY;
+        rx_len = 0;
+        break;
+    case AFTER_BAUD:
+        previous_baudrate = baudrate;
+        baudrate = arg;
+        baud_verify_us = now_us() + BAUD_VERIFY_TIMEOUT_MS * 1000ull;
+        break;
+    case AFTER_RESET:
+        apply_reset();
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Put a result on the line: frame it now, in the framing in use
+ */
+static void send_result(const sim_result_t *res) {
+    uint8_t out[MAX_FRAME_LENGTH];
+    int n = sim_encode(res, out, sizeof(out));
+
+    if (n > 0) {
+        if (verbose) {
+            fprintf(stderr, "< %s#%u\n", uart_opcode_name(res->opcode), res->id);
+        }
+        tx_put(out, n);
+    }
+
+    /* The framing follows the reply; rate and reboot wait until it has left */
+    if (res->after == AFTER_PROTO) {
+        apply_after(res->after, res->after_arg);
+    } else if (res->after != AFTER_NONE && tx_mark_count < SIM_TX_MARKS) {
+        tx_marks[tx_mark_count++] = (sim_mark_t){ tx_queued, res->after, res->after_arg };
+    }
+}
+
+/**
+ * @brief Queue a result to go out at res->due_us, keeping the queue sorted
+ */
+static void schedule(const sim_result_t *res) {
+    int i = pending_count;
+
+    if (pending_count == SIM_PENDING) {
+        stats.dropped++;
+        return;
+    }
+    while (i > 0 && pending[i - 1].due_us > res->due_us) {
+        pending[i] = pending[i - 1];
+        i--;
+    }
+    pending[i] = *res;
+    pending_count++;
+    if (res->normal) {
+        bulk_waiting++;
+        if ((uint32_t)bulk_waiting > stats.jobs_max_used) {
+            stats.jobs_max_used = bulk_waiting;
+        }
+    }
+}
+
+/**
+ * @brief Queue an unsolicited message behind everything due by now
+ */
+static void push(uint8_t opcode, const uint32_t *args, size_t nargs,
+                 const uint8_t *data, size_t data_len) {
+    sim_result_t res = { .due_us = now_us(), .opcode = opcode, .nargs = nargs };
+
+    memcpy(res.args, args, nargs * sizeof(args[0]));
+    if (data_len > 0) {
+        memcpy(res.data, data, data_len);
+        res.data_len = data_len;
+    }
+    schedule(&res);
+}
+
+static void set_error(sim_result_t *res, uint32_t error) {
+    res->opcode = OP_ERROR;
+    res->args[0] = error;
+    res->nargs = 1;
+}
+
+/* ---- Board ---- */
+
+static int sim_port(uint32_t letter) {
+    if (letter >= 'a' && letter <= 'z') {
+        letter -= 'a' - 'A';
+    }
+    if (letter < 'A' || letter - 'A' >= SIM_PORTS || !(SIM_PORT_MASK & (1u << (letter - 'A')))) {
+        return -1;
+    }
+    return letter - 'A';
+}
+
+/**
+ * @brief ADC reading: a triangle wave, one period per (channel + 1) seconds
+ */
+static uint32_t sim_adc(uint32_t channel, uint64_t t_us) {
+    uint64_t period = 1000000ull * (channel + 1);
+    uint64_t phase = t_us % period;
+    int32_t value = (int32_t)((phase < period / 2 ? phase : period - phase) * 8190 / period);
+
+    value += (int32_t)(sim_random() % 9) - 4;
+    return value < 0 ? 0 : value > 4095 ? 4095 : value;
+}
+
+static void gpio_event(int port, uint32_t pin, uint32_t level) {
+    uint32_t args[6] = {
+        UART_EVT_GPIO, 'A' + port, pin, level, (uint32_t)(now_us() - boot_us), gpio_event_seq++
+    };
+
+    push(OP_EVT, args, 6, NULL, 0);
+}
+
+/* GPIO_SET:port,pin,value; the pin reads back, and a watched one raises EVT */
+static void cmd_gpio_set(const uint32_t *args, int nargs, sim_result_t *res) {
+    int port = sim_port(args[0]);
+    uint32_t old;
+
+    if (port < 0 || args[1] >= SIM_PINS || args[2] > 1) {
+        set_error(res, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+    old = (gpio_levels[port] >> args[1]) & 1;
+    gpio_levels[port] = (gpio_levels[port] & ~(1u << args[1])) | (args[2] << args[1]);
+    if (old != args[2] &&
+        (gpio_watch[port][args[1]] & (args[2] ? GPIO_WATCH_RISING : GPIO_WATCH_FALLING))) {
+        gpio_event(port, args[1], args[2]);
+    }
+}
+
+static void cmd_gpio_get(const uint32_t *args, int nargs, sim_result_t *res) {
+    int port = sim_port(args[0]);
+
+    if (port < 0 || args[1] >= SIM_PINS) {
+        set_error(res, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+    res->args[0] = (gpio_levels[port] >> args[1]) & 1;
+    res->nargs = 1;
+}
+
+/* A pin number is watched on one port at a time: the ports share EXTI lines */
+static void cmd_gpio_watch(const uint32_t *args, int nargs, sim_result_t *res) {
+    int port = sim_port(args[0]);
+
+    if (port < 0 || args[1] >= SIM_PINS || args[2] > GPIO_WATCH_BOTH) {
+        set_error(res, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+    for (int p = 0; p < SIM_PORTS; p++) {
+        if (p != port && args[2] != GPIO_WATCH_OFF && gpio_watch[p][args[1]] != GPIO_WATCH_OFF) {
+            set_error(res, UART_ERR_GPIO_FAIL);
+            return;
+        }
+    }
+    gpio_watch[port][args[1]] = args[2];
+}
+
+/* I2C_READ:bus,addr,reg,len -> OK:byte,... */
+static void cmd_i2c_read(const uint32_t *args, int nargs, sim_result_t *res) {
+    if (args[0] < 1 || args[0] > SIM_I2C_BUSES || args[1] >= SIM_I2C_ADDRS || args[2] > 0xFF ||
+        args[3] == 0 || args[3] > MAX_FRAME_ARGS) {
+        set_error(res, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+    for (uint32_t i = 0; i < args[3]; i++) {
+        res->args[i] = i2c_regs[args[0] - 1][args[1]][(args[2] + i) & 0xFF];
+    }
+    res->nargs = args[3];
+}
+
+/* I2C_WRITE:bus,addr,reg,data[,data...] */
+static void cmd_i2c_write(const uint32_t *args, int nargs, sim_result_t *res) {
+    if (args[0] < 1 || args[0] > SIM_I2C_BUSES || args[1] >= SIM_I2C_ADDRS) {
+        set_error(res, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+    for (int i = 2; i < nargs; i++) {
+        if (args[i] > 0xFF) {
+            set_error(res, UART_ERR_INVALID_PARAMS);
+            return;
+        }
+    }
+    for (int i = 3; i < nargs; i++) {
+        i2c_regs[args[0] - 1][args[1]][(args[2] + i - 3) & 0xFF] = args[i];
+    }
+}
+
+static void cmd_adc_read(const uint32_t *args, int nargs, sim_result_t *res) {
+    if (args[0] >= SIM_ADC_CHANNELS) {
+        set_error(res, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+    /* The stream owns the ADC until it is stopped */
+    if (adc_stream.active) {
+        set_error(res, UART_ERR_BUSY);
+        return;
+    }
+    res->args[0] = sim_adc(args[0], now_us() - boot_us);
+    res->nargs = 1;
+}
+
+/* ADC_STREAM:channel,rate[,count] (rate 0 stops, count 0 runs until stopped) */
+static void cmd_adc_stream(const uint32_t *args, int nargs, sim_result_t *res) {
+    if (args[0] >= SIM_ADC_CHANNELS || args[1] > ADC_STREAM_RATE_MAX) {
+        set_error(res, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+    adc_stream.active = args[1] != 0;
+    adc_stream.channel = args[0];
+    adc_stream.rate = args[1];
+    adc_stream.remaining = nargs > 2 ? args[2] : 0;
+    adc_stream.seq = 0;
+    adc_stream.sample_us = now_us();
+}
+
+static void cmd_pwm_set(const uint32_t *args, int nargs, sim_result_t *res) {
+    if (args[0] < 1 || args[0] > SIM_PWM_CHANNELS || args[1] > SIM_PWM_PERIOD) {
+        set_error(res, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+    pwm_duty[args[0] - 1] = args[1];
+}
+
+static void cmd_status(const uint32_t *args, int nargs, sim_result_t *res) {
+    uart_status_t st;
+
+    memset(&st, 0, sizeof(st));
+    st.version = UART_STATUS_VERSION;
+    st.size = sizeof(st);
+    st.reset_cause = reset_cause;
+    st.flags = binary_mode ? UART_STATUS_BINARY : 0;
+    st.uptime_ms = (uint32_t)((now_us() - boot_us) / 1000);
+    st.kernel_version = SIM_KERNEL_VERSION;
+    st.sysclk_hz = SIM_SYSCLK_HZ;
+    st.baudrate = baudrate;
+    st.rx_bytes = (uint32_t)stats.rx_bytes;
+    st.rx_overruns = stats.rx_overruns;
+    st.crc_errors = stats.crc_errors;
+    st.commands = (uint32_t)stats.commands;
+    st.gpio_errors = stats.errors[UART_ERR_GPIO_FAIL];
+    st.i2c_errors = stats.errors[UART_ERR_I2C_FAIL];
+    st.adc_errors = stats.errors[UART_ERR_ADC_FAIL];
+    st.pwm_errors = stats.errors[UART_ERR_PWM_FAIL];
+    /* Replies are sent one at a time here, so one tx buffer is ever taken */
+    st.pools[UART_STATUS_POOL_JOB].blocks = SIM_BULK_QUEUE;
+    st.pools[UART_STATUS_POOL_JOB].max_used = stats.jobs_max_used;
+    st.pools[UART_STATUS_POOL_JOB].exhausted = stats.jobs_exhausted;
+    st.pools[UART_STATUS_POOL_TX].blocks = SIM_TX_BUFFERS;
+    st.pools[UART_STATUS_POOL_TX].max_used = 1;
+    st.pools[UART_STATUS_POOL_ADC].blocks = SIM_ADC_BLOCKS;
+    st.pools[UART_STATUS_POOL_ADC].max_used = stats.adc_max_used;
+
+    res->opcode = OP_STATUS_DATA;
+    memcpy(res->data, &st, sizeof(st));
+    res->data_len = sizeof(st);
+}
+
+static void cmd_ping(const uint32_t *args, int nargs, sim_result_t *res) {
+    res->opcode = OP_PONG;
+}
+
+static void cmd_reset(const uint32_t *args, int nargs, sim_result_t *res) {
+    res->after = AFTER_RESET;
+}
+
+static void cmd_proto(const uint32_t *args, int nargs, sim_result_t *res) {
+    if (args[0] > PROTO_BINARY) {
+        set_error(res, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+    res->after = AFTER_PROTO;
+    res->after_arg = args[0];
+}
+
+static void cmd_set_baud(const uint32_t *args, int nargs, sim_result_t *res) {
+    if (!uart_baudrate_supported(args[0])) {
+        set_error(res, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+    res->after = AFTER_BAUD;
+    res->after_arg = args[0];
+}
+
+/* TELEMETRY:period_ms,ports,channels[,deadband] (period 0 stops) */
+static void cmd_telemetry(const uint32_t *args, int nargs, sim_result_t *res) {
+    if ((args[0] != 0 && args[0] < TELEMETRY_PERIOD_MIN_MS) ||
+        args[1] >= (1u << TELEMETRY_PORTS_MAX) || (args[1] & ~SIM_PORT_MASK) ||
+        args[2] >= (1u << SIM_ADC_CHANNELS)) {
+        set_error(res, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+    tlm.period_ms = args[0];
+    tlm.ports = args[1];
+    tlm.channels = args[2];
+    tlm.deadband = nargs > 3 ? args[3] : 0;
+    tlm.sampled = 0;
+    tlm.next_us = tlm.keyframe_us = now_us();
+}
+
+static void cmd_profile(const uint32_t *args, int nargs, sim_result_t *res) {
+    if (nargs == 0) {
+        res->args[0] = SIM_SYSCLK_HZ;
+        res->args[1] = 0;
+        for (int op = 0; op < SIM_PROFILE_OPCODES; op++) {
+            for (int i = 0; i < UART_PROFILE_BUCKETS; i++) {
+                if (profile[op][UART_PROFILE_PARSE].buckets[i] != 0) {
+                    res->args[1] |= 1u << op;
+                    break;
+                }
+            }
+        }
+        res->nargs = 2;
+        return;
+    }
+    if (nargs == 1) {
+        if (args[0] != OP_NONE) {
+            set_error(res, UART_ERR_INVALID_PARAMS);
+            return;
+        }
+        memset(profile, 0, sizeof(profile));
+        return;
+    }
+    if (args[0] >= SIM_PROFILE_OPCODES || args[1] >= UART_PROFILE_PHASES) {
+        set_error(res, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+    res->args[0] = profile[args[0]][args[1]].max;
+    memcpy(res->args + 1, profile[args[0]][args[1]].buckets, sizeof(profile[0][0].buckets));
+    res->nargs = 1 + UART_PROFILE_BUCKETS;
+}
+
+/* THREADS -> OK:count,time_us,heap...; THREADS:index -> OK:stack_size,stack_used,runtime_us,name... */
+static void cmd_threads(const uint32_t *args, int nargs, sim_result_t *res) {
+    uint64_t elapsed = now_us() - boot_us;
+    uint64_t runtime[SIM_THREADS] = { run_high_us, run_bulk_us };
+    const char *name;
+
+    if (nargs == 0) {
+        res->args[0] = SIM_THREADS;
+        res->args[1] = (uint32_t)elapsed;
+        res->args[2] = res->args[3] = SIM_HEAP_SIZE;     /* Nothing allocated, ever */
+        res->args[4] = 0;
+        res->nargs = 5;
+        return;
+    }
+    if (args[0] >= SIM_THREADS) {
+        set_error(res, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+    runtime[2] = elapsed > run_high_us + run_bulk_us ? elapsed - run_high_us - run_bulk_us : 0;
+
+    res->args[0] = sim_threads[args[0]].stack_size;
+    res->args[1] = sim_threads[args[0]].stack_used;
+    res->args[2] = (uint32_t)runtime[args[0]];
+    res->nargs = UART_THREAD_VALUES;
+    for (name = sim_threads[args[0]].name; *name != '\0' && res->nargs < MAX_FRAME_ARGS; name++) {
+        res->args[res->nargs++] = (uint8_t)*name;
+    }
+}
+
+/**
+ * @brief Count a command into the PROFILE histograms
+ */
+static void profile_record(uint8_t opcode, uint64_t wait_us, uint64_t service) {
+    uint32_t cycles[UART_PROFILE_PHASES] = {
+        [UART_PROFILE_DISPATCH] = (uint32_t)(wait_us * (SIM_SYSCLK_HZ / 1000000)),
+        [UART_PROFILE_EXECUTE] = (uint32_t)(service * (SIM_SYSCLK_HZ / 1000000)),
+    };
+
+    if (opcode >= SIM_PROFILE_OPCODES) {
+        return;
+    }
+    for (int phase = 0; phase < UART_PROFILE_PHASES; phase++) {
+        profile[opcode][phase].buckets[uart_profile_bucket(cycles[phase])]++;
+        if (cycles[phase] > profile[opcode][phase].max) {
+            profile[opcode][phase].max = cycles[phase];
+        }
+    }
+}
+
+static const sim_cmd_t sim_cmds[] = {
+    [OP_GPIO_SET]   = { cmd_gpio_set,   3, 3,              true },
+    [OP_GPIO_GET]   = { cmd_gpio_get,   2, 2,              true },
+    [OP_I2C_READ]   = { cmd_i2c_read,   4, 4,              true },
+    [OP_I2C_WRITE]  = { cmd_i2c_write,  4, MAX_FRAME_ARGS, true },
+    [OP_ADC_READ]   = { cmd_adc_read,   1, 1,              true },
+    [OP_PWM_SET]    = { cmd_pwm_set,    2, 2,              true },
+    [OP_STATUS]     = { cmd_status,     0, 0,              false },
+    [OP_PING]       = { cmd_ping,       0, 0,              true },
+    [OP_RESET]      = { cmd_reset,      0, 0,              false },
+    [OP_PROTO]      = { cmd_proto,      1, 1,              false },
+    [OP_SET_BAUD]   = { cmd_set_baud,   1, 1,              false },
+    [OP_ADC_STREAM] = { cmd_adc_stream, 2, 3,              false },
+    [OP_GPIO_WATCH] = { cmd_gpio_watch, 3, 3,              true },
+    [OP_TELEMETRY]  = { cmd_telemetry,  3, 4,              false },
+    [OP_PROFILE]    = { cmd_profile,    0, 2,              false },
+    [OP_THREADS]    = { cmd_threads,    0, 1,              false },
+};
+
+static const sim_cmd_t *sim_cmd(uint8_t opcode) {
+    if (opcode >= sizeof(sim_cmds) / sizeof(sim_cmds[0]) || sim_cmds[opcode].handler == NULL) {
+        return NULL;
+    }
+    return &sim_cmds[opcode];
+}
+
+/**
+ * @brief Run a BATCH payload as the firmware does: check all, run all,
+ *        OK with the values, or ERROR:code,index
+ * @return Service time of the sub-commands run
+ */
+static uint64_t run_batch(const uint8_t *payload, size_t len, sim_result_t *res) {
+    uint32_t args[MAX_FRAME_ARGS];
+    uint32_t index = 0;
+    uint64_t service = 0;
+    size_t off = 0;
+    uint8_t opcode;
+    int nargs;
+
+    while (off < len) {
+        const sim_cmd_t *cmd;
+
+        nargs = uart_batch_next(payload, len, &off, &opcode, args, MAX_FRAME_ARGS);
+        cmd = nargs < 0 ? NULL : sim_cmd(opcode);
+        if (cmd == NULL || !cmd->batch || index == MAX_BATCH_COMMANDS ||
+            nargs < cmd->min_args || nargs > cmd->max_args) {
+            set_error(res, UART_ERR_INVALID_PARAMS);
+            res->args[res->nargs++] = index;
+            return 0;
+        }
+        index++;
+    }
+    if (index == 0) {
+        set_error(res, UART_ERR_INVALID_PARAMS);
+        return 0;
+    }
+
+    for (off = 0, index = 0; off < len; index++) {
+        sim_result_t sub = { .opcode = OP_OK };
+
+        nargs = uart_batch_next(payload, len, &off, &opcode, args, MAX_FRAME_ARGS);
+        sim_cmds[opcode].handler(args, nargs, &sub);
+        service += service_us[opcode];
+
+        if (sub.opcode == OP_OK && res->nargs + sub.nargs > MAX_FRAME_ARGS) {
+            set_error(&sub, UART_ERR_INVALID_PARAMS);
+        }
+        if (sub.opcode == OP_ERROR) {
+            set_error(res, sub.args[0]);
+            res->args[res->nargs++] = index;
+            return service;
+        }
+        if (sub.opcode == OP_OK) {
+            memcpy(res->args + res->nargs, sub.args, sub.nargs * sizeof(sub.args[0]));
+            res->nargs += sub.nargs;
+        }
+    }
+    return service;
+}
+
+/**
+ * @brief Execute a decoded command and schedule its reply
+ *
+ * High-priority commands run on their own timeline and delay the normal
+ * ones that are running, as on the firmware's two threads.
+ */
+static void run_command(uint8_t opcode, uint16_t id, uint8_t priority, const uint32_t *args,
+                        int nargs, const uint8_t *payload, size_t len) {
+    sim_result_t res = { .id = id, .opcode = OP_OK };
+    uint64_t now = now_us();
+    uint64_t service = 0;
+    uint64_t start;
+    const sim_cmd_t *cmd;
+
+    stats.commands++;
+    baud_verify_us = 0;
+    res.normal = priority != UART_PRIO_HIGH;
+    if (verbose) {
+        fprintf(stderr, "> %s#%u\n", uart_opcode_name(opcode) ? uart_opcode_name(opcode) : "?", id);
+    }
+
+    if (res.normal && bulk_waiting >= SIM_BULK_QUEUE) {
+        stats.jobs_exhausted++;
+        res.normal = false;
+        set_error(&res, UART_ERR_BUSY);
+    } else if (opcode == OP_BATCH) {
+        service = run_batch(payload, len, &res);
+    } else if ((cmd = sim_cmd(opcode)) == NULL) {
+        set_error(&res, UART_ERR_INVALID_CMD);
+    } else if (nargs < cmd->min_args || nargs > cmd->max_args) {
+        set_error(&res, UART_ERR_INVALID_PARAMS);
+    } else {
+        cmd->handler(args, nargs, &res);
+        service = service_us[opcode];
+    }
+    if (res.opcode == OP_ERROR && res.args[0] < UART_ERR_COUNT) {
+        stats.errors[res.args[0]]++;
+    }
+
+    if (res.normal) {
+        start = busy_bulk_us > now ? busy_bulk_us : now;
+        busy_bulk_us = start + service;
+        run_bulk_us += service;
+        res.due_us = busy_bulk_us;
+    } else {
+        start = busy_high_us > now ? busy_high_us : now;
+        busy_high_us = start + service;
+        run_high_us += service;
+        if (busy_bulk_us > start) {
+            busy_bulk_us += service;
+        }
+        res.due_us = busy_high_us;
+    }
+    /* As on the firmware, BUSY is answered before a command is dispatched */
+    if (res.opcode != OP_ERROR || res.args[0] != UART_ERR_BUSY) {
+        profile_record(opcode, start - now, service);
+    }
+    schedule(&res);
+}
+
+/* ---- Receiving ---- */
+
+/* ASCII line: NAME[#id][!][:params] */
+static void handle_ascii(const char *line, size_t len) {
+    uint32_t args[MAX_FRAME_ARGS];
+    sim_result_t res = { .due_us = now_us() };
+    uart_message_t msg;
+    int nargs;
+
+    for (size_t i = 0; i < len; i++) {
+        if ((line[i] < ' ' || line[i] > '~') && line[i] != '\r') {
+            return;     /* Not text: noise or stray binary frame */
+        }
+    }
+    if (!parse_message(line, len, &msg)) {
+        set_error(&res, UART_ERR_INVALID_CMD);
+        stats.errors[UART_ERR_INVALID_CMD]++;
+        schedule(&res);
+        return;
+    }
+
+    if (msg.opcode == OP_BATCH) {
+        uint8_t payload[MAX_MESSAGE_LENGTH];
+        int n = uart_batch_encode(&msg.params, payload, sizeof(payload));
+
+        if (n < 0) {
+            res.id = msg.id;
+            set_error(&res, UART_ERR_INVALID_PARAMS);
+            schedule(&res);
+            return;
+        }
+        run_command(OP_BATCH, msg.id, msg.priority, NULL, 0, payload, n);
+        return;
+    }
+
+    nargs = uart_message_args(&msg, args, MAX_FRAME_ARGS);
+    if (nargs < 0) {
+        res.id = msg.id;
+        set_error(&res, UART_ERR_INVALID_PARAMS);
+        schedule(&res);
+        return;
+    }
+    run_command(msg.opcode, msg.id, msg.priority, args, nargs, NULL, 0);
+}
+
+static void handle_frame(uint8_t *data, size_t len) {
+    uint32_t args[MAX_FRAME_ARGS];
+    uart_frame_t frame;
+    int nargs;
+
+    if (!binary_mode) {
+        handle_ascii((const char *)data, len);
+        return;
+    }
+    /* Request ID unknown: the daemon times the command out */
+    if (!uart_frame_decode(data, len, &frame)) {
+        stats.crc_errors++;
+        return;
+    }
+    if (frame.opcode == OP_BATCH) {
+        run_command(OP_BATCH, frame.id, frame.priority, NULL, 0, frame.payload, frame.payload_len);
+        return;
+    }
+    nargs = uart_frame_args(&frame, args, MAX_FRAME_ARGS);
+    if (nargs < 0) {
+        sim_result_t res = { .due_us = now_us(), .id = frame.id };
+
+        set_error(&res, UART_ERR_INVALID_PARAMS);
+        schedule(&res);
+        return;
+    }
+    run_command(frame.opcode, frame.id, frame.priority, args, nargs, NULL, 0);
+}
+
+/**
+ * @brief Split received bytes into lines or frames
+ */
+static void receive(const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        uint8_t delimiter = binary_mode ? FRAME_DELIMITER : MESSAGE_DELIMITER;
+
+        if (data[i] != delimiter) {
+            /* Leftover binary traffic in ASCII mode: drop the line */
+            if (!binary_mode && data[i] == FRAME_DELIMITER) {
+                rx_len = 0;
+                continue;
+            }
+            if (rx_len == sizeof(rx_buf)) {
+                if (!rx_overflow) {
+                    stats.rx_overruns++;
+                }
+                rx_overflow = true;
+                continue;
+            }
+            rx_buf[rx_len++] = data[i];
+            continue;
+        }
+        /* Empty frames come from the daemon's leading delimiter */
+        if (!rx_overflow && rx_len > 0) {
+            handle_frame(rx_buf, rx_len);
+        }
+        rx_len = 0;
+        rx_overflow = false;
+    }
+}
+
+/* ---- Periodic work ---- */
+
+static void apply_reset(void) {
+    uint64_t now = now_us();
+
+    binary_mode = false;
+    baudrate = previous_baudrate = UART_BAUDRATE;
+    baud_verify_us = 0;
+    rx_len = 0;
+    boot_us = now;
+    reset_cause = UART_RESET_SOFTWARE;
+    memset(gpio_levels, 0, sizeof(gpio_levels));
+    memset(gpio_watch, 0, sizeof(gpio_watch));
+    memset(pwm_duty, 0, sizeof(pwm_duty));
+    memset(&adc_stream, 0, sizeof(adc_stream));
+    memset(&tlm, 0, sizeof(tlm));
+    memset(&stats.errors, 0, sizeof(stats.errors));
+    stats.rx_overruns = stats.crc_errors = 0;
+    stats.jobs_max_used = stats.jobs_exhausted = stats.adc_max_used = 0;
+    busy_high_us = busy_bulk_us = now;
+    run_high_us = run_bulk_us = 0;
+    if (verbose) {
+        fprintf(stderr, "reset\n");
+    }
+}
+
+/**
+ * @brief Send the ADC_DATA blocks whose last sample time has passed
+ */
+static void adc_stream_run(uint64_t now) {
+    uint64_t interval = adc_stream.active ? 1000000ull / adc_stream.rate : 0;
+
+    while (adc_stream.active &&
+           adc_stream.sample_us + interval * (ADC_DATA_MAX_SAMPLES - 1) <= now) {
+        uint16_t samples[ADC_DATA_MAX_SAMPLES];
+        uint8_t packed[SIM_DATA_MAX];
+        uint32_t args[2] = { adc_stream.channel, adc_stream.seq++ };
+        size_t count = ADC_DATA_MAX_SAMPLES;
+
+        if (adc_stream.remaining != 0 && adc_stream.remaining < count) {
+            count = adc_stream.remaining;
+        }
+        for (size_t i = 0; i < count; i++) {
+            samples[i] = sim_adc(adc_stream.channel, adc_stream.sample_us - boot_us);
+            adc_stream.sample_us += interval;
+        }
+        push(OP_ADC_DATA, args, 2, packed, uart_adc_pack(samples, count, packed));
+        /* A block is sent as soon as it is full, while the next one fills */
+        stats.adc_max_used = 2;
+
+        if (adc_stream.remaining != 0) {
+            adc_stream.remaining -= count;
+            adc_stream.active = adc_stream.remaining > 0;
+        }
+    }
+}
+
+static void tlm_set(uint8_t field, uint32_t value) {
+    tlm.value[field] = value;
+    tlm.sampled |= 1ull << field;
+}
+
+static void tlm_push(uint32_t flags, const uint8_t *pairs, size_t len) {
+    uint32_t max_gap = tlm.period_ms > SIM_KEYFRAME_MS ? tlm.period_ms : SIM_KEYFRAME_MS;
+    uint32_t args[3] = { tlm.seq++, flags, max_gap };
+
+    push(OP_TLM, args, 3, pairs, len);
+}
+
+/**
+ * @brief Sample and send what changed (everything for a keyframe), as
+ *        telemetry.c does
+ */
+static void tlm_run(uint64_t now) {
+    uint32_t max_gap_us = (tlm.period_ms > SIM_KEYFRAME_MS ? tlm.period_ms : SIM_KEYFRAME_MS) * 1000;
+    bool keyframe = now >= tlm.keyframe_us;
+    uint8_t pairs[TLM_MAX_PAIRS_LENGTH];
+    size_t len = 0;
+
+    if (tlm.period_ms == 0 || now < tlm.next_us) {
+        return;
+    }
+    tlm.next_us = now + tlm.period_ms * 1000ull;
+    if (keyframe) {
+        tlm.keyframe_us = now + max_gap_us - tlm.period_ms * 1000ull;
+    }
+
+    for (uint32_t ch = 0; ch < SIM_ADC_CHANNELS; ch++) {
+        if ((tlm.channels & (1u << ch)) && !adc_stream.active) {
+            tlm_set(UART_TLM_ADC + ch, sim_adc(ch, now - boot_us));
+        }
+    }
+    for (int i = 0; i < TELEMETRY_PORTS_MAX; i++) {
+        if (tlm.ports & (1u << i)) {
+            tlm_set(UART_TLM_GPIO + i, gpio_levels[i]);
+        }
+    }
+    tlm_set(UART_TLM_RX_OVERRUNS, stats.rx_overruns);
+    tlm_set(UART_TLM_CRC_ERRORS, stats.crc_errors);
+    tlm_set(UART_TLM_RX_ERRORS, 0);
+    tlm_set(UART_TLM_GPIO_ERRORS, stats.errors[UART_ERR_GPIO_FAIL]);
+    tlm_set(UART_TLM_I2C_ERRORS, stats.errors[UART_ERR_I2C_FAIL]);
+    tlm_set(UART_TLM_ADC_ERRORS, stats.errors[UART_ERR_ADC_FAIL]);
+    tlm_set(UART_TLM_PWM_ERRORS, stats.errors[UART_ERR_PWM_FAIL]);
+
+    for (uint8_t field = 0; field < UART_TLM_FIELDS; field++) {
+        uint32_t value = tlm.value[field], sent = tlm.sent[field];
+        bool changed = field >= UART_TLM_ADC ?
+                       (value > sent ? value - sent : sent - value) > tlm.deadband :
+                       value != sent;
+
+        if (!(tlm.sampled & (1ull << field)) || (!keyframe && !changed)) {
+            continue;
+        }
+        if (len + 6 > sizeof(pairs)) {
+            tlm_push(keyframe ? UART_TLM_KEYFRAME : 0, pairs, len);
+            len = 0;
+        }
+        len += uart_varint_encode(field, pairs + len);
+        len += uart_varint_encode(value, pairs + len);
+        tlm.sent[field] = value;
+    }
+    if (len > 0) {
+        tlm_push(keyframe ? UART_TLM_KEYFRAME : 0, pairs, len);
+    }
+}
+
+/**
+ * @brief Hand due results to the line, write what the line rate allows
+ */
+static void transmit(uint64_t now) {
+    while (pending_count > 0 && pending[0].due_us <= now) {
+        sim_result_t res = pending[0];
+
+        memmove(pending, pending + 1, (pending_count - 1) * sizeof(pending[0]));
+        pending_count--;
+        if (res.normal) {
+            bulk_waiting--;
+        }
+        send_result(&res);
+    }
+
+    while (tx_len > 0) {
+        uint8_t chunk[4096];
+        size_t n = line_credit(&tx_line, now);
+        ssize_t written;
+
+        if (n > tx_len) {
+            n = tx_len;
+        }
+        if (n > sizeof(chunk)) {
+            n = sizeof(chunk);
+        }
+        /* Line rate changes and reboots take effect between frames */
+        if (tx_mark_count > 0 && tx_sent + n > tx_marks[0].offset) {
+            n = tx_marks[0].offset - tx_sent;
+        }
+        if (n == 0) {
+            return;
+        }
+        for (size_t i = 0; i < n; i++) {
+            chunk[i] = tx_queue[(tx_start + i) & (SIM_TX_QUEUE - 1)];
+        }
+        corrupt(chunk, n);
+        written = write(pty_master, chunk, n);
+        if (written < 0) {
+            return;
+        }
+        line_use(&tx_line, written);
+        tx_start = (tx_start + written) & (SIM_TX_QUEUE - 1);
+        tx_len -= written;
+        tx_sent += written;
+        stats.tx_bytes += written;
+
+        while (tx_mark_count > 0 && tx_sent == tx_marks[0].offset) {
+            sim_mark_t mark = tx_marks[0];
+
+            memmove(tx_marks, tx_marks + 1, (tx_mark_count - 1) * sizeof(tx_marks[0]));
+            tx_mark_count--;
+            apply_after(mark.after, mark.arg);
+        }
+        if ((size_t)written < n) {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Microseconds until something is due, -1 for nothing
+ */
+static int64_t next_wakeup(uint64_t now) {
+    int64_t wait = -1;
+
+#define SOONER(t) do { int64_t w_ = (t) > now ? (int64_t)((t) - now) : 0; \
+                       if (wait < 0 || w_ < wait) wait = w_; } while (0)
+    if (pending_count > 0) {
+        SOONER(pending[0].due_us);
+    }
+    if (tx_len > 0 && paced) {
+        SOONER(now + line_wait_us(&tx_line));
+    }
+    if (paced && line_credit(&rx_line, now) == 0) {
+        SOONER(now + line_wait_us(&rx_line));
+    }
+    if (adc_stream.active) {
+        SOONER(adc_stream.sample_us + 1000000ull / adc_stream.rate * (ADC_DATA_MAX_SAMPLES - 1));
+    }
+    if (tlm.period_ms > 0) {
+        SOONER(tlm.next_us);
+    }
+    if (baud_verify_us > 0) {
+        SOONER(baud_verify_us);
+    }
+#undef SOONER
+    return wait;
+}
+
+static void signal_handler(int signum) {
+    (void)signum;
+    running = false;
+}
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [-l link] [-t [command=]us]... [-e ppm] [-b rate] [-n] [-S seed] [-v]\n", prog);
+    printf("  -l  symlink to create to the pty slave, for uart-bridge -d\n");
+    printf("  -t  service time in us, of all commands or of one (-t I2C_READ=300); repeatable\n");
+    printf("  -e  bytes per million with a bit flipped, in both directions (default: 0)\n");
+    printf("  -b  line rate before SET_BAUD (default: %d)\n", UART_BAUDRATE);
+    printf("  -n  no line rate pacing\n");
+    printf("  -S  random seed for -e and ADC noise\n");
+    printf("  -v  log commands and replies\n");
+}
+
+static int set_service_time(const char *arg) {
+    const char *eq = strchr(arg, '=');
+    uint8_t opcode;
+    char *end;
+    unsigned long us = strtoul(eq ? eq + 1 : arg, &end, 10);
+
+    if (end == (eq ? eq + 1 : arg) || *end != '\0' || us > 10000000) {
+        return -1;
+    }
+    if (eq == NULL) {
+        for (int i = 0; i < 256; i++) {
+            service_us[i] = us;
+        }
+        return 0;
+    }
+    opcode = uart_opcode_from_name(arg, eq - arg);
+    if (opcode == OP_NONE) {
+        return -1;
+    }
+    service_us[opcode] = us;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    struct sigaction sa;
+    struct termios tty;
+    int pty_slave;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:t:e:b:nS:vh")) != -1) {
+        switch (opt) {
+            case 'l': link_path = optarg; break;
+            case 't':
+                if (set_service_time(optarg) < 0) {
+                    fprintf(stderr, "Bad service time: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'e': error_ppm = strtoul(optarg, NULL, 10); break;
+            case 'b': baudrate = previous_baudrate = strtoul(optarg, NULL, 10); break;
+            case 'n': paced = false; break;
+            case 'S': rng_state = strtoull(optarg, NULL, 0) | 1; break;
+            case 'v': verbose = true; break;
+            default:
+                print_usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (baudrate == 0 || error_ppm > 1000000) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    pty_master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (pty_master < 0 || grantpt(pty_master) < 0 || unlockpt(pty_master) < 0) {
+        perror("posix_openpt");
+        return 1;
+    }
+    /* Hold the slave open so the master never sees EIO between opens */
+    pty_slave = open(ptsname(pty_master), O_RDWR | O_NOCTTY);
+    if (pty_slave < 0) {
+        perror("open pty slave");
+        return 1;
+    }
+    tcgetattr(pty_slave, &tty);
+    cfmakeraw(&tty);
+    tcsetattr(pty_slave, TCSANOW, &tty);
+
+    if (link_path != NULL) {
+        unlink(link_path);
+        if (symlink(ptsname(pty_master), link_path) < 0) {
+            perror("symlink");
+            return 1;
+        }
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = signal_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    boot_us = rx_line.at_us = tx_line.at_us = now_us();
+    printf("%s\n", link_path ? link_path : ptsname(pty_master));
+    fflush(stdout);
+
+    while (running) {
+        uint64_t now = now_us();
+        struct pollfd pfd = { .fd = pty_master };
+        struct timespec ts;
+        int64_t wait;
+        size_t credit;
+
+        if (baud_verify_us > 0 && now >= baud_verify_us) {
+            /* Nothing valid arrived at the new rate: fall back */
+            baudrate = previous_baudrate;
+            baud_verify_us = 0;
+        }
+        adc_stream_run(now);
+        tlm_run(now);
+        transmit(now);
+
+        credit = line_credit(&rx_line, now);
+        if (credit > 0) {
+            pfd.events |= POLLIN;
+        }
+        wait = next_wakeup(now);
+        ts.tv_sec = wait / 1000000;
+        ts.tv_nsec = (wait % 1000000) * 1000;
+        if (ppoll(&pfd, 1, wait < 0 ? NULL : &ts, NULL) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("ppoll");
+            break;
+        }
+
+        if (pfd.revents & POLLIN) {
+            uint8_t buf[4096];
+            ssize_t n = read(pty_master, buf, credit < sizeof(buf) ? credit : sizeof(buf));
+
+            if (n > 0) {
+                line_use(&rx_line, n);
+                stats.rx_bytes += n;
+                corrupt(buf, n);
+                receive(buf, n);
+            }
+        }
+    }
+
+    fprintf(stderr, "commands %llu, rx %llu bytes, tx %llu bytes, corrupted %llu bytes, "
+            "crc errors %u, overruns %u, dropped %llu\n",
+            (unsigned long long)stats.commands, (unsigned long long)stats.rx_bytes,
+            (unsigned long long)stats.tx_bytes, (unsigned long long)stats.corrupted,
+            stats.crc_errors, stats.rx_overruns, (unsigned long long)stats.dropped);
+    if (link_path != NULL) {
+        unlink(link_path);
+    }
+    close(pty_slave);
+    close(pty_master);
+    return 0;
+}
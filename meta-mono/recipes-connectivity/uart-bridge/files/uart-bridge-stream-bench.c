@@ -0,0 +1,381 @@
+/**
+ * @file uart-bridge-stream-bench.c
+ * @brief Unsolicited message throughput benchmark for the uart-bridge daemon
+ *
+ * Starts uart-bridge on a pseudo-terminal that stands in for the STM32
+ * UART, negotiates binary framing like the firmware does, and streams
+ * ADC_DATA frames into it as fast as the pty takes them.
+ * N libuartbridge consumers subscribe to them, first over the socket,
+ * then over shared memory rings, and the delivered messages/s, the losses
+ * and the CPU time spent per message by the daemon and by the consumers
+ * are compared.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <termios.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "uart-protocol.h"
+#include "uart-bridge-client.h"
+
+#define DEFAULT_DAEMON      "/usr/bin/uart-bridge"
+#define DEFAULT_MESSAGES    100000
+#define DEFAULT_CONSUMERS   4
+#define DEFAULT_RING        65536
+#define BLOCK_SAMPLES       64
+#define IDLE_TIMEOUT_MS     500         /* Consumer gives up after this */
+
+typedef struct {
+    bool ring;
+    int messages;
+    int received;
+    int lost;                           /* seq gaps */
+    uint64_t last_ns;                   /* Arrival of the last message */
+    uint64_t cpu_ns;
+    bool failed;
+} consumer_t;
+
+static int pty_master = -1;
+static char socket_path[96];
+static size_t ring_bytes = DEFAULT_RING;
+static pthread_barrier_t ready;
+static bool link_ready;                 /* Daemon finished link setup */
+
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @brief CPU time used so far by a process, from /proc
+ */
+static uint64_t process_cpu_ns(pid_t pid) {
+    char path[32];
+    char stat[512];
+    unsigned long utime, stime;
+    const char *p;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    f = fopen(path, "r");
+    if (f == NULL) {
+        return 0;
+    }
+    if (fgets(stat, sizeof(stat), f) == NULL) {
+        fclose(f);
+        return 0;
+    }
+    fclose(f);
+
+    /* Fields 14 and 15, counted after the parenthesised command name */
+    p = strrchr(stat, ')');
+    if (p == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                            &utime, &stime) != 2) {
+        return 0;
+    }
+    return (uint64_t)(utime + stime) * 1000000000ull / sysconf(_SC_CLK_TCK);
+}
+
+/* Answer one command: PONG for PING, OK for anything else */
+static void answer(uint8_t opcode, uint16_t id) {
+    uint8_t out[MAX_FRAME_LENGTH];
+    int len = uart_frame_encode(opcode == OP_PING ? OP_PONG : OP_OK, id, NULL, 0, NULL, 0,
+                                out, sizeof(out));
+
+    if (len > 0) {
+        (void)!write(pty_master, out, len);
+    }
+}
+
+/**
+ * @brief Fake STM32: accept PROTO:1, then answer binary frames
+ */
+static void *responder_thread(void *arg) {
+    uint8_t buf[4096];
+    uint8_t frame[MAX_FRAME_LENGTH];
+    size_t frame_len = 0;
+    bool binary = false;
+
+    (void)arg;
+
+    for (;;) {
+        ssize_t n = read(pty_master, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+
+        for (ssize_t i = 0; i < n; i++) {
+            uint8_t end = binary ? FRAME_DELIMITER : MESSAGE_DELIMITER;
+            uart_message_t msg;
+            uart_frame_t decoded;
+
+            if (buf[i] != end) {
+                if (frame_len < sizeof(frame)) {
+                    frame[frame_len++] = buf[i];
+                }
+                continue;
+            }
+
+            if (binary) {
+                if (uart_frame_decode(frame, frame_len, &decoded)) {
+                    answer(decoded.opcode, decoded.id);
+                    if (decoded.opcode == OP_PING) {
+                        __atomic_store_n(&link_ready, true, __ATOMIC_RELEASE);
+                    }
+                }
+            } else if (parse_message((const char *)frame, frame_len, &msg)) {
+                char reply[32];
+                int len = build_message(msg.opcode == OP_PING ? RESP_PONG : RESP_OK, msg.id,
+                                        NULL, reply, sizeof(reply));
+
+                (void)!write(pty_master, reply, len);
+                binary = msg.opcode == OP_PROTO;
+            }
+            frame_len = 0;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief One consumer: count ADC_DATA blocks until the last one or idle
+ */
+static void *consumer_thread(void *arg) {
+    consumer_t *c = arg;
+    char line[MAX_MESSAGE_LENGTH];
+    uart_bridge_t *ub = uart_bridge_open(socket_path);
+    uint64_t cpu_start;
+    long expected = 0;
+
+    if (ub == NULL || (c->ring && uart_bridge_ring(ub, ring_bytes) < 0) ||
+        uart_bridge_subscribe(ub, RESP_ADC_DATA) < 0) {
+        c->failed = true;
+    }
+    pthread_barrier_wait(&ready);
+    if (c->failed) {
+        uart_bridge_close(ub);
+        return NULL;
+    }
+
+    cpu_start = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    while (expected < c->messages) {
+        char *seq;
+        long n;
+
+        if (uart_bridge_next(ub, line, sizeof(line), IDLE_TIMEOUT_MS) <= 0) {
+            break;
+        }
+        /* ADC_DATA:channel,seq,hex */
+        seq = strchr(line, PARAM_SEPARATOR);
+        if (seq == NULL) {
+            continue;
+        }
+        n = strtol(seq + 1, NULL, 10);
+        c->lost += n - expected;
+        expected = n + 1;
+        c->received++;
+        c->last_ns = clock_ns(CLOCK_MONOTONIC);
+    }
+    c->lost += c->messages - expected;
+    c->cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+
+    uart_bridge_close(ub);
+    return NULL;
+}
+
+/**
+ * @brief Write the ADC_DATA stream into the pty master
+ */
+static void produce(int messages) {
+    static uint8_t chunk[64 * MAX_FRAME_LENGTH];
+    uint16_t samples[BLOCK_SAMPLES];
+    uint8_t packed[UART_ADC_PACKED_SIZE(BLOCK_SAMPLES)];
+    size_t packed_len;
+    size_t len = 0;
+
+    for (int i = 0; i < BLOCK_SAMPLES; i++) {
+        samples[i] = (uint16_t)(i * 64);
+    }
+    packed_len = uart_adc_pack(samples, BLOCK_SAMPLES, packed);
+
+    for (int seq = 0; seq < messages; seq++) {
+        uint32_t args[2] = { 1, (uint32_t)seq };
+
+        len += uart_frame_encode(OP_ADC_DATA, REQUEST_ID_NONE, args, 2, packed, packed_len,
+                                 chunk + len, sizeof(chunk) - len);
+        if (len > sizeof(chunk) - MAX_FRAME_LENGTH || seq == messages - 1) {
+            for (size_t off = 0; off < len; ) {
+                ssize_t n = write(pty_master, chunk + off, len - off);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    return;
+                }
+                off += n;
+            }
+            len = 0;
+        }
+    }
+}
+
+static void run_round(pid_t daemon_pid, bool ring, int nconsumers, int messages) {
+    pthread_t threads[nconsumers];
+    consumer_t consumers[nconsumers];
+    uint64_t start, end = 0, daemon_cpu, client_cpu = 0;
+    long received = 0, lost = 0;
+    int failed = 0;
+
+    pthread_barrier_init(&ready, NULL, nconsumers + 1);
+    for (int i = 0; i < nconsumers; i++) {
+        memset(&consumers[i], 0, sizeof(consumers[i]));
+        consumers[i].ring = ring;
+        consumers[i].messages = messages;
+        pthread_create(&threads[i], NULL, consumer_thread, &consumers[i]);
+    }
+    pthread_barrier_wait(&ready);
+
+    daemon_cpu = process_cpu_ns(daemon_pid);
+    start = clock_ns(CLOCK_MONOTONIC);
+    produce(messages);
+
+    for (int i = 0; i < nconsumers; i++) {
+        pthread_join(threads[i], NULL);
+        if (consumers[i].failed) {
+            failed++;
+            continue;
+        }
+        received += consumers[i].received;
+        lost += consumers[i].lost;
+        client_cpu += consumers[i].cpu_ns;
+        if (consumers[i].last_ns > end) {
+            end = consumers[i].last_ns;
+        }
+    }
+    daemon_cpu = process_cpu_ns(daemon_pid) - daemon_cpu;
+    pthread_barrier_destroy(&ready);
+
+    if (failed > 0 || received == 0) {
+        printf("%-9s  %10s  %8s  %14s  %14s  (%d consumers failed)\n",
+               ring ? "ring" : "socket", "-", "-", "-", "-", failed);
+        return;
+    }
+    printf("%-9s  %10.0f  %8ld  %14.2f  %14.2f\n", ring ? "ring" : "socket",
+           received / ((end - start) / 1e9), lost,
+           daemon_cpu / 1000.0 / received, client_cpu / 1000.0 / received);
+}
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [-x daemon] [-c consumers] [-n messages] [-r ring_bytes]\n", prog);
+    printf("  -x  uart-bridge binary (default: %s)\n", DEFAULT_DAEMON);
+    printf("  -c  concurrent consumers (default: %d)\n", DEFAULT_CONSUMERS);
+    printf("  -n  ADC_DATA messages per round (default: %d)\n", DEFAULT_MESSAGES);
+    printf("  -r  ring size in bytes (default: %d)\n", DEFAULT_RING);
+}
+
+int main(int argc, char *argv[]) {
+    const char *daemon_path = DEFAULT_DAEMON;
+    int consumers = DEFAULT_CONSUMERS;
+    int messages = DEFAULT_MESSAGES;
+    pthread_t responder;
+    struct termios tty;
+    int pty_slave;
+    pid_t pid;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "x:c:n:r:h")) != -1) {
+        switch (opt) {
+            case 'x': daemon_path = optarg; break;
+            case 'c': consumers = atoi(optarg); break;
+            case 'n': messages = atoi(optarg); break;
+            case 'r': ring_bytes = strtoul(optarg, NULL, 0); break;
+            default:
+                print_usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (consumers < 1 || messages < 1 || ring_bytes > UART_RING_MAX) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Pseudo-terminal standing in for the STM32 UART */
+    pty_master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (pty_master < 0 || grantpt(pty_master) < 0 || unlockpt(pty_master) < 0) {
+        perror("posix_openpt");
+        return 1;
+    }
+
+    /* Hold the slave open so the master never sees EIO between opens */
+    pty_slave = open(ptsname(pty_master), O_RDWR | O_NOCTTY);
+    if (pty_slave < 0) {
+        perror("open pty slave");
+        return 1;
+    }
+    tcgetattr(pty_slave, &tty);
+    cfmakeraw(&tty);
+    tcsetattr(pty_slave, TCSANOW, &tty);
+
+    snprintf(socket_path, sizeof(socket_path), "/tmp/uart-bridge-stream-bench.%d.sock",
+             (int)getpid());
+
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (pid == 0) {
+        execl(daemon_path, daemon_path, "-d", ptsname(pty_master), "-s", socket_path,
+              (char *)NULL);
+        perror("exec uart-bridge");
+        _exit(127);
+    }
+
+    pthread_create(&responder, NULL, responder_thread, NULL);
+
+    /* Wait up to 2 s for the daemon to finish link setup */
+    for (int i = 0; i < 200 && !__atomic_load_n(&link_ready, __ATOMIC_ACQUIRE); i++) {
+        usleep(10000);
+    }
+    if (!__atomic_load_n(&link_ready, __ATOMIC_ACQUIRE)) {
+        fprintf(stderr, "uart-bridge did not set up the link\n");
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        return 1;
+    }
+
+    printf("uart-bridge stream benchmark (%d ADC_DATA blocks, %d consumers, ring %zu bytes)\n",
+           messages, consumers, ring_bytes);
+    printf("%-9s  %10s  %8s  %14s  %14s\n",
+           "transport", "msgs/s", "lost", "daemon us/msg", "client us/msg");
+
+    run_round(pid, false, consumers, messages);
+    run_round(pid, true, consumers, messages);
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    close(pty_slave);
+    close(pty_master);
+    return 0;
+}
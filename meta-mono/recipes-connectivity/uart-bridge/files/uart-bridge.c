@@ -1,42 +1,440 @@
 /**
  * @file uart-bridge.c
  * @brief UART bridge daemon for i.MX6ULL <-> STM32F411 communication
- * 
+ *
  * This daemon runs on i.MX6ULL Linux and manages communication with
  * STM32F411 running Zephyr RTOS via UART2 (ttymxc1).
+ *
+ * All I/O is driven by a single edge-triggered epoll loop. Any number of
+ * local clients (up to MAX_CLIENTS) may be connected at the same time;
+ * each one owns a non-blocking read buffer and a pending output buffer.
+ *
+ * Every command forwarded to the STM32 is tagged with a request ID of our
+ * own and recorded in the in-flight table, so clients may pipeline as many
+ * commands as they like and each response goes back to the socket that
+ * asked, carrying the client's own request ID (if it used one).
+ *
+ * Clients always speak ASCII. On the UART the daemon negotiates the
+ * compact COBS/CRC-16 binary framing at startup (PROTO:1) and translates
+ * at the boundary; if the STM32 does not accept it, ASCII is kept. It then
+ * raises the line rate with SET_BAUD, keeping the new rate only once a
+ * PING/PONG round trip succeeds at it.
+ *
+ * Client commands wait in one of two lanes, by priority class, until the
+ * UART has room: only a few milliseconds of line time are handed to the
+ * driver at once, high-priority lane first, so RESET, PING or GPIO_SET
+ * overtake queued bulk traffic. A command carrying a deadline ('@ms')
+ * that passes in the lane is answered ERROR:TIMEOUT and never sent. When
+ * the in-flight table is nearly full the daemon stops reading client
+ * sockets, so pressure propagates back to the writers instead of commands
+ * being dropped; the last entries are kept for high-priority commands.
+ * SIGUSR1 logs the queue depth.
+ *
+ * Reads without side effects (STATUS, GPIO_GET, ADC_READ) go through a
+ * small response cache: an answer is reused for a per-command time (-c),
+ * and a read identical to one already waiting for the STM32 takes that
+ * request's answer instead of being sent again. GPIO_SET, GPIO_WATCH and
+ * GPIO events forget the pin's level; RESET, BATCH and a link reset
+ * forget everything.
+ *
+ * Unsolicited messages from the STM32 (ADC_DATA sample blocks, EVT
+ * events) answer no command; they go to every client with a matching
+ * SUBSCRIBE topic filter. Each message is stored once, in a refcounted
+ * buffer from a fixed slab, and subscribers queue only its index; their
+ * output is written with a single sendmsg() gathering the pending
+ * responses and queued messages. A subscriber whose socket backs up has a
+ * bounded queue and misses messages instead of stalling the UART reader
+ * or being disconnected.
+ *
+ * A client may move its unsolicited messages to a shared memory ring with
+ * RING:bytes (see uart-bridge-client.h). The daemon then copies them into
+ * the ring directly and writes the client's eventfd only when the client
+ * has announced that it is going to sleep, so a busy consumer costs no
+ * system call on either side.
+ *
+ * With TELEMETRY running, the STM32 pushes changed GPIO levels, ADC
+ * values and error counters (TLM) on its own. The daemon keeps the latest
+ * values and answers GPIO_GET and ADC_READ from them while they are fresh
+ * (a keyframe at least every max_gap_ms, no gap in seq) and no write to
+ * the port is in flight; TLM messages are published to subscribers too.
+ *
+ * The STM32 answers STATUS with a binary snapshot (uart_status_t); the
+ * daemon keeps it as sent and renders the part a client asked for
+ * (STATUS[:errors|memory|threads]) as JSON on the way out, so one cached
+ * snapshot serves all of them.
+ *
+ * Traffic counters and round-trip histograms per command are kept by the
+ * loop itself, so they need no locking. STATS[:command] reports them to a
+ * client, and -m writes them as a Prometheus text file every few seconds.
+ *
+ * Messages are not logged one by one. Every frame crossing the UART and
+ * every client command is copied into an in-memory trace ring with a
+ * timestamp instead; TRACE or SIGUSR1 writes the recent history to a
+ * file. Builds with -DUART_BRIDGE_LOG_MESSAGES also syslog each message.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <limits.h>
 #include <termios.h>
 #include <signal.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
 #include <syslog.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <linux/serial.h>
 
 #include "uart-protocol.h"
+#include "uart-bridge-client.h"
+
+
+#define UNIX_SOCKET_PATH UART_BRIDGE_SOCKET
+#define MAX_CLIENTS 64
+#define MAX_EVENTS 32
+#define LISTEN_BACKLOG 16
+#define CLIENT_RX_BUFFER 1024
+#define CLIENT_TX_BUFFER 4096
+#define UART_TX_QUEUE 8192              /* Must be a power of two */
+#define UART_RX_CHUNK 4096              /* Bytes per read() of the UART */
+#define UART_TX_WINDOW_MS 5             /* Line time handed to the driver ahead of the lanes */
+#define UART_TX_WINDOW_MIN (MAX_FRAME_LENGTH + 1)       /* At least one command */
+#define CLIENT_BURST 16                 /* Commands taken from one client in a row */
+#define MAX_INFLIGHT 256                /* Must be a power of two */
+#define INFLIGHT_URGENT_RESERVE 32      /* Entries only high-priority commands may take */
+#define INFLIGHT_RESUME (MAX_INFLIGHT * 3 / 4)
+#define INFLIGHT_TIMEOUT_MS 2000
+#define LINK_RESET_TIMEOUTS 3           /* Renegotiate after this many misses */
+#define BAUD_SETTLE_US 2000             /* STM32 switch time after its OK */
+#define INTERNAL_SLOT 0xFFFF            /* In-flight entry owned by the daemon */
+#define LANE_SENT 0xFF                  /* In-flight entry no longer queued */
+#define LANE_FOLLOWER 0xFE              /* In-flight entry answered with another's response */
+#define MAX_CLIENT_TOPICS 8             /* SUBSCRIBE filters per client */
+#define MAX_TOPIC_LENGTH 32
+#define CLIENT_PUB_QUEUE 32             /* Unsolicited messages queued per client */
+#define PUB_SLAB_SIZE 256               /* Unsolicited messages queued in total */
+#define STATS_OPCODES 0x20              /* Request opcodes with their own histogram */
+#define HIST_SUB_BITS 3                 /* 8 buckets per power of two, 12.5% wide */
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((32 - HIST_SUB_BITS + 1) * HIST_SUB)
+#define HIST_EXPORT_MIN 4               /* Metrics file buckets: 2^4 us ... */
+#define HIST_EXPORT_MAX 22              /* ... 2^22 us (4.2 s) */
+#define METRICS_INTERVAL_MS 5000
+#define STM32_THREADS_MAX 16            /* Threads exported from THREADS polls */
+#define CACHE_ENTRIES 64                /* Must be a power of two */
+#define CACHE_PROBES 4                  /* Slots a key may occupy */
+#define CACHE_MAX_ARGS 2                /* Arguments of the longest cached read */
+#define CACHE_TTL_STATUS_MS 1000
+#define CACHE_TTL_READ_MS 10            /* GPIO_GET, ADC_READ */
+#define CACHE_TTL_MAX_MS 60000
+#define TLM_GRACE_MS 250                /* Delivery slack on top of max_gap_ms */
+#define TRACE_PATH "/var/run/uart-bridge.trace"
+#define TRACE_RECORDS 4096              /* Must be a power of two */
+#define TRACE_DATA 131072               /* Must be a power of two */
+#define TRACE_NO_SLOT 0xFF              /* Record of the UART itself */
+
+/* Per-message syslog costs a formatted socket write; the trace replaces it */
+#ifdef UART_BRIDGE_LOG_MESSAGES
+#define log_message(...) syslog(LOG_DEBUG, __VA_ARGS__)
+#else
+#define log_message(...) ((void)0)
+#endif
+
+/* epoll tokens: clients are EV_CLIENT + slot index */
+#define EV_UART     0
+#define EV_LISTEN   1
+#define EV_CLIENT   2
+
+/* Connected local client */
+typedef struct {
+    int fd;                             /* -1 when the slot is free */
+    uint32_t generation;                /* Bumped on every reuse of the slot */
+    char rx_buf[CLIENT_RX_BUFFER];      /* Received, not yet handled lines */
+    size_t rx_len;
+    bool rx_discard;                    /* Skipping an over-long line */
+    bool throttled;                     /* Not read until the UART queue drains */
+    char tx_buf[CLIENT_TX_BUFFER];      /* Data the socket did not accept yet */
+    size_t tx_len;
+    unsigned int waiting;               /* Commands still awaiting a response */
+    char topics[MAX_CLIENT_TOPICS][MAX_TOPIC_LENGTH];   /* SUBSCRIBE filters */
+    uint8_t ntopics;
+    uint16_t pub_queue[CLIENT_PUB_QUEUE];       /* pub_slab indices, oldest first */
+    uint8_t pub_head;
+    uint8_t pub_count;
+    uint16_t pub_off;                   /* Bytes of the oldest one already sent */
+    unsigned long pub_dropped;          /* Missed because the queue was full */
+    uart_ring_t *ring;                  /* RING: unsolicited messages go here */
+    uint32_t ring_size;                 /* Own copies, the client can write the ring */
+    uint32_t ring_head;
+    int ring_efd;                       /* Doorbell */
+    bool ring_kick;                     /* Ring written since the last doorbell */
+    bool eof;                           /* Client shut down its write side */
+} client_t;
+
+/* Link setup steps the daemon runs itself; clients get BUSY meanwhile */
+typedef enum {
+    LINK_READY,                         /* Client commands flow */
+    LINK_PROTO,                         /* PROTO:1 outstanding */
+    LINK_BAUD,                          /* SET_BAUD outstanding */
+    LINK_BAUD_VERIFY,                   /* PING at the new rate outstanding */
+} link_state_t;
+
+/* Part of the STATUS snapshot a client gets, as JSON (STATUS:<name>) */
+typedef enum {
+    STATUS_SUMMARY,
+    STATUS_ERRORS,
+    STATUS_MEMORY,
+    STATUS_THREADS,
+    STATUS_POOLS,
+    STATUS_RAW,                         /* Hex as sent by the STM32 */
+    STATUS_VIEWS
+} status_view_t;
+
+/* Unsolicited message, shared by every subscriber queue it is on */
+typedef struct {
+    uint16_t refs;                      /* Queues holding it, 0 = free */
+    uint16_t len;
+    char data[MAX_MESSAGE_LENGTH + 1];  /* Line with its delimiter */
+} pub_buf_t;
+
+/* Command queued for the STM32 or sent and still waiting for its response */
+typedef struct {
+    uint16_t wire_id;                   /* ID used on the UART, 0 = free entry */
+    uint16_t client_id;                 /* ID chosen by the client, 0 = none */
+    uint16_t slot;                      /* Client slot that asked */
+    uint32_t generation;                /* Client slot generation at send time */
+    uint64_t deadline_ms;               /* Answer ERROR:TIMEOUT after this */
+    uint64_t sent_us;                   /* For the round-trip histogram */
+    uint8_t opcode;
+    uint8_t lane;                       /* UART_PRIO_* while queued, LANE_FOLLOWER, else LANE_SENT */
+    uint8_t view;                       /* STATUS_*, for STATUS requests */
+    uint8_t tlm_ports;                  /* Telemetry ports held until the answer, bit per port */
+    int16_t prev, next;                 /* Deadline-order list, -1 terminated */
+    int16_t lane_prev, lane_next;       /* Lane FIFO, -1 terminated */
+    int16_t leader;                     /* LANE_FOLLOWER: entry whose answer it takes */
+    uint16_t followers;                 /* Entries taking this one's answer */
+    int16_t cache;                      /* Cache slot to fill with the answer, -1 = none */
+    uint16_t len;
+    char line[MAX_MESSAGE_LENGTH];      /* Client command, kept until it is sent */
+} inflight_t;
+
+/*
+ * Log-linear latency histogram in microseconds: exact below 2 * HIST_SUB,
+ * then HIST_SUB equal buckets per power of two up to 2^32.
+ */
+typedef struct {
+    uint32_t buckets[HIST_BUCKETS];
+    uint64_t count;
+    uint64_t sum_us;
+    uint32_t max_us;
+} latency_hist_t;
+
+/* Trace record directions, TRACE_BINARY set for COBS frames */
+enum {
+    TRACE_UART_TX   = 0x01,
+    TRACE_UART_RX   = 0x02,
+    TRACE_CLIENT_RX = 0x03,
+    TRACE_CLIENT_TX = 0x04,
+    TRACE_BINARY    = 0x80,
+};
+
+/* One traced message; its bytes are in trace_data */
+typedef struct {
+    uint32_t time_us;                   /* Monotonic, wraps after 71 minutes */
+    uint32_t data;                      /* Start in trace_data, free-running */
+    uint16_t len;
+    uint8_t dir;                        /* TRACE_* */
+    uint8_t slot;                       /* Client slot, TRACE_NO_SLOT for the UART */
+} trace_record_t;
+
+/* Requests of one opcode sent to the STM32 */
+typedef struct {
+    uint64_t sent;
+    uint64_t timeouts;
+    uint64_t cache_hits;                /* Answered from the cache */
+    uint64_t merged;                    /* Answered with an identical request's response */
+    uint64_t telemetry_hits;            /* Answered from TELEMETRY values */
+    latency_hist_t rtt;                 /* Send to response, timeouts excluded */
+} command_stats_t;
+
+/* Idempotent read the cache handles */
+typedef struct {
+    uint8_t opcode;
+    unsigned int ttl_ms;                /* 0: only merge identical requests in flight */
+} cache_rule_t;
 
+/* Answer to one read (opcode and arguments), and the request fetching it */
+typedef struct {
+    uint8_t opcode;                     /* OP_NONE = free slot */
+    uint8_t nargs;
+    uint8_t priority;                   /* Of the pending request */
+    uint32_t args[CACHE_MAX_ARGS];
+    int16_t pending;                    /* In-flight entry fetching it, -1 = none */
+    uint64_t expires_ms;                /* Response usable before this, 0 = none held */
+    uint16_t len;
+    char response[MAX_MESSAGE_LENGTH];  /* "OK:1", without request ID */
+} cache_entry_t;
 
-#define UNIX_SOCKET_PATH "/var/run/uart-bridge.sock"
-#define MAX_CLIENTS 5
-#define READ_TIMEOUT_SEC 5
 static int uart_fd = -1;
 static int socket_fd = -1;
+static int epoll_fd = -1;
+static const char *socket_path = UNIX_SOCKET_PATH;
 static volatile bool running = true;
+static volatile bool dump_stats = false;
+
+static client_t clients[MAX_CLIENTS];
+static int client_count = 0;
+
+static inflight_t inflight[MAX_INFLIGHT];
+static int16_t inflight_head = -1;      /* Earliest deadline */
+static int16_t inflight_tail = -1;      /* Latest deadline */
+static unsigned int inflight_count = 0;
+static uint16_t next_wire_id = 1;
+
+/* Client commands not sent yet, one FIFO per UART_PRIO_* */
+static struct {
+    int16_t head, tail;
+} lanes[UART_PRIORITIES] = { { -1, -1 }, { -1, -1 } };
+static unsigned int lane_count = 0;
+
+static bool binary_mode = false;        /* UART currently uses binary frames */
+static bool ascii_only = false;         /* -a: never try binary framing */
+static link_state_t link_state = LINK_READY;
+static uint32_t baudrate = UART_BAUDRATE;               /* Current line rate */
+static uint32_t target_baudrate = UART_BAUDRATE_MAX;    /* -b */
+static uint32_t previous_baudrate = UART_BAUDRATE;      /* Kept if verify fails */
+static unsigned int consecutive_timeouts = 0;
+static bool flow_control = false;       /* -r: RTS/CTS on the UART */
+static bool low_latency = false;        /* -l: ASYNC_LOW_LATENCY on the UART */
+
+/* Bytes waiting for the UART driver to accept them, a ring */
+static uint8_t uart_tx_buf[UART_TX_QUEUE];
+static size_t uart_tx_start = 0;        /* Oldest byte */
+static size_t uart_tx_len = 0;
+static size_t uart_tx_peak = 0;
+static bool backpressure = false;       /* Client sockets are not being read */
+static unsigned int backpressure_count = 0;
+static int throttled_clients = 0;
+static unsigned long unsolicited_dropped = 0;   /* Not delivered to a slow subscriber */
+
+static pub_buf_t pub_slab[PUB_SLAB_SIZE];
+static uint16_t pub_free[PUB_SLAB_SIZE];        /* Stack of free pub_slab indices */
+static unsigned int pub_free_count = 0;
+
+/* Traffic counters; only the loop writes them */
+static struct {
+    uint64_t uart_rx_bytes;
+    uint64_t uart_tx_bytes;
+    uint64_t uart_rx_frames;            /* Frames or lines from the STM32 */
+    uint64_t uart_tx_frames;
+    uint64_t rx_corrupt;                /* Bad COBS or CRC */
+    uint64_t rx_malformed;              /* Unknown frames, unparsable lines */
+    uint64_t rx_overflows;              /* Over-long input, receive buffer reset */
+    uint64_t rx_unmatched;              /* Responses nobody waits for (late) */
+    uint64_t unsolicited;               /* ADC_DATA/EVT messages published */
+    uint64_t clients_accepted;
+    uint64_t clients_rejected;          /* MAX_CLIENTS reached */
+    uint64_t client_errors;             /* ERROR answered by the daemon itself */
+    uint64_t client_busy;               /* ERROR:BUSY */
+    uint64_t expired;                   /* Deadline passed before sending */
+} stats;
+static command_stats_t command_stats[STATS_OPCODES];
+
+static cache_rule_t cache_rules[] = {
+    { OP_STATUS,   CACHE_TTL_STATUS_MS },
+    { OP_GPIO_GET, CACHE_TTL_READ_MS },
+    { OP_ADC_READ, CACHE_TTL_READ_MS },
+};
+static cache_entry_t cache[CACHE_ENTRIES];
+
+/* Latest TELEMETRY values pushed by the STM32 */
+static struct {
+    uint32_t value[UART_TLM_FIELDS];
+    uint64_t valid;                     /* Bit per field */
+    uint64_t fresh_until_ms;            /* Stale from then on without another TLM */
+    uint32_t next_seq;
+    bool seen;                          /* next_seq is known */
+    uint8_t writes[TELEMETRY_PORTS_MAX];        /* Requests in flight that may change the port */
+    uint64_t messages;
+    uint64_t gaps;                      /* Lost TLM messages noticed */
+} tlm;
+/* STM32 threads and heap, polled with THREADS along with the metrics file */
+typedef struct {
+    char name[UART_THREAD_NAME_MAX + 1];        /* "" = not reported yet */
+    uint32_t stack_size;
+    uint32_t stack_used;
+    uint32_t runtime_us;
+    uint32_t time_us;                   /* STM32 time at which runtime_us was read */
+    int32_t cpu_permille;               /* Since the previous poll, -1 = unknown */
+} stm32_thread_t;
+
+static struct {
+    bool polling;                       /* A THREADS query is in flight */
+    uint32_t next;                      /* Thread being asked for */
+    uint32_t count;                     /* Threads in the latest summary */
+    uint32_t time_us;
+    uint32_t heap_size;                 /* 0 = no summary yet */
+    uint32_t heap_free;
+    uint32_t heap_max_used;
+    stm32_thread_t thread[STM32_THREADS_MAX];
+} stm32_threads;
+static latency_hist_t loop_hist;        /* Handling one epoll wakeup */
+static const char *metrics_path = NULL; /* -m */
+static uint64_t metrics_due_ms = 0;
+
+/* Trace ring; the loop is its only writer and reader */
+static trace_record_t trace_records[TRACE_RECORDS];
+static uint8_t trace_data[TRACE_DATA];
+static uint32_t trace_count = 0;        /* Records written, free-running */
+static uint32_t trace_data_head = 0;
+static const char *trace_path = TRACE_PATH;     /* -t */
+
 static int open_uart(const char *device, speed_t baudrate);
 static int create_unix_socket(const char *path);
 static void signal_handler(int signum);
 static void process_uart_data(void);
-static void process_client_data(int client_fd);
-static int send_to_stm32(const char *message);
+static void process_client_data(client_t *client);
+static void accept_clients(void);
+static void close_client(client_t *client);
+static int send_to_client(client_t *client, const char *data, size_t len);
+static void flush_client(client_t *client);
+static void finish_client(client_t *client);
+static int send_to_stm32(const uart_message_t *msg, uint16_t wire_id);
+static void handle_internal_response(uint8_t opcode, const uart_message_t *resp);
+static void start_link_setup(void);
 static void cleanup(void);
 
+/**
+ * @brief Ask the serial driver to hand received bytes over without delay
+ *
+ * Drivers that buffer input for a while before passing it to the tty
+ * layer skip that with ASYNC_LOW_LATENCY. Not every driver supports it.
+ */
+static void set_low_latency(int fd) {
+    struct serial_struct serial;
+
+    if (ioctl(fd, TIOCGSERIAL, &serial) < 0) {
+        syslog(LOG_WARNING, "UART has no low latency mode: %s", strerror(errno));
+        return;
+    }
+    serial.flags |= ASYNC_LOW_LATENCY;
+    if (ioctl(fd, TIOCSSERIAL, &serial) < 0) {
+        syslog(LOG_WARNING, "Failed to set UART low latency mode: %s", strerror(errno));
+    }
+}
+
 /**
  * @brief Open and configure UART device
  */
@@ -44,7 +442,7 @@ static int open_uart(const char *device, speed_t baudrate) {
     int fd;
     struct termios tty;
 
-    fd = open(device, O_RDWR | O_NOCTTY | O_SYNC);
+    fd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
     if (fd < 0) {
         syslog(LOG_ERR, "Failed to open UART device %s: %s", device, strerror(errno));
         return -1;
@@ -63,14 +461,24 @@ static int open_uart(const char *device, speed_t baudrate) {
     tty.c_iflag &= ~IGNBRK;                         /* Disable break processing */
     tty.c_lflag = 0;                                /* No signaling chars, no echo, no canonical processing */
     tty.c_oflag = 0;                                /* No remapping, no delays */
-    tty.c_cc[VMIN]  = 0;                            /* Read doesn't block */
-    tty.c_cc[VTIME] = 5;                            /* 0.5 seconds read timeout */
+    /*
+     * Reads never block (O_NONBLOCK). With VTIME 0, poll only reports the
+     * port readable once VMIN bytes are in, which would strand a short
+     * response; 1 wakes the loop on the first byte.
+     */
+    tty.c_cc[VMIN]  = 1;
+    tty.c_cc[VTIME] = 0;
 
     tty.c_iflag &= ~(IXON | IXOFF | IXANY);         /* Shut off xon/xoff ctrl */
+    tty.c_iflag &= ~(ICRNL | INLCR | IGNCR | ISTRIP | PARMRK); /* Binary frames carry any byte */
     tty.c_cflag |= (CLOCAL | CREAD);                /* Ignore modem controls, enable reading */
     tty.c_cflag &= ~(PARENB | PARODD);              /* No parity */
     tty.c_cflag &= ~CSTOPB;                         /* 1 stop bit */
-    tty.c_cflag &= ~CRTSCTS;                        /* No hardware flow control */
+    if (flow_control) {
+        tty.c_cflag |= CRTSCTS;                     /* STM32 paces us with CTS */
+    } else {
+        tty.c_cflag &= ~CRTSCTS;                    /* No hardware flow control */
+    }
 
     if (tcsetattr(fd, TCSANOW, &tty) != 0) {
         syslog(LOG_ERR, "Failed to set UART attributes: %s", strerror(errno));
@@ -78,10 +486,53 @@ static int open_uart(const char *device, speed_t baudrate) {
         return -1;
     }
 
-    syslog(LOG_INFO, "UART device %s opened successfully", device);
+    if (low_latency) {
+        set_low_latency(fd);
+    }
+
+    syslog(LOG_INFO, "UART device %s opened successfully%s", device,
+           flow_control ? " (RTS/CTS)" : "");
     return fd;
 }
 
+static speed_t baud_to_speed(uint32_t rate) {
+    switch (rate) {
+        case 115200:  return B115200;
+        case 230400:  return B230400;
+        case 460800:  return B460800;
+        case 921600:  return B921600;
+        case 1000000: return B1000000;
+        case 1500000: return B1500000;
+        case 2000000: return B2000000;
+        case 3000000: return B3000000;
+    }
+    return B0;
+}
+
+/**
+ * @brief Change the UART line rate once pending output has gone out
+ */
+static int set_uart_baudrate(uint32_t rate) {
+    speed_t speed = baud_to_speed(rate);
+    struct termios tty;
+
+    if (speed == B0 || tcgetattr(uart_fd, &tty) != 0) {
+        return -1;
+    }
+
+    cfsetospeed(&tty, speed);
+    cfsetispeed(&tty, speed);
+    if (tcsetattr(uart_fd, TCSADRAIN, &tty) != 0) {
+        syslog(LOG_ERR, "Failed to set UART to %u baud: %s", rate, strerror(errno));
+        return -1;
+    }
+
+    /* Anything received around the switch is garbage */
+    tcflush(uart_fd, TCIFLUSH);
+    baudrate = rate;
+    return 0;
+}
+
 /**
  * @brief Create Unix domain socket for local IPC
  */
@@ -91,7 +542,7 @@ static int create_unix_socket(const char *path) {
 
     unlink(path);
 
-    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (fd < 0) {
         syslog(LOG_ERR, "Failed to create socket: %s", strerror(errno));
         return -1;
@@ -107,7 +558,7 @@ static int create_unix_socket(const char *path) {
         return -1;
     }
 
-    if (listen(fd, MAX_CLIENTS) < 0) {
+    if (listen(fd, LISTEN_BACKLOG) < 0) {
         syslog(LOG_ERR, "Failed to listen on socket: %s", strerror(errno));
         close(fd);
         return -1;
@@ -117,186 +568,3009 @@ static int create_unix_socket(const char *path) {
     return fd;
 }
 
+/**
+ * @brief Register file descriptor with the epoll instance
+ */
+static int epoll_add(int fd, uint32_t events, uint32_t token) {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.u32 = token;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        syslog(LOG_ERR, "epoll_ctl(ADD) failed: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
 /**
  * @brief Signal handler for graceful shutdown
  */
 static void signal_handler(int signum) {
-    syslog(LOG_INFO, "Received signal %d, shutting down...", signum);
+    if (signum == SIGUSR1) {
+        dump_stats = true;
+        return;
+    }
     running = false;
 }
 
 /**
- * @brief Send message to STM32 via UART
+ * @brief Monotonic time in milliseconds
  */
-static int send_to_stm32(const char *message) {
-    char buffer[MAX_MESSAGE_LENGTH];
-    int len;
+static uint64_t now_ms(void) {
+    struct timespec ts;
 
-    len = snprintf(buffer, sizeof(buffer), "%s\n", message);
-    if (len < 0 || len >= sizeof(buffer)) {
-        syslog(LOG_ERR, "Message too long");
-        return -1;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Monotonic time in microseconds
+ */
+static uint64_t now_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static unsigned int hist_index(uint32_t us) {
+    int shift;
+
+    if (us < 2 * HIST_SUB) {
+        return us;
     }
+    shift = 31 - __builtin_clz(us) - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + (us >> shift) - HIST_SUB;
+}
 
-    int written = write(uart_fd, buffer, len);
-    if (written != len) {
-        syslog(LOG_ERR, "Failed to write to UART: %s", strerror(errno));
-        return -1;
+/* Largest value that lands in bucket i */
+static uint32_t hist_upper(unsigned int i) {
+    int shift;
+
+    if (i < 2 * HIST_SUB) {
+        return i;
     }
+    shift = i / HIST_SUB - 1;
+    return ((uint32_t)(i % HIST_SUB + HIST_SUB) << shift) + ((1u << shift) - 1);
+}
 
-    syslog(LOG_DEBUG, "Sent to STM32: %s", message);
-    return 0;
+static void hist_record(latency_hist_t *h, uint64_t us) {
+    uint32_t v = us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+
+    h->buckets[hist_index(v)]++;
+    h->count++;
+    h->sum_us += v;
+    if (v > h->max_us) {
+        h->max_us = v;
+    }
 }
 
 /**
- * @brief Process data received from UART (STM32)
+ * @brief Value below which permille/1000 of the samples fall
+ *
+ * Exact to the bucket width (1/HIST_SUB of the value), never above the
+ * largest sample.
  */
-static void process_uart_data(void) {
-    static char buffer[MAX_MESSAGE_LENGTH];
-    static int buffer_pos = 0;
-    char read_buf[64];
-    int n;
-
-    n = read(uart_fd, read_buf, sizeof(read_buf) - 1);
-    if (n > 0) {
-        read_buf[n] = '\0';
-        
-        for (int i = 0; i < n; i++) {
-            if (read_buf[i] == '\n') {
-                buffer[buffer_pos] = '\0';
-                syslog(LOG_DEBUG, "Received from STM32: %s", buffer);
-                
-                /* TODO: Forward to connected clients or process locally */
-                printf("STM32: %s\n", buffer);
-                
-                buffer_pos = 0;
-            } else if (buffer_pos < MAX_MESSAGE_LENGTH - 1) {
-                buffer[buffer_pos++] = read_buf[i];
+static uint32_t hist_percentile(const latency_hist_t *h, unsigned int permille) {
+    uint64_t target = (h->count * permille + 999) / 1000;
+    uint64_t seen = 0;
+
+    for (unsigned int i = 0; i < HIST_BUCKETS && target > 0; i++) {
+        seen += h->buckets[i];
+        if (seen >= target) {
+            return hist_upper(i) < h->max_us ? hist_upper(i) : h->max_us;
+        }
+    }
+    return h->max_us;
+}
+
+static void hist_merge(latency_hist_t *into, const latency_hist_t *h) {
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+        into->buckets[i] += h->buckets[i];
+    }
+    into->count += h->count;
+    into->sum_us += h->sum_us;
+    if (h->max_us > into->max_us) {
+        into->max_us = h->max_us;
+    }
+}
+
+static command_stats_t *command_stats_for(uint8_t opcode) {
+    return &command_stats[opcode < STATS_OPCODES ? opcode : OP_NONE];
+}
+
+/**
+ * @brief Record a message in the trace ring, overwriting the oldest
+ */
+static void trace(uint8_t dir, uint8_t slot, const void *data, size_t len) {
+    trace_record_t *r = &trace_records[trace_count++ & (TRACE_RECORDS - 1)];
+    uint32_t off = trace_data_head & (TRACE_DATA - 1);
+    size_t first = TRACE_DATA - off < len ? TRACE_DATA - off : len;
+
+    r->time_us = (uint32_t)now_us();
+    r->data = trace_data_head;
+    r->len = len;
+    r->dir = dir;
+    r->slot = slot;
+    memcpy(trace_data + off, data, first);
+    memcpy(trace_data, (const uint8_t *)data + first, len - first);
+    trace_data_head += len;
+}
+
+/**
+ * @brief Write the records still in the trace ring to trace_path, oldest first
+ *
+ * One line per message: time in microseconds, direction, client slot,
+ * length, then the line as text or a binary frame as hex (COBS-encoded,
+ * without the delimiter).
+ *
+ * @return Records written, or -1 if the file could not be written
+ */
+static int write_trace(void) {
+    static const char *const dir_names[] = {
+        [TRACE_UART_TX] = "uart-tx", [TRACE_UART_RX] = "uart-rx",
+        [TRACE_CLIENT_RX] = "client-rx", [TRACE_CLIENT_TX] = "client-tx",
+    };
+    char tmp_path[PATH_MAX];
+    uint32_t first = trace_count > TRACE_RECORDS ? trace_count - TRACE_RECORDS : 0;
+    int written = 0;
+    FILE *f;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", trace_path);
+    f = fopen(tmp_path, "w");
+    if (f == NULL) {
+        syslog(LOG_ERR, "Failed to write %s: %s", tmp_path, strerror(errno));
+        return -1;
+    }
+
+    for (uint32_t n = first; n != trace_count; n++) {
+        const trace_record_t *r = &trace_records[n & (TRACE_RECORDS - 1)];
+
+        /* Bytes already reused by newer records */
+        if (trace_data_head - r->data > TRACE_DATA) {
+            continue;
+        }
+        fprintf(f, "%10u %-9s ", r->time_us, dir_names[r->dir & ~TRACE_BINARY]);
+        if (r->slot == TRACE_NO_SLOT) {
+            fprintf(f, " - ");
+        } else {
+            fprintf(f, "%2u ", r->slot);
+        }
+        fprintf(f, "%3u ", r->len);
+        for (uint16_t i = 0; i < r->len; i++) {
+            uint8_t c = trace_data[(r->data + i) & (TRACE_DATA - 1)];
+
+            if (r->dir & TRACE_BINARY) {
+                fprintf(f, "%02x", c);
+            } else if (c >= 0x20 && c < 0x7F && c != '\\') {
+                fputc(c, f);
             } else {
-                syslog(LOG_WARNING, "Buffer overflow, resetting");
-                buffer_pos = 0;
+                fprintf(f, "\\x%02x", c);
             }
         }
+        fputc('\n', f);
+        written++;
+    }
+
+    if (fclose(f) != 0 || rename(tmp_path, trace_path) < 0) {
+        syslog(LOG_ERR, "Failed to write %s: %s", trace_path, strerror(errno));
+        unlink(tmp_path);
+        return -1;
     }
+    return written;
 }
 
 /**
- * @brief Process data from client socket
+ * @brief Format "NAME[#id][!][:params]" into buffer (no delimiter)
+ * @return Length written, or -1 if it does not fit
+ */
+static int format_frame(char *buffer, size_t size, const uart_slice_t *name,
+                        uint16_t id, bool urgent, const uart_slice_t *params) {
+    int len;
+
+    if (id != REQUEST_ID_NONE) {
+        len = snprintf(buffer, size, "%.*s%c%u", name->len, name->ptr, REQUEST_ID_SEPARATOR, id);
+    } else {
+        len = snprintf(buffer, size, "%.*s", name->len, name->ptr);
+    }
+    if (len >= 0 && urgent) {
+        len += snprintf(buffer + len, size > (size_t)len ? size - len : 0, "%c",
+                        PRIORITY_MARKER);
+    }
+    if (len >= 0 && params->len > 0) {
+        len += snprintf(buffer + len, size > (size_t)len ? size - len : 0, "%c%.*s",
+                        FIELD_SEPARATOR, params->len, params->ptr);
+    }
+
+    return (len < 0 || (size_t)len >= size) ? -1 : len;
+}
+
+/**
+ * @brief Write as much of the UART queue as the driver accepts
+ *
+ * Called once per loop pass, so everything the clients queued meanwhile
+ * goes out in one writev(). The rest goes out on the next EPOLLOUT.
+ */
+static void flush_uart(void) {
+    while (uart_tx_len > 0) {
+        size_t first = UART_TX_QUEUE - uart_tx_start;
+        struct iovec iov[2] = {
+            { uart_tx_buf + uart_tx_start, first < uart_tx_len ? first : uart_tx_len },
+            { uart_tx_buf, first < uart_tx_len ? uart_tx_len - first : 0 },
+        };
+        ssize_t written = writev(uart_fd, iov, iov[1].iov_len > 0 ? 2 : 1);
+
+        if (written > 0) {
+            uart_tx_start = (uart_tx_start + written) & (UART_TX_QUEUE - 1);
+            uart_tx_len -= written;
+            stats.uart_tx_bytes += written;
+            continue;
+        }
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written < 0 && errno == EAGAIN) {
+            break;
+        }
+        /* Commands lost here are answered ERROR:TIMEOUT */
+        syslog(LOG_ERR, "Failed to write to UART: %s", strerror(errno));
+        uart_tx_len = 0;
+    }
+}
+
+/**
+ * @brief Queue bytes for the UART; flush_uart() sends them
+ *
+ * Never waits for the line. Client commands are only taken while
+ * link_backlogged() is false, so the queue cannot overflow with them.
+ */
+static int write_uart(const void *data, size_t len) {
+    size_t end = (uart_tx_start + uart_tx_len) & (UART_TX_QUEUE - 1);
+    size_t first = UART_TX_QUEUE - end < len ? UART_TX_QUEUE - end : len;
+
+    if (len > sizeof(uart_tx_buf) - uart_tx_len) {
+        syslog(LOG_ERR, "UART TX queue full, %zu bytes not sent", len);
+        return -1;
+    }
+
+    memcpy(uart_tx_buf + end, data, first);
+    memcpy(uart_tx_buf, (const uint8_t *)data + first, len - first);
+    uart_tx_len += len;
+    if (uart_tx_len > uart_tx_peak) {
+        uart_tx_peak = uart_tx_len;
+    }
+    return 0;
+}
+
+/**
+ * @brief Throw away output the STM32 will no longer understand
+ */
+static void discard_uart_tx(void) {
+    uart_tx_len = 0;
+    tcflush(uart_fd, TCOFLUSH);
+}
+
+/**
+ * @brief Send message to STM32 via UART
+ *
+ * @param msg Parsed command; its own request ID is replaced by wire_id
+ * @param wire_id Request ID to use on the UART
+ * @return 0 on success, -1 on write failure, -2 if the message cannot
+ *         be expressed in binary framing
  */
-static void process_client_data(int client_fd) {
+static int send_to_stm32(const uart_message_t *msg, uint16_t wire_id) {
+    /* Only a raised priority travels; the STM32 knows each opcode's class */
+    bool urgent = msg->priority > uart_opcode_priority(msg->opcode);
     char buffer[MAX_MESSAGE_LENGTH];
-    int n;
+    int len;
+
+    if (binary_mode) {
+        uint8_t frame[MAX_FRAME_LENGTH];
+        uint32_t args[MAX_FRAME_ARGS];
+        int nargs;
+
+        if (msg->opcode == OP_NONE || msg->opcode >= OP_OK) {
+            return -2;
+        }
+        if (msg->opcode == OP_BATCH) {
+            uint8_t payload[MAX_MESSAGE_LENGTH];
+            int payload_len = uart_batch_encode(&msg->params, payload, sizeof(payload));
 
-    n = read(client_fd, buffer, sizeof(buffer) - 1);
-    if (n > 0) {
-        buffer[n] = '\0';
-        
-        if (buffer[n-1] == '\n') {
-            buffer[n-1] = '\0';
+            if (payload_len < 0) {
+                return -2;
+            }
+            len = uart_frame_encode(OP_BATCH | (urgent ? OP_FLAG_URGENT : 0), wire_id,
+                                    NULL, 0, payload, payload_len, frame, sizeof(frame));
+            if (len < 0) {
+                return -2;
+            }
+        } else {
+            nargs = uart_message_args(msg, args, MAX_FRAME_ARGS);
+            if (nargs < 0) {
+                return -2;
+            }
+            len = uart_frame_encode(msg->opcode | (urgent ? OP_FLAG_URGENT : 0), wire_id,
+                                    args, nargs, NULL, 0, frame, sizeof(frame));
+        }
+        if (len < 0 || write_uart(frame, len) < 0) {
+            return -1;
         }
-        
-        syslog(LOG_DEBUG, "Received from client: %s", buffer);
-        
-        send_to_stm32(buffer);
+        stats.uart_tx_frames++;
+        trace(TRACE_UART_TX | TRACE_BINARY, TRACE_NO_SLOT, frame, len - 1);
+        log_message("Sent to STM32 (binary, %d bytes): %.*s", len,
+                    msg->name.len, msg->name.ptr);
+        return 0;
     }
+
+    len = format_frame(buffer, sizeof(buffer) - 1, &msg->name, wire_id, urgent, &msg->params);
+    if (len < 0) {
+        syslog(LOG_ERR, "Message too long");
+        return -1;
+    }
+    buffer[len++] = MESSAGE_DELIMITER;
+
+    if (write_uart(buffer, len) < 0) {
+        return -1;
+    }
+    stats.uart_tx_frames++;
+    trace(TRACE_UART_TX, TRACE_NO_SLOT, buffer, len - 1);
+
+    log_message("Sent to STM32: %.*s", len - 1, buffer);
+    return 0;
 }
 
 /**
- * @brief Cleanup resources
+ * @brief Queue an in-flight entry at the end of a lane
  */
-static void cleanup(void) {
-    if (uart_fd >= 0) {
-        close(uart_fd);
-        uart_fd = -1;
+static void lane_push(int16_t idx, uint8_t priority) {
+    inflight_t *e = &inflight[idx];
+
+    e->lane = priority;
+    e->lane_prev = lanes[priority].tail;
+    e->lane_next = -1;
+    if (lanes[priority].tail >= 0) {
+        inflight[lanes[priority].tail].lane_next = idx;
+    } else {
+        lanes[priority].head = idx;
     }
-    
-    if (socket_fd >= 0) {
-        close(socket_fd);
-        socket_fd = -1;
+    lanes[priority].tail = idx;
+    lane_count++;
+}
+
+static void lane_remove(int16_t idx) {
+    inflight_t *e = &inflight[idx];
+
+    if (e->lane_prev >= 0) {
+        inflight[e->lane_prev].lane_next = e->lane_next;
+    } else {
+        lanes[e->lane].head = e->lane_next;
     }
-    
-    unlink(UNIX_SOCKET_PATH);
-    syslog(LOG_INFO, "Cleanup completed");
+    if (e->lane_next >= 0) {
+        inflight[e->lane_next].lane_prev = e->lane_prev;
+    } else {
+        lanes[e->lane].tail = e->lane_prev;
+    }
+
+    e->lane = LANE_SENT;
+    lane_count--;
+}
+
+static void inflight_unlink(int16_t idx) {
+    inflight_t *e = &inflight[idx];
+
+    if (e->lane == LANE_FOLLOWER) {
+        inflight[e->leader].followers--;
+    } else if (e->lane != LANE_SENT) {
+        lane_remove(idx);
+    }
+    if (e->prev >= 0) {
+        inflight[e->prev].next = e->next;
+    } else {
+        inflight_head = e->next;
+    }
+    if (e->next >= 0) {
+        inflight[e->next].prev = e->prev;
+    } else {
+        inflight_tail = e->prev;
+    }
+
+    e->wire_id = 0;
+    inflight_count--;
 }
 
 /**
- * @brief Main function
+ * @brief Reserve an in-flight entry and a fresh wire request ID
+ *
+ * The entry goes into the list by deadline. Most commands use the default
+ * timeout and are simply appended; one with a shorter deadline of its own
+ * walks back from the end.
+ *
+ * @return Entry index, or -1 if MAX_INFLIGHT commands are outstanding
  */
-int main(int argc, char *argv[]) {
-    fd_set read_fds;
-    int max_fd;
-    struct timeval timeout;
-    int client_fd = -1;
+static int16_t inflight_alloc(uint64_t deadline_ms) {
+    if (inflight_count >= MAX_INFLIGHT) {
+        return -1;
+    }
 
-    openlog("uart-bridge", LOG_PID | LOG_CONS, LOG_DAEMON);
-    syslog(LOG_INFO, "UART Bridge Daemon starting...");
+    for (;;) {
+        uint16_t id = next_wire_id++;
+        int16_t idx = id & (MAX_INFLIGHT - 1);
+        inflight_t *e = &inflight[idx];
+        int16_t prev = inflight_tail;
 
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
+        if (next_wire_id == REQUEST_ID_NONE) {
+            next_wire_id = 1;
+        }
+        if (id == REQUEST_ID_NONE || e->wire_id != 0) {
+            continue;
+        }
 
-    uart_fd = open_uart(UART_DEVICE, B115200);
-    if (uart_fd < 0) {
-        syslog(LOG_ERR, "Failed to open UART, exiting");
-        return EXIT_FAILURE;
+        while (prev >= 0 && inflight[prev].deadline_ms > deadline_ms) {
+            prev = inflight[prev].prev;
+        }
+        e->wire_id = id;
+        e->deadline_ms = deadline_ms;
+        e->lane = LANE_SENT;
+        e->followers = 0;
+        e->cache = -1;
+        e->view = STATUS_SUMMARY;
+        e->tlm_ports = 0;
+        e->prev = prev;
+        e->next = prev >= 0 ? inflight[prev].next : inflight_head;
+        if (e->next >= 0) {
+            inflight[e->next].prev = idx;
+        } else {
+            inflight_tail = idx;
+        }
+        if (prev >= 0) {
+            inflight[prev].next = idx;
+        } else {
+            inflight_head = idx;
+        }
+        inflight_count++;
+        return idx;
     }
+}
 
-    socket_fd = create_unix_socket(UNIX_SOCKET_PATH);
-    if (socket_fd < 0) {
-        cleanup();
-        return EXIT_FAILURE;
+/**
+ * @brief Look up the in-flight entry for a wire request ID
+ */
+static int16_t inflight_find(uint16_t wire_id) {
+    int16_t idx = wire_id & (MAX_INFLIGHT - 1);
+
+    return inflight[idx].wire_id == wire_id && inflight[idx].lane == LANE_SENT ? idx : -1;
+}
+
+/**
+ * @brief The sent command with the earliest deadline, which for commands
+ *        on the default timeout is the oldest one
+ */
+static int16_t inflight_oldest_sent(void) {
+    int16_t idx = inflight_head;
+
+    while (idx >= 0 && inflight[idx].lane != LANE_SENT) {
+        idx = inflight[idx].next;
     }
+    return idx;
+}
 
-    syslog(LOG_INFO, "UART Bridge Daemon running");
+static const char *const status_view_names[STATUS_VIEWS] = {
+    [STATUS_SUMMARY] = "",
+    [STATUS_ERRORS]  = "errors",
+    [STATUS_MEMORY]  = "memory",
+    [STATUS_THREADS] = "threads",
+    [STATUS_POOLS]   = "pools",
+    [STATUS_RAW]     = "raw",
+};
 
-    while (running) {
-        FD_ZERO(&read_fds);
-        FD_SET(uart_fd, &read_fds);
-        FD_SET(socket_fd, &read_fds);
-        
-        max_fd = (uart_fd > socket_fd) ? uart_fd : socket_fd;
-        
-        if (client_fd >= 0) {
-            FD_SET(client_fd, &read_fds);
-            if (client_fd > max_fd) {
-                max_fd = client_fd;
-            }
+static int status_view_from_name(const uart_slice_t *name) {
+    for (int i = 0; i < STATUS_VIEWS; i++) {
+        if (strlen(status_view_names[i]) == name->len &&
+            memcmp(status_view_names[i], name->ptr, name->len) == 0) {
+            return i;
         }
+    }
+    return -1;
+}
 
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
+/**
+ * @brief Render one part of a STATUS snapshot (hex parameters) as JSON
+ * @return Length written, or -1 if the parameters are no snapshot (older
+ *         firmware sends JSON itself) or the part does not fit
+ */
+static int render_status(const uart_slice_t *hex, uint8_t view, char *out, size_t size) {
+    static const char *const reset_names[] = {
+        "power_on", "pin", "brownout", "software", "watchdog", "low_power",
+    };
+    uint8_t raw[MAX_MESSAGE_LENGTH / 2];
+    char resets[80] = "";
+    uart_status_t st;
+    size_t pos = 0;
+    int n = uart_hex_decode(hex->ptr, hex->len, raw, sizeof(raw));
 
-        int ret = select(max_fd + 1, &read_fds, NULL, NULL, &timeout);
-        
-        if (ret < 0) {
-            if (errno == EINTR) {
-                continue;
+    if (n < 0 || uart_status_decode(raw, n, &st) < 0) {
+        return -1;
+    }
+
+    switch (view) {
+    case STATUS_SUMMARY:
+        for (size_t i = 0; i < sizeof(reset_names) / sizeof(reset_names[0]); i++) {
+            if (st.reset_cause & (1u << i)) {
+                pos += snprintf(resets + pos, sizeof(resets) - pos, "%s\"%s\"",
+                                pos == 0 ? "" : ",", reset_names[i]);
             }
-            syslog(LOG_ERR, "select() failed: %s", strerror(errno));
-            break;
         }
+        n = snprintf(out, size,
+                     "{\"uptime_ms\":%u,\"reset\":[%s],\"sysclk_hz\":%u,\"baud\":%u,"
+                     "\"framing\":\"%s\",\"zephyr\":\"%u.%u.%u\",\"cpu_permille\":%u}",
+                     st.uptime_ms, resets, st.sysclk_hz, st.baudrate,
+                     (st.flags & UART_STATUS_BINARY) ? "binary" : "ascii",
+                     (st.kernel_version >> 16) & 0xFF, (st.kernel_version >> 8) & 0xFF,
+                     st.kernel_version & 0xFF, st.cpu_permille);
+        break;
+    case STATUS_ERRORS:
+        n = snprintf(out, size,
+                     "{\"rx_bytes\":%u,\"rx_dropped\":%u,\"rx_overruns\":%u,\"rx_errors\":%u,"
+                     "\"crc_errors\":%u,\"commands\":%u,\"gpio\":%u,\"i2c\":%u,\"adc\":%u,"
+                     "\"pwm\":%u}",
+                     st.rx_bytes, st.rx_dropped, st.rx_overruns, st.rx_errors, st.crc_errors,
+                     st.commands, st.gpio_errors, st.i2c_errors, st.adc_errors, st.pwm_errors);
+        break;
+    case STATUS_MEMORY:
+        n = snprintf(out, size,
+                     "{\"heap_size\":%u,\"heap_used\":%u,\"heap_max_used\":%u}",
+                     st.heap_size, st.heap_used, st.heap_max_used);
+        break;
+    case STATUS_THREADS:
+        n = snprintf(out, size,
+                     "{\"cpu_permille\":%u,\"bridge\":{\"cpu_permille\":%u,\"stack_size\":%u,"
+                     "\"stack_used\":%u},\"bulk\":{\"cpu_permille\":%u,\"stack_size\":%u,"
+                     "\"stack_used\":%u}}",
+                     st.cpu_permille,
+                     st.threads[UART_STATUS_THREAD_BRIDGE].cpu_permille,
+                     st.threads[UART_STATUS_THREAD_BRIDGE].stack_size,
+                     st.threads[UART_STATUS_THREAD_BRIDGE].stack_used,
+                     st.threads[UART_STATUS_THREAD_BULK].cpu_permille,
+                     st.threads[UART_STATUS_THREAD_BULK].stack_size,
+                     st.threads[UART_STATUS_THREAD_BULK].stack_used);
+        break;
+    case STATUS_POOLS:
+        n = snprintf(out, size,
+                     "{\"job\":{\"blocks\":%u,\"max_used\":%u,\"exhausted\":%u},"
+                     "\"tx\":{\"blocks\":%u,\"max_used\":%u,\"exhausted\":%u},"
+                     "\"adc\":{\"blocks\":%u,\"max_used\":%u,\"exhausted\":%u}}",
+                     st.pools[UART_STATUS_POOL_JOB].blocks,
+                     st.pools[UART_STATUS_POOL_JOB].max_used,
+                     st.pools[UART_STATUS_POOL_JOB].exhausted,
+                     st.pools[UART_STATUS_POOL_TX].blocks,
+                     st.pools[UART_STATUS_POOL_TX].max_used,
+                     st.pools[UART_STATUS_POOL_TX].exhausted,
+                     st.pools[UART_STATUS_POOL_ADC].blocks,
+                     st.pools[UART_STATUS_POOL_ADC].max_used,
+                     st.pools[UART_STATUS_POOL_ADC].exhausted);
+        break;
+    default:
+        return -1;
+    }
+    return (n < 0 || (size_t)n >= size) ? -1 : n;
+}
 
-        if (ret == 0) {
-            continue;
-        }
+/**
+ * @brief Send a response to a client under the client's own request ID
+ * @param view STATUS_* part to render if the response is a STATUS snapshot
+ */
+static void reply_to_client(client_t *client, uint16_t client_id, uint8_t view,
+                            const uart_message_t *resp) {
+    char reply[MAX_MESSAGE_LENGTH + 8];
+    char json[MAX_MESSAGE_LENGTH];
+    uart_message_t rendered;
+    int len;
 
-        if (FD_ISSET(uart_fd, &read_fds)) {
-            process_uart_data();
+    /* RESP_STATUS reads back as the request's name */
+    if (resp->opcode == OP_STATUS &&
+        (len = render_status(&resp->params, view, json, sizeof(json))) > 0) {
+        rendered = *resp;
+        rendered.params.ptr = json;
+        rendered.params.len = len;
+        resp = &rendered;
+    }
+
+    len = format_frame(reply, sizeof(reply) - 1, &resp->name, client_id, false, &resp->params);
+    if (len < 0) {
+        return;
+    }
+    reply[len++] = MESSAGE_DELIMITER;
+    send_to_client(client, reply, len);
+}
+
+static cache_rule_t *cache_rule(uint8_t opcode) {
+    for (size_t i = 0; i < sizeof(cache_rules) / sizeof(cache_rules[0]); i++) {
+        if (cache_rules[i].opcode == opcode) {
+            return &cache_rules[i];
         }
+    }
+    return NULL;
+}
 
-        if (FD_ISSET(socket_fd, &read_fds)) {
-            client_fd = accept(socket_fd, NULL, NULL);
-            if (client_fd < 0) {
-                syslog(LOG_ERR, "Failed to accept client: %s", strerror(errno));
+/**
+ * @brief Fill in the key fields of a cache entry; port letters count in
+ *        either case, as on the STM32
+ * @return false if the arguments do not make a key
+ */
+static bool cache_make_key(cache_entry_t *key, uint8_t opcode, const uint32_t *args,
+                           int nargs) {
+    if (nargs < 0 || nargs > CACHE_MAX_ARGS) {
+        return false;
+    }
+    memset(key->args, 0, sizeof(key->args));
+    memcpy(key->args, args, nargs * sizeof(args[0]));
+    if ((opcode == OP_GPIO_GET) && nargs > 0 && key->args[0] >= 'a' && key->args[0] <= 'z') {
+        key->args[0] -= 'a' - 'A';
+    }
+    key->opcode = opcode;
+    key->nargs = nargs;
+    return true;
+}
+
+/**
+ * @brief Release a cache slot; a request still fetching it no longer fills it
+ */
+static void cache_drop(cache_entry_t *c) {
+    if (c->pending >= 0) {
+        inflight[c->pending].cache = -1;
+    }
+    c->opcode = OP_NONE;
+    c->pending = -1;
+    c->expires_ms = 0;
+}
+
+/**
+ * @brief Look up a key among its CACHE_PROBES slots
+ *
+ * With create, a missing key takes a free slot, else the one whose
+ * response expired first, preferring slots no request is fetching.
+ */
+static cache_entry_t *cache_find(const cache_entry_t *key, bool create) {
+    uint32_t h = 2166136261u ^ key->opcode;
+    cache_entry_t *victim = NULL;
+
+    for (int i = 0; i < key->nargs; i++) {
+        h = (h ^ key->args[i]) * 16777619u;
+    }
+
+    for (int p = 0; p < CACHE_PROBES; p++) {
+        cache_entry_t *c = &cache[(h + p) & (CACHE_ENTRIES - 1)];
+
+        if (c->opcode == key->opcode && c->nargs == key->nargs &&
+            memcmp(c->args, key->args, sizeof(c->args)) == 0) {
+            return c;
+        }
+        if (victim == NULL || (victim->opcode != OP_NONE &&
+            (c->opcode == OP_NONE || (c->pending < 0 &&
+             (victim->pending >= 0 || c->expires_ms < victim->expires_ms))))) {
+            victim = c;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    if (victim->opcode != OP_NONE) {
+        cache_drop(victim);
+    }
+    victim->opcode = key->opcode;
+    victim->nargs = key->nargs;
+    memcpy(victim->args, key->args, sizeof(victim->args));
+    victim->pending = -1;
+    victim->expires_ms = 0;
+    return victim;
+}
+
+/**
+ * @brief Forget the answer to one read, e.g. after a write to the same pin
+ */
+static void cache_invalidate(uint8_t opcode, const uint32_t *args, int nargs) {
+    cache_entry_t key;
+    cache_entry_t *c;
+
+    if (cache_make_key(&key, opcode, args, nargs) && (c = cache_find(&key, false)) != NULL) {
+        cache_drop(c);
+    }
+}
+
+static void cache_flush(void) {
+    for (int i = 0; i < CACHE_ENTRIES; i++) {
+        if (cache[i].opcode != OP_NONE) {
+            cache_drop(&cache[i]);
+        }
+    }
+}
+
+/**
+ * @brief Keep a successful answer to a cached read for its TTL
+ */
+static void cache_store(cache_entry_t *c, const uart_message_t *resp) {
+    const cache_rule_t *rule = cache_rule(c->opcode);
+    int len;
+
+    c->pending = -1;
+    if (rule == NULL || rule->ttl_ms == 0 || resp->opcode == OP_ERROR) {
+        cache_drop(c);
+        return;
+    }
+    len = format_frame(c->response, sizeof(c->response), &resp->name, REQUEST_ID_NONE, false,
+                       &resp->params);
+    if (len < 0) {
+        cache_drop(c);
+        return;
+    }
+    c->len = len;
+    c->expires_ms = now_ms() + rule->ttl_ms;
+}
+
+/**
+ * @brief Forget all TELEMETRY values (link reset, RESET)
+ */
+static void tlm_reset(void) {
+    tlm.valid = 0;
+    tlm.seen = false;
+    tlm.fresh_until_ms = 0;
+}
+
+/**
+ * @brief Ports a request may change, whose TELEMETRY levels must not be
+ *        trusted until it is answered (bit per port)
+ */
+static uint8_t tlm_ports_for(const uart_message_t *msg) {
+    uint32_t args[MAX_FRAME_ARGS];
+    uint32_t port;
+
+    switch (msg->opcode) {
+    case OP_GPIO_SET:
+    case OP_GPIO_WATCH:
+        if (uart_message_args(msg, args, MAX_FRAME_ARGS) < 1) {
+            return 0;
+        }
+        port = args[0] >= 'a' ? args[0] - ('a' - 'A') : args[0];
+        return port >= 'A' && port - 'A' < TELEMETRY_PORTS_MAX ? 1u << (port - 'A') : 0;
+    case OP_BATCH:                      /* Sub-commands are not looked at */
+    case OP_RESET:
+        return 0xFF;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Hold or release the TELEMETRY levels of ports a request may change
+ *
+ * The STM32 sends a sample's port levels in its first TLM message, before
+ * it answers a command it runs after sampling, so values arriving once the
+ * write is answered reflect it. Until the next TLM for the port, reads go
+ * to the STM32.
+ */
+static void tlm_hold(uint8_t ports, bool hold) {
+    for (int i = 0; i < TELEMETRY_PORTS_MAX; i++) {
+        if (!(ports & (1u << i))) {
+            continue;
+        }
+        if (hold) {
+            tlm.writes[i]++;
+        } else if (tlm.writes[i] > 0) {
+            tlm.writes[i]--;
+        }
+        tlm.valid &= ~(1ull << (UART_TLM_GPIO + i));
+    }
+}
+
+/**
+ * @brief Take in a TLM message: TLM:seq,flags,max_gap_ms,<pairs as hex>
+ */
+static void tlm_receive(const uart_message_t *resp) {
+    uart_message_t head = *resp;
+    uint8_t pairs[TLM_MAX_PAIRS_LENGTH];
+    uint32_t args[3];
+    size_t off = 0;
+    int len;
+
+    head.nparams = resp->nparams < 3 ? resp->nparams : 3;
+    if (resp->nparams != 4 || uart_message_args(&head, args, 3) != 3) {
+        stats.rx_malformed++;
+        return;
+    }
+    len = uart_hex_decode(resp->param[3].ptr, resp->param[3].len, pairs, sizeof(pairs));
+    if (len < 0) {
+        stats.rx_malformed++;
+        return;
+    }
+
+    tlm.messages++;
+    /* A lost message may have carried changes: nothing is known until a keyframe */
+    if (tlm.seen && args[0] != tlm.next_seq) {
+        tlm.gaps++;
+        tlm.valid = 0;
+    }
+    tlm.seen = true;
+    tlm.next_seq = args[0] + 1;
+    tlm.fresh_until_ms = now_ms() + args[2] + TLM_GRACE_MS;
+
+    while (off < (size_t)len) {
+        uint8_t field;
+        uint32_t value;
+
+        if (uart_tlm_next(pairs, len, &off, &field, &value) < 0) {
+            stats.rx_malformed++;
+            return;
+        }
+        tlm.value[field] = value;
+        if (field < UART_TLM_GPIO + TELEMETRY_PORTS_MAX && tlm.writes[field - UART_TLM_GPIO] > 0) {
+            continue;
+        }
+        tlm.valid |= 1ull << field;
+    }
+}
+
+/**
+ * @brief Answer GPIO_GET or ADC_READ from fresh TELEMETRY values
+ * @return true if the request was answered
+ */
+static bool tlm_serve(client_t *client, const uart_message_t *msg) {
+    uint32_t args[MAX_FRAME_ARGS];
+    char reply[32];
+    char value[12];
+    uint32_t result;
+    uint8_t field;
+    int len;
+
+    if (tlm.valid == 0 || now_ms() >= tlm.fresh_until_ms) {
+        return false;
+    }
+    if (msg->opcode == OP_GPIO_GET && uart_message_args(msg, args, MAX_FRAME_ARGS) == 2) {
+        uint32_t port = args[0] >= 'a' ? args[0] - ('a' - 'A') : args[0];
+
+        if (port < 'A' || port - 'A' >= TELEMETRY_PORTS_MAX || args[1] > 15) {
+            return false;
+        }
+        field = UART_TLM_GPIO + (port - 'A');
+        result = (tlm.value[field] >> args[1]) & 1;
+    } else if (msg->opcode == OP_ADC_READ && uart_message_args(msg, args, MAX_FRAME_ARGS) == 1) {
+        if (args[0] >= UART_TLM_FIELDS - UART_TLM_ADC) {
+            return false;
+        }
+        field = UART_TLM_ADC + args[0];
+        result = tlm.value[field];
+    } else {
+        return false;
+    }
+    if (!(tlm.valid & (1ull << field))) {
+        return false;
+    }
+
+    snprintf(value, sizeof(value), "%u", result);
+    len = build_message(RESP_OK, msg->id, value, reply, sizeof(reply));
+    if (len > 0) {
+        send_to_client(client, reply, len);
+    }
+    command_stats_for(msg->opcode)->telemetry_hits++;
+    return true;
+}
+
+/**
+ * @brief Deliver a response to the client of an in-flight entry and retire it
+ *
+ * Entries that were merged into this one get the same response.
+ */
+static void complete_inflight(int16_t idx, const uart_message_t *resp) {
+    inflight_t *e = &inflight[idx];
+    client_t *client;
+
+    inflight_unlink(idx);
+
+    if (e->tlm_ports != 0) {
+        tlm_hold(e->tlm_ports, false);
+    }
+    if (e->cache >= 0) {
+        cache_store(&cache[e->cache], resp);
+    }
+    for (int16_t i = 0; e->followers > 0 && i < MAX_INFLIGHT; i++) {
+        if (inflight[i].wire_id != 0 && inflight[i].lane == LANE_FOLLOWER &&
+            inflight[i].leader == idx) {
+            complete_inflight(i, resp);
+        }
+    }
+
+    if (e->slot == INTERNAL_SLOT) {
+        handle_internal_response(e->opcode, resp);
+        return;
+    }
+    client = &clients[e->slot];
+
+    /* Client disconnected (and maybe slot reused) while waiting */
+    if (client->fd < 0 || client->generation != e->generation) {
+        return;
+    }
+
+    client->waiting--;
+    reply_to_client(client, e->client_id, e->view, resp);
+}
+
+/**
+ * @brief Answer an in-flight entry with ERROR:error and retire it
+ */
+static void fail_inflight(int16_t idx, const char *error) {
+    char line[64];
+    uart_message_t resp;
+    int len = snprintf(line, sizeof(line), "%s%c%s", RESP_ERROR, FIELD_SEPARATOR, error);
+
+    if (parse_message(line, len, &resp)) {
+        complete_inflight(idx, &resp);
+    }
+}
+
+/**
+ * @brief Move queued commands into the UART queue, high priority first
+ *
+ * Only about UART_TX_WINDOW_MS of line time is handed on at a time,
+ * counting what the driver still holds, so a high-priority command never
+ * waits behind more than that. Commands are encoded here, in the framing
+ * the link uses by now.
+ *
+ * @return Milliseconds until the window has room again, -1 if nothing waits
+ */
+static int pump_lanes(void) {
+    size_t window = baudrate / 10 * UART_TX_WINDOW_MS / 1000;
+    uint64_t now = now_ms();
+    size_t queued;
+    int outq = 0;
+
+    if (lane_count == 0 || link_state != LINK_READY) {
+        return -1;
+    }
+
+    if (window < UART_TX_WINDOW_MIN) {
+        window = UART_TX_WINDOW_MIN;
+    }
+    if (ioctl(uart_fd, TIOCOUTQ, &outq) < 0) {
+        outq = 0;
+    }
+    queued = uart_tx_len + outq;
+
+    while (lane_count > 0 && queued < window) {
+        int16_t idx = lanes[UART_PRIO_HIGH].head >= 0 ? lanes[UART_PRIO_HIGH].head :
+                      lanes[UART_PRIO_NORMAL].head;
+        inflight_t *e = &inflight[idx];
+        size_t before = uart_tx_len;
+        uart_message_t msg;
+
+        lane_remove(idx);
+        if (e->deadline_ms <= now) {
+            stats.expired++;
+            fail_inflight(idx, ERR_TIMEOUT);
+            continue;
+        }
+
+        parse_message(e->line, e->len, &msg);
+        switch (send_to_stm32(&msg, e->wire_id)) {
+            case 0:
+                break;
+            case -2:
+                fail_inflight(idx, ERR_INVALID_CMD);
+                continue;
+            default:
+                fail_inflight(idx, ERR_TIMEOUT);
+                continue;
+        }
+        e->sent_us = now_us();
+        command_stats_for(e->opcode)->sent++;
+        queued += uart_tx_len - before;
+    }
+
+    if (lane_count == 0) {
+        return -1;
+    }
+    /* Look again once about half the window has gone out */
+    return (int)((queued - window / 2) * 10 * 1000 / baudrate) + 1;
+}
+
+/**
+ * @brief Answer ERROR:TIMEOUT for commands the STM32 never responded to
+ * @return Milliseconds until the next deadline, -1 if nothing is in flight
+ */
+static int expire_inflight(void) {
+    static const char timeout[] = RESP_ERROR ":" ERR_TIMEOUT;
+    uint64_t now = now_ms();
+    uart_message_t resp;
+
+    if (inflight_head >= 0) {
+        parse_message(timeout, sizeof(timeout) - 1, &resp);
+    }
+
+    while (inflight_head >= 0) {
+        inflight_t *e = &inflight[inflight_head];
+
+        if (e->deadline_ms > now) {
+            return (int)(e->deadline_ms - now);
+        }
+        /* Never sent (still in its lane, or merged): says nothing about the link */
+        if (e->lane != LANE_SENT) {
+            stats.expired++;
+            complete_inflight(inflight_head, &resp);
+            continue;
+        }
+        syslog(LOG_WARNING, "Request %u timed out", e->wire_id);
+        command_stats_for(e->opcode)->timeouts++;
+
+        /* A rebooted STM32 is back on ASCII at the default rate */
+        if ((binary_mode || baudrate != UART_BAUDRATE) && e->slot != INTERNAL_SLOT &&
+            ++consecutive_timeouts >= LINK_RESET_TIMEOUTS) {
+            syslog(LOG_WARNING, "STM32 stopped answering, renegotiating the link");
+            binary_mode = false;
+            consecutive_timeouts = 0;
+            discard_uart_tx();
+            set_uart_baudrate(UART_BAUDRATE);
+            complete_inflight(inflight_head, &resp);
+            start_link_setup();
+            continue;
+        }
+
+        complete_inflight(inflight_head, &resp);
+    }
+    return -1;
+}
+
+/**
+ * @brief Drop one queue's reference to a shared message
+ */
+static void pub_release(uint16_t slot) {
+    if (--pub_slab[slot].refs == 0) {
+        pub_free[pub_free_count++] = slot;
+    }
+}
+
+/**
+ * @brief Remove the oldest message from a client's queue
+ */
+static void pub_pop(client_t *client) {
+    pub_release(client->pub_queue[client->pub_head]);
+    client->pub_head = (client->pub_head + 1) % CLIENT_PUB_QUEUE;
+    client->pub_count--;
+    client->pub_off = 0;
+}
+
+/**
+ * @brief Account for n bytes sent of the oldest queued message
+ * @return Bytes left over for what follows it
+ */
+static size_t pub_advance(client_t *client, size_t n) {
+    size_t left = pub_slab[client->pub_queue[client->pub_head]].len - client->pub_off;
+
+    if (n < left) {
+        client->pub_off += n;
+        return 0;
+    }
+    pub_pop(client);
+    return n - left;
+}
+
+/**
+ * @brief Check a message line against a client's SUBSCRIBE filters
+ *
+ * A filter matches every message that starts with it, so "EVT:GPIO,C,13,"
+ * picks one pin and "ADC" everything from the ADC.
+ */
+static bool client_subscribed(const client_t *client, const char *line, size_t len) {
+    for (int i = 0; i < client->ntopics; i++) {
+        size_t n = strlen(client->topics[i]);
+
+        if (n <= len && memcmp(client->topics[i], line, n) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Copy into the ring data area, wrapping at the end */
+static void ring_write(client_t *client, uint32_t pos, const void *data, size_t len) {
+    uint32_t off = pos & (client->ring_size - 1);
+    size_t first = client->ring_size - off < len ? client->ring_size - off : len;
+
+    memcpy(client->ring->data + off, data, first);
+    memcpy(client->ring->data, (const uint8_t *)data + first, len - first);
+}
+
+/**
+ * @brief Wake a ring client that is waiting for messages
+ */
+static void ring_doorbell(client_t *client) {
+    client->ring_kick = false;
+
+    /* Pairs with the client setting sleeping, then reading head */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&client->ring->sleeping, 0, __ATOMIC_SEQ_CST)) {
+        uint64_t one = 1;
+        (void)!write(client->ring_efd, &one, sizeof(one));
+    }
+}
+
+/**
+ * @brief Append a message to a client's shared memory ring
+ *
+ * The tail comes from the client and is only trusted as far as it keeps
+ * the ring consistent; otherwise the ring counts as full.
+ */
+static void ring_put(client_t *client, const char *line, size_t len) {
+    uint16_t record_len = (uint16_t)len;
+    uint32_t head = client->ring_head;
+    uint32_t used = head - __atomic_load_n(&client->ring->tail, __ATOMIC_ACQUIRE);
+
+    if (used > client->ring_size || client->ring_size - used < sizeof(record_len) + len) {
+        __atomic_fetch_add(&client->ring->dropped, 1, __ATOMIC_RELAXED);
+        client->pub_dropped++;
+        unsolicited_dropped++;
+        return;
+    }
+
+    ring_write(client, head, &record_len, sizeof(record_len));
+    ring_write(client, head + sizeof(record_len), line, len);
+    client->ring_head = head + sizeof(record_len) + len;
+    __atomic_store_n(&client->ring->head, client->ring_head, __ATOMIC_RELEASE);
+
+    /* One wakeup per UART read, unless the ring is filling up meanwhile */
+    client->ring_kick = true;
+    if (used + sizeof(record_len) + len >= client->ring_size / 2) {
+        ring_doorbell(client);
+    }
+}
+
+/**
+ * @brief Queue an unsolicited message for every client subscribed to it
+ *
+ * The line is stored once; subscribers only take a reference. Nothing is
+ * written here unless a queue is full: flush_subscribers() sends whatever
+ * one UART read produced in one go.
+ */
+static void publish(const char *line, size_t len) {
+    uint16_t slot = 0;
+    pub_buf_t *buf = NULL;
+
+    if (len >= MAX_MESSAGE_LENGTH) {
+        return;
+    }
+    stats.unsolicited++;
+
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        client_t *client = &clients[i];
+
+        if (client->fd < 0 || !client_subscribed(client, line, len)) {
+            continue;
+        }
+        if (client->ring != NULL) {
+            ring_put(client, line, len);
+            continue;
+        }
+        if (client->pub_count == CLIENT_PUB_QUEUE) {
+            flush_client(client);
+            if (client->fd < 0) {
+                continue;
+            }
+        }
+        /* Skip rather than drop a subscriber that is behind */
+        if (client->pub_count == CLIENT_PUB_QUEUE || (buf == NULL && pub_free_count == 0)) {
+            client->pub_dropped++;
+            unsolicited_dropped++;
+            continue;
+        }
+        if (buf == NULL) {
+            slot = pub_free[--pub_free_count];
+            buf = &pub_slab[slot];
+            memcpy(buf->data, line, len);
+            buf->data[len] = MESSAGE_DELIMITER;
+            buf->len = len + 1;
+            buf->refs = 1;              /* Ours, until every queue has it */
+        }
+        client->pub_queue[(client->pub_head + client->pub_count) % CLIENT_PUB_QUEUE] = slot;
+        client->pub_count++;
+        buf->refs++;
+    }
+
+    if (buf != NULL) {
+        pub_release(slot);
+    }
+}
+
+/**
+ * @brief Send the unsolicited messages queued by publish(), ring doorbells
+ */
+static void flush_subscribers(void) {
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        client_t *client = &clients[i];
+
+        if (client->fd >= 0 && client->pub_count > 0) {
+            flush_client(client);
+        }
+        if (client->fd >= 0 && client->ring_kick) {
+            ring_doorbell(client);
+        }
+    }
+}
+
+/**
+ * @brief Forget the level of a pin that just changed ("EVT:GPIO,C,13,...")
+ */
+static void cache_invalidate_event(const uart_message_t *evt) {
+    uart_message_t pin = { .nparams = 2 };
+    uint32_t args[2];
+
+    if (evt->nparams < 3 || evt->param[0].len != sizeof(EVT_GPIO) - 1 ||
+        memcmp(evt->param[0].ptr, EVT_GPIO, sizeof(EVT_GPIO) - 1) != 0) {
+        return;
+    }
+    /* Port and pin as GPIO_GET takes them, so the cache key matches */
+    pin.param[0] = evt->param[1];
+    pin.param[1] = evt->param[2];
+    if (uart_message_args(&pin, args, 2) != 2) {
+        return;
+    }
+    cache_invalidate(OP_GPIO_GET, args, 2);
+}
+
+/**
+ * @brief Route one line from the STM32 to the client that asked for it
+ *
+ * Tagged responses are matched by request ID. An untagged response (older
+ * firmware) is taken to answer the oldest outstanding command, unless it
+ * is an unsolicited message, which goes to the subscribers.
+ */
+static void route_response(const char *line, size_t len) {
+    uart_message_t resp;
+    int16_t idx;
+
+    if (!parse_message(line, len, &resp)) {
+        syslog(LOG_WARNING, "Malformed response from STM32: %.*s", (int)len, line);
+        stats.rx_malformed++;
+        return;
+    }
+
+    if (resp.opcode >= OP_FIRST_UNSOLICITED) {
+        if (resp.opcode == OP_EVT) {
+            cache_invalidate_event(&resp);
+        } else if (resp.opcode == OP_TLM) {
+            tlm_receive(&resp);
+        }
+        publish(line, len);
+        return;
+    }
+
+    idx = (resp.id != REQUEST_ID_NONE) ? inflight_find(resp.id) : inflight_oldest_sent();
+    if (idx < 0) {
+        log_message("Unsolicited message from STM32: %.*s", (int)len, line);
+        stats.rx_unmatched++;
+        return;
+    }
+
+    consecutive_timeouts = 0;
+    hist_record(&command_stats_for(inflight[idx].opcode)->rtt,
+                now_us() - inflight[idx].sent_us);
+    complete_inflight(idx, &resp);
+}
+
+/**
+ * @brief Render a binary frame from the STM32 as an ASCII response line
+ * @return Line length, or -1 if the frame cannot be rendered
+ */
+static int frame_to_line(const uart_frame_t *frame, char *line, size_t size) {
+    const char *name = uart_opcode_name(frame->opcode);
+    uint32_t args[MAX_FRAME_ARGS];
+    int nargs;
+    int len;
+
+    if (name == NULL) {
+        return -1;
+    }
+    len = build_message(name, frame->id, NULL, line, size);
+    if (len < 0) {
+        return -1;
+    }
+    len--;      /* Drop the delimiter, parameters follow */
+
+    /* STATUS:hex, as in ASCII; firmware before 1.3 sends JSON text */
+    if (frame->opcode == OP_STATUS_DATA) {
+        if (frame->payload_len > 0 && frame->payload[0] == '{') {
+            int n = snprintf(line + len, size - len, "%c%.*s", FIELD_SEPARATOR,
+                             (int)frame->payload_len, (const char *)frame->payload);
+            return (n < 0 || (size_t)n >= size - len) ? -1 : len + n;
+        }
+        if (len + 1 + 2 * frame->payload_len >= size) {
+            return -1;
+        }
+        line[len++] = FIELD_SEPARATOR;
+        return len + (int)uart_hex_encode(frame->payload, frame->payload_len, line + len);
+    }
+
+    /* ADC_DATA:channel,seq,hex and TLM:seq,flags,max_gap_ms,hex */
+    if (frame->opcode == OP_ADC_DATA || frame->opcode == OP_TLM) {
+        size_t count = frame->opcode == OP_TLM ? 3 : 2;
+        const uint8_t *data;
+        size_t data_len;
+
+        if (uart_frame_data(frame, args, count, &data, &data_len) < 0) {
+            return -1;
+        }
+        for (size_t i = 0; i < count; i++) {
+            int n = snprintf(line + len, size - len, "%c%u",
+                             i == 0 ? FIELD_SEPARATOR : PARAM_SEPARATOR, args[i]);
+
+            if (n < 0 || (size_t)n >= size - len) {
+                return -1;
+            }
+            len += n;
+        }
+        if ((size_t)len + 1 + 2 * data_len >= size) {
+            return -1;
+        }
+        line[len++] = PARAM_SEPARATOR;
+        return len + (int)uart_hex_encode(data, data_len, line + len);
+    }
+
+    nargs = uart_frame_args(frame, args, MAX_FRAME_ARGS);
+    if (nargs < 0) {
+        return -1;
+    }
+
+    /* EVT:type,... with the type by name */
+    if (frame->opcode == OP_EVT) {
+        int n;
+
+        if (size - len < 2) {
+            return -1;
+        }
+        line[len] = FIELD_SEPARATOR;
+        n = uart_event_format(args, nargs, line + len + 1, size - len - 1);
+        return n < 0 ? -1 : len + 1 + n;
+    }
+
+    /* ERROR:name[,detail...] (a failed BATCH adds the sub-command index) */
+    if (frame->opcode == OP_ERROR) {
+        int n = snprintf(line + len, size - len, "%c%s", FIELD_SEPARATOR,
+                         uart_error_name(nargs > 0 ? args[0] : UART_ERR_NONE));
+        if (n < 0 || (size_t)n >= size - len) {
+            return -1;
+        }
+        len += n;
+    }
+
+    for (int i = frame->opcode == OP_ERROR ? 1 : 0; i < nargs; i++) {
+        int n = snprintf(line + len, size - len, "%c%u",
+                         i == 0 ? FIELD_SEPARATOR : PARAM_SEPARATOR, args[i]);
+        if (n < 0 || (size_t)n >= size - len) {
+            return -1;
+        }
+        len += n;
+    }
+    return len;
+}
+
+/**
+ * @brief Handle a complete binary frame (without delimiter) from the STM32
+ */
+static void process_uart_frame(uint8_t *data, size_t len) {
+    char line[MAX_MESSAGE_LENGTH];
+    uart_frame_t frame;
+    int line_len;
+
+    if (!uart_frame_decode(data, len, &frame)) {
+        syslog(LOG_WARNING, "Dropping corrupt frame from STM32 (%zu bytes)", len);
+        stats.rx_corrupt++;
+        return;
+    }
+    stats.uart_rx_frames++;
+
+    line_len = frame_to_line(&frame, line, sizeof(line));
+    if (line_len < 0) {
+        syslog(LOG_WARNING, "Unknown frame 0x%02x from STM32", frame.opcode);
+        stats.rx_malformed++;
+        return;
+    }
+    route_response(line, line_len);
+}
+
+/**
+ * @brief Send a command the daemon issues itself during link setup
+ * @return 0 on success, -1 if it could not be sent
+ */
+static int send_internal(const char *command, size_t len, unsigned int timeout_ms) {
+    const char delimiter = binary_mode ? FRAME_DELIMITER : MESSAGE_DELIMITER;
+    uart_message_t msg;
+    int16_t idx;
+
+    if (!parse_message(command, len, &msg)) {
+        return -1;
+    }
+
+    idx = inflight_alloc(now_ms() + timeout_ms);
+    if (idx < 0) {
+        return -1;
+    }
+
+    /* Leading delimiter flushes any partial frame left in the STM32 buffer */
+    if (write_uart(&delimiter, 1) < 0 || send_to_stm32(&msg, inflight[idx].wire_id) < 0) {
+        inflight_unlink(idx);
+        return -1;
+    }
+
+    inflight[idx].client_id = REQUEST_ID_NONE;
+    inflight[idx].slot = INTERNAL_SLOT;
+    inflight[idx].generation = 0;
+    inflight[idx].opcode = msg.opcode;
+    inflight[idx].sent_us = now_us();
+    command_stats_for(msg.opcode)->sent++;
+    return 0;
+}
+
+/**
+ * @brief Forget what THREADS reported (link reset, RESET): run times restart
+ */
+static void stm32_threads_reset(void) {
+    memset(stm32_threads.thread, 0, sizeof(stm32_threads.thread));
+    stm32_threads.count = 0;
+    stm32_threads.heap_size = 0;
+}
+
+/**
+ * @brief Ask the STM32 for its thread summary, or the next thread
+ */
+static void stm32_threads_query(void) {
+    char command[24];
+    int len = stm32_threads.next == UINT32_MAX ?
+              snprintf(command, sizeof(command), "%s", CMD_THREADS) :
+              snprintf(command, sizeof(command), "%s%c%u", CMD_THREADS, FIELD_SEPARATOR,
+                       stm32_threads.next);
+
+    stm32_threads.polling = send_internal(command, len, INFLIGHT_TIMEOUT_MS) == 0;
+}
+
+/**
+ * @brief Start a THREADS poll unless one is running or the link is being set up
+ */
+static void stm32_threads_poll(void) {
+    if (stm32_threads.polling || link_state != LINK_READY) {
+        return;
+    }
+    stm32_threads.next = UINT32_MAX;
+    stm32_threads_query();
+}
+
+/**
+ * @brief Take in one THREADS answer and ask for the next thread
+ *
+ * A thread's CPU share is the change of its run time over the change of
+ * the STM32's total between two polls, both in microseconds modulo 2^32.
+ */
+static void stm32_threads_receive(const uart_message_t *resp) {
+    uint32_t args[MAX_FRAME_ARGS];
+    int nargs = resp->opcode == OP_OK ? uart_message_args(resp, args, MAX_FRAME_ARGS) : -1;
+    stm32_thread_t *t;
+    char name[UART_THREAD_NAME_MAX + 1];
+    size_t n = 0;
+
+    stm32_threads.polling = false;
+
+    /* Firmware before protocol 1.6 answers INVALID_COMMAND */
+    if (stm32_threads.next == UINT32_MAX) {
+        if (nargs != 5) {
+            return;
+        }
+        stm32_threads.count = args[0];
+        stm32_threads.time_us = args[1];
+        stm32_threads.heap_size = args[2];
+        stm32_threads.heap_free = args[3];
+        stm32_threads.heap_max_used = args[4];
+        stm32_threads.next = 0;
+    } else {
+        if (nargs < UART_THREAD_VALUES) {
+            return;
+        }
+        /* Names become metric labels: printable, nothing to escape */
+        for (int i = UART_THREAD_VALUES; i < nargs && n < UART_THREAD_NAME_MAX; i++) {
+            name[n++] = args[i] > ' ' && args[i] < 0x7f && args[i] != '"' && args[i] != '\\' ?
+                        (char)args[i] : '_';
+        }
+        name[n] = '\0';
+
+        t = &stm32_threads.thread[stm32_threads.next];
+        if (t->name[0] == '\0' || strcmp(t->name, name) != 0) {
+            /* Threads came or went: no earlier sample of this one */
+            t->cpu_permille = -1;
+        } else if (stm32_threads.time_us != t->time_us) {
+            uint64_t permille = (uint64_t)(args[2] - t->runtime_us) * 1000 /
+                                (stm32_threads.time_us - t->time_us);
+
+            t->cpu_permille = permille > 1000 ? 1000 : (int32_t)permille;
+        }
+        snprintf(t->name, sizeof(t->name), "%s", n > 0 ? name : "?");
+        t->stack_size = args[0];
+        t->stack_used = args[1];
+        t->runtime_us = args[2];
+        t->time_us = stm32_threads.time_us;
+        stm32_threads.next++;
+    }
+
+    if (stm32_threads.next < stm32_threads.count && stm32_threads.next < STM32_THREADS_MAX) {
+        stm32_threads_query();
+    }
+}
+
+/**
+ * @brief Propose target_baudrate to the STM32 if the link is not there yet
+ */
+static void start_baud_change(void) {
+    char command[32];
+    int len;
+
+    if (target_baudrate == baudrate) {
+        return;
+    }
+
+    len = snprintf(command, sizeof(command), "%s%c%u", CMD_SET_BAUD, FIELD_SEPARATOR,
+                   target_baudrate);
+    if (send_internal(command, len, INFLIGHT_TIMEOUT_MS) == 0) {
+        link_state = LINK_BAUD;
+    }
+}
+
+/**
+ * @brief Handle the answer to a request the daemon issued itself
+ */
+static void handle_internal_response(uint8_t opcode, const uart_message_t *resp) {
+    link_state_t step = link_state;
+
+    if (opcode == OP_THREADS) {
+        stm32_threads_receive(resp);
+        return;
+    }
+
+    link_state = LINK_READY;
+
+    switch (step) {
+        case LINK_PROTO:
+            if (resp->opcode == OP_OK) {
+                binary_mode = true;
+                syslog(LOG_INFO, "Binary framing negotiated with STM32");
+            } else {
+                syslog(LOG_INFO, "STM32 declined binary framing, staying on ASCII");
+            }
+            start_baud_change();
+            break;
+
+        case LINK_BAUD:
+            if (resp->opcode != OP_OK) {
+                syslog(LOG_INFO, "STM32 declined %u baud, staying at %u", target_baudrate,
+                       baudrate);
+                break;
+            }
+            /* The STM32 switches once its OK is out; follow, then verify */
+            previous_baudrate = baudrate;
+            if (set_uart_baudrate(target_baudrate) < 0) {
+                break;
+            }
+            usleep(BAUD_SETTLE_US);
+            if (send_internal(CMD_PING, strlen(CMD_PING), BAUD_VERIFY_TIMEOUT_MS) == 0) {
+                link_state = LINK_BAUD_VERIFY;
+            }
+            break;
+
+        case LINK_BAUD_VERIFY:
+            if (resp->opcode == OP_PONG) {
+                syslog(LOG_INFO, "UART link running at %u baud", baudrate);
+                break;
+            }
+            /* The STM32 reverts on its own when no valid command arrives */
+            syslog(LOG_WARNING, "No PONG at %u baud, back to %u", baudrate, previous_baudrate);
+            set_uart_baudrate(previous_baudrate);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief (Re)start link setup: binary framing first, then the line rate
+ *
+ * Client commands are answered with ERROR:BUSY until the STM32 replies, so
+ * no command can reach it in a framing or at a rate it has left.
+ */
+static void start_link_setup(void) {
+    char command[16];
+    int len;
+
+    if (link_state != LINK_READY) {
+        return;
+    }
+
+    /* Whatever was read before may not hold after a reboot */
+    cache_flush();
+    tlm_reset();
+    stm32_threads_reset();
+
+    if (ascii_only) {
+        start_baud_change();
+        return;
+    }
+
+    len = snprintf(command, sizeof(command), "%s%c%d", CMD_PROTO, FIELD_SEPARATOR, PROTO_BINARY);
+    if (send_internal(command, len, INFLIGHT_TIMEOUT_MS) == 0) {
+        link_state = LINK_PROTO;
+    }
+}
+
+/**
+ * @brief Handle one complete message (without delimiter) from the STM32
+ * @param binary Framing the delimiter was searched for
+ */
+static void process_uart_message(char *msg, size_t len, bool binary) {
+    if (binary) {
+        if (len > 0) {
+            trace(TRACE_UART_RX | TRACE_BINARY, TRACE_NO_SLOT, msg, len);
+            process_uart_frame((uint8_t *)msg, len);
+        }
+        return;
+    }
+
+    msg[len] = '\0';
+    trace(TRACE_UART_RX, TRACE_NO_SLOT, msg, len);
+    log_message("Received from STM32: %s", msg);
+    stats.uart_rx_frames++;
+    route_response(msg, len);
+}
+
+/**
+ * @brief Process data received from UART (STM32)
+ *
+ * Reads in large chunks and looks for delimiters with memchr(). Messages
+ * that arrive whole within one read are handled in place; only a message
+ * split across reads is assembled in buffer.
+ */
+static void process_uart_data(void) {
+    static char buffer[MAX_MESSAGE_LENGTH];
+    static size_t buffer_pos = 0;
+    static bool discard = false;        /* Skipping the rest of an over-long message */
+    static char read_buf[UART_RX_CHUNK];
+    ssize_t n;
+
+    /* Edge-triggered: drain everything the driver has buffered */
+    for (;;) {
+        n = read(uart_fd, read_buf, sizeof(read_buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        stats.uart_rx_bytes += n;
+
+        for (char *p = read_buf, *end = read_buf + n; p < end;) {
+            /* PROTO:1 is answered in ASCII, binary frames may follow in this read */
+            bool binary = binary_mode;
+            char *stop = memchr(p, binary ? FRAME_DELIMITER : MESSAGE_DELIMITER, end - p);
+            char *msg = p;
+            size_t len = (stop != NULL ? stop : end) - p;
+
+            p += len + (stop != NULL);
+            if (discard) {
+                discard = stop == NULL;
+                continue;
+            }
+            if (buffer_pos + len > MAX_MESSAGE_LENGTH - 1) {
+                syslog(LOG_WARNING, "Buffer overflow, resetting");
+                stats.rx_overflows++;
+                buffer_pos = 0;
+                discard = stop == NULL;
+                continue;
+            }
+            if (stop == NULL) {
+                memcpy(buffer + buffer_pos, msg, len);
+                buffer_pos += len;
+                break;
+            }
+            if (buffer_pos > 0) {
+                memcpy(buffer + buffer_pos, msg, len);
+                msg = buffer;
+                len += buffer_pos;
+                buffer_pos = 0;
+            }
+            process_uart_message(msg, len, binary);
+        }
+    }
+
+    flush_subscribers();
+}
+
+/**
+ * @brief Backpressure check before taking another command from a client
+ *
+ * Engages for normal-priority commands when all but
+ * INFLIGHT_URGENT_RESERVE in-flight entries are taken, and releases once
+ * the count is well below that. High-priority commands only wait when
+ * every entry is taken.
+ */
+static bool link_backlogged(uint8_t priority) {
+    if (!backpressure && inflight_count >= MAX_INFLIGHT - INFLIGHT_URGENT_RESERVE) {
+        backpressure = true;
+        backpressure_count++;
+        syslog(LOG_DEBUG, "Link backlogged (%u queued, %u in flight), pausing clients",
+               lane_count, inflight_count);
+    } else if (backpressure && inflight_count <= INFLIGHT_RESUME) {
+        backpressure = false;
+    }
+    return priority == UART_PRIO_HIGH ? inflight_count >= MAX_INFLIGHT : backpressure;
+}
+
+/**
+ * @brief Priority class of a client line; high if it does not parse, as
+ *        the error reply needs no link capacity
+ */
+static uint8_t line_priority(const char *line, size_t len) {
+    uart_message_t msg;
+
+    return parse_message(line, len, &msg) ? msg.priority : UART_PRIO_HIGH;
+}
+
+/**
+ * @brief Reply to a client directly, without involving the STM32
+ */
+static void reply_error(client_t *client, uint16_t client_id, const char *error) {
+    char reply[64];
+    int len = build_message(RESP_ERROR, client_id, error, reply, sizeof(reply));
+
+    if (strcmp(error, ERR_BUSY) == 0) {
+        stats.client_busy++;
+    } else {
+        stats.client_errors++;
+    }
+    if (len > 0) {
+        send_to_client(client, reply, len);
+    }
+}
+
+/**
+ * @brief Check that a topic filter can match some unsolicited message
+ *
+ * The message name part must be a prefix of an unsolicited opcode name,
+ * or the whole name if the filter goes on to the parameters.
+ */
+static bool topic_valid(const char *filter, size_t len) {
+    size_t name_len = 0;
+
+    while (name_len < len && filter[name_len] != FIELD_SEPARATOR) {
+        name_len++;
+    }
+    for (int opcode = OP_FIRST_UNSOLICITED; opcode <= 0xFF; opcode++) {
+        const char *name = uart_opcode_name(opcode);
+
+        if (name != NULL && strncmp(name, filter, name_len) == 0 &&
+            (name_len == len || name[name_len] == '\0')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief SUBSCRIBE:filter / UNSUBSCRIBE:filter, answered by the daemon itself
+ *
+ * The filter is the raw parameter text, commas included; a trailing '*'
+ * is accepted and ignored since every filter matches by prefix.
+ */
+static void handle_subscribe(client_t *client, const uart_message_t *msg) {
+    const char *filter = msg->params.ptr;
+    size_t len = msg->params.len;
+    int found = -1;
+    char reply[32];
+    int reply_len;
+
+    if (len > 0 && filter[len - 1] == '*') {
+        len--;
+    }
+    if (msg->nparams == 0 || len >= MAX_TOPIC_LENGTH || !topic_valid(filter, len)) {
+        reply_error(client, msg->id, ERR_INVALID_PARAMS);
+        return;
+    }
+
+    for (int i = 0; i < client->ntopics; i++) {
+        if (strlen(client->topics[i]) == len && memcmp(client->topics[i], filter, len) == 0) {
+            found = i;
+            break;
+        }
+    }
+
+    if (msg->opcode == OP_SUBSCRIBE && found < 0) {
+        if (client->ntopics == MAX_CLIENT_TOPICS) {
+            reply_error(client, msg->id, ERR_BUSY);
+            return;
+        }
+        memcpy(client->topics[client->ntopics], filter, len);
+        client->topics[client->ntopics++][len] = '\0';
+    } else if (msg->opcode == OP_UNSUBSCRIBE && found >= 0) {
+        client->ntopics--;
+        memcpy(client->topics[found], client->topics[client->ntopics], MAX_TOPIC_LENGTH);
+    }
+
+    reply_len = build_message(RESP_OK, msg->id, NULL, reply, sizeof(reply));
+    if (reply_len > 0) {
+        send_to_client(client, reply, reply_len);
+    }
+}
+
+/**
+ * @brief RING:bytes, answered by the daemon itself
+ *
+ * Creates a sealed memfd holding a uart_ring_t of bytes rounded up to a
+ * power of two, plus an eventfd doorbell, and passes both with the OK.
+ * The descriptors must ride on the first byte of the reply, so the
+ * request is refused while earlier output is still only partly sent.
+ */
+static void handle_ring(client_t *client, const uart_message_t *msg) {
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    char value[16];
+    char reply[32];
+    struct iovec iov;
+    struct msghdr out = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+    };
+    struct cmsghdr *cmsg;
+    uint32_t requested = 0;
+    uint32_t size = UART_RING_MIN;
+    size_t map_len;
+    uart_ring_t *ring;
+    int memfd, efd;
+    int len;
+    ssize_t n;
+
+    if (uart_message_args(msg, &requested, 1) != 1 ||
+        requested > UART_RING_MAX || client->ring != NULL) {
+        reply_error(client, msg->id, ERR_INVALID_PARAMS);
+        return;
+    }
+    if (client->tx_len > 0 || client->pub_off > 0) {
+        reply_error(client, msg->id, ERR_BUSY);
+        return;
+    }
+    while (size < requested) {
+        size <<= 1;
+    }
+    map_len = sizeof(uart_ring_t) + size;
+
+    memfd = memfd_create("uart-bridge-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memfd < 0) {
+        syslog(LOG_ERR, "Failed to create ring: %s", strerror(errno));
+        reply_error(client, msg->id, ERR_BUSY);
+        return;
+    }
+    /* The client must not be able to shrink it under our mapping */
+    if (ftruncate(memfd, map_len) < 0 ||
+        fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0 ||
+        (ring = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0)) == MAP_FAILED) {
+        syslog(LOG_ERR, "Failed to set up ring: %s", strerror(errno));
+        close(memfd);
+        reply_error(client, msg->id, ERR_BUSY);
+        return;
+    }
+    efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (efd < 0) {
+        syslog(LOG_ERR, "Failed to create ring doorbell: %s", strerror(errno));
+        munmap(ring, map_len);
+        close(memfd);
+        reply_error(client, msg->id, ERR_BUSY);
+        return;
+    }
+    ring->magic = UART_RING_MAGIC;
+    ring->size = size;
+
+    snprintf(value, sizeof(value), "%u", size);
+    len = build_message(RESP_OK, msg->id, value, reply, sizeof(reply));
+    iov.iov_base = reply;
+    iov.iov_len = len;
+    cmsg = CMSG_FIRSTHDR(&out);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), (int[]){ memfd, efd }, 2 * sizeof(int));
+
+    do {
+        n = sendmsg(client->fd, &out, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    close(memfd);
+    if (n <= 0) {
+        munmap(ring, map_len);
+        close(efd);
+        if (n < 0 && errno == EAGAIN) {
+            reply_error(client, msg->id, ERR_BUSY);
+        } else {
+            close_client(client);
+        }
+        return;
+    }
+    if (n < len) {
+        memcpy(client->tx_buf, reply + n, len - n);
+        client->tx_len = len - n;
+    }
+
+    client->ring = ring;
+    client->ring_size = size;
+    client->ring_head = 0;
+    client->ring_efd = efd;
+    client->ring_kick = false;
+    syslog(LOG_INFO, "Client switched to a %u byte ring", size);
+}
+
+/**
+ * @brief STATS[:command], answered by the daemon itself
+ *
+ * Without a parameter: link and daemon counters plus the round trip over
+ * all commands. With a command name: that command's counts and round-trip
+ * percentiles. Times are in microseconds.
+ */
+static void handle_stats(client_t *client, const uart_message_t *msg) {
+    char value[MAX_MESSAGE_LENGTH - 16];
+    char reply[MAX_MESSAGE_LENGTH];
+    int len;
+
+    if (msg->nparams == 0) {
+        latency_hist_t all;
+
+        memset(&all, 0, sizeof(all));
+        for (int i = 0; i < STATS_OPCODES; i++) {
+            hist_merge(&all, &command_stats[i].rtt);
+        }
+        snprintf(value, sizeof(value),
+                 "{\"rx_bytes\":%llu,\"tx_bytes\":%llu,\"rx_frames\":%llu,\"tx_frames\":%llu,"
+                 "\"rx_errors\":%llu,\"overflows\":%llu,\"clients\":%d,\"uart_queue\":%zu,"
+                 "\"inflight\":%u,\"queued\":%u,\"expired\":%llu,\"rtt_p50_us\":%u,"
+                 "\"rtt_p99_us\":%u}",
+                 (unsigned long long)stats.uart_rx_bytes, (unsigned long long)stats.uart_tx_bytes,
+                 (unsigned long long)stats.uart_rx_frames, (unsigned long long)stats.uart_tx_frames,
+                 (unsigned long long)(stats.rx_corrupt + stats.rx_malformed),
+                 (unsigned long long)stats.rx_overflows, client_count, uart_tx_len,
+                 inflight_count, lane_count, (unsigned long long)stats.expired,
+                 hist_percentile(&all, 500), hist_percentile(&all, 990));
+    } else {
+        uint8_t opcode = uart_opcode_from_name(msg->params.ptr, msg->params.len);
+        const command_stats_t *cs;
+
+        if (opcode == OP_NONE || opcode >= STATS_OPCODES) {
+            reply_error(client, msg->id, ERR_INVALID_PARAMS);
+            return;
+        }
+        cs = &command_stats[opcode];
+        snprintf(value, sizeof(value),
+                 "{\"sent\":%llu,\"timeouts\":%llu,\"cache_hits\":%llu,\"merged\":%llu,"
+                 "\"telemetry_hits\":%llu,"
+                 "\"p50_us\":%u,\"p90_us\":%u,\"p99_us\":%u,\"max_us\":%u}",
+                 (unsigned long long)cs->sent, (unsigned long long)cs->timeouts,
+                 (unsigned long long)cs->cache_hits, (unsigned long long)cs->merged,
+                 (unsigned long long)cs->telemetry_hits,
+                 hist_percentile(&cs->rtt, 500), hist_percentile(&cs->rtt, 900),
+                 hist_percentile(&cs->rtt, 990), cs->rtt.max_us);
+    }
+
+    len = build_message(RESP_OK, msg->id, value, reply, sizeof(reply));
+    if (len > 0) {
+        send_to_client(client, reply, len);
+    }
+}
+
+/**
+ * @brief TRACE, answered by the daemon itself: OK:records written
+ */
+static void handle_trace(client_t *client, const uart_message_t *msg) {
+    char value[16];
+    char reply[32];
+    int records = write_trace();
+    int len;
+
+    if (records < 0) {
+        reply_error(client, msg->id, ERR_BUSY);
+        return;
+    }
+    snprintf(value, sizeof(value), "%d", records);
+    len = build_message(RESP_OK, msg->id, value, reply, sizeof(reply));
+    if (len > 0) {
+        send_to_client(client, reply, len);
+    }
+}
+
+/**
+ * @brief Time by which a client request must be answered
+ */
+static uint64_t request_deadline(const uart_message_t *msg) {
+    return now_ms() + (msg->deadline_ms ? msg->deadline_ms : INFLIGHT_TIMEOUT_MS);
+}
+
+/**
+ * @brief Forget cached answers a request may change
+ */
+static void cache_invalidate_for(const uart_message_t *msg) {
+    uint32_t args[MAX_FRAME_ARGS];
+
+    switch (msg->opcode) {
+    case OP_GPIO_SET:
+    case OP_GPIO_WATCH:
+        if (uart_message_args(msg, args, MAX_FRAME_ARGS) >= 2) {
+            cache_invalidate(OP_GPIO_GET, args, 2);
+        }
+        break;
+    case OP_RESET:
+    case OP_BATCH:                      /* Sub-commands are not looked at */
+        cache_flush();
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Answer a read from the cache, or merge it into an identical
+ *        request already in flight
+ * @param entry Set to the slot a new request should fill, or NULL
+ * @return true if the request was taken care of
+ */
+static bool cache_serve(client_t *client, const uart_message_t *msg, uint8_t view,
+                        cache_entry_t **entry) {
+    command_stats_t *cs = command_stats_for(msg->opcode);
+    uint32_t args[MAX_FRAME_ARGS];
+    cache_entry_t key;
+    cache_entry_t *c;
+    uart_message_t resp;
+    int16_t idx;
+
+    *entry = NULL;
+    if (cache_rule(msg->opcode) == NULL ||
+        !cache_make_key(&key, msg->opcode, args,
+                        uart_message_args(msg, args, MAX_FRAME_ARGS))) {
+        return false;
+    }
+    c = cache_find(&key, link_state == LINK_READY);
+    if (c == NULL) {
+        return false;
+    }
+
+    if (c->expires_ms > now_ms() && parse_message(c->response, c->len, &resp)) {
+        cs->cache_hits++;
+        reply_to_client(client, msg->id, view, &resp);
+        return true;
+    }
+    c->expires_ms = 0;
+
+    /* A more urgent request does not wait behind a queued one */
+    if (c->pending < 0 || msg->priority > c->priority) {
+        *entry = c->pending < 0 ? c : NULL;
+        return false;
+    }
+
+    idx = inflight_alloc(request_deadline(msg));
+    if (idx < 0) {
+        return false;
+    }
+    inflight[idx].client_id = msg->id;
+    inflight[idx].slot = client - clients;
+    inflight[idx].generation = client->generation;
+    inflight[idx].opcode = msg->opcode;
+    inflight[idx].sent_us = 0;
+    inflight[idx].view = view;
+    inflight[idx].lane = LANE_FOLLOWER;
+    inflight[idx].leader = c->pending;
+    inflight[c->pending].followers++;
+    client->waiting++;
+    cs->merged++;
+    return true;
+}
+
+/**
+ * @brief Handle one complete command line from a client
+ */
+static void handle_client_line(client_t *client, char *line, size_t len) {
+    uart_message_t msg;
+    cache_entry_t *cached;
+    int view = STATUS_SUMMARY;
+    int16_t idx;
+
+    if (len == 0 || (len == 1 && line[0] == '\r')) {
+        return;
+    }
+
+    trace(TRACE_CLIENT_RX, client - clients, line, len);
+    log_message("Received from client: %.*s", (int)len, line);
+
+    if (!parse_message(line, len, &msg)) {
+        reply_error(client, REQUEST_ID_NONE, ERR_INVALID_CMD);
+        return;
+    }
+
+    /* The daemon owns the link settings */
+    if (msg.opcode == OP_PROTO || msg.opcode == OP_SET_BAUD) {
+        reply_error(client, msg.id, ERR_INVALID_CMD);
+        return;
+    }
+    if (msg.opcode == OP_SUBSCRIBE || msg.opcode == OP_UNSUBSCRIBE) {
+        handle_subscribe(client, &msg);
+        return;
+    }
+    if (msg.opcode == OP_RING) {
+        handle_ring(client, &msg);
+        return;
+    }
+    if (msg.opcode == OP_STATS) {
+        handle_stats(client, &msg);
+        return;
+    }
+    if (msg.opcode == OP_TRACE) {
+        handle_trace(client, &msg);
+        return;
+    }
+
+    /* The STM32 always sends the whole snapshot; the part is ours to pick */
+    if (msg.opcode == OP_STATUS && msg.params.len > 0) {
+        view = status_view_from_name(&msg.params);
+        if (view < 0) {
+            reply_error(client, msg.id, ERR_INVALID_PARAMS);
+            return;
+        }
+        len = msg.params.ptr - 1 - line;
+        msg.params.len = 0;
+        msg.nparams = 0;
+    }
+
+    cache_invalidate_for(&msg);
+    if (msg.opcode == OP_RESET) {
+        tlm_reset();
+        stm32_threads_reset();
+    }
+    if (tlm_serve(client, &msg) || cache_serve(client, &msg, view, &cached)) {
+        return;
+    }
+
+    /* Sent by pump_lanes(); the deadline covers the wait in the lane too */
+    idx = link_state != LINK_READY ? -1 : inflight_alloc(request_deadline(&msg));
+    if (idx < 0) {
+        reply_error(client, msg.id, ERR_BUSY);
+        return;
+    }
+
+    /* This request fetches the answer the next identical ones share */
+    if (cached != NULL) {
+        cached->pending = idx;
+        cached->priority = msg.priority;
+        inflight[idx].cache = cached - cache;
+    }
+
+    inflight[idx].client_id = msg.id;
+    inflight[idx].slot = client - clients;
+    inflight[idx].generation = client->generation;
+    inflight[idx].opcode = msg.opcode;
+    inflight[idx].view = view;
+    inflight[idx].tlm_ports = tlm_ports_for(&msg);
+    tlm_hold(inflight[idx].tlm_ports, true);
+    inflight[idx].sent_us = 0;
+    inflight[idx].len = len;
+    memcpy(inflight[idx].line, line, len);
+    lane_push(idx, msg.priority);
+    client->waiting++;
+}
+
+/**
+ * @brief Handle the complete lines buffered for a client
+ * @param budget Commands the client may still issue in this turn
+ * @return false if the client must not be read any further for now
+ */
+static bool process_client_lines(client_t *client, unsigned int *budget) {
+    size_t off = 0;
+
+    if (client->throttled) {
+        return false;
+    }
+
+    while (off < client->rx_len) {
+        char *line = client->rx_buf + off;
+        char *end = memchr(line, MESSAGE_DELIMITER, client->rx_len - off);
+
+        if (end == NULL) {
+            break;
+        }
+        /*
+         * Leave the rest here and in the socket until the link drains, or
+         * until the other clients had their turn
+         */
+        if (!client->rx_discard &&
+            (*budget == 0 || link_backlogged(line_priority(line, end - line)))) {
+            client->throttled = true;
+            throttled_clients++;
+            break;
+        }
+        if (!client->rx_discard) {
+            *end = '\0';
+            (*budget)--;
+            handle_client_line(client, line, end - line);
+            /* The handler may have dropped a slow client */
+            if (client->fd < 0) {
+                return false;
+            }
+        }
+        client->rx_discard = false;
+        off = end + 1 - client->rx_buf;
+    }
+
+    memmove(client->rx_buf, client->rx_buf + off, client->rx_len - off);
+    client->rx_len -= off;
+    if (client->throttled) {
+        return false;
+    }
+
+    if (client->rx_len >= MAX_MESSAGE_LENGTH - 1) {
+        if (!client->rx_discard) {
+            syslog(LOG_WARNING, "Client message too long, discarding");
+        }
+        client->rx_len = 0;
+        client->rx_discard = true;
+    }
+    return true;
+}
+
+/**
+ * @brief Process data from client socket
+ */
+static void process_client_data(client_t *client) {
+    unsigned int budget = CLIENT_BURST;
+    ssize_t n;
+
+    for (;;) {
+        if (!process_client_lines(client, &budget)) {
+            return;
+        }
+
+        n = read(client->fd, client->rx_buf + client->rx_len,
+                 sizeof(client->rx_buf) - client->rx_len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN) {
+            return;
+        }
+        if (n == 0) {
+            /* Half-close: keep the socket until outstanding replies are sent */
+            client->eof = true;
+            finish_client(client);
+            return;
+        }
+        if (n < 0) {
+            close_client(client);
+            return;
+        }
+        client->rx_len += n;
+    }
+}
+
+/**
+ * @brief Read paused clients again once the link has drained
+ *
+ * Clients are paused by backpressure or after CLIENT_BURST commands in a
+ * row. Edge-triggered epoll will not report data that was already
+ * waiting, so they are picked up here, round robin starting after the
+ * last one resumed.
+ */
+static void resume_clients(void) {
+    static int next = 0;
+
+    for (int n = 0; n < MAX_CLIENTS && throttled_clients > 0 &&
+                    !link_backlogged(UART_PRIO_HIGH); n++) {
+        client_t *client = &clients[next];
+
+        next = (next + 1) % MAX_CLIENTS;
+        if (client->fd >= 0 && client->throttled) {
+            client->throttled = false;
+            throttled_clients--;
+            process_client_data(client);
+        }
+    }
+}
+
+/**
+ * @brief Write as much pending output to the client as the socket accepts
+ *
+ * Responses and queued unsolicited messages go out in one sendmsg(). A
+ * message cut short by the socket is finished before anything else so
+ * lines never interleave.
+ */
+static void flush_client(client_t *client) {
+    struct iovec iov[CLIENT_PUB_QUEUE + 1];
+
+    while (client->tx_len > 0 || client->pub_count > 0) {
+        struct msghdr msg = { .msg_iov = iov };
+        int first = 0;
+        size_t taken;
+        ssize_t n;
+
+        if (client->pub_off > 0) {
+            const pub_buf_t *buf = &pub_slab[client->pub_queue[client->pub_head]];
+
+            iov[msg.msg_iovlen].iov_base = (char *)buf->data + client->pub_off;
+            iov[msg.msg_iovlen++].iov_len = buf->len - client->pub_off;
+            first = 1;
+        }
+        if (client->tx_len > 0) {
+            iov[msg.msg_iovlen].iov_base = client->tx_buf;
+            iov[msg.msg_iovlen++].iov_len = client->tx_len;
+        }
+        for (int i = first; i < client->pub_count; i++) {
+            pub_buf_t *buf = &pub_slab[client->pub_queue[(client->pub_head + i) % CLIENT_PUB_QUEUE]];
+
+            iov[msg.msg_iovlen].iov_base = buf->data;
+            iov[msg.msg_iovlen++].iov_len = buf->len;
+        }
+
+        n = sendmsg(client->fd, &msg, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN) {
+            break;
+        }
+        if (n <= 0) {
+            close_client(client);
+            return;
+        }
+
+        /* Consume in iov order */
+        if (first) {
+            n = pub_advance(client, n);
+        }
+        taken = (size_t)n < client->tx_len ? (size_t)n : client->tx_len;
+        memmove(client->tx_buf, client->tx_buf + taken, client->tx_len - taken);
+        client->tx_len -= taken;
+        n -= taken;
+        while (n > 0) {
+            n = pub_advance(client, n);
+        }
+    }
+
+    finish_client(client);
+}
+
+/**
+ * @brief Close a half-closed client once nothing is left to deliver
+ */
+static void finish_client(client_t *client) {
+    if (client->fd >= 0 && client->eof && client->waiting == 0 && client->tx_len == 0) {
+        close_client(client);
+    }
+}
+
+/**
+ * @brief Queue data for a client, sending immediately when possible
+ * @return 0 on success, -1 if the client was dropped
+ */
+static int send_to_client(client_t *client, const char *data, size_t len) {
+    trace(TRACE_CLIENT_TX, client - clients, data,
+          len > 0 && data[len - 1] == MESSAGE_DELIMITER ? len - 1 : len);
+
+    if (client->tx_len + len > sizeof(client->tx_buf)) {
+        flush_client(client);
+        if (client->fd < 0) {
+            return -1;
+        }
+        if (client->tx_len + len > sizeof(client->tx_buf)) {
+            syslog(LOG_WARNING, "Client not reading its responses, disconnecting");
+            close_client(client);
+            return -1;
+        }
+    }
+
+    memcpy(client->tx_buf + client->tx_len, data, len);
+    client->tx_len += len;
+    flush_client(client);
+    return client->fd < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Accept all pending connections on the listening socket
+ */
+static void accept_clients(void) {
+    for (;;) {
+        int fd = accept4(socket_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        client_t *client = NULL;
+
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                syslog(LOG_ERR, "Failed to accept client: %s", strerror(errno));
+            }
+            return;
+        }
+
+        for (int i = 0; i < MAX_CLIENTS; i++) {
+            if (clients[i].fd < 0) {
+                client = &clients[i];
+                break;
+            }
+        }
+
+        if (client == NULL) {
+            syslog(LOG_WARNING, "Too many clients, rejecting connection");
+            stats.clients_rejected++;
+            close(fd);
+            continue;
+        }
+
+        client->fd = fd;
+        client->generation++;
+        client->rx_len = 0;
+        client->rx_discard = false;
+        client->throttled = false;
+        client->tx_len = 0;
+        client->waiting = 0;
+        client->eof = false;
+        client->ntopics = 0;
+        client->pub_head = 0;
+        client->pub_count = 0;
+        client->pub_off = 0;
+        client->pub_dropped = 0;
+        client->ring = NULL;
+
+        if (epoll_add(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+                      EV_CLIENT + (client - clients)) < 0) {
+            close(fd);
+            client->fd = -1;
+            continue;
+        }
+
+        client_count++;
+        stats.clients_accepted++;
+        syslog(LOG_INFO, "Client connected (%d active)", client_count);
+    }
+}
+
+/**
+ * @brief Disconnect client and release its slot
+ */
+static void close_client(client_t *client) {
+    if (client->fd < 0) {
+        return;
+    }
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    client->fd = -1;
+    if (client->throttled) {
+        client->throttled = false;
+        throttled_clients--;
+    }
+    while (client->pub_count > 0) {
+        pub_pop(client);
+    }
+    if (client->ring != NULL) {
+        munmap(client->ring, sizeof(uart_ring_t) + client->ring_size);
+        close(client->ring_efd);
+        client->ring = NULL;
+    }
+    client->tx_len = 0;
+    client->rx_len = 0;
+    client_count--;
+    if (client->pub_dropped > 0) {
+        syslog(LOG_INFO, "Subscriber missed %lu unsolicited messages", client->pub_dropped);
+    }
+    syslog(LOG_INFO, "Client disconnected (%d active)", client_count);
+}
+
+/**
+ * @brief Cleanup resources
+ */
+static void cleanup(void) {
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        close_client(&clients[i]);
+    }
+
+    if (uart_fd >= 0) {
+        close(uart_fd);
+        uart_fd = -1;
+    }
+
+    if (socket_fd >= 0) {
+        close(socket_fd);
+        socket_fd = -1;
+        unlink(socket_path);
+    }
+
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+
+    syslog(LOG_INFO, "Cleanup completed");
+}
+
+/* Walks the FIFO, for the SIGUSR1 log only */
+static unsigned int lane_length(uint8_t priority) {
+    unsigned int n = 0;
+
+    for (int16_t idx = lanes[priority].head; idx >= 0; idx = inflight[idx].lane_next) {
+        n++;
+    }
+    return n;
+}
+
+/**
+ * @brief Log queue state on SIGUSR1
+ */
+static void log_stats(void) {
+    syslog(LOG_INFO, "UART TX queue %zu bytes (peak %zu of %d), %u commands in flight "
+           "(%u queued: %u high, %u normal), clients paused %u times (%d waiting), "
+           "%lu unsolicited messages dropped, %u of %d message buffers in use",
+           uart_tx_len, uart_tx_peak, UART_TX_QUEUE, inflight_count, lane_count,
+           lane_length(UART_PRIO_HIGH), lane_length(UART_PRIO_NORMAL), backpressure_count,
+           throttled_clients, unsolicited_dropped, PUB_SLAB_SIZE - pub_free_count, PUB_SLAB_SIZE);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0 && clients[i].pub_dropped > 0) {
+            syslog(LOG_INFO, "Subscriber in slot %d: %u queued, %lu dropped",
+                   i, clients[i].pub_count, clients[i].pub_dropped);
+        }
+    }
+}
+
+static void write_counter(FILE *f, const char *name, const char *help, uint64_t value) {
+    fprintf(f, "# HELP uart_bridge_%s %s\n# TYPE uart_bridge_%s counter\n"
+            "uart_bridge_%s %llu\n", name, help, name, name, (unsigned long long)value);
+}
+
+static void write_gauge(FILE *f, const char *name, const char *help, uint64_t value) {
+    fprintf(f, "# HELP uart_bridge_%s %s\n# TYPE uart_bridge_%s gauge\n"
+            "uart_bridge_%s %llu\n", name, help, name, name, (unsigned long long)value);
+}
+
+/* Samples of one histogram, bucket bounds at powers of two in seconds */
+static void write_histogram(FILE *f, const char *name, const char *labels,
+                            const latency_hist_t *h) {
+    const char *sep = labels[0] ? "," : "";
+    char braced[64] = "";
+    uint64_t cumulative = 0;
+    unsigned int i = 0;
+
+    if (labels[0]) {
+        snprintf(braced, sizeof(braced), "{%s}", labels);
+    }
+
+    /* Values are whole microseconds, so 2^k us bounds fall on bucket edges */
+    for (int k = HIST_EXPORT_MIN; k <= HIST_EXPORT_MAX; k++) {
+        for (; i < (unsigned int)(k - HIST_SUB_BITS + 1) * HIST_SUB; i++) {
+            cumulative += h->buckets[i];
+        }
+        fprintf(f, "uart_bridge_%s_bucket{%s%sle=\"%.6f\"} %llu\n", name, labels, sep,
+                (double)(1u << k) / 1e6, (unsigned long long)cumulative);
+    }
+    fprintf(f, "uart_bridge_%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep,
+            (unsigned long long)h->count);
+    fprintf(f, "uart_bridge_%s_sum%s %.6f\n", name, braced, (double)h->sum_us / 1e6);
+    fprintf(f, "uart_bridge_%s_count%s %llu\n", name, braced, (unsigned long long)h->count);
+}
+
+/**
+ * @brief Error counters of the STM32, as far as TELEMETRY reported them
+ */
+static void write_stm32_counters(FILE *f) {
+    static const char *const names[] = {
+        [UART_TLM_RX_ERRORS - UART_TLM_RX_ERRORS]   = "rx_errors",
+        [UART_TLM_RX_OVERRUNS - UART_TLM_RX_ERRORS] = "rx_overruns",
+        [UART_TLM_CRC_ERRORS - UART_TLM_RX_ERRORS]  = "crc_errors",
+        [UART_TLM_GPIO_ERRORS - UART_TLM_RX_ERRORS] = "gpio_errors",
+        [UART_TLM_I2C_ERRORS - UART_TLM_RX_ERRORS]  = "i2c_errors",
+        [UART_TLM_ADC_ERRORS - UART_TLM_RX_ERRORS]  = "adc_errors",
+        [UART_TLM_PWM_ERRORS - UART_TLM_RX_ERRORS]  = "pwm_errors",
+    };
+
+    fprintf(f, "# HELP uart_bridge_stm32_errors_total Error counters of the STM32 (TELEMETRY)\n"
+            "# TYPE uart_bridge_stm32_errors_total counter\n");
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (tlm.valid & (1ull << (UART_TLM_RX_ERRORS + i))) {
+            fprintf(f, "uart_bridge_stm32_errors_total{counter=\"%s\"} %u\n", names[i],
+                    tlm.value[UART_TLM_RX_ERRORS + i]);
+        }
+    }
+}
+
+/**
+ * @brief Stack, CPU and heap use of the STM32, as far as THREADS reported them
+ */
+static void write_stm32_threads(FILE *f) {
+    uint32_t count = stm32_threads.count < STM32_THREADS_MAX ? stm32_threads.count
+                                                              : STM32_THREADS_MAX;
+
+    if (stm32_threads.heap_size == 0 && count == 0) {
+        return;
+    }
+    fprintf(f, "# HELP uart_bridge_stm32_thread_stack_bytes Stack size of an STM32 thread\n"
+            "# TYPE uart_bridge_stm32_thread_stack_bytes gauge\n");
+    for (uint32_t i = 0; i < count; i++) {
+        if (stm32_threads.thread[i].name[0] != '\0') {
+            fprintf(f, "uart_bridge_stm32_thread_stack_bytes{thread=\"%s\"} %u\n",
+                    stm32_threads.thread[i].name, stm32_threads.thread[i].stack_size);
+        }
+    }
+    fprintf(f, "# HELP uart_bridge_stm32_thread_stack_used_bytes Stack high-water mark of an STM32 thread\n"
+            "# TYPE uart_bridge_stm32_thread_stack_used_bytes gauge\n");
+    for (uint32_t i = 0; i < count; i++) {
+        if (stm32_threads.thread[i].name[0] != '\0') {
+            fprintf(f, "uart_bridge_stm32_thread_stack_used_bytes{thread=\"%s\"} %u\n",
+                    stm32_threads.thread[i].name, stm32_threads.thread[i].stack_used);
+        }
+    }
+    fprintf(f, "# HELP uart_bridge_stm32_thread_cpu_ratio CPU share of an STM32 thread between polls\n"
+            "# TYPE uart_bridge_stm32_thread_cpu_ratio gauge\n");
+    for (uint32_t i = 0; i < count; i++) {
+        if (stm32_threads.thread[i].name[0] != '\0' && stm32_threads.thread[i].cpu_permille >= 0) {
+            fprintf(f, "uart_bridge_stm32_thread_cpu_ratio{thread=\"%s\"} %.3f\n",
+                    stm32_threads.thread[i].name, stm32_threads.thread[i].cpu_permille / 1000.0);
+        }
+    }
+    if (stm32_threads.heap_size == 0) {
+        return;
+    }
+    write_gauge(f, "stm32_heap_bytes", "Size of the STM32 system heap", stm32_threads.heap_size);
+    write_gauge(f, "stm32_heap_free_bytes", "Free bytes in the STM32 system heap",
+                stm32_threads.heap_free);
+    write_gauge(f, "stm32_heap_max_used_bytes", "Peak use of the STM32 system heap since boot",
+                stm32_threads.heap_max_used);
+}
+
+/**
+ * @brief Write the counters to metrics_path in Prometheus text format
+ *
+ * Written to a temporary file and renamed, so a collector never sees a
+ * partial file.
+ */
+static void write_metrics(void) {
+    char tmp_path[PATH_MAX];
+    FILE *f;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", metrics_path);
+    f = fopen(tmp_path, "w");
+    if (f == NULL) {
+        syslog(LOG_ERR, "Failed to write %s: %s", tmp_path, strerror(errno));
+        return;
+    }
+
+    write_counter(f, "uart_rx_bytes_total", "Bytes read from the UART", stats.uart_rx_bytes);
+    write_counter(f, "uart_tx_bytes_total", "Bytes written to the UART", stats.uart_tx_bytes);
+    write_counter(f, "uart_rx_frames_total", "Frames or lines received from the STM32",
+                  stats.uart_rx_frames);
+    write_counter(f, "uart_tx_frames_total", "Commands sent to the STM32", stats.uart_tx_frames);
+    write_counter(f, "uart_rx_corrupt_total", "Frames dropped for a bad COBS encoding or CRC",
+                  stats.rx_corrupt);
+    write_counter(f, "uart_rx_malformed_total", "Unknown frames and unparsable lines",
+                  stats.rx_malformed);
+    write_counter(f, "uart_rx_overflows_total", "Over-long input that reset the receive buffer",
+                  stats.rx_overflows);
+    write_counter(f, "uart_rx_unmatched_total", "Responses arriving after their command timed out",
+                  stats.rx_unmatched);
+    write_counter(f, "unsolicited_total", "Unsolicited messages from the STM32", stats.unsolicited);
+    write_counter(f, "unsolicited_dropped_total", "Unsolicited messages a subscriber missed",
+                  unsolicited_dropped);
+    write_counter(f, "clients_accepted_total", "Client connections accepted",
+                  stats.clients_accepted);
+    write_counter(f, "clients_rejected_total", "Client connections over the limit",
+                  stats.clients_rejected);
+    write_counter(f, "client_errors_total", "Errors answered by the daemon, BUSY excluded",
+                  stats.client_errors);
+    write_counter(f, "client_busy_total", "Commands answered with ERROR:BUSY", stats.client_busy);
+    write_counter(f, "expired_total", "Commands whose deadline passed before they were sent",
+                  stats.expired);
+    write_counter(f, "backpressure_total", "Times client sockets were paused for the UART",
+                  backpressure_count);
+
+    write_gauge(f, "clients", "Connected clients", client_count);
+    write_gauge(f, "uart_tx_queue_bytes", "Bytes waiting for the UART", uart_tx_len);
+    write_gauge(f, "uart_tx_queue_peak_bytes", "Largest UART queue depth seen", uart_tx_peak);
+    write_gauge(f, "inflight", "Commands waiting for the STM32", inflight_count);
+    write_gauge(f, "queued", "Commands not sent to the STM32 yet", lane_count);
+    write_gauge(f, "message_buffers", "Unsolicited message buffers in use",
+                PUB_SLAB_SIZE - pub_free_count);
+    write_gauge(f, "uart_baudrate", "Current line rate", baudrate);
+    write_gauge(f, "uart_binary", "1 if the link uses binary framing", binary_mode);
+
+    fprintf(f, "# HELP uart_bridge_commands_total Commands sent to the STM32\n"
+            "# TYPE uart_bridge_commands_total counter\n");
+    for (int i = 0; i < STATS_OPCODES; i++) {
+        const char *name = i == OP_NONE ? "other" : uart_opcode_name(i);
+
+        if (command_stats[i].sent > 0) {
+            fprintf(f, "uart_bridge_commands_total{command=\"%s\"} %llu\n", name,
+                    (unsigned long long)command_stats[i].sent);
+        }
+    }
+    fprintf(f, "# HELP uart_bridge_command_timeouts_total Commands the STM32 never answered\n"
+            "# TYPE uart_bridge_command_timeouts_total counter\n");
+    for (int i = 0; i < STATS_OPCODES; i++) {
+        const char *name = i == OP_NONE ? "other" : uart_opcode_name(i);
+
+        if (command_stats[i].sent > 0) {
+            fprintf(f, "uart_bridge_command_timeouts_total{command=\"%s\"} %llu\n", name,
+                    (unsigned long long)command_stats[i].timeouts);
+        }
+    }
+    fprintf(f, "# HELP uart_bridge_cache_hits_total Reads answered from the response cache\n"
+            "# TYPE uart_bridge_cache_hits_total counter\n");
+    for (size_t i = 0; i < sizeof(cache_rules) / sizeof(cache_rules[0]); i++) {
+        fprintf(f, "uart_bridge_cache_hits_total{command=\"%s\"} %llu\n",
+                uart_opcode_name(cache_rules[i].opcode),
+                (unsigned long long)command_stats[cache_rules[i].opcode].cache_hits);
+    }
+    fprintf(f, "# HELP uart_bridge_cache_merged_total Reads answered with an identical request's response\n"
+            "# TYPE uart_bridge_cache_merged_total counter\n");
+    for (size_t i = 0; i < sizeof(cache_rules) / sizeof(cache_rules[0]); i++) {
+        fprintf(f, "uart_bridge_cache_merged_total{command=\"%s\"} %llu\n",
+                uart_opcode_name(cache_rules[i].opcode),
+                (unsigned long long)command_stats[cache_rules[i].opcode].merged);
+    }
+    fprintf(f, "# HELP uart_bridge_telemetry_hits_total Reads answered from TELEMETRY values\n"
+            "# TYPE uart_bridge_telemetry_hits_total counter\n");
+    fprintf(f, "uart_bridge_telemetry_hits_total{command=\"%s\"} %llu\n", CMD_GPIO_GET,
+            (unsigned long long)command_stats[OP_GPIO_GET].telemetry_hits);
+    fprintf(f, "uart_bridge_telemetry_hits_total{command=\"%s\"} %llu\n", CMD_ADC_READ,
+            (unsigned long long)command_stats[OP_ADC_READ].telemetry_hits);
+    write_counter(f, "telemetry_messages_total", "TLM messages received", tlm.messages);
+    write_counter(f, "telemetry_gaps_total", "Lost TLM messages noticed by seq", tlm.gaps);
+    write_stm32_counters(f);
+    write_stm32_threads(f);
+    fprintf(f, "# HELP uart_bridge_command_rtt_seconds Command sent to response received\n"
+            "# TYPE uart_bridge_command_rtt_seconds histogram\n");
+    for (int i = 0; i < STATS_OPCODES; i++) {
+        char labels[48];
+
+        if (command_stats[i].sent > 0) {
+            snprintf(labels, sizeof(labels), "command=\"%s\"",
+                     i == OP_NONE ? "other" : uart_opcode_name(i));
+            write_histogram(f, "command_rtt_seconds", labels, &command_stats[i].rtt);
+        }
+    }
+    fprintf(f, "# HELP uart_bridge_loop_seconds Time spent handling one batch of events\n"
+            "# TYPE uart_bridge_loop_seconds histogram\n");
+    write_histogram(f, "loop_seconds", "", &loop_hist);
+
+    if (fclose(f) != 0 || rename(tmp_path, metrics_path) < 0) {
+        syslog(LOG_ERR, "Failed to write %s: %s", metrics_path, strerror(errno));
+        unlink(tmp_path);
+    }
+}
+
+/**
+ * @brief epoll_wait() timeout: next in-flight deadline, room in the UART
+ *        window for queued commands, or metrics update
+ */
+static int next_timeout(void) {
+    int timeout = expire_inflight();
+    int pump = pump_lanes();            /* After expiry: nothing stale goes out */
+    uint64_t now;
+
+    if (pump >= 0 && (timeout < 0 || pump < timeout)) {
+        timeout = pump;
+    }
+
+    /* Clients that used up their burst still have commands waiting */
+    if (throttled_clients > 0 && !backpressure) {
+        timeout = 0;
+    }
+    if (metrics_path == NULL) {
+        return timeout;
+    }
+    now = now_ms();
+    if (now >= metrics_due_ms) {
+        write_metrics();
+        stm32_threads_poll();           /* Lands in the next file */
+        metrics_due_ms = now + METRICS_INTERVAL_MS;
+    }
+    if (timeout < 0 || (uint64_t)timeout > metrics_due_ms - now) {
+        timeout = (int)(metrics_due_ms - now);
+    }
+    return timeout;
+}
+
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-d uart_device] [-s socket_path] [-b baudrate] [-a] [-r] "
+            "[-l] [-m metrics_file] [-t trace_file] [-c command=ms]... [-v]\n", prog);
+    fprintf(stderr, "  -d  UART device (default: %s)\n", UART_DEVICE);
+    fprintf(stderr, "  -s  Unix socket path (default: %s)\n", UNIX_SOCKET_PATH);
+    fprintf(stderr, "  -b  line rate to negotiate with SET_BAUD (default: %d, %d keeps the boot rate)\n",
+            UART_BAUDRATE_MAX, UART_BAUDRATE);
+    fprintf(stderr, "  -a  ASCII framing only, do not negotiate binary mode\n");
+    fprintf(stderr, "  -r  RTS/CTS hardware flow control (firmware built with it too)\n");
+    fprintf(stderr, "  -l  low latency mode of the serial driver (ASYNC_LOW_LATENCY)\n");
+    fprintf(stderr, "  -m  write Prometheus metrics to this file every %d s\n",
+            METRICS_INTERVAL_MS / 1000);
+    fprintf(stderr, "  -t  file TRACE and SIGUSR1 write recent traffic to (default: %s)\n",
+            TRACE_PATH);
+    fprintf(stderr, "  -c  keep %s/%s/%s answers this many ms (default: %d/%d/%d),\n"
+            "      0 only merges identical reads; repeatable\n", CMD_STATUS, CMD_GPIO_GET,
+            CMD_ADC_READ, CACHE_TTL_STATUS_MS, CACHE_TTL_READ_MS, CACHE_TTL_READ_MS);
+    fprintf(stderr, "  -v  debug logging\n");
+}
+
+/**
+ * @brief Parse a -c option, "GPIO_GET=50"
+ * @return 0 on success, -1 if the command is not cached or the time is bad
+ */
+static int set_cache_ttl(const char *arg) {
+    const char *eq = strchr(arg, '=');
+    cache_rule_t *rule;
+    char *end;
+    unsigned long ttl;
+
+    if (eq == NULL) {
+        return -1;
+    }
+    rule = cache_rule(uart_opcode_from_name(arg, eq - arg));
+    ttl = strtoul(eq + 1, &end, 10);
+    if (rule == NULL || end == eq + 1 || *end != '\0' || ttl > CACHE_TTL_MAX_MS) {
+        return -1;
+    }
+    rule->ttl_ms = ttl;
+    return 0;
+}
+
+/**
+ * @brief Main function
+ */
+int main(int argc, char *argv[]) {
+    struct epoll_event events[MAX_EVENTS];
+    const char *uart_device = UART_DEVICE;
+    struct sigaction sa;
+    bool verbose = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:s:b:arlm:t:c:vh")) != -1) {
+        switch (opt) {
+            case 'd': uart_device = optarg; break;
+            case 's': socket_path = optarg; break;
+            case 'b':
+                target_baudrate = strtoul(optarg, NULL, 10);
+                if (!uart_baudrate_supported(target_baudrate)) {
+                    fprintf(stderr, "Unsupported baud rate: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'a': ascii_only = true; break;
+            case 'r': flow_control = true; break;
+            case 'l': low_latency = true; break;
+            case 'm': metrics_path = optarg; break;
+            case 't': trace_path = optarg; break;
+            case 'c':
+                if (set_cache_ttl(optarg) < 0) {
+                    fprintf(stderr, "Not a cached command or bad time: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'v': verbose = true; break;
+            default:
+                print_usage(argv[0]);
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    openlog("uart-bridge", LOG_PID | LOG_CONS, LOG_DAEMON);
+    if (!verbose) {
+        setlogmask(LOG_UPTO(LOG_INFO));
+    }
+    syslog(LOG_INFO, "UART Bridge Daemon starting...");
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = signal_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        clients[i].fd = -1;
+    }
+    for (int i = PUB_SLAB_SIZE - 1; i >= 0; i--) {
+        pub_free[pub_free_count++] = i;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        syslog(LOG_ERR, "Failed to create epoll instance: %s", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    uart_fd = open_uart(uart_device, B115200);
+    if (uart_fd < 0) {
+        syslog(LOG_ERR, "Failed to open UART, exiting");
+        cleanup();
+        return EXIT_FAILURE;
+    }
+
+    socket_fd = create_unix_socket(socket_path);
+    if (socket_fd < 0) {
+        cleanup();
+        return EXIT_FAILURE;
+    }
+
+    if (epoll_add(uart_fd, EPOLLIN | EPOLLOUT | EPOLLET, EV_UART) < 0 ||
+        epoll_add(socket_fd, EPOLLIN | EPOLLET, EV_LISTEN) < 0) {
+        cleanup();
+        return EXIT_FAILURE;
+    }
+
+    start_link_setup();
+
+    syslog(LOG_INFO, "UART Bridge Daemon running");
+
+    while (running) {
+        int timeout = next_timeout();   /* May queue link setup and client commands */
+        uint64_t woke_us;
+        int nfds;
+
+        /* Everything queued for the UART in the last pass, in one write */
+        flush_uart();
+        nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+        woke_us = now_us();
+
+        if (dump_stats) {
+            dump_stats = false;
+            log_stats();
+            if (write_trace() >= 0) {
+                syslog(LOG_INFO, "Trace written to %s", trace_path);
+            }
+        }
+        if (nfds < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            syslog(LOG_ERR, "epoll_wait() failed: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < nfds; i++) {
+            uint32_t token = events[i].data.u32;
+            uint32_t ev = events[i].events;
+
+            if (token == EV_UART) {
+                if (ev & EPOLLOUT) {
+                    flush_uart();
+                }
+                if (ev & EPOLLIN) {
+                    process_uart_data();
+                }
+            } else if (token == EV_LISTEN) {
+                accept_clients();
             } else {
-                syslog(LOG_INFO, "Client connected");
+                client_t *client = &clients[token - EV_CLIENT];
+
+                if (client->fd < 0) {
+                    continue;
+                }
+                if (ev & EPOLLOUT) {
+                    flush_client(client);
+                }
+                if (client->fd >= 0 && !client->eof &&
+                    (ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+                    process_client_data(client);
+                }
             }
         }
 
-        if (client_fd >= 0 && FD_ISSET(client_fd, &read_fds)) {
-            process_client_data(client_fd);
+        resume_clients();
+        if (nfds > 0) {
+            hist_record(&loop_hist, now_us() - woke_us);
         }
     }
 
+    syslog(LOG_INFO, "Shutting down...");
     cleanup();
     closelog();
     return EXIT_SUCCESS;
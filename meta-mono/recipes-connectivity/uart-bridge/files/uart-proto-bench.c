@@ -0,0 +1,159 @@
+/**
+ * @file uart-proto-bench.c
+ * @brief Host-side microbenchmark for libuartproto
+ *
+ * Times the ASCII parser, the message builder, opcode lookup (against the
+ * strcmp chain it replaces) and binary frame encode/decode, in ns per call.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+
+#include "uart-protocol.h"
+
+#define DEFAULT_ITERATIONS 2000000
+
+static const char *const sample_messages[] = {
+    "GPIO_SET#17:C,13,1",
+    "GPIO_GET:A,5",
+    "I2C_READ#4096:1,0x50,0x10,4",
+    "I2C_WRITE:1,0x68,0x6B,0",
+    "ADC_READ#3:1",
+    "PWM_SET:2,750",
+    "STATUS",
+    "PING#65535",
+};
+
+#define NUM_SAMPLES (sizeof(sample_messages) / sizeof(sample_messages[0]))
+
+/* Sink so the compiler cannot drop the loops */
+static volatile uint32_t sink;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* The lookup uart-bridge would need without a precomputed opcode */
+static uint8_t opcode_strcmp_chain(const char *name) {
+    if (strcmp(name, CMD_GPIO_SET) == 0) return OP_GPIO_SET;
+    if (strcmp(name, CMD_GPIO_GET) == 0) return OP_GPIO_GET;
+    if (strcmp(name, CMD_I2C_READ) == 0) return OP_I2C_READ;
+    if (strcmp(name, CMD_I2C_WRITE) == 0) return OP_I2C_WRITE;
+    if (strcmp(name, CMD_ADC_READ) == 0) return OP_ADC_READ;
+    if (strcmp(name, CMD_PWM_SET) == 0) return OP_PWM_SET;
+    if (strcmp(name, CMD_STATUS) == 0) return OP_STATUS;
+    if (strcmp(name, CMD_PING) == 0) return OP_PING;
+    if (strcmp(name, CMD_RESET) == 0) return OP_RESET;
+    if (strcmp(name, CMD_PROTO) == 0) return OP_PROTO;
+    if (strcmp(name, CMD_SET_BAUD) == 0) return OP_SET_BAUD;
+    if (strcmp(name, CMD_BATCH) == 0) return OP_BATCH;
+    if (strcmp(name, CMD_ADC_STREAM) == 0) return OP_ADC_STREAM;
+    if (strcmp(name, CMD_SUBSCRIBE) == 0) return OP_SUBSCRIBE;
+    if (strcmp(name, CMD_UNSUBSCRIBE) == 0) return OP_UNSUBSCRIBE;
+    if (strcmp(name, CMD_GPIO_WATCH) == 0) return OP_GPIO_WATCH;
+    if (strcmp(name, CMD_RING) == 0) return OP_RING;
+    if (strcmp(name, CMD_STATS) == 0) return OP_STATS;
+    if (strcmp(name, CMD_TRACE) == 0) return OP_TRACE;
+    return OP_NONE;
+}
+
+static void report(const char *what, uint64_t elapsed, long iterations) {
+    printf("  %-28s %8.1f ns/op\n", what, (double)elapsed / iterations);
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = argc > 1 ? atol(argv[1]) : DEFAULT_ITERATIONS;
+    size_t lengths[NUM_SAMPLES];
+    char names[NUM_SAMPLES][16];
+    uint8_t frames[NUM_SAMPLES][MAX_FRAME_LENGTH];
+    int frame_lengths[NUM_SAMPLES];
+    uint64_t start;
+
+    if (iterations <= 0) {
+        printf("Usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    for (size_t i = 0; i < NUM_SAMPLES; i++) {
+        uart_message_t msg;
+        uint32_t args[MAX_FRAME_ARGS];
+        int nargs;
+
+        lengths[i] = strlen(sample_messages[i]);
+        if (!parse_message(sample_messages[i], lengths[i], &msg)) {
+            fprintf(stderr, "Sample does not parse: %s\n", sample_messages[i]);
+            return 1;
+        }
+        snprintf(names[i], sizeof(names[i]), "%.*s", msg.name.len, msg.name.ptr);
+        nargs = uart_message_args(&msg, args, MAX_FRAME_ARGS);
+        frame_lengths[i] = uart_frame_encode(msg.opcode, msg.id, args, nargs, NULL, 0,
+                                             frames[i], sizeof(frames[i]));
+        printf("%-28s ascii %2zu bytes, binary %2d bytes\n",
+               sample_messages[i], lengths[i] + 1, frame_lengths[i]);
+    }
+
+    printf("\nlibuartproto, %ld iterations:\n", iterations);
+
+    start = now_ns();
+    for (long n = 0; n < iterations; n++) {
+        uart_message_t msg;
+        size_t i = n % NUM_SAMPLES;
+
+        parse_message(sample_messages[i], lengths[i], &msg);
+        sink += msg.opcode + msg.nparams;
+    }
+    report("parse_message", now_ns() - start, iterations);
+
+    start = now_ns();
+    for (long n = 0; n < iterations; n++) {
+        size_t i = n % NUM_SAMPLES;
+
+        sink += uart_opcode_from_name(names[i], strlen(names[i]));
+    }
+    report("uart_opcode_from_name", now_ns() - start, iterations);
+
+    start = now_ns();
+    for (long n = 0; n < iterations; n++) {
+        sink += opcode_strcmp_chain(names[n % NUM_SAMPLES]);
+    }
+    report("strcmp chain (baseline)", now_ns() - start, iterations);
+
+    start = now_ns();
+    for (long n = 0; n < iterations; n++) {
+        char buffer[MAX_MESSAGE_LENGTH];
+
+        sink += build_message(CMD_GPIO_SET, (uint16_t)n, "C,13,1", buffer, sizeof(buffer));
+    }
+    report("build_message", now_ns() - start, iterations);
+
+    start = now_ns();
+    for (long n = 0; n < iterations; n++) {
+        static const uint32_t args[] = { 'C', 13, 1 };
+        uint8_t frame[MAX_FRAME_LENGTH];
+
+        sink += uart_frame_encode(OP_GPIO_SET, (uint16_t)n, args, 3, NULL, 0, frame, sizeof(frame));
+    }
+    report("uart_frame_encode", now_ns() - start, iterations);
+
+    start = now_ns();
+    for (long n = 0; n < iterations; n++) {
+        size_t i = n % NUM_SAMPLES;
+        uint8_t frame[MAX_FRAME_LENGTH];
+        uart_frame_t decoded;
+
+        /* Decoding is in place, so work on a copy without the delimiter */
+        memcpy(frame, frames[i], frame_lengths[i] - 1);
+        sink += uart_frame_decode(frame, frame_lengths[i] - 1, &decoded) ? decoded.opcode : 0;
+    }
+    report("uart_frame_decode (+copy)", now_ns() - start, iterations);
+
+    return 0;
+}
@@ -0,0 +1,150 @@
+/**
+ * @file uart-proto-fuzz.c
+ * @brief Fuzz target for the libuartproto decoders
+ *
+ * Every input is fed to each decoder that sees bytes from the wire or a
+ * client: the ASCII parser and its argument conversion, BATCH encoding
+ * and decoding, binary frame decoding, TLM pairs and STATUS snapshots.
+ * Besides the sanitizers' checks, the slices and offsets the decoders
+ * return must stay inside the input.
+ *
+ * Built with clang -fsanitize=fuzzer, libFuzzer drives it. Built with
+ * -DUART_FUZZ_STDIN, it runs one input from stdin, for AFL or to replay
+ * a crash found by libFuzzer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "uart-protocol.h"
+
+/* Longest line or frame the daemon and the firmware accept */
+#define FUZZ_MAX_INPUT  MAX_FRAME_LENGTH
+
+#define FUZZ_CHECK(cond) do { if (!(cond)) abort(); } while (0)
+
+static void fuzz_slice(const uart_slice_t *slice, const char *start, size_t len) {
+    FUZZ_CHECK(slice->ptr >= start && slice->ptr + slice->len <= start + len);
+}
+
+static void fuzz_batch_payload(const uint8_t *payload, size_t len) {
+    uint32_t args[MAX_FRAME_ARGS];
+    uint8_t opcode;
+    size_t off = 0;
+
+    while (off < len) {
+        size_t before = off;
+
+        if (uart_batch_next(payload, len, &off, &opcode, args, MAX_FRAME_ARGS) < 0) {
+            break;
+        }
+        FUZZ_CHECK(off > before && off <= len);
+    }
+}
+
+/* ASCII line, as a client or the ASCII link sends it (no delimiter) */
+static void fuzz_message(const char *line, size_t len) {
+    uint32_t args[MAX_FRAME_ARGS];
+    uint8_t batch[MAX_MESSAGE_LENGTH];
+    uart_message_t msg;
+    int n;
+
+    if (!parse_message(line, len, &msg)) {
+        return;
+    }
+    FUZZ_CHECK(msg.nparams <= MAX_MESSAGE_PARAMS);
+    fuzz_slice(&msg.name, line, len);
+    fuzz_slice(&msg.params, line, len);
+    for (uint8_t i = 0; i < msg.nparams; i++) {
+        fuzz_slice(&msg.param[i], line, len);
+    }
+    uart_message_args(&msg, args, MAX_FRAME_ARGS);
+
+    if (msg.opcode == OP_BATCH) {
+        n = uart_batch_encode(&msg.params, batch, sizeof(batch));
+        if (n >= 0) {
+            FUZZ_CHECK((size_t)n <= sizeof(batch));
+            fuzz_batch_payload(batch, n);
+        }
+    }
+}
+
+/* Binary frame without its delimiter, decoded in place */
+static void fuzz_frame(uint8_t *buf, size_t len) {
+    uint32_t args[MAX_FRAME_ARGS];
+    const uint8_t *data;
+    size_t data_len;
+    uart_frame_t frame;
+
+    if (!uart_frame_decode(buf, len, &frame)) {
+        return;
+    }
+    FUZZ_CHECK(frame.payload >= buf && frame.payload + frame.payload_len <= buf + len);
+    uart_frame_args(&frame, args, MAX_FRAME_ARGS);
+    for (size_t nargs = 0; nargs <= 3; nargs++) {
+        if (uart_frame_data(&frame, args, nargs, &data, &data_len) == 0) {
+            FUZZ_CHECK(data >= frame.payload &&
+                       data + data_len <= frame.payload + frame.payload_len);
+        }
+    }
+    if (frame.opcode == OP_BATCH) {
+        fuzz_batch_payload(frame.payload, frame.payload_len);
+    }
+}
+
+static void fuzz_tlm(const uint8_t *pairs, size_t len) {
+    uint32_t value;
+    uint8_t field;
+    size_t off = 0;
+
+    while (off < len) {
+        size_t before = off;
+
+        if (uart_tlm_next(pairs, len, &off, &field, &value) < 0) {
+            break;
+        }
+        FUZZ_CHECK(off > before && off <= len && field < UART_TLM_FIELDS);
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    uart_status_t status;
+    uint8_t *copy;
+
+    if (size > FUZZ_MAX_INPUT) {
+        return 0;
+    }
+    /* Exact-size copy: reads past the input are caught by ASan */
+    copy = malloc(size ? size : 1);
+    if (copy == NULL) {
+        return 0;
+    }
+    memcpy(copy, data, size);
+
+    fuzz_message((const char *)data, size);
+    fuzz_batch_payload(data, size);
+    fuzz_tlm(data, size);
+    uart_status_decode(data, size, &status);
+    fuzz_frame(copy, size);
+
+    free(copy);
+    return 0;
+}
+
+#ifdef UART_FUZZ_STDIN
+int main(void) {
+    static uint8_t input[FUZZ_MAX_INPUT + 1];
+    size_t len = fread(input, 1, sizeof(input), stdin);
+    uint8_t *data = malloc(len ? len : 1);
+
+    if (data == NULL) {
+        return 1;
+    }
+    memcpy(data, input, len);
+    LLVMFuzzerTestOneInput(data, len);
+    free(data);
+    return 0;
+}
+#endif
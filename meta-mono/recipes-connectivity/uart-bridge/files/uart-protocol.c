@@ -0,0 +1,802 @@
+/**
+ * @file uart-protocol.c
+ * @brief libuartproto - protocol helpers shared by uart-bridge (Linux) and the Zephyr firmware
+ *
+ * Only depends on the C library headers, and never allocates, so the same
+ * file builds into libuartproto.so and into the STM32F411 application.
+ * The ASCII parser works in place: a uart_message_t only holds slices into
+ * the caller's buffer.
+ */
+
+#include <string.h>
+
+#include "uart-protocol.h"
+
+/* Names indexed by opcode; responses live at 0x80 + n */
+static const char *const command_names[] = {
+    [OP_GPIO_SET]   = CMD_GPIO_SET,
+    [OP_GPIO_GET]   = CMD_GPIO_GET,
+    [OP_I2C_READ]   = CMD_I2C_READ,
+    [OP_I2C_WRITE]  = CMD_I2C_WRITE,
+    [OP_ADC_READ]   = CMD_ADC_READ,
+    [OP_PWM_SET]    = CMD_PWM_SET,
+    [OP_STATUS]     = CMD_STATUS,
+    [OP_PING]       = CMD_PING,
+    [OP_RESET]      = CMD_RESET,
+    [OP_PROTO]      = CMD_PROTO,
+    [OP_SET_BAUD]   = CMD_SET_BAUD,
+    [OP_BATCH]      = CMD_BATCH,
+    [OP_ADC_STREAM] = CMD_ADC_STREAM,
+    [OP_SUBSCRIBE]  = CMD_SUBSCRIBE,
+    [OP_UNSUBSCRIBE] = CMD_UNSUBSCRIBE,
+    [OP_GPIO_WATCH] = CMD_GPIO_WATCH,
+    [OP_RING]       = CMD_RING,
+    [OP_STATS]      = CMD_STATS,
+    [OP_TRACE]      = CMD_TRACE,
+    [OP_TELEMETRY]  = CMD_TELEMETRY,
+    [OP_PROFILE]    = CMD_PROFILE,
+    [OP_THREADS]    = CMD_THREADS,
+};
+
+static const char *const response_names[] = {
+    [OP_OK - 0x80]          = RESP_OK,
+    [OP_ERROR - 0x80]       = RESP_ERROR,
+    [OP_STATUS_DATA - 0x80] = RESP_STATUS,
+    [OP_PONG - 0x80]        = RESP_PONG,
+    [OP_ADC_DATA - 0x80]    = RESP_ADC_DATA,
+    [OP_EVT - 0x80]         = RESP_EVT,
+    [OP_TLM - 0x80]         = RESP_TLM,
+};
+
+static const char *const event_names[UART_EVT_COUNT] = {
+    [UART_EVT_GPIO] = EVT_GPIO,
+};
+
+static const char *const error_names[UART_ERR_COUNT] = {
+    [UART_ERR_NONE]           = "",
+    [UART_ERR_INVALID_CMD]    = ERR_INVALID_CMD,
+    [UART_ERR_INVALID_PARAMS] = ERR_INVALID_PARAMS,
+    [UART_ERR_GPIO_FAIL]      = ERR_GPIO_FAIL,
+    [UART_ERR_I2C_FAIL]       = ERR_I2C_FAIL,
+    [UART_ERR_ADC_FAIL]       = ERR_ADC_FAIL,
+    [UART_ERR_PWM_FAIL]       = ERR_PWM_FAIL,
+    [UART_ERR_TIMEOUT]        = ERR_TIMEOUT,
+    [UART_ERR_BUSY]           = ERR_BUSY,
+};
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+/* CRC-16/CCITT-FALSE, one nibble at a time (32-byte table) */
+static const uint16_t crc16_nibble[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+};
+
+uint16_t uart_crc16(const uint8_t *data, size_t len) {
+    uint16_t crc = 0xFFFF;
+
+    while (len--) {
+        crc = (crc << 4) ^ crc16_nibble[(crc >> 12) ^ (*data >> 4)];
+        crc = (crc << 4) ^ crc16_nibble[(crc >> 12) ^ (*data & 0x0F)];
+        data++;
+    }
+    return crc;
+}
+
+size_t uart_varint_encode(uint32_t value, uint8_t *out) {
+    size_t n = 0;
+
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+int uart_varint_decode(const uint8_t *in, size_t len, uint32_t *value) {
+    uint32_t result = 0;
+
+    for (size_t i = 0; i < len && i < 5; i++) {
+        result |= (uint32_t)(in[i] & 0x7F) << (7 * i);
+        if (!(in[i] & 0x80)) {
+            *value = result;
+            return (int)i + 1;
+        }
+    }
+    return -1;
+}
+
+size_t uart_cobs_encode(const uint8_t *in, size_t len, uint8_t *out) {
+    size_t code_pos = 0;
+    size_t o = 1;
+    uint8_t code = 1;
+
+    for (size_t i = 0; i < len; i++) {
+        if (in[i] == FRAME_DELIMITER) {
+            out[code_pos] = code;
+            code_pos = o++;
+            code = 1;
+            continue;
+        }
+        out[o++] = in[i];
+        if (++code == 0xFF) {
+            out[code_pos] = code;
+            code_pos = o++;
+            code = 1;
+        }
+    }
+    out[code_pos] = code;
+    return o;
+}
+
+int uart_cobs_decode(uint8_t *buf, size_t len) {
+    size_t in = 0;
+    size_t out = 0;
+
+    while (in < len) {
+        uint8_t code = buf[in++];
+
+        if (code == FRAME_DELIMITER || in + code - 1 > len) {
+            return -1;
+        }
+        for (uint8_t i = 1; i < code; i++) {
+            buf[out++] = buf[in++];
+        }
+        if (code != 0xFF && in < len) {
+            buf[out++] = FRAME_DELIMITER;
+        }
+    }
+    return (int)out;
+}
+
+int uart_frame_encode(uint8_t opcode, uint16_t id, const uint32_t *args, size_t nargs,
+                      const uint8_t *data, size_t data_len, uint8_t *out, size_t out_size) {
+    uint8_t raw[MAX_MESSAGE_LENGTH];
+    size_t n = 0;
+    size_t encoded;
+    uint16_t crc;
+
+    /* Worst case: opcode + id + 5 bytes per arg + CRC */
+    if (1 + 3 + nargs * 5 + data_len + 2 > sizeof(raw)) {
+        return -1;
+    }
+
+    raw[n++] = opcode;
+    n += uart_varint_encode(id, raw + n);
+    for (size_t i = 0; i < nargs; i++) {
+        n += uart_varint_encode(args[i], raw + n);
+    }
+    if (data_len > 0) {
+        memcpy(raw + n, data, data_len);
+        n += data_len;
+    }
+
+    crc = uart_crc16(raw, n);
+    raw[n++] = (uint8_t)(crc >> 8);
+    raw[n++] = (uint8_t)crc;
+
+    if (n + n / 254 + 2 > out_size) {
+        return -1;
+    }
+    encoded = uart_cobs_encode(raw, n, out);
+    out[encoded++] = FRAME_DELIMITER;
+    return (int)encoded;
+}
+
+bool uart_frame_decode(uint8_t *buf, size_t len, uart_frame_t *frame) {
+    uint32_t id;
+    int n = uart_cobs_decode(buf, len);
+    int used;
+
+    /* opcode + id + CRC at minimum */
+    if (n < 4) {
+        return false;
+    }
+    if (uart_crc16(buf, n - 2) != (uint16_t)((buf[n - 2] << 8) | buf[n - 1])) {
+        return false;
+    }
+
+    used = uart_varint_decode(buf + 1, n - 3, &id);
+    if (used < 0 || id > REQUEST_ID_MAX) {
+        return false;
+    }
+
+    frame->opcode = buf[0];
+    frame->priority = UART_PRIO_NORMAL;
+    if (frame->opcode < OP_OK && (frame->opcode & OP_FLAG_URGENT)) {
+        frame->opcode &= ~OP_FLAG_URGENT;
+        frame->priority = UART_PRIO_HIGH;
+    }
+    if (frame->priority == UART_PRIO_NORMAL) {
+        frame->priority = uart_opcode_priority(frame->opcode);
+    }
+    frame->id = (uint16_t)id;
+    frame->payload = buf + 1 + used;
+    frame->payload_len = n - 3 - used;
+    return true;
+}
+
+int uart_frame_args(const uart_frame_t *frame, uint32_t *args, size_t max_args) {
+    size_t off = 0;
+    int nargs = 0;
+
+    while (off < frame->payload_len) {
+        int used;
+
+        if ((size_t)nargs == max_args) {
+            return -1;
+        }
+        used = uart_varint_decode(frame->payload + off, frame->payload_len - off, &args[nargs]);
+        if (used < 0) {
+            return -1;
+        }
+        off += used;
+        nargs++;
+    }
+    return nargs;
+}
+
+int uart_frame_data(const uart_frame_t *frame, uint32_t *args, size_t nargs,
+                    const uint8_t **data, size_t *data_len) {
+    size_t off = 0;
+
+    for (size_t i = 0; i < nargs; i++) {
+        int used = uart_varint_decode(frame->payload + off, frame->payload_len - off, &args[i]);
+
+        if (used < 0) {
+            return -1;
+        }
+        off += used;
+    }
+    *data = frame->payload + off;
+    *data_len = frame->payload_len - off;
+    return 0;
+}
+
+static bool is_name_char(char c) {
+    return (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+bool parse_message(const char *raw_message, size_t len, uart_message_t *msg) {
+    const char *p = raw_message;
+    const char *end;
+    size_t i = 0;
+    uint32_t id = REQUEST_ID_NONE;
+
+    while (len > 0 && (p[len - 1] == MESSAGE_DELIMITER || p[len - 1] == '\r')) {
+        len--;
+    }
+    if (len == 0 || len >= MAX_MESSAGE_LENGTH) {
+        return false;
+    }
+    end = p + len;
+
+    while (i < len && is_name_char(p[i])) {
+        i++;
+    }
+    if (i == 0) {
+        return false;
+    }
+    msg->name.ptr = p;
+    msg->name.len = (uint16_t)i;
+
+    if (i < len && p[i] == REQUEST_ID_SEPARATOR) {
+        size_t digits = 0;
+
+        for (i++; i < len && p[i] >= '0' && p[i] <= '9'; i++, digits++) {
+            id = id * 10 + (p[i] - '0');
+            if (id > REQUEST_ID_MAX) {
+                return false;
+            }
+        }
+        if (digits == 0) {
+            return false;
+        }
+    }
+    msg->id = (uint16_t)id;
+
+    msg->priority = UART_PRIO_NORMAL;
+    if (i < len && p[i] == PRIORITY_MARKER) {
+        msg->priority = UART_PRIO_HIGH;
+        i++;
+    }
+
+    msg->deadline_ms = 0;
+    if (i < len && p[i] == DEADLINE_SEPARATOR) {
+        uint32_t ms = 0;
+        size_t digits = 0;
+
+        for (i++; i < len && p[i] >= '0' && p[i] <= '9'; i++, digits++) {
+            ms = ms * 10 + (p[i] - '0');
+            if (ms > UINT16_MAX) {
+                return false;
+            }
+        }
+        if (digits == 0 || ms == 0) {
+            return false;
+        }
+        msg->deadline_ms = (uint16_t)ms;
+    }
+
+    msg->nparams = 0;
+    msg->params.ptr = end;
+    msg->params.len = 0;
+
+    if (i < len) {
+        const char *q;
+
+        if (p[i] != FIELD_SEPARATOR) {
+            return false;
+        }
+        msg->params.ptr = p + i + 1;
+        msg->params.len = (uint16_t)(len - i - 1);
+
+        /* Split on ','; the last slot takes whatever is left over */
+        q = msg->params.ptr;
+        while (q < end) {
+            const char *sep = q;
+
+            if (msg->nparams < MAX_MESSAGE_PARAMS - 1) {
+                while (sep < end && *sep != PARAM_SEPARATOR) {
+                    sep++;
+                }
+            } else {
+                sep = end;
+            }
+            msg->param[msg->nparams].ptr = q;
+            msg->param[msg->nparams].len = (uint16_t)(sep - q);
+            msg->nparams++;
+            q = sep + 1;
+        }
+        /* "a,b," has an empty last parameter, which uart_message_args() rejects */
+        if (q == end && msg->params.len > 0 && end[-1] == PARAM_SEPARATOR &&
+            msg->nparams < MAX_MESSAGE_PARAMS) {
+            msg->param[msg->nparams].ptr = end;
+            msg->param[msg->nparams].len = 0;
+            msg->nparams++;
+        }
+    }
+
+    msg->opcode = uart_opcode_from_name(msg->name.ptr, msg->name.len);
+    if (msg->priority == UART_PRIO_NORMAL) {
+        msg->priority = uart_opcode_priority(msg->opcode);
+    }
+    return true;
+}
+
+int build_message(const char *command, uint16_t id, const char *params,
+                  char *buffer, size_t buffer_size) {
+    size_t cmd_len = strlen(command);
+    size_t params_len = params ? strlen(params) : 0;
+    size_t n = 0;
+    char digits[5];
+    size_t ndigits = 0;
+
+    if (id != REQUEST_ID_NONE) {
+        for (uint16_t v = id; v > 0; v /= 10) {
+            digits[ndigits++] = (char)('0' + v % 10);
+        }
+    }
+
+    /* NAME [#id] [:params] \n */
+    if (cmd_len + (ndigits ? ndigits + 1 : 0) + (params ? params_len + 1 : 0) + 1 > buffer_size) {
+        return -1;
+    }
+
+    memcpy(buffer, command, cmd_len);
+    n = cmd_len;
+    if (ndigits > 0) {
+        buffer[n++] = REQUEST_ID_SEPARATOR;
+        while (ndigits > 0) {
+            buffer[n++] = digits[--ndigits];
+        }
+    }
+    if (params != NULL) {
+        buffer[n++] = FIELD_SEPARATOR;
+        memcpy(buffer + n, params, params_len);
+        n += params_len;
+    }
+    buffer[n++] = MESSAGE_DELIMITER;
+    return (int)n;
+}
+
+bool validate_message(const char *message, size_t len) {
+    uart_message_t msg;
+
+    for (size_t i = 0; i < len; i++) {
+        if ((message[i] < ' ' || message[i] > '~') && message[i] != MESSAGE_DELIMITER &&
+            message[i] != '\r') {
+            return false;
+        }
+    }
+    return parse_message(message, len, &msg) && msg.opcode != OP_NONE;
+}
+
+/* One parameter slice to a frame argument */
+static bool param_to_u32(const uart_slice_t *param, uint32_t *out) {
+    const char *p = param->ptr;
+    size_t len = param->len;
+    uint64_t value = 0;
+
+    if (len == 0) {
+        return false;
+    }
+
+    if (len == 1 && ((p[0] >= 'A' && p[0] <= 'Z') || (p[0] >= 'a' && p[0] <= 'z'))) {
+        *out = (uint8_t)p[0];
+        return true;
+    }
+
+    if (len > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+        for (size_t k = 2; k < len; k++) {
+            char c = p[k];
+            uint32_t digit;
+
+            if (c >= '0' && c <= '9') {
+                digit = c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                digit = c - 'a' + 10;
+            } else if (c >= 'A' && c <= 'F') {
+                digit = c - 'A' + 10;
+            } else {
+                return false;
+            }
+            value = (value << 4) | digit;
+            if (value > UINT32_MAX) {
+                return false;
+            }
+        }
+    } else {
+        for (size_t k = 0; k < len; k++) {
+            if (p[k] < '0' || p[k] > '9') {
+                return false;
+            }
+            value = value * 10 + (p[k] - '0');
+            if (value > UINT32_MAX) {
+                return false;
+            }
+        }
+    }
+
+    *out = (uint32_t)value;
+    return true;
+}
+
+int uart_message_args(const uart_message_t *msg, uint32_t *args, size_t max_args) {
+    if (msg->nparams > max_args) {
+        return -1;
+    }
+    for (uint8_t i = 0; i < msg->nparams; i++) {
+        if (!param_to_u32(&msg->param[i], &args[i])) {
+            return -1;
+        }
+    }
+    return msg->nparams;
+}
+
+int uart_batch_encode(const uart_slice_t *params, uint8_t *out, size_t out_size) {
+    const char *p = params->ptr;
+    const char *end = params->ptr + params->len;
+    size_t n = 0;
+    int count = 0;
+
+    while (p < end) {
+        const char *sep = memchr(p, BATCH_SEPARATOR, end - p);
+        uint32_t args[MAX_FRAME_ARGS];
+        uart_message_t sub;
+        int nargs;
+
+        if (sep == NULL) {
+            sep = end;
+        }
+        if (++count > MAX_BATCH_COMMANDS || !parse_message(p, sep - p, &sub) ||
+            sub.opcode == OP_NONE || sub.opcode >= OP_OK || sub.id != REQUEST_ID_NONE) {
+            return -1;
+        }
+        nargs = uart_message_args(&sub, args, MAX_FRAME_ARGS);
+        /* opcode + nargs + 5 bytes per arg, worst case */
+        if (nargs < 0 || n + 2 + (size_t)nargs * 5 > out_size) {
+            return -1;
+        }
+
+        out[n++] = sub.opcode;
+        n += uart_varint_encode((uint32_t)nargs, out + n);
+        for (int i = 0; i < nargs; i++) {
+            n += uart_varint_encode(args[i], out + n);
+        }
+        p = sep + 1;
+    }
+    return count > 0 ? (int)n : -1;
+}
+
+int uart_batch_next(const uint8_t *payload, size_t len, size_t *off,
+                    uint8_t *opcode, uint32_t *args, size_t max_args) {
+    size_t o = *off;
+    uint32_t nargs;
+    int used;
+
+    if (o >= len) {
+        return -1;
+    }
+    *opcode = payload[o++];
+
+    used = uart_varint_decode(payload + o, len - o, &nargs);
+    if (used < 0 || nargs > max_args) {
+        return -1;
+    }
+    o += used;
+
+    for (uint32_t i = 0; i < nargs; i++) {
+        used = uart_varint_decode(payload + o, len - o, &args[i]);
+        if (used < 0) {
+            return -1;
+        }
+        o += used;
+    }
+
+    *off = o;
+    return (int)nargs;
+}
+
+int uart_tlm_next(const uint8_t *pairs, size_t len, size_t *off, uint8_t *field,
+                  uint32_t *value) {
+    size_t o = *off;
+    uint32_t f;
+    int used;
+
+    used = o < len ? uart_varint_decode(pairs + o, len - o, &f) : -1;
+    if (used < 0 || f >= UART_TLM_FIELDS) {
+        return -1;
+    }
+    o += used;
+    used = uart_varint_decode(pairs + o, len - o, value);
+    if (used < 0) {
+        return -1;
+    }
+    *field = (uint8_t)f;
+    *off = o + used;
+    return 0;
+}
+
+uint8_t uart_profile_bucket(uint32_t cycles) {
+    uint8_t bucket = 0;
+
+    for (cycles >>= UART_PROFILE_SHIFT; cycles != 0 && bucket < UART_PROFILE_BUCKETS - 1;
+         cycles >>= 1) {
+        bucket++;
+    }
+    return bucket;
+}
+
+size_t uart_adc_pack(const uint16_t *samples, size_t count, uint8_t *out) {
+    size_t n = 0;
+
+    for (size_t i = 0; i + 1 < count; i += 2) {
+        out[n++] = (uint8_t)samples[i];
+        out[n++] = (uint8_t)(((samples[i] >> 8) & 0x0F) | (samples[i + 1] << 4));
+        out[n++] = (uint8_t)(samples[i + 1] >> 4);
+    }
+    /* Odd count: the last sample takes two bytes */
+    if (count & 1) {
+        out[n++] = (uint8_t)samples[count - 1];
+        out[n++] = (uint8_t)((samples[count - 1] >> 8) & 0x0F);
+    }
+    return n;
+}
+
+int uart_adc_unpack(const uint8_t *data, size_t len, uint16_t *samples, size_t max_samples) {
+    size_t count = len / 3 * 2 + (len % 3 == 2 ? 1 : 0);
+    size_t n = 0;
+
+    if (len % 3 == 1 || count > max_samples) {
+        return -1;
+    }
+    for (size_t i = 0; i + 2 < len; i += 3) {
+        samples[n++] = data[i] | (uint16_t)(data[i + 1] & 0x0F) << 8;
+        samples[n++] = data[i + 1] >> 4 | (uint16_t)data[i + 2] << 4;
+    }
+    if (len % 3 == 2) {
+        samples[n++] = data[len - 2] | (uint16_t)(data[len - 1] & 0x0F) << 8;
+    }
+    return (int)n;
+}
+
+_Static_assert(sizeof(uart_status_t) == 116, "uart_status_t layout changed");
+
+int uart_status_decode(const uint8_t *data, size_t len, uart_status_t *status) {
+    size_t size;
+
+    /* Everything up to the uptime is in every version */
+    if (len < 8 || data[0] != UART_STATUS_VERSION || data[1] < 8 || data[1] > len) {
+        return -1;
+    }
+    size = data[1] < sizeof(*status) ? data[1] : sizeof(*status);
+    memset(status, 0, sizeof(*status));
+    memcpy(status, data, size);
+    return 0;
+}
+
+size_t uart_hex_encode(const uint8_t *data, size_t len, char *out) {
+    static const char digits[] = "0123456789abcdef";
+
+    for (size_t i = 0; i < len; i++) {
+        out[2 * i] = digits[data[i] >> 4];
+        out[2 * i + 1] = digits[data[i] & 0x0F];
+    }
+    return 2 * len;
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+int uart_hex_decode(const char *hex, size_t len, uint8_t *out, size_t out_size) {
+    if (len % 2 != 0 || len / 2 > out_size) {
+        return -1;
+    }
+    for (size_t i = 0; i < len; i += 2) {
+        int hi = hex_digit(hex[i]);
+        int lo = hex_digit(hex[i + 1]);
+
+        if (hi < 0 || lo < 0) {
+            return -1;
+        }
+        out[i / 2] = (uint8_t)(hi << 4 | lo);
+    }
+    return (int)(len / 2);
+}
+
+int uart_event_format(const uint32_t *args, size_t nargs, char *out, size_t size) {
+    size_t n;
+
+    if (nargs == 0 || args[0] == UART_EVT_NONE || args[0] >= UART_EVT_COUNT) {
+        return -1;
+    }
+    n = strlen(event_names[args[0]]);
+    if (n >= size) {
+        return -1;
+    }
+    memcpy(out, event_names[args[0]], n);
+
+    for (size_t i = 1; i < nargs; i++) {
+        char digits[10];
+        size_t ndigits = 0;
+        uint32_t v = args[i];
+
+        /* GPIO port as its letter, everything else in decimal */
+        if (args[0] == UART_EVT_GPIO && i == 1 && v >= 'A' && v <= 'Z') {
+            digits[ndigits++] = (char)v;
+        } else {
+            do {
+                digits[ndigits++] = (char)('0' + v % 10);
+                v /= 10;
+            } while (v > 0);
+        }
+        if (n + 1 + ndigits >= size) {
+            return -1;
+        }
+        out[n++] = PARAM_SEPARATOR;
+        while (ndigits > 0) {
+            out[n++] = digits[--ndigits];
+        }
+    }
+    out[n] = '\0';
+    return (int)n;
+}
+
+/* Confirm the single candidate picked by uart_opcode_from_name() */
+static uint8_t name_match(const char *name, size_t len, const char *candidate, uint8_t opcode) {
+    return memcmp(name, candidate, len) == 0 ? opcode : OP_NONE;
+}
+
+uint8_t uart_opcode_from_name(const char *name, size_t len) {
+    switch (len) {
+    case 2:
+        return name_match(name, len, RESP_OK, OP_OK);
+    case 3:
+        return name[0] == 'E' ? name_match(name, len, RESP_EVT, OP_EVT)
+                              : name_match(name, len, RESP_TLM, OP_TLM);
+    case 4:
+        switch (name[1]) {
+        case 'I': return name[0] == 'P' ? name_match(name, len, CMD_PING, OP_PING)
+                                        : name_match(name, len, CMD_RING, OP_RING);
+        case 'O': return name_match(name, len, RESP_PONG, OP_PONG);
+        }
+        return OP_NONE;
+    case 5:
+        switch (name[0]) {
+        case 'B': return name_match(name, len, CMD_BATCH, OP_BATCH);
+        case 'E': return name_match(name, len, RESP_ERROR, OP_ERROR);
+        case 'P': return name_match(name, len, CMD_PROTO, OP_PROTO);
+        case 'R': return name_match(name, len, CMD_RESET, OP_RESET);
+        case 'S': return name_match(name, len, CMD_STATS, OP_STATS);
+        case 'T': return name_match(name, len, CMD_TRACE, OP_TRACE);
+        }
+        return OP_NONE;
+    case 6:
+        return name_match(name, len, CMD_STATUS, OP_STATUS);
+    case 7:
+        switch (name[1]) {
+        case 'W': return name_match(name, len, CMD_PWM_SET, OP_PWM_SET);
+        case 'R': return name_match(name, len, CMD_PROFILE, OP_PROFILE);
+        case 'H': return name_match(name, len, CMD_THREADS, OP_THREADS);
+        }
+        return OP_NONE;
+    case 8:
+        switch (name[0]) {
+        case 'A':
+            return name[4] == 'R' ? name_match(name, len, CMD_ADC_READ, OP_ADC_READ)
+                                  : name_match(name, len, RESP_ADC_DATA, OP_ADC_DATA);
+        case 'I': return name_match(name, len, CMD_I2C_READ, OP_I2C_READ);
+        case 'S': return name_match(name, len, CMD_SET_BAUD, OP_SET_BAUD);
+        case 'G':
+            return name[5] == 'S' ? name_match(name, len, CMD_GPIO_SET, OP_GPIO_SET)
+                                  : name_match(name, len, CMD_GPIO_GET, OP_GPIO_GET);
+        }
+        return OP_NONE;
+    case 9:
+        switch (name[0]) {
+        case 'I': return name_match(name, len, CMD_I2C_WRITE, OP_I2C_WRITE);
+        case 'S': return name_match(name, len, CMD_SUBSCRIBE, OP_SUBSCRIBE);
+        case 'T': return name_match(name, len, CMD_TELEMETRY, OP_TELEMETRY);
+        }
+        return OP_NONE;
+    case 10:
+        return name[0] == 'A' ? name_match(name, len, CMD_ADC_STREAM, OP_ADC_STREAM)
+                              : name_match(name, len, CMD_GPIO_WATCH, OP_GPIO_WATCH);
+    case 11:
+        return name_match(name, len, CMD_UNSUBSCRIBE, OP_UNSUBSCRIBE);
+    }
+    return OP_NONE;
+}
+
+const char *uart_opcode_name(uint8_t opcode) {
+    if (opcode >= 0x80) {
+        return (size_t)(opcode - 0x80) < ARRAY_LEN(response_names) ?
+               response_names[opcode - 0x80] : NULL;
+    }
+    return opcode < ARRAY_LEN(command_names) ? command_names[opcode] : NULL;
+}
+
+uint8_t uart_opcode_priority(uint8_t opcode) {
+    switch (opcode) {
+        case OP_GPIO_SET:
+        case OP_GPIO_GET:
+        case OP_PWM_SET:
+        case OP_PING:
+        case OP_RESET:
+        case OP_PROTO:
+        case OP_SET_BAUD:
+        case OP_GPIO_WATCH:
+            return UART_PRIO_HIGH;
+        default:
+            return UART_PRIO_NORMAL;
+    }
+}
+
+const char *uart_error_name(uint8_t code) {
+    return code < UART_ERR_COUNT ? error_names[code] : ERR_INVALID_CMD;
+}
+
+bool uart_baudrate_supported(uint32_t rate) {
+    static const uint32_t rates[] = {
+        115200, 230400, 460800, 921600, 1000000, 1500000, 2000000, 3000000,
+    };
+
+    for (size_t i = 0; i < ARRAY_LEN(rates); i++) {
+        if (rates[i] == rate) {
+            return rate <= UART_BAUDRATE_MAX;
+        }
+    }
+    return false;
+}
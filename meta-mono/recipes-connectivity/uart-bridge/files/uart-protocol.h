@@ -6,21 +6,150 @@
  * - i.MX6ULL (Cortex-A7) running Linux
  * - STM32F411 (Cortex-M4) running Zephyr RTOS
  * 
- * Communication: UART at 115200 baud (configurable up to 3Mbps)
+ * Communication: UART at 115200 baud, raised up to 3Mbps with SET_BAUD
  * Format: ASCII text-based protocol with newline termination
+ *
+ * Every command may carry a request ID which the STM32 echoes in its
+ * response, so several commands can be outstanding at once:
+ *
+ *   GPIO_SET#17:C,13,1   ->   OK#17
+ *   PING#18              ->   PONG#18
+ *
+ * Commands without an ID are still accepted; their response carries none.
+ *
+ * Commands run in one of two priority classes. RESET, PING, PROTO,
+ * SET_BAUD and the GPIO/PWM commands are high priority, everything else
+ * (I2C, ADC, STATUS, BATCH) normal; '!' after the ID raises a command to
+ * high. A deadline in milliseconds after '@' is for uart-bridge only: a
+ * command still queued in the daemon when it expires is answered
+ * ERROR:TIMEOUT and never sent.
+ *
+ *   I2C_READ#21!:1,0x50,0,4
+ *   I2C_READ#22@50:1,0x50,0,4
+ *
+ * The daemon sends high-priority commands ahead of queued normal ones,
+ * and the STM32 runs them on the protocol thread while normal ones wait
+ * for a lower-priority work queue. In a binary frame, OP_FLAG_URGENT in
+ * the opcode byte stands for '!'; request opcodes stay below it.
+ *
+ * After a successful PROTO:1 exchange both sides switch to binary framing:
+ *
+ *   COBS( opcode | id (varint) | args (varint...) | CRC-16 ) 0x00
+ *
+ * The CRC is CRC-16/CCITT-FALSE over opcode..args, sent big-endian.
+ * ASCII parameters map to varint arguments one to one: a single letter
+ * (GPIO port) is sent as its character code, numbers as their value.
+ * OK/ERROR responses carry varints, STATUS carries its snapshot as raw
+ * bytes.
+ *
+ * STATUS is answered with a fixed-layout binary snapshot (uart_status_t):
+ * the struct itself in a binary frame, its bytes as hex in ASCII
+ * (STATUS:<hex>). uart-bridge renders it as JSON for clients, in parts
+ * (STATUS, STATUS:errors, STATUS:memory, STATUS:threads, STATUS:pools) so
+ * each fits a line; STATUS:raw passes the hex through for
+ * uart_status_decode().
+ *
+ * SET_BAUD:rate is answered with OK at the old rate, then both sides
+ * switch. The STM32 keeps the new rate only if a valid command arrives
+ * within BAUD_VERIFY_TIMEOUT_MS; the daemon sends PING and goes back to
+ * the old rate if no PONG comes back in that time.
+ *
+ * BATCH runs several commands back to back on the STM32 with a single
+ * round trip; sub-commands are separated by ';' and carry no request ID:
+ *
+ *   BATCH#20:PWM_SET:1,500;PWM_SET:2,500;GPIO_GET:A,0   ->   OK#20:1
+ *
+ * Sub-commands that do not block (GPIO_SET, GPIO_GET, PWM_SET, PING,
+ * GPIO_WATCH) run without other commands in between. I2C_READ, I2C_WRITE
+ * and ADC_READ wait for their transfer, and other commands may run while
+ * they do, so a batch is only atomic between blocking sub-commands.
+ *
+ * Nothing runs unless every sub-command is well-formed. The OK carries the
+ * values of all sub-commands in order; the first failure stops the batch
+ * and is answered as ERROR:code,index (0-based sub-command index). In a
+ * binary frame the payload is, per sub-command: opcode, nargs (varint),
+ * args (varints).
+ *
+ * ADC_STREAM:channel,rate,count samples one channel at rate Hz (count
+ * samples, 0 = until stopped with a rate of 0). The samples arrive as
+ * unsolicited ADC_DATA messages without request ID, one per block:
+ *
+ *   ADC_DATA:channel,seq,<packed samples as hex>
+ *
+ * seq counts blocks, so a gap means blocks were lost. Samples are 12 bit,
+ * packed two into three bytes (uart_adc_pack); a binary frame carries
+ * channel and seq as varints followed by the packed bytes. uart-bridge
+ * only forwards unsolicited messages to clients that asked for them with
+ * SUBSCRIBE:filter, a prefix of the message line (UNSUBSCRIBE:filter to
+ * stop). RING:bytes moves a client's unsolicited messages to a shared
+ * memory ring (see uart-bridge-client.h). STATS[:command] reports the
+ * daemon's own counters, or one command's round-trip times, and TRACE
+ * writes its record of recent traffic to a file. These never reach the
+ * STM32.
+ *
+ * GPIO_WATCH:port,pin,edges reports edges on an input pin (GPIO_WATCH_*,
+ * 0 stops) as unsolicited events, captured by interrupt on the STM32:
+ *
+ *   EVT:GPIO,port,pin,level,time_us,seq
+ *
+ * time_us counts microseconds since the STM32 booted (modulo 2^32), seq
+ * counts events so a gap means some were lost. In a binary frame all
+ * fields are varints, the event type (UART_EVT_*) and port as numbers.
+ *
+ * TELEMETRY:period_ms,ports,channels[,deadband] has the STM32 sample GPIO
+ * ports (bit n = port 'A' + n), ADC channels (bit n = channel n) and its
+ * error counters every period_ms (0 stops), and push only what changed:
+ *
+ *   TLM:seq,flags,max_gap_ms,<field/value pairs as hex>
+ *
+ * The pairs are varints, a field (UART_TLM_*) and its new value. ADC
+ * values count as changed once they move by more than deadband. At least
+ * every max_gap_ms all fields are sent again (UART_TLM_KEYFRAME), so a
+ * reader that missed a message (a gap in seq) recovers, and silence for
+ * longer means the values are stale. A binary frame carries seq, flags
+ * and max_gap_ms as varints followed by the raw pairs.
+ *
+ * PROFILE reports where the STM32 spends its time on commands. Each one
+ * is timed in CPU cycles through the UART_PROFILE_* phases and counted
+ * into a histogram per opcode and phase:
+ *
+ *   PROFILE              ->   OK:cycles_per_sec,opcodes (bit n = opcode n seen)
+ *   PROFILE:opcode,phase ->   OK:max_cycles,<UART_PROFILE_BUCKETS counts>
+ *   PROFILE:0            ->   OK (all histograms cleared)
+ *
+ * Bucket 0 counts phases shorter than 2^UART_PROFILE_SHIFT cycles, bucket
+ * n those shorter than 2^(UART_PROFILE_SHIFT + n), the last one the rest
+ * (uart_profile_bucket()).
+ *
+ * THREADS reports what the STM32's threads and heap use, for sizing
+ * stacks and pools:
+ *
+ *   THREADS         ->   OK:count,time_us,heap_size,heap_free,heap_max_used
+ *   THREADS:index   ->   OK:stack_size,stack_used,runtime_us,<name>
+ *
+ * index runs from 0 to count - 1. stack_used is the high-water mark in
+ * bytes. runtime_us is the thread's CPU time since boot and time_us that
+ * of all threads together, idle included, both modulo 2^32: the change of
+ * one over the change of the other between two queries is the thread's
+ * CPU share. heap_max_used is the most the system heap has had allocated
+ * at once since boot. The name follows as one argument per character
+ * code, at most UART_THREAD_NAME_MAX of them.
  */
 
 #ifndef UART_PROTOCOL_H
 #define UART_PROTOCOL_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
 /* Protocol version */
-#define PROTOCOL_VERSION "1.0"
+#define PROTOCOL_VERSION "1.6"
 
 /* UART settings */
 #define UART_BAUDRATE 115200
+#define UART_BAUDRATE_MAX 3000000
+#define BAUD_VERIFY_TIMEOUT_MS 1000
 #define UART_DEVICE "/dev/ttymxc1"  /* UART2 on i.MX6ULL */
 
 /* Message format */
@@ -28,6 +157,13 @@
 #define MESSAGE_DELIMITER '\n'
 #define FIELD_SEPARATOR ':'
 #define PARAM_SEPARATOR ','
+#define REQUEST_ID_SEPARATOR '#'
+#define PRIORITY_MARKER '!'
+#define DEADLINE_SEPARATOR '@'
+
+/* Request IDs (decimal, 0 means "no ID") */
+#define REQUEST_ID_NONE 0
+#define REQUEST_ID_MAX  65535
 
 /* Command types from Linux to STM32 */
 #define CMD_GPIO_SET    "GPIO_SET"      /* Set GPIO pin: GPIO_SET:port,pin,value */
@@ -39,13 +175,34 @@
 #define CMD_STATUS      "STATUS"        /* Get system status: STATUS */
 #define CMD_PING        "PING"          /* Ping test: PING */
 #define CMD_RESET       "RESET"         /* Reset STM32: RESET */
+#define CMD_PROTO       "PROTO"         /* Select framing: PROTO:mode */
+#define CMD_SET_BAUD    "SET_BAUD"      /* Change line rate: SET_BAUD:rate */
+#define CMD_BATCH       "BATCH"         /* Run several commands: BATCH:CMD[:args];... */
+#define CMD_ADC_STREAM  "ADC_STREAM"    /* Sample continuously: ADC_STREAM:channel,rate,count */
+#define CMD_SUBSCRIBE   "SUBSCRIBE"     /* uart-bridge only: SUBSCRIBE:EVT:GPIO* */
+#define CMD_UNSUBSCRIBE "UNSUBSCRIBE"   /* uart-bridge only: UNSUBSCRIBE:EVT:GPIO* */
+#define CMD_GPIO_WATCH  "GPIO_WATCH"    /* Report edges: GPIO_WATCH:port,pin,edges */
+#define CMD_RING        "RING"          /* uart-bridge only: RING:bytes */
+#define CMD_STATS       "STATS"         /* uart-bridge only: STATS[:command] */
+#define CMD_TRACE       "TRACE"         /* uart-bridge only: TRACE */
+#define CMD_TELEMETRY   "TELEMETRY"     /* Push changes: TELEMETRY:period_ms,ports,channels[,deadband] */
+#define CMD_PROFILE     "PROFILE"       /* Cycle histograms: PROFILE[:opcode[,phase]] */
+#define CMD_THREADS     "THREADS"       /* Thread and heap use: THREADS[:index] */
 
 /* Response types from STM32 to Linux */
 #define RESP_OK         "OK"            /* Success: OK or OK:data */
 #define RESP_ERROR      "ERROR"         /* Error: ERROR:message */
-#define RESP_STATUS     "STATUS"        /* Status: STATUS:{json} */
+#define RESP_STATUS     "STATUS"        /* Status: STATUS:<uart_status_t as hex> */
 #define RESP_PONG       "PONG"          /* Ping response: PONG */
 
+/* Unsolicited messages from STM32 to Linux (no request ID) */
+#define RESP_ADC_DATA   "ADC_DATA"      /* Sample block: ADC_DATA:channel,seq,hex */
+#define RESP_EVT        "EVT"           /* Event: EVT:type,... */
+#define RESP_TLM        "TLM"           /* Telemetry: TLM:seq,flags,max_gap_ms,hex */
+
+/* EVT types */
+#define EVT_GPIO        "GPIO"          /* EVT:GPIO,port,pin,level,time_us,seq */
+
 /* Error codes */
 #define ERR_INVALID_CMD     "INVALID_COMMAND"
 #define ERR_INVALID_PARAMS  "INVALID_PARAMETERS"
@@ -56,6 +213,213 @@
 #define ERR_TIMEOUT         "TIMEOUT"
 #define ERR_BUSY            "BUSY"
 
+/* Command priority classes */
+typedef enum {
+    UART_PRIO_NORMAL = 0,
+    UART_PRIO_HIGH,
+    UART_PRIORITIES
+} uart_priority_t;
+
+/* PROTO modes */
+#define PROTO_ASCII     0
+#define PROTO_BINARY    1
+
+/* BATCH */
+#define BATCH_SEPARATOR     ';'
+#define MAX_BATCH_COMMANDS  16
+
+/* GPIO_WATCH edges */
+#define GPIO_WATCH_OFF      0
+#define GPIO_WATCH_RISING   1
+#define GPIO_WATCH_FALLING  2
+#define GPIO_WATCH_BOTH     3
+
+/* ADC_STREAM */
+#define ADC_STREAM_RATE_MAX     10000   /* Samples per second */
+#define ADC_DATA_MAX_SAMPLES    64      /* Per ADC_DATA block */
+#define UART_ADC_PACKED_SIZE(n) (((n) * 3 + 1) / 2)
+
+/* Binary framing */
+#define FRAME_DELIMITER     0x00
+#define MAX_FRAME_ARGS      16
+#define MAX_FRAME_LENGTH    (MAX_MESSAGE_LENGTH + MAX_MESSAGE_LENGTH / 254 + 2)
+
+/* Binary opcodes */
+typedef enum {
+    OP_NONE         = 0x00,
+    OP_GPIO_SET     = 0x01,
+    OP_GPIO_GET     = 0x02,
+    OP_I2C_READ     = 0x03,
+    OP_I2C_WRITE    = 0x04,
+    OP_ADC_READ     = 0x05,
+    OP_PWM_SET      = 0x06,
+    OP_STATUS       = 0x07,
+    OP_PING         = 0x08,
+    OP_RESET        = 0x09,
+    OP_PROTO        = 0x0A,
+    OP_SET_BAUD     = 0x0B,
+    OP_BATCH        = 0x0C,
+    OP_ADC_STREAM   = 0x0D,
+    OP_SUBSCRIBE    = 0x0E,     /* Handled by uart-bridge */
+    OP_UNSUBSCRIBE  = 0x0F,     /* Handled by uart-bridge */
+    OP_GPIO_WATCH   = 0x10,
+    OP_RING         = 0x11,     /* Handled by uart-bridge */
+    OP_STATS        = 0x12,     /* Handled by uart-bridge */
+    OP_TRACE        = 0x13,     /* Handled by uart-bridge */
+    OP_TELEMETRY    = 0x14,
+    OP_PROFILE      = 0x15,
+    OP_THREADS      = 0x16,
+
+    OP_OK           = 0x80,
+    OP_ERROR        = 0x81,
+    OP_STATUS_DATA  = 0x82,
+    OP_PONG         = 0x83,
+
+    /* Unsolicited, from OP_FIRST_UNSOLICITED up */
+    OP_ADC_DATA     = 0x84,
+    OP_EVT          = 0x85,
+    OP_TLM          = 0x86,
+} uart_opcode_t;
+
+#define OP_FIRST_UNSOLICITED OP_ADC_DATA
+
+/* Request opcode byte: run at UART_PRIO_HIGH whatever the opcode */
+#define OP_FLAG_URGENT 0x40
+
+/* Binary error codes (ERROR responses), same order as ERR_* above */
+typedef enum {
+    UART_ERR_NONE = 0,
+    UART_ERR_INVALID_CMD,
+    UART_ERR_INVALID_PARAMS,
+    UART_ERR_GPIO_FAIL,
+    UART_ERR_I2C_FAIL,
+    UART_ERR_ADC_FAIL,
+    UART_ERR_PWM_FAIL,
+    UART_ERR_TIMEOUT,
+    UART_ERR_BUSY,
+    UART_ERR_COUNT
+} uart_error_t;
+
+/* EVT types (first argument of an EVT frame) */
+typedef enum {
+    UART_EVT_NONE = 0,
+    UART_EVT_GPIO,
+    UART_EVT_COUNT
+} uart_event_t;
+
+/*
+ * STATUS snapshot. Little-endian, as on both CPUs, and laid out without
+ * padding. Fields are only ever appended: size is what the sender filled
+ * in, and a reader takes the part it knows. version changes only if a
+ * field changes meaning.
+ */
+#define UART_STATUS_VERSION     1
+
+/* reset_cause bits, the RCC_CSR flags of this boot */
+#define UART_RESET_POWER_ON     0x01
+#define UART_RESET_PIN          0x02
+#define UART_RESET_BROWNOUT     0x04
+#define UART_RESET_SOFTWARE     0x08
+#define UART_RESET_WATCHDOG     0x10
+#define UART_RESET_LOW_POWER    0x20
+
+/* flags bits */
+#define UART_STATUS_BINARY      0x01    /* Link uses binary framing */
+
+/* threads[] slots */
+enum {
+    UART_STATUS_THREAD_BRIDGE,          /* Protocol thread, high-priority commands */
+    UART_STATUS_THREAD_BULK,            /* Work queue, normal-priority commands */
+    UART_STATUS_THREADS
+};
+
+typedef struct {
+    uint16_t stack_size;                /* Bytes */
+    uint16_t stack_used;                /* High-water mark, bytes */
+    uint16_t cpu_permille;              /* Share of the CPU since the previous STATUS */
+    uint16_t reserved;
+} uart_status_thread_t;
+
+/* pools[] slots: the STM32's fixed-block pools of the command path */
+enum {
+    UART_STATUS_POOL_JOB,               /* Received frames queued as commands */
+    UART_STATUS_POOL_TX,                /* Reply and message encoding buffers */
+    UART_STATUS_POOL_ADC,               /* ADC_STREAM sample blocks */
+    UART_STATUS_POOLS
+};
+
+typedef struct {
+    uint16_t blocks;
+    uint16_t max_used;                  /* High-water mark */
+    uint32_t exhausted;                 /* Allocations that found no free block */
+} uart_status_pool_t;
+
+typedef struct {
+    uint8_t version;                    /* UART_STATUS_VERSION */
+    uint8_t size;                       /* Bytes filled in */
+    uint8_t reset_cause;                /* UART_RESET_* */
+    uint8_t flags;                      /* UART_STATUS_* */
+    uint32_t uptime_ms;
+    uint32_t kernel_version;            /* 0x00MMmmpp (KERNEL_VERSION_NUMBER) */
+    uint32_t sysclk_hz;
+    uint32_t baudrate;
+    uint32_t rx_bytes;                  /* Bridge UART receive side */
+    uint32_t rx_dropped;
+    uint32_t rx_overruns;
+    uint32_t rx_errors;
+    uint32_t crc_errors;
+    uint32_t commands;
+    uint32_t gpio_errors;               /* ERROR responses by peripheral */
+    uint32_t i2c_errors;
+    uint32_t adc_errors;
+    uint32_t pwm_errors;
+    uint32_t heap_size;                 /* System heap (k_malloc), bytes */
+    uint32_t heap_used;
+    uint32_t heap_max_used;
+    uint16_t cpu_permille;              /* All threads but idle, since the previous STATUS */
+    uint16_t reserved;
+    uart_status_thread_t threads[UART_STATUS_THREADS];
+    uart_status_pool_t pools[UART_STATUS_POOLS];
+} uart_status_t;
+
+/* TELEMETRY fields, the first varint of each TLM pair */
+enum {
+    UART_TLM_GPIO           = 0x00,     /* + port - 'A': input levels of the port */
+    UART_TLM_RX_ERRORS      = 0x10,     /* Counters as in uart_status_t */
+    UART_TLM_RX_OVERRUNS,
+    UART_TLM_CRC_ERRORS,
+    UART_TLM_GPIO_ERRORS,
+    UART_TLM_I2C_ERRORS,
+    UART_TLM_ADC_ERRORS,
+    UART_TLM_PWM_ERRORS,
+    UART_TLM_ADC            = 0x20,     /* + channel: last conversion */
+    UART_TLM_FIELDS         = UART_TLM_ADC + 19
+};
+
+/* TLM flags */
+#define UART_TLM_KEYFRAME       0x01    /* Part of a full resend */
+
+#define TELEMETRY_PORTS_MAX     8       /* Ports A-H */
+#define TELEMETRY_PERIOD_MIN_MS 10
+#define TLM_MAX_PAIRS_LENGTH    96      /* Pair bytes per TLM, fits as hex in ASCII */
+
+/* PROFILE phases, in the order a command goes through them */
+enum {
+    UART_PROFILE_PARSE,                 /* Complete frame to decoded arguments */
+    UART_PROFILE_DISPATCH,              /* To the handler, bulk queue wait included */
+    UART_PROFILE_EXECUTE,               /* Handler up to its reply: peripheral access */
+    UART_PROFILE_ENCODE,                /* Reply formatted or framed */
+    UART_PROFILE_TX,                    /* Reply handed to the UART until it is out */
+    UART_PROFILE_PHASES
+};
+
+#define UART_PROFILE_BUCKETS    12
+#define UART_PROFILE_SHIFT      9       /* Bucket 0: under 512 cycles */
+
+/* THREADS:index reply: three values, then the name */
+#define UART_THREAD_VALUES      3
+#define UART_THREAD_NAME_MAX    (MAX_FRAME_ARGS - UART_THREAD_VALUES)
+
 /* GPIO ports (STM32F411) */
 #define GPIO_PORT_A 'A'
 #define GPIO_PORT_B 'B'
@@ -64,38 +428,234 @@
 #define GPIO_PORT_E 'E'
 #define GPIO_PORT_H 'H'
 
-/* Message structure */
+/* Maximum number of parameters split out of an ASCII message */
+#define MAX_MESSAGE_PARAMS MAX_FRAME_ARGS
+
+/* Read-only view into a message buffer (not NUL-terminated) */
+typedef struct {
+    const char *ptr;
+    uint16_t len;
+} uart_slice_t;
+
+/* Parsed ASCII message; all slices point into the caller's buffer */
 typedef struct {
-    char command[32];
-    char params[MAX_MESSAGE_LENGTH - 32];
-    char full_message[MAX_MESSAGE_LENGTH];
+    uint8_t opcode;                             /* OP_*, OP_NONE if the name is unknown */
+    uint16_t id;                                /* REQUEST_ID_NONE if absent */
+    uint8_t priority;                           /* UART_PRIO_*, '!' or the opcode's class */
+    uint16_t deadline_ms;                       /* 0 if absent */
+    uart_slice_t name;                          /* "GPIO_SET" */
+    uart_slice_t params;                        /* "C,13,1", len 0 if absent */
+    uart_slice_t param[MAX_MESSAGE_PARAMS];     /* Last one holds any excess */
+    uint8_t nparams;
 } uart_message_t;
 
+/* Decoded binary frame; payload points into the receive buffer */
+typedef struct {
+    uint8_t opcode;                             /* OP_FLAG_URGENT removed */
+    uint16_t id;
+    uint8_t priority;                           /* UART_PRIO_* */
+    const uint8_t *payload;
+    size_t payload_len;
+} uart_frame_t;
+
 /* Function prototypes for protocol handling */
 
 /**
- * @brief Parse incoming UART message
- * @param raw_message Raw message string
- * @param msg Parsed message structure
+ * @brief Parse incoming UART message in place (no copies, no allocation)
+ * @param raw_message Raw message, a trailing delimiter / CR is ignored
+ * @param len Length of raw_message
+ * @param msg Parsed message structure, slices point into raw_message
  * @return true if parsing successful, false otherwise
  */
-bool parse_message(const char *raw_message, uart_message_t *msg);
+bool parse_message(const char *raw_message, size_t len, uart_message_t *msg);
 
 /**
  * @brief Build UART message from command and parameters
  * @param command Command string
+ * @param id Request ID, REQUEST_ID_NONE for none
  * @param params Parameters string (can be NULL)
  * @param buffer Output buffer
  * @param buffer_size Size of output buffer
- * @return Number of bytes written, or -1 on error
+ * @return Number of bytes written including the delimiter, or -1 on error
  */
-int build_message(const char *command, const char *params, char *buffer, size_t buffer_size);
+int build_message(const char *command, uint16_t id, const char *params,
+                  char *buffer, size_t buffer_size);
 
 /**
  * @brief Validate message format
  * @param message Message to validate
+ * @param len Length of message
  * @return true if valid, false otherwise
  */
-bool validate_message(const char *message);
+bool validate_message(const char *message, size_t len);
+
+/**
+ * @brief Convert parameter slices to frame arguments
+ *
+ * A single letter (GPIO port) becomes its character code, decimal and
+ * 0x-prefixed hex numbers their value.
+ *
+ * @return Number of arguments, or -1 if a parameter cannot be represented
+ */
+int uart_message_args(const uart_message_t *msg, uint32_t *args, size_t max_args);
+
+/**
+ * @brief Encode the sub-commands of an ASCII BATCH as a binary BATCH payload
+ * @param params Parameters of the BATCH message ("GPIO_SET:C,13,1;PING")
+ * @return Payload length, or -1 if a sub-command is malformed, there are
+ *         more than MAX_BATCH_COMMANDS or the payload does not fit
+ */
+int uart_batch_encode(const uart_slice_t *params, uint8_t *out, size_t out_size);
+
+/**
+ * @brief Decode the next sub-command of a binary BATCH payload
+ * @param off Offset of the sub-command, advanced past it on success
+ * @return Number of arguments, or -1 if the payload is malformed
+ */
+int uart_batch_next(const uint8_t *payload, size_t len, size_t *off,
+                    uint8_t *opcode, uint32_t *args, size_t max_args);
+
+/**
+ * @brief Pack 12-bit samples, two into three bytes (low byte of the first,
+ *        high nibble of the first | low nibble of the second << 4, high
+ *        byte of the second)
+ * @param out Must hold UART_ADC_PACKED_SIZE(count) bytes
+ * @return Number of bytes written
+ */
+size_t uart_adc_pack(const uint16_t *samples, size_t count, uint8_t *out);
+
+/**
+ * @brief Unpack samples written by uart_adc_pack()
+ * @return Number of samples, or -1 if len is not a packed length or the
+ *         samples do not fit
+ */
+int uart_adc_unpack(const uint8_t *data, size_t len, uint16_t *samples, size_t max_samples);
+
+/**
+ * @brief Lower-case hex encoding; out must hold 2 * len bytes (no NUL added)
+ * @return Number of characters written
+ */
+size_t uart_hex_encode(const uint8_t *data, size_t len, char *out);
+
+/**
+ * @brief Decode hex digits (either case)
+ * @return Number of bytes, or -1 on odd length, bad digit or overflow
+ */
+int uart_hex_decode(const char *hex, size_t len, uint8_t *out, size_t out_size);
+
+/**
+ * @brief Read a STATUS snapshot; fields the sender did not fill in are 0
+ * @return 0, or -1 if the data is not a uart_status_t of a known version
+ */
+int uart_status_decode(const uint8_t *data, size_t len, uart_status_t *status);
+
+/**
+ * @brief Decode the next field/value pair of a TLM message
+ * @param off Offset of the pair, advanced past it on success
+ * @return 0, or -1 if the pairs are malformed or the field is unknown
+ */
+int uart_tlm_next(const uint8_t *pairs, size_t len, size_t *off, uint8_t *field,
+                  uint32_t *value);
+
+/**
+ * @brief PROFILE histogram bucket of a phase that took this many cycles
+ */
+uint8_t uart_profile_bucket(uint32_t cycles);
+
+/**
+ * @brief Render the arguments of an EVT frame as ASCII parameters
+ *        ("GPIO,C,13,1,1234567,42")
+ * @return Length written (NUL-terminated), or -1 if unknown or too long
+ */
+int uart_event_format(const uint32_t *args, size_t nargs, char *out, size_t size);
+
+/* Binary framing */
+
+/**
+ * @brief CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF)
+ */
+uint16_t uart_crc16(const uint8_t *data, size_t len);
+
+/**
+ * @brief Encode unsigned LEB128 varint
+ * @return Number of bytes written (1-5)
+ */
+size_t uart_varint_encode(uint32_t value, uint8_t *out);
+
+/**
+ * @brief Decode unsigned LEB128 varint
+ * @return Number of bytes consumed, or -1 if truncated/overlong
+ */
+int uart_varint_decode(const uint8_t *in, size_t len, uint32_t *value);
+
+/**
+ * @brief COBS-encode len bytes; out must hold len + len / 254 + 1 bytes
+ * @return Encoded length (no trailing delimiter)
+ */
+size_t uart_cobs_encode(const uint8_t *in, size_t len, uint8_t *out);
+
+/**
+ * @brief COBS-decode in place
+ * @return Decoded length, or -1 if the data is not valid COBS
+ */
+int uart_cobs_decode(uint8_t *buf, size_t len);
+
+/**
+ * @brief Build a complete binary frame, including the trailing delimiter
+ * @param data Raw bytes appended after the varint args (can be NULL)
+ * @return Number of bytes written to out, or -1 if it does not fit
+ */
+int uart_frame_encode(uint8_t opcode, uint16_t id, const uint32_t *args, size_t nargs,
+                      const uint8_t *data, size_t data_len, uint8_t *out, size_t out_size);
+
+/**
+ * @brief Decode a received frame (without delimiter) in place and check its CRC
+ * @return true if the frame is well-formed
+ */
+bool uart_frame_decode(uint8_t *buf, size_t len, uart_frame_t *frame);
+
+/**
+ * @brief Decode the varint arguments of a frame
+ * @return Number of arguments, or -1 if the payload is malformed
+ */
+int uart_frame_args(const uart_frame_t *frame, uint32_t *args, size_t max_args);
+
+/**
+ * @brief Decode exactly nargs varint arguments and locate the raw data after them
+ * @return 0 on success, -1 if the payload holds fewer arguments
+ */
+int uart_frame_data(const uart_frame_t *frame, uint32_t *args, size_t nargs,
+                    const uint8_t **data, size_t *data_len);
+
+/**
+ * @brief Map a command/response name to its opcode
+ *
+ * Resolved by a switch on length and one distinguishing character, then a
+ * single memcmp, so the cost does not grow with the command set.
+ *
+ * @return Opcode, or OP_NONE if unknown
+ */
+uint8_t uart_opcode_from_name(const char *name, size_t len);
+
+/**
+ * @brief Name of an opcode ("GPIO_SET", "OK", ...), NULL if unknown
+ */
+const char *uart_opcode_name(uint8_t opcode);
+
+/**
+ * @brief Priority class of a command when it is not marked with '!'
+ */
+uint8_t uart_opcode_priority(uint8_t opcode);
+
+/**
+ * @brief ERR_* string for a binary error code
+ */
+const char *uart_error_name(uint8_t code);
+
+/**
+ * @brief Whether SET_BAUD may propose this rate (standard rates up to
+ *        UART_BAUDRATE_MAX that both UARTs can generate)
+ */
+bool uart_baudrate_supported(uint32_t rate);
 
 #endif /* UART_PROTOCOL_H */
@@ -0,0 +1,152 @@
+#!/bin/sh
+#
+# Host-side test of the recovery firmware's bridge protocol, no hardware
+#
+# Runs the firmware under native_sim or QEMU (qemu_cortex_m3), finds the
+# pty its bridge UART is on, starts uart-bridge there and checks the
+# replies to PING, GPIO_SET, GPIO_GET and STATUS. The firmware is built
+# with west first if the build directory holds no image.
+#
+# native_sim has emulated GPIO ports, so the pin reads back what was set.
+# qemu_cortex_m3 has no usable GPIO and must answer GPIO_SET with an error.
+#
+# Needs west and the Zephyr SDK for the firmware, uart-bridge and socat.
+# Exits 0 if every reply was as expected.
+
+set -u
+
+usage() {
+    cat <<EOF
+Usage: $0 [-b board] [-d build_dir] [-p pty] [-x uart-bridge]
+  -b  native_sim (default) or qemu_cortex_m3
+  -d  west build directory (default: build-<board>)
+  -p  test a target already running with its bridge link on this pty
+  -x  uart-bridge binary (default: uart-bridge from PATH)
+EOF
+}
+
+APP_DIR=$(cd "$(dirname "$0")/.." && pwd)
+BOARD=native_sim
+BUILD_DIR=
+PTY=
+UART_BRIDGE=uart-bridge
+
+while getopts b:d:p:x:h opt; do
+    case $opt in
+        b) BOARD=$OPTARG ;;
+        d) BUILD_DIR=$OPTARG ;;
+        p) PTY=$OPTARG ;;
+        x) UART_BRIDGE=$OPTARG ;;
+        h) usage; exit 0 ;;
+        *) usage; exit 2 ;;
+    esac
+done
+BUILD_DIR=${BUILD_DIR:-build-$BOARD}
+
+WORK=$(mktemp -d)
+SOCK=$WORK/uart-bridge.sock
+TARGET_PID=
+BRIDGE_PID=
+FAILED=0
+
+cleanup() {
+    [ -n "$BRIDGE_PID" ] && kill "$BRIDGE_PID" 2>/dev/null
+    # west runs QEMU as a child: stop the whole session
+    [ -n "$TARGET_PID" ] && kill -- "-$TARGET_PID" 2>/dev/null
+    wait 2>/dev/null
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+# Wait up to 10 s for the target to announce its pty; $1 extracts the path
+wait_pty() {
+    for _ in $(seq 100); do
+        PTY=$(sed -n "$1" "$WORK/target.log" | head -n 1)
+        [ -n "$PTY" ] && return 0
+        kill -0 "$TARGET_PID" 2>/dev/null || break
+        sleep 0.1
+    done
+    echo "No bridge pty from $BOARD:" >&2
+    cat "$WORK/target.log" >&2
+    return 1
+}
+
+start_target() {
+    case $BOARD in
+        native_sim) image=$BUILD_DIR/zephyr/zephyr.exe ;;
+        qemu_cortex_m3) image=$BUILD_DIR/zephyr/zephyr.elf ;;
+        *) echo "Unsupported board: $BOARD" >&2; exit 2 ;;
+    esac
+    if [ ! -e "$image" ]; then
+        west build -b "$BOARD" -d "$BUILD_DIR" "$APP_DIR" || exit 1
+    fi
+
+    # An open, silent stdin for the shell console
+    mkfifo "$WORK/console"
+    exec 3<>"$WORK/console"
+
+    case $BOARD in
+        native_sim)
+            setsid "$image" <&3 >"$WORK/target.log" 2>&1 &
+            TARGET_PID=$!
+            wait_pty 's|.*connected to pseudotty: \(/dev/pts/[0-9]*\).*|\1|p'
+            ;;
+        qemu_cortex_m3)
+            # The console stays on stdio; the extra serial port is the bridge link
+            QEMU_EXTRA_FLAGS="-serial pty" setsid west build -d "$BUILD_DIR" -t run \
+                <&3 >"$WORK/target.log" 2>&1 &
+            TARGET_PID=$!
+            wait_pty 's|.*char device redirected to \(/dev/pts/[0-9]*\).*|\1|p'
+            ;;
+    esac
+}
+
+# Send lines on one connection; print the replies that arrive within $1 s
+send() {
+    timeout=$1
+    shift
+    printf '%s\n' "$@" | socat -t "$timeout" - "UNIX-CONNECT:$SOCK" 2>/dev/null
+}
+
+# The reply tagged #$1 must match the grep pattern $2
+expect() {
+    line=$(grep "^[A-Z_]*#$1\\(:\\|\$\\)" "$WORK/replies" | head -n 1)
+    if printf '%s\n' "$line" | grep -q "$2"; then
+        echo "ok    #$1 $line"
+    else
+        echo "FAIL  #$1 ${line:-no reply}, expected $2"
+        FAILED=1
+    fi
+}
+
+if [ -z "$PTY" ]; then
+    start_target || exit 1
+fi
+echo "Bridge link on $PTY"
+
+# Keep the boot rate: the pty has none, and QEMU's UART ignores it
+"$UART_BRIDGE" -d "$PTY" -s "$SOCK" -b 115200 &
+BRIDGE_PID=$!
+
+# PROTO and link setup first; commands meanwhile are answered BUSY
+for _ in $(seq 20); do
+    [ -S "$SOCK" ] && send 1 "PING#1" | grep -q "^PONG#1" && break
+    sleep 0.5
+done
+
+case $BOARD in
+    native_sim)
+        send 3 "PING#1" "GPIO_SET#2:C,13,1" "GPIO_GET#3:C,13" "STATUS#4" >"$WORK/replies"
+        expect 2 '^OK#2$'
+        expect 3 '^OK#3:1$'
+        ;;
+    *)
+        send 3 "PING#1" "GPIO_SET#2:C,13,1" "STATUS#4" >"$WORK/replies"
+        expect 2 '^ERROR#2:\(INVALID_PARAMS\|GPIO_FAIL\)'
+        ;;
+esac
+expect 1 '^PONG#1$'
+expect 4 '^STATUS#4:{"uptime_ms":[0-9]*,'
+
+exit $FAILED
@@ -0,0 +1,483 @@
+/*
+ * ADC_STREAM: continuous sampling of one ADC channel
+ *
+ * On the STM32 (CONFIG_BRIDGE_ADC_STREAM_DMA) TIM3's update event starts
+ * every ADC1 conversion through TRGO, and DMA2 writes the samples into a
+ * ping-pong buffer of two blocks. The half-transfer and transfer-complete
+ * interrupts each hand over the half just filled while the DMA fills the
+ * other one: one interrupt per block, and sample times set by the timer
+ * rather than by interrupt latency. The ADC driver still sets up the
+ * channel; while a stream runs, its registers are programmed directly.
+ *
+ * Elsewhere (native_sim, QEMU) the ADC driver paces the conversions with
+ * its interval timer and calls adc_stream_sample() after each one.
+ * Answering ADC_ACTION_REPEAT keeps a single sequence running on a
+ * one-sample buffer. That is an interrupt per sample, timed to the
+ * kernel tick, which is good enough to exercise the protocol.
+ *
+ * Either way the samples go into blocks from a fixed pool
+ * (CONFIG_BRIDGE_ADC_STREAM_BLOCKS). A full block is queued for the
+ * protocol thread, which packs it into an ADC_DATA message and frees it.
+ * Only the protocol thread sends blocks, so they go out in seq order;
+ * ADC_STREAM itself runs on the bulk queue and just wakes it. If the
+ * thread has fallen so far behind that the pool is empty when a block
+ * completes, that block is dropped; its seq is still used up, so the
+ * daemon sees the gap.
+ */
+
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/sys/atomic.h>
+
+#include "bridge.h"
+
+#define ADC_STREAM_NODE         DT_NODELABEL(adc1)
+
+#if defined(CONFIG_ADC) && DT_NODE_HAS_STATUS(ADC_STREAM_NODE, okay)
+#include <zephyr/drivers/adc.h>
+#define BRIDGE_HAS_ADC 1
+#endif
+
+#if defined(BRIDGE_HAS_ADC) && defined(CONFIG_BRIDGE_ADC_STREAM_DMA)
+#include <soc.h>
+#include <stm32_ll_adc.h>
+#include <stm32_ll_tim.h>
+#include <zephyr/drivers/clock_control.h>
+#include <zephyr/drivers/clock_control/stm32_clock_control.h>
+#include <zephyr/drivers/dma.h>
+#include <zephyr/drivers/dma/dma_stm32.h>
+#endif
+
+#define ADC_STREAM_BLOCK        CONFIG_BRIDGE_ADC_STREAM_BLOCK
+#define ADC_STREAM_FIRST_BLOCK_MS 100
+
+BUILD_ASSERT(ADC_STREAM_BLOCK <= ADC_DATA_MAX_SAMPLES, "ADC_DATA block too large");
+
+struct adc_stream_block {
+    void *fifo_reserved;                /* Used by k_fifo */
+    uint16_t samples[ADC_STREAM_BLOCK];
+    uint16_t count;
+    uint16_t channel;
+    uint32_t seq;
+};
+
+#ifdef BRIDGE_HAS_ADC
+static const struct device *const adc_dev = DEVICE_DT_GET(ADC_STREAM_NODE);
+
+K_MEM_SLAB_DEFINE_STATIC(adc_pool, sizeof(struct adc_stream_block),
+                         CONFIG_BRIDGE_ADC_STREAM_BLOCKS, 4);
+static K_FIFO_DEFINE(adc_ready);        /* Full blocks waiting for the thread */
+
+/* Owned by the interrupt while streaming */
+static struct adc_stream_block *adc_fill;       /* Block being filled */
+static uint32_t adc_next_seq;
+static uint32_t adc_remaining;          /* Samples left, 0 = until stopped */
+
+static atomic_t adc_running;
+static uint32_t adc_channel;            /* Set by ADC_STREAM before the start */
+
+/*
+ * Queue the block being filled and, unless the stream ends with it, take
+ * the next one. Interrupt context, or a stream whose trigger has stopped.
+ */
+static void adc_stream_complete(bool last)
+{
+    struct adc_stream_block *block = adc_fill;
+    void *next = NULL;
+
+    block->seq = adc_next_seq++;
+    block->channel = adc_channel;
+    if (!last && k_mem_slab_alloc(&adc_pool, &next, K_NO_WAIT) != 0) {
+        /* Every other block is still queued: lose this one */
+        bridge_pool_exhausted(UART_STATUS_POOL_ADC);
+        block->count = 0;
+        return;
+    }
+    k_fifo_put(&adc_ready, block);
+    adc_fill = next;
+    if (next != NULL) {
+        adc_fill->count = 0;
+    }
+    bridge_wake();
+}
+
+/* ADC ready, first block taken, channel set up: common to both starts */
+static int adc_stream_prepare(uint32_t channel)
+{
+    struct adc_channel_cfg cfg = {
+        .gain = ADC_GAIN_1,
+        .reference = ADC_REF_INTERNAL,
+        .acquisition_time = ADC_ACQ_TIME_DEFAULT,
+        .channel_id = channel,
+    };
+
+    if (!device_is_ready(adc_dev)) {
+        return -ENODEV;
+    }
+    /* A start that failed leaves its first block behind; otherwise wait for
+     * the protocol thread to send what the last stream queued
+     */
+    if (adc_fill == NULL &&
+        k_mem_slab_alloc(&adc_pool, (void **)&adc_fill, K_MSEC(ADC_STREAM_FIRST_BLOCK_MS)) != 0) {
+        bridge_pool_exhausted(UART_STATUS_POOL_ADC);
+        return -ENOMEM;
+    }
+    return adc_channel_setup(adc_dev, &cfg);
+}
+
+bool adc_stream_active(void)
+{
+    return atomic_get(&adc_running);
+}
+
+struct k_mem_slab *adc_stream_pool(void)
+{
+    return &adc_pool;
+}
+
+void adc_stream_flush(void)
+{
+    struct adc_stream_block *block;
+
+    while ((block = k_fifo_get(&adc_ready, K_NO_WAIT)) != NULL) {
+        uint8_t packed[UART_ADC_PACKED_SIZE(ADC_STREAM_BLOCK)];
+        uint32_t args[2];
+        size_t len;
+
+        args[0] = block->channel;
+        args[1] = block->seq;
+        len = uart_adc_pack(block->samples, block->count, packed);
+        bridge_push(OP_ADC_DATA, args, ARRAY_SIZE(args), packed, len);
+        k_mem_slab_free(&adc_pool, block);
+    }
+}
+
+#ifdef CONFIG_BRIDGE_ADC_STREAM_DMA
+
+#define ADC_STREAM_TIMER        DT_NODELABEL(timers3)
+#define ADC_STREAM_DMA_CHANNEL  DT_DMAS_CELL_BY_NAME(ADC_STREAM_NODE, dma, channel)
+/* A conversion takes at most 480 + 12 ADC clocks, under 25 us from 20 MHz up */
+#define ADC_STREAM_CONVERSION_US 25
+
+static ADC_TypeDef *const adc_regs = (ADC_TypeDef *)DT_REG_ADDR(ADC_STREAM_NODE);
+static TIM_TypeDef *const adc_timer = (TIM_TypeDef *)DT_REG_ADDR(ADC_STREAM_TIMER);
+static const struct device *const adc_dma =
+    DEVICE_DT_GET(DT_DMAS_CTLR_BY_NAME(ADC_STREAM_NODE, dma));
+static const struct stm32_pclken adc_timer_pclken = {
+    .bus = DT_CLOCKS_CELL(ADC_STREAM_TIMER, bus),
+    .enr = DT_CLOCKS_CELL(ADC_STREAM_TIMER, bits),
+};
+
+/* Ping-pong: the DMA fills one half while the other is copied out */
+static uint16_t adc_dma_buf[2 * ADC_STREAM_BLOCK];
+static uint8_t adc_dma_half;            /* Half the DMA is filling */
+
+/* No more triggers or transfers; ADC_READ's software starts work again */
+static void adc_stream_halt(void)
+{
+    LL_TIM_DisableCounter(adc_timer);
+    LL_ADC_REG_StopConversionExtTrig(adc_regs);
+    LL_ADC_REG_SetDMATransfer(adc_regs, LL_ADC_REG_DMA_TRANSFER_NONE);
+    LL_ADC_REG_SetTriggerSource(adc_regs, LL_ADC_REG_TRIG_SOFTWARE);
+    dma_stop(adc_dma, ADC_STREAM_DMA_CHANNEL);
+}
+
+/* Copy n samples of the given half into the block being filled and queue it */
+static void adc_stream_take(uint8_t half, uint32_t n, bool last)
+{
+    memcpy(adc_fill->samples, &adc_dma_buf[half * ADC_STREAM_BLOCK], n * sizeof(uint16_t));
+    adc_fill->count = n;
+    adc_stream_complete(last);
+}
+
+/* Half transfer (first half full) or transfer complete (second), ISR context */
+static void adc_stream_dma_done(const struct device *dev, void *user_data,
+                                uint32_t channel, int status)
+{
+    uint8_t half = status == DMA_STATUS_COMPLETE ? 1 : 0;
+    uint32_t n = ADC_STREAM_BLOCK;
+    bool last = false;
+
+    if (!atomic_get(&adc_running)) {
+        return;
+    }
+    if (status < 0) {
+        /* Transfer error: what the buffer holds is suspect */
+        adc_stream_halt();
+        atomic_clear(&adc_running);
+        bridge_wake();
+        return;
+    }
+    adc_dma_half = half ^ 1;
+    if (adc_remaining != 0) {
+        /* The conversions past count in this half are dropped */
+        n = MIN(n, adc_remaining);
+        adc_remaining -= n;
+        last = adc_remaining == 0;
+    }
+    if (last) {
+        adc_stream_halt();
+    }
+    adc_stream_take(half, n, last);
+    if (last) {
+        atomic_clear(&adc_running);
+    }
+}
+
+/* TIM3 update event, and so TRGO, rate times a second */
+static int adc_stream_timer_setup(uint32_t rate)
+{
+    const struct device *clk = DEVICE_DT_GET(STM32_CLOCK_CONTROL_NODE);
+    uint32_t tim_clk, ticks, psc;
+    int err;
+
+    err = clock_control_on(clk, (clock_control_subsys_t)&adc_timer_pclken);
+    if (err == 0) {
+        err = clock_control_get_rate(clk, (clock_control_subsys_t)&adc_timer_pclken, &tim_clk);
+    }
+    if (err != 0) {
+        return err;
+    }
+    /* Timers on a divided APB bus run at twice its clock (RM0383 6.2) */
+    if (STM32_APB1_PRESCALER > 1) {
+        tim_clk *= 2;
+    }
+
+    /* TIM3 counts 16 bits: the prescaler takes what ARR cannot */
+    ticks = tim_clk / rate;
+    psc = (ticks - 1) / (UINT16_MAX + 1);
+    LL_TIM_DisableCounter(adc_timer);
+    LL_TIM_SetCounterMode(adc_timer, LL_TIM_COUNTERMODE_UP);
+    LL_TIM_SetPrescaler(adc_timer, psc);
+    LL_TIM_SetAutoReload(adc_timer, ticks / (psc + 1) - 1);
+    LL_TIM_SetTriggerOutput(adc_timer, LL_TIM_TRGO_UPDATE);
+    /* Load the prescaler now, while the ADC does not listen yet */
+    LL_TIM_GenerateEvent_UPDATE(adc_timer);
+    return 0;
+}
+
+/* ADC1 data register to adc_dma_buf, circular, interrupts at each half */
+static int adc_stream_dma_setup(void)
+{
+    struct dma_block_config block = {
+        .source_address = LL_ADC_DMA_GetRegAddr(adc_regs, LL_ADC_DMA_REG_REGULAR_DATA),
+        .dest_address = (uint32_t)(uintptr_t)adc_dma_buf,
+        .block_size = sizeof(adc_dma_buf),
+        .source_addr_adj = DMA_ADDR_ADJ_NO_CHANGE,
+        .dest_addr_adj = DMA_ADDR_ADJ_INCREMENT,
+        .source_reload_en = 1,
+        .dest_reload_en = 1,
+    };
+    struct dma_config cfg = {
+        .dma_slot = DT_DMAS_CELL_BY_NAME(ADC_STREAM_NODE, dma, slot),
+        .channel_direction = PERIPHERAL_TO_MEMORY,
+        .channel_priority = STM32_DMA_CONFIG_PRIORITY(
+            DT_DMAS_CELL_BY_NAME(ADC_STREAM_NODE, dma, channel_config)),
+        .source_data_size = sizeof(uint16_t),
+        .dest_data_size = sizeof(uint16_t),
+        .source_burst_length = 1,
+        .dest_burst_length = 1,
+        .block_count = 1,
+        .head_block = &block,
+        .dma_callback = adc_stream_dma_done,
+    };
+    int err;
+
+    if (!device_is_ready(adc_dma)) {
+        return -ENODEV;
+    }
+    err = dma_config(adc_dma, ADC_STREAM_DMA_CHANNEL, &cfg);
+    if (err == 0) {
+        err = dma_start(adc_dma, ADC_STREAM_DMA_CHANNEL);
+    }
+    return err;
+}
+
+void adc_stream_stop(void)
+{
+    struct dma_status status;
+    uint32_t written, start, n;
+
+    if (!atomic_get(&adc_running)) {
+        return;
+    }
+    /* Once the last triggered conversion has landed nothing moves, and any
+     * half it completed has been handed over by the interrupt
+     */
+    LL_TIM_DisableCounter(adc_timer);
+    k_busy_wait(ADC_STREAM_CONVERSION_US);
+
+    /* The rest of the half being filled is the last block */
+    if (atomic_get(&adc_running) &&
+        dma_get_status(adc_dma, ADC_STREAM_DMA_CHANNEL, &status) == 0) {
+        /* The STM32 driver reports NDTR: transfers left in this lap */
+        written = ARRAY_SIZE(adc_dma_buf) - status.pending_length;
+        start = adc_dma_half * ADC_STREAM_BLOCK;
+        n = written > start ? MIN(written - start, ADC_STREAM_BLOCK) : 0;
+        if (adc_remaining != 0) {
+            n = MIN(n, adc_remaining);
+        }
+        if (n > 0) {
+            adc_stream_take(adc_dma_half, n, true);
+        }
+    }
+    adc_stream_halt();
+    atomic_clear(&adc_running);
+    bridge_wake();
+}
+
+int adc_stream_start(uint32_t channel, uint32_t rate, uint32_t count)
+{
+    int err;
+
+    adc_stream_stop();
+
+    err = adc_stream_prepare(channel);
+    if (err == 0) {
+        err = adc_stream_timer_setup(rate);
+    }
+    if (err != 0) {
+        return err;
+    }
+
+    LL_ADC_SetResolution(adc_regs, LL_ADC_RESOLUTION_12B);
+    LL_ADC_REG_SetSequencerLength(adc_regs, LL_ADC_REG_SEQ_SCAN_DISABLE);
+    LL_ADC_REG_SetSequencerRanks(adc_regs, LL_ADC_REG_RANK_1,
+                                 __LL_ADC_DECIMAL_NB_TO_CHANNEL(channel));
+    LL_ADC_REG_SetContinuousMode(adc_regs, LL_ADC_REG_CONV_SINGLE);
+    LL_ADC_REG_SetTriggerSource(adc_regs, LL_ADC_REG_TRIG_EXT_TIM3_TRGO);
+    LL_ADC_REG_SetDMATransfer(adc_regs, LL_ADC_REG_DMA_TRANSFER_UNLIMITED);
+
+    adc_channel = channel;
+    adc_remaining = count;
+    adc_next_seq = 0;
+    adc_dma_half = 0;
+    adc_fill->count = 0;
+    atomic_set(&adc_running, 1);
+
+    err = adc_stream_dma_setup();
+    if (err != 0) {
+        adc_stream_halt();
+        atomic_clear(&adc_running);
+        return err;
+    }
+    LL_ADC_Enable(adc_regs);
+    LL_ADC_REG_StartConversionExtTrig(adc_regs, LL_ADC_REG_TRIG_EXT_RISING);
+    LL_TIM_EnableCounter(adc_timer);
+    return 0;
+}
+
+#else /* !CONFIG_BRIDGE_ADC_STREAM_DMA */
+
+#define ADC_STREAM_RESOLUTION   12
+
+static int16_t adc_sample;              /* The driver converts into this */
+static atomic_t adc_stop;
+
+/* Set up by ADC_STREAM on the bulk queue before the sequence starts */
+static struct adc_sequence_options adc_options;
+static struct adc_sequence adc_sequence;
+static struct k_poll_signal adc_done = K_POLL_SIGNAL_INITIALIZER(adc_done);
+
+/* Conversion complete, ISR context */
+static enum adc_action adc_stream_sample(const struct device *dev,
+                                         const struct adc_sequence *sequence,
+                                         uint16_t sampling_index)
+{
+    bool last = atomic_get(&adc_stop) || (adc_remaining != 0 && --adc_remaining == 0);
+
+    adc_fill->samples[adc_fill->count++] = (uint16_t)adc_sample;
+
+    if (adc_fill->count == ADC_STREAM_BLOCK || last) {
+        adc_stream_complete(last);
+    }
+
+    if (last) {
+        atomic_clear(&adc_running);
+        return ADC_ACTION_FINISH;
+    }
+    return ADC_ACTION_REPEAT;
+}
+
+void adc_stream_stop(void)
+{
+    struct k_poll_event event = K_POLL_EVENT_INITIALIZER(K_POLL_TYPE_SIGNAL,
+                                                         K_POLL_MODE_NOTIFY_ONLY, &adc_done);
+
+    if (!atomic_get(&adc_running)) {
+        return;
+    }
+    /* The sequence ends at the next conversion; its last block is queued */
+    atomic_set(&adc_stop, 1);
+    k_poll(&event, 1, K_USEC(2 * adc_options.interval_us + USEC_PER_MSEC));
+    bridge_wake();
+}
+
+int adc_stream_start(uint32_t channel, uint32_t rate, uint32_t count)
+{
+    int err;
+
+    adc_stream_stop();
+
+    err = adc_stream_prepare(channel);
+    if (err != 0) {
+        return err;
+    }
+
+    adc_options = (struct adc_sequence_options) {
+        .interval_us = USEC_PER_SEC / rate,
+        .callback = adc_stream_sample,
+    };
+    adc_sequence = (struct adc_sequence) {
+        .options = &adc_options,
+        .channels = BIT(channel),
+        .buffer = &adc_sample,
+        .buffer_size = sizeof(adc_sample),
+        .resolution = ADC_STREAM_RESOLUTION,
+    };
+
+    adc_channel = channel;
+    adc_remaining = count;
+    adc_next_seq = 0;
+    adc_fill->count = 0;
+    atomic_clear(&adc_stop);
+    atomic_set(&adc_running, 1);
+    k_poll_signal_reset(&adc_done);
+
+    err = adc_read_async(adc_dev, &adc_sequence, &adc_done);
+    if (err != 0) {
+        atomic_clear(&adc_running);
+    }
+    return err;
+}
+
+#endif /* CONFIG_BRIDGE_ADC_STREAM_DMA */
+
+#else /* !BRIDGE_HAS_ADC */
+
+bool adc_stream_active(void)
+{
+    return false;
+}
+
+struct k_mem_slab *adc_stream_pool(void)
+{
+    return NULL;
+}
+
+void adc_stream_flush(void)
+{
+}
+
+void adc_stream_stop(void)
+{
+}
+
+int adc_stream_start(uint32_t channel, uint32_t rate, uint32_t count)
+{
+    return -ENOTSUP;
+}
+
+#endif /* BRIDGE_HAS_ADC */
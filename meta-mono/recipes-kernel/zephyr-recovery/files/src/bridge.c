@@ -0,0 +1,846 @@
+/*
+ * uart-bridge link: UART transport, framing and protocol thread
+ *
+ * Receive runs without per-byte CPU work where the driver allows it: the
+ * async API streams into two DMA buffers in turn and reports data when a
+ * buffer fills or the line goes idle. The callback copies each chunk into
+ * a lock-free ring and wakes the protocol thread, which splits frames,
+ * decodes them and dispatches the commands. UARTs without an async driver
+ * (qemu_cortex_m3) fall back to the interrupt-driven API feeding the same
+ * ring; ones with neither (the native_sim pty) are polled by the protocol
+ * thread every BRIDGE_RX_POLL_US.
+ *
+ * The line rate starts at the devicetree current-speed. SET_BAUD switches
+ * it after the OK is sent; the new rate is kept once a valid command
+ * arrives at it and reverted after BAUD_VERIFY_TIMEOUT_MS otherwise. A
+ * link that only delivers garbage for BRIDGE_LINK_RESET_MS falls back to
+ * the boot rate and ASCII, where the daemon will look for it.
+ *
+ * With hw-flow-control on the UART node (flow-control.overlay) the ring
+ * also pushes back on the daemon: when it is nearly full the next DMA
+ * buffer is withheld, reception stops at the end of the current one and
+ * the USART drops RTS until the protocol thread has caught up.
+ *
+ * The protocol thread also sends the unsolicited messages that other
+ * modules queue in interrupt context (ADC_DATA blocks from adc_stream.c,
+ * EVT records from gpio_events.c).
+ *
+ * High-priority commands (uart_opcode_priority(), or marked urgent) run on
+ * the protocol thread as soon as they are decoded. Normal ones are copied
+ * into a job and run by the bulk work queue at a lower thread priority,
+ * so a RESET or GPIO_SET is not held up by an I2C transfer in progress.
+ * Replies from both threads go out under bridge_tx_lock, whole frames at
+ * a time.
+ *
+ * Each command carries its profile_marks from the complete frame to the
+ * end of its reply (the protocol thread's, copied into the bulk job), so
+ * profile.c can tell which phase the time went to.
+ *
+ * Nothing on the command path comes from the heap. Received frames, the
+ * buffers replies are encoded in and ADC sample blocks are blocks of fixed
+ * pools (k_mem_slab), allocated and freed in constant time; an empty pool
+ * is counted in bridge_stats.pool_exhausted. Bytes are assembled into
+ * bridge_frame and handled before the next frame starts; a frame that
+ * outlives that (a normal-priority command) is decoded into a job block,
+ * so the job pool is the RX frame pool. A command that finds no job is
+ * answered BUSY, a sender that finds no buffer waits for one.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/uart.h>
+#include <zephyr/sys/printk.h>
+#include <string.h>
+
+#include "bridge.h"
+#include "ring.h"
+
+#define BRIDGE_UART_NODE    DT_CHOSEN(mono_bridge_uart)
+#define BRIDGE_BOOT_BAUDRATE DT_PROP(BRIDGE_UART_NODE, current_speed)
+#define BRIDGE_LINK_RESET_MS (3 * BAUD_VERIFY_TIMEOUT_MS)
+#define BRIDGE_FLOW_CONTROL DT_PROP_OR(BRIDGE_UART_NODE, hw_flow_control, 0)
+
+/* One 8N1 character at the given rate, rounded up */
+#define BRIDGE_CHAR_US(rate) (10 * USEC_PER_SEC / (rate) + 1)
+
+static const struct device *const bridge_uart = DEVICE_DT_GET(BRIDGE_UART_NODE);
+
+RING_DEFINE(bridge_ring, CONFIG_BRIDGE_RX_RING_SIZE);
+static K_SEM_DEFINE(bridge_rx_sem, 0, 1);      /* Ring and ADC stream doorbell */
+
+static K_THREAD_STACK_DEFINE(bridge_stack, CONFIG_BRIDGE_THREAD_STACK_SIZE);
+static struct k_thread bridge_thread_data;
+
+/* Normal-priority command waiting for or running on the bulk work queue */
+struct bridge_job {
+    struct k_work work;
+    uint8_t opcode;
+    uint8_t nargs;
+    uint16_t id;
+    uint16_t len;                       /* BATCH payload */
+    struct profile_marks marks;
+    union {
+        uint32_t args[MAX_FRAME_ARGS];
+        uint8_t payload[MAX_MESSAGE_LENGTH];
+    };
+};
+
+/* Space to format or frame one reply or unsolicited message in */
+union bridge_tx_buf {
+    uint8_t frame[MAX_FRAME_LENGTH];
+    struct {
+        char line[MAX_MESSAGE_LENGTH];
+        char params[MAX_MESSAGE_LENGTH - 16];
+    };
+};
+
+static K_THREAD_STACK_DEFINE(bridge_bulk_stack, CONFIG_BRIDGE_BULK_STACK_SIZE);
+static struct k_work_q bridge_bulk_q;
+K_MEM_SLAB_DEFINE_STATIC(bridge_job_slab, sizeof(struct bridge_job), CONFIG_BRIDGE_BULK_QUEUE, 4);
+K_MEM_SLAB_DEFINE_STATIC(bridge_tx_slab, sizeof(union bridge_tx_buf), CONFIG_BRIDGE_TX_BUFFERS, 4);
+
+static K_MUTEX_DEFINE(bridge_tx_lock);  /* One frame on the wire at a time */
+
+static struct bridge_stats bridge_stats;
+static bool bridge_binary;             /* Protocol thread only */
+static bool bridge_polled;             /* No async or interrupt receive */
+
+/* Line rate, protocol thread only */
+static uint32_t bridge_baudrate = BRIDGE_BOOT_BAUDRATE;
+static uint32_t bridge_baudrate_fallback;      /* Unconfirmed change: rate to revert to */
+static int64_t bridge_baud_deadline;
+static int64_t bridge_garbage_since;            /* First bad input since the last good frame */
+static uint32_t bridge_rx_errors_seen;
+
+/* Command being timed on the protocol thread, and on the bulk queue */
+static struct profile_marks bridge_marks_rx;
+static struct profile_marks bridge_marks_bulk;
+
+/* BATCH in progress on the protocol thread, and on the bulk queue: that
+ * thread's replies go there instead of the UART. A normal BATCH can block
+ * in a handler while a BATCH! runs on the protocol thread.
+ */
+static struct bridge_capture *bridge_capture_rx;
+static struct bridge_capture *bridge_capture_bulk;
+
+/* Frame being assembled by the protocol thread */
+static uint8_t bridge_frame[MAX_FRAME_LENGTH];
+static size_t bridge_frame_len;
+static bool bridge_frame_overflow;
+
+#ifdef CONFIG_UART_ASYNC_API
+static bool bridge_async;
+static uint8_t bridge_dma_buf[2][CONFIG_BRIDGE_RX_DMA_BUF_SIZE];
+static uint8_t bridge_dma_next;
+static atomic_t bridge_rx_held;         /* Next buffer withheld, RX winding down */
+static atomic_t bridge_rx_paused;       /* RX stopped, thread restarts it */
+static K_SEM_DEFINE(bridge_tx_sem, 0, 1);
+#endif
+
+const struct bridge_stats *bridge_get_stats(void)
+{
+    return &bridge_stats;
+}
+
+void bridge_get_threads(k_tid_t threads[UART_STATUS_THREADS])
+{
+    threads[UART_STATUS_THREAD_BRIDGE] = &bridge_thread_data;
+    threads[UART_STATUS_THREAD_BULK] = k_work_queue_thread_get(&bridge_bulk_q);
+}
+
+void bridge_get_pools(struct k_mem_slab *pools[UART_STATUS_POOLS])
+{
+    pools[UART_STATUS_POOL_JOB] = &bridge_job_slab;
+    pools[UART_STATUS_POOL_TX] = &bridge_tx_slab;
+    pools[UART_STATUS_POOL_ADC] = adc_stream_pool();
+}
+
+void bridge_pool_exhausted(uint8_t pool)
+{
+    atomic_inc(&bridge_stats.pool_exhausted[pool]);
+}
+
+/* Encoding buffer for the calling thread; waits if all are in use */
+static union bridge_tx_buf *bridge_tx_buf_get(void)
+{
+    void *buf;
+
+    if (k_mem_slab_alloc(&bridge_tx_slab, &buf, K_NO_WAIT) != 0) {
+        bridge_pool_exhausted(UART_STATUS_POOL_TX);
+        k_mem_slab_alloc(&bridge_tx_slab, &buf, K_FOREVER);
+    }
+    return buf;
+}
+
+static void bridge_tx_buf_put(union bridge_tx_buf *buf)
+{
+    k_mem_slab_free(&bridge_tx_slab, buf);
+}
+
+bool bridge_is_binary(void)
+{
+    return bridge_binary;
+}
+
+void bridge_set_binary(bool binary)
+{
+    bridge_binary = binary;
+}
+
+uint32_t bridge_get_baudrate(void)
+{
+    return bridge_baudrate;
+}
+
+static int bridge_uart_set_rate(uint32_t rate)
+{
+    struct uart_config cfg;
+    int err;
+
+    err = uart_config_get(bridge_uart, &cfg);
+    if (err == 0) {
+        cfg.baudrate = rate;
+        err = uart_configure(bridge_uart, &cfg);
+    }
+    if (err == 0) {
+        bridge_baudrate = rate;
+    }
+    return err;
+}
+
+void bridge_change_baudrate(uint32_t rate)
+{
+    uint32_t old = bridge_baudrate;
+
+    /* bridge_reply() returns with the last OK character still shifting out */
+    k_busy_wait(2 * BRIDGE_CHAR_US(old));
+
+    if (bridge_uart_set_rate(rate) != 0) {
+        printk("Bridge: cannot switch to %u baud\n", rate);
+        return;
+    }
+    bridge_baudrate_fallback = old;
+    bridge_baud_deadline = k_uptime_get() + BAUD_VERIFY_TIMEOUT_MS;
+}
+
+/* A frame decoded: the link works at the current rate */
+static void bridge_link_good(void)
+{
+    if (bridge_baudrate_fallback != 0) {
+        printk("Bridge: link running at %u baud\n", bridge_baudrate);
+        bridge_baudrate_fallback = 0;
+    }
+    bridge_garbage_since = 0;
+}
+
+/* Undecodable input: tolerate noise, not a link at the wrong rate */
+static void bridge_link_bad(void)
+{
+    int64_t now = k_uptime_get();
+
+    if (bridge_garbage_since == 0) {
+        bridge_garbage_since = now;
+        return;
+    }
+    if (now - bridge_garbage_since < BRIDGE_LINK_RESET_MS ||
+        (bridge_baudrate == BRIDGE_BOOT_BAUDRATE && !bridge_binary)) {
+        return;
+    }
+
+    printk("Bridge: no valid frame for %d ms, back to %u baud ASCII\n",
+           BRIDGE_LINK_RESET_MS, BRIDGE_BOOT_BAUDRATE);
+    bridge_uart_set_rate(BRIDGE_BOOT_BAUDRATE);
+    bridge_binary = false;
+    bridge_baudrate_fallback = 0;
+    bridge_garbage_since = 0;
+}
+
+/* Periodic part of the link checks, run by the protocol thread */
+static void bridge_link_check(void)
+{
+    if (bridge_baudrate_fallback != 0 && k_uptime_get() >= bridge_baud_deadline) {
+        printk("Bridge: nothing received at %u baud, back to %u\n",
+               bridge_baudrate, bridge_baudrate_fallback);
+        bridge_uart_set_rate(bridge_baudrate_fallback);
+        bridge_baudrate_fallback = 0;
+    }
+
+    if (bridge_stats.rx_errors != bridge_rx_errors_seen) {
+        bridge_rx_errors_seen = bridge_stats.rx_errors;
+        bridge_link_bad();
+    }
+}
+
+/* Producer side, ISR context */
+static void bridge_rx_push(const uint8_t *data, size_t len)
+{
+    size_t stored = ring_put(&bridge_ring, data, len);
+
+    bridge_stats.rx_bytes += len;
+    bridge_stats.rx_dropped += len - stored;
+    k_sem_give(&bridge_rx_sem);
+}
+
+#ifdef CONFIG_UART_ASYNC_API
+static int bridge_rx_start(void)
+{
+    bridge_dma_next = 1;
+    return uart_rx_enable(bridge_uart, bridge_dma_buf[0], sizeof(bridge_dma_buf[0]),
+                          CONFIG_BRIDGE_RX_IDLE_US);
+}
+
+static void bridge_uart_callback(const struct device *dev, struct uart_event *evt,
+                                 void *user_data)
+{
+    ARG_UNUSED(user_data);
+
+    switch (evt->type) {
+    case UART_RX_RDY:
+        bridge_rx_push(evt->data.rx.buf + evt->data.rx.offset, evt->data.rx.len);
+        break;
+
+    case UART_RX_BUF_REQUEST:
+        /* Room for this buffer and the next one, or let RTS hold the daemon */
+        if (BRIDGE_FLOW_CONTROL &&
+            ring_space(&bridge_ring) < 2 * sizeof(bridge_dma_buf[0])) {
+            atomic_set(&bridge_rx_held, 1);
+            break;
+        }
+        /* The other buffer was released before this one started filling */
+        uart_rx_buf_rsp(dev, bridge_dma_buf[bridge_dma_next], sizeof(bridge_dma_buf[0]));
+        bridge_dma_next ^= 1;
+        break;
+
+    case UART_RX_STOPPED:
+        bridge_stats.rx_errors++;
+        k_sem_give(&bridge_rx_sem);
+        break;
+
+    case UART_RX_DISABLED:
+        if (atomic_cas(&bridge_rx_held, 1, 0)) {
+            /* Ran out of buffers on purpose: resume once the ring drains */
+            atomic_set(&bridge_rx_paused, 1);
+            k_sem_give(&bridge_rx_sem);
+            break;
+        }
+        /* Otherwise a line error stopped reception: start over */
+        bridge_rx_start();
+        break;
+
+    case UART_TX_DONE:
+    case UART_TX_ABORTED:
+        k_sem_give(&bridge_tx_sem);
+        break;
+
+    default:
+        break;
+    }
+}
+#endif /* CONFIG_UART_ASYNC_API */
+
+#ifdef CONFIG_UART_INTERRUPT_DRIVEN
+static void bridge_uart_isr(const struct device *dev, void *user_data)
+{
+    uint8_t buf[16];
+    int n;
+
+    ARG_UNUSED(user_data);
+
+    if (!uart_irq_update(dev)) {
+        return;
+    }
+
+    while (uart_irq_rx_ready(dev) && (n = uart_fifo_read(dev, buf, sizeof(buf))) > 0) {
+        bridge_rx_push(buf, n);
+    }
+}
+#endif /* CONFIG_UART_INTERRUPT_DRIVEN */
+
+/* Polled receive, protocol thread; what does not fit stays in the driver */
+static void bridge_rx_poll(void)
+{
+    uint8_t buf[16];
+    size_t n = sizeof(buf);
+
+    while (n == sizeof(buf) && ring_space(&bridge_ring) >= sizeof(buf)) {
+        for (n = 0; n < sizeof(buf) && uart_poll_in(bridge_uart, &buf[n]) == 0; n++) {
+        }
+        if (n > 0) {
+            bridge_rx_push(buf, n);
+        }
+    }
+}
+
+static struct profile_marks *bridge_marks(void)
+{
+    k_tid_t self = k_current_get();
+
+    if (!IS_ENABLED(CONFIG_BRIDGE_PROFILE)) {
+        return NULL;
+    }
+    if (self == &bridge_thread_data) {
+        return &bridge_marks_rx;
+    }
+    return self == k_work_queue_thread_get(&bridge_bulk_q) ? &bridge_marks_bulk : NULL;
+}
+
+static struct bridge_capture **bridge_capture_slot(void)
+{
+    k_tid_t self = k_current_get();
+
+    if (self == &bridge_thread_data) {
+        return &bridge_capture_rx;
+    }
+    return self == k_work_queue_thread_get(&bridge_bulk_q) ? &bridge_capture_bulk : NULL;
+}
+
+/* The calling thread's BATCH capture, NULL if its replies go out */
+static struct bridge_capture *bridge_capture_get(void)
+{
+    struct bridge_capture **slot = bridge_capture_slot();
+
+    return slot != NULL ? *slot : NULL;
+}
+
+static void bridge_send(const uint8_t *data, size_t len)
+{
+    k_mutex_lock(&bridge_tx_lock, K_FOREVER);
+#ifdef CONFIG_UART_ASYNC_API
+    if (bridge_async) {
+        /* data is the caller's buffer: wait until DMA is done with it */
+        if (uart_tx(bridge_uart, data, len, SYS_FOREVER_US) == 0) {
+            k_sem_take(&bridge_tx_sem, K_FOREVER);
+        }
+        k_mutex_unlock(&bridge_tx_lock);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < len; i++) {
+        uart_poll_out(bridge_uart, data[i]);
+    }
+    k_mutex_unlock(&bridge_tx_lock);
+}
+
+/* Send a reply formatted by now, and time it going out */
+static void bridge_send_reply(const uint8_t *data, size_t len)
+{
+    struct profile_marks *marks = bridge_marks();
+
+    profile_mark(marks, UART_PROFILE_ENCODE);
+    bridge_send(data, len);
+    profile_mark(marks, UART_PROFILE_TX);
+}
+
+void bridge_capture_replies(struct bridge_capture *capture)
+{
+    struct bridge_capture **slot = bridge_capture_slot();
+
+    if (slot != NULL) {
+        *slot = capture;
+    }
+}
+
+void bridge_reply(uint8_t opcode, uint16_t id, const uint32_t *args, size_t nargs)
+{
+    struct bridge_capture *capture = bridge_capture_get();
+    union bridge_tx_buf *buf;
+    size_t len = 0;
+    size_t i = 0;
+    int n;
+
+    if (capture != NULL) {
+        capture->opcode = opcode;
+        capture->nargs = MIN(nargs, ARRAY_SIZE(capture->args));
+        if (args != NULL) {
+            memcpy(capture->args, args, capture->nargs * sizeof(args[0]));
+        }
+        return;
+    }
+    profile_mark(bridge_marks(), UART_PROFILE_EXECUTE);
+
+    if (opcode == OP_ERROR && nargs > 0 && args[0] < UART_ERR_COUNT) {
+        bridge_stats.errors[args[0]]++;
+    }
+
+    buf = bridge_tx_buf_get();
+    if (bridge_binary) {
+        n = uart_frame_encode(opcode, id, args, nargs, NULL, 0, buf->frame, sizeof(buf->frame));
+        if (n > 0) {
+            bridge_send_reply(buf->frame, n);
+        }
+        bridge_tx_buf_put(buf);
+        return;
+    }
+
+    /* ERROR:name[,detail...] */
+    buf->params[0] = '\0';
+    if (opcode == OP_ERROR) {
+        len = snprintk(buf->params, sizeof(buf->params), "%s",
+                       uart_error_name(nargs > 0 ? args[0] : UART_ERR_NONE));
+        i = 1;
+    }
+    for (; i < nargs && len < sizeof(buf->params) - 12; i++) {
+        len += snprintk(buf->params + len, sizeof(buf->params) - len, "%s%u",
+                        len == 0 ? "" : ",", args[i]);
+    }
+
+    n = build_message(uart_opcode_name(opcode), id, buf->params[0] ? buf->params : NULL,
+                      buf->line, sizeof(buf->line));
+    if (n > 0) {
+        bridge_send_reply((const uint8_t *)buf->line, n);
+    }
+    bridge_tx_buf_put(buf);
+}
+
+void bridge_push(uint8_t opcode, const uint32_t *args, size_t nargs,
+                 const uint8_t *data, size_t data_len)
+{
+    union bridge_tx_buf *buf = bridge_tx_buf_get();
+    size_t len = 0;
+    int n;
+
+    if (bridge_binary) {
+        n = uart_frame_encode(opcode, REQUEST_ID_NONE, args, nargs, data, data_len,
+                              buf->frame, sizeof(buf->frame));
+        if (n > 0) {
+            bridge_send(buf->frame, n);
+        }
+        goto out;
+    }
+
+    if (opcode == OP_EVT) {
+        /* EVT:type,... */
+        if (uart_event_format(args, nargs, buf->params, sizeof(buf->params)) < 0) {
+            goto out;
+        }
+    } else {
+        /* NAME:arg,...[,hexdata] */
+        for (size_t i = 0; i < nargs && len < sizeof(buf->params) - 12; i++) {
+            len += snprintk(buf->params + len, sizeof(buf->params) - len, "%s%u",
+                            i == 0 ? "" : ",", args[i]);
+        }
+        if (len + 1 + 2 * data_len >= sizeof(buf->params)) {
+            goto out;
+        }
+        if (data_len > 0) {
+            buf->params[len++] = PARAM_SEPARATOR;
+            len += uart_hex_encode(data, data_len, buf->params + len);
+        }
+        buf->params[len] = '\0';
+    }
+
+    n = build_message(uart_opcode_name(opcode), REQUEST_ID_NONE, buf->params,
+                      buf->line, sizeof(buf->line));
+    if (n > 0) {
+        bridge_send((const uint8_t *)buf->line, n);
+    }
+out:
+    bridge_tx_buf_put(buf);
+}
+
+void bridge_wake(void)
+{
+    k_sem_give(&bridge_rx_sem);
+}
+
+void bridge_reply_error(uint16_t id, uint32_t error)
+{
+    bridge_reply(OP_ERROR, id, &error, 1);
+}
+
+void bridge_reply_data(uint8_t opcode, uint16_t id, const uint8_t *data, size_t len)
+{
+    union bridge_tx_buf *buf;
+    int n;
+
+    if (bridge_capture_get() != NULL) {
+        bridge_reply(opcode, id, NULL, 0);
+        return;
+    }
+    profile_mark(bridge_marks(), UART_PROFILE_EXECUTE);
+
+    buf = bridge_tx_buf_get();
+    if (bridge_binary) {
+        n = uart_frame_encode(opcode, id, NULL, 0, data, len, buf->frame, sizeof(buf->frame));
+        if (n > 0) {
+            bridge_send_reply(buf->frame, n);
+        }
+    } else if (2 * len < sizeof(buf->params)) {
+        buf->params[uart_hex_encode(data, len, buf->params)] = '\0';
+        n = build_message(uart_opcode_name(opcode), id, buf->params, buf->line, sizeof(buf->line));
+        if (n > 0) {
+            bridge_send_reply((const uint8_t *)buf->line, n);
+        }
+    }
+    bridge_tx_buf_put(buf);
+}
+
+static void bridge_execute(uint8_t opcode, uint16_t id, const uint32_t *args, int nargs,
+                           const uint8_t *payload, size_t len)
+{
+    profile_mark(bridge_marks(), UART_PROFILE_DISPATCH);
+
+    if (opcode == OP_BATCH) {
+        bridge_dispatch_batch(id, payload, len);
+    } else {
+        bridge_dispatch(opcode, id, args, nargs);
+    }
+}
+
+static void bridge_job_run(struct k_work *work)
+{
+    struct bridge_job *job = CONTAINER_OF(work, struct bridge_job, work);
+
+    bridge_marks_bulk = job->marks;
+    bridge_execute(job->opcode, job->id, job->args, job->nargs, job->payload, job->len);
+    k_mem_slab_free(&bridge_job_slab, job);
+}
+
+/*
+ * Run a decoded command by priority: now, or queued behind the other
+ * normal ones. args or payload (BATCH) is copied for the queue.
+ */
+static void bridge_run(uint8_t opcode, uint16_t id, uint8_t priority,
+                       const uint32_t *args, int nargs, const uint8_t *payload, size_t len)
+{
+    struct bridge_job *job;
+
+    bridge_stats.commands++;
+    bridge_marks_rx.opcode = opcode;
+    profile_mark(&bridge_marks_rx, UART_PROFILE_PARSE);
+
+    if (priority == UART_PRIO_HIGH) {
+        /* Replies still being produced must go out in the old framing and rate */
+        if (opcode == OP_PROTO || opcode == OP_SET_BAUD) {
+            k_work_queue_drain(&bridge_bulk_q, false);
+        }
+        bridge_execute(opcode, id, args, nargs, payload, len);
+        return;
+    }
+
+    if (k_mem_slab_alloc(&bridge_job_slab, (void **)&job, K_NO_WAIT) != 0) {
+        bridge_pool_exhausted(UART_STATUS_POOL_JOB);
+        bridge_reply_error(id, UART_ERR_BUSY);
+        return;
+    }
+
+    k_work_init(&job->work, bridge_job_run);
+    job->opcode = opcode;
+    job->id = id;
+    job->marks = bridge_marks_rx;
+    if (opcode == OP_BATCH) {
+        job->len = MIN(len, sizeof(job->payload));
+        memcpy(job->payload, payload, job->len);
+    } else {
+        job->nargs = nargs;
+        memcpy(job->args, args, nargs * sizeof(args[0]));
+    }
+    k_work_submit_to_queue(&bridge_bulk_q, &job->work);
+}
+
+/* ASCII line: NAME[#id][!][:params] */
+static void bridge_handle_ascii(const char *line, size_t len)
+{
+    uint32_t args[MAX_FRAME_ARGS];
+    uart_message_t msg;
+    size_t i;
+    int nargs;
+
+    for (i = 0; i < len; i++) {
+        if ((line[i] < ' ' || line[i] > '~') && line[i] != '\r') {
+            bridge_link_bad();
+            return;     /* Not text: noise or stray binary frame */
+        }
+    }
+
+    if (!parse_message(line, len, &msg)) {
+        bridge_link_bad();
+        bridge_reply_error(REQUEST_ID_NONE, UART_ERR_INVALID_CMD);
+        return;
+    }
+    bridge_link_good();
+
+    if (msg.opcode == OP_BATCH) {
+        uint8_t payload[MAX_MESSAGE_LENGTH];
+        int n = uart_batch_encode(&msg.params, payload, sizeof(payload));
+
+        if (n < 0) {
+            bridge_reply_error(msg.id, UART_ERR_INVALID_PARAMS);
+            return;
+        }
+        bridge_run(OP_BATCH, msg.id, msg.priority, NULL, 0, payload, n);
+        return;
+    }
+
+    nargs = uart_message_args(&msg, args, MAX_FRAME_ARGS);
+    if (nargs < 0) {
+        bridge_reply_error(msg.id, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+
+    bridge_run(msg.opcode, msg.id, msg.priority, args, nargs, NULL, 0);
+}
+
+static void bridge_handle(uint8_t *data, size_t len)
+{
+    uint32_t args[MAX_FRAME_ARGS];
+    uart_frame_t frame;
+    int nargs;
+
+    if (!bridge_binary) {
+        bridge_handle_ascii((const char *)data, len);
+        return;
+    }
+
+    if (!uart_frame_decode(data, len, &frame)) {
+        /* Request ID is unknown: let the daemon time the command out */
+        bridge_stats.crc_errors++;
+        bridge_link_bad();
+        return;
+    }
+    bridge_link_good();
+
+    if (frame.opcode == OP_BATCH) {
+        bridge_run(OP_BATCH, frame.id, frame.priority, NULL, 0,
+                   frame.payload, frame.payload_len);
+        return;
+    }
+
+    nargs = uart_frame_args(&frame, args, MAX_FRAME_ARGS);
+    if (nargs < 0) {
+        bridge_reply_error(frame.id, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+
+    bridge_run(frame.opcode, frame.id, frame.priority, args, nargs, NULL, 0);
+}
+
+static void bridge_frame_append(const uint8_t *data, size_t len)
+{
+    if (!bridge_binary) {
+        const uint8_t *nul;
+
+        /* Leftover binary traffic (e.g. after a reset): drop the line */
+        while ((nul = memchr(data, FRAME_DELIMITER, len)) != NULL) {
+            len -= nul + 1 - data;
+            data = nul + 1;
+            bridge_frame_len = 0;
+        }
+    }
+
+    if (len > sizeof(bridge_frame) - bridge_frame_len) {
+        if (!bridge_frame_overflow) {
+            bridge_stats.rx_overruns++;
+        }
+        bridge_frame_overflow = true;
+        return;
+    }
+    memcpy(bridge_frame + bridge_frame_len, data, len);
+    bridge_frame_len += len;
+}
+
+/* Split received bytes into frames; the delimiter may change after PROTO */
+static void bridge_rx_process(const uint8_t *data, size_t len)
+{
+    while (len > 0) {
+        uint8_t delimiter = bridge_binary ? FRAME_DELIMITER : MESSAGE_DELIMITER;
+        const uint8_t *end = memchr(data, delimiter, len);
+        size_t chunk = end != NULL ? (size_t)(end - data) : len;
+
+        bridge_frame_append(data, chunk);
+        if (end == NULL) {
+            return;
+        }
+
+        if (!bridge_frame_overflow && bridge_frame_len > 0) {
+            profile_start(&bridge_marks_rx);
+            bridge_handle(bridge_frame, bridge_frame_len);
+        }
+        bridge_frame_len = 0;
+        bridge_frame_overflow = false;
+
+        data += chunk + 1;
+        len -= chunk + 1;
+    }
+}
+
+static void bridge_thread(void *p1, void *p2, void *p3)
+{
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
+    while (1) {
+        k_timeout_t timeout = K_FOREVER;
+        const uint8_t *data;
+        size_t len;
+
+        /* Wake up in time to revert an unconfirmed rate change */
+        if (bridge_baudrate_fallback != 0) {
+            timeout = K_MSEC(MAX(bridge_baud_deadline - k_uptime_get(), 0));
+        }
+        if (bridge_polled) {
+            timeout = K_USEC(CONFIG_BRIDGE_RX_POLL_US);
+        }
+        k_sem_take(&bridge_rx_sem, timeout);
+
+        if (bridge_polled) {
+            bridge_rx_poll();
+        }
+
+        while ((len = ring_peek(&bridge_ring, &data)) > 0) {
+            bridge_rx_process(data, len);
+            ring_consume(&bridge_ring, len);
+        }
+#ifdef CONFIG_UART_ASYNC_API
+        if (atomic_cas(&bridge_rx_paused, 1, 0)) {
+            bridge_rx_start();
+        }
+#endif
+        adc_stream_flush();
+        gpio_events_flush();
+        bridge_link_check();
+    }
+}
+
+int bridge_init(void)
+{
+    int err = -ENOTSUP;
+
+    if (!device_is_ready(bridge_uart)) {
+        printk("Bridge UART %s not ready\n", bridge_uart->name);
+        return -ENODEV;
+    }
+
+#ifdef CONFIG_UART_ASYNC_API
+    err = uart_callback_set(bridge_uart, bridge_uart_callback, NULL);
+    if (err == 0) {
+        err = bridge_rx_start();
+        bridge_async = (err == 0);
+    }
+#endif
+#ifdef CONFIG_UART_INTERRUPT_DRIVEN
+    if (err != 0) {
+        err = uart_irq_callback_user_data_set(bridge_uart, bridge_uart_isr, NULL);
+        if (err == 0) {
+            uart_irq_rx_enable(bridge_uart);
+        }
+    }
+#endif
+    if (err != 0) {
+        printk("Bridge UART %s: no async or interrupt support (%d), polling\n",
+               bridge_uart->name, err);
+        bridge_polled = true;
+    }
+
+    k_work_queue_start(&bridge_bulk_q, bridge_bulk_stack,
+                       K_THREAD_STACK_SIZEOF(bridge_bulk_stack),
+                       K_PRIO_PREEMPT(CONFIG_BRIDGE_BULK_PRIORITY),
+                       &(struct k_work_queue_config){ .name = "bridge_bulk" });
+
+    k_thread_create(&bridge_thread_data, bridge_stack, K_THREAD_STACK_SIZEOF(bridge_stack),
+                    bridge_thread, NULL, NULL, NULL,
+                    K_PRIO_PREEMPT(CONFIG_BRIDGE_THREAD_PRIORITY), 0, K_NO_WAIT);
+    k_thread_name_set(&bridge_thread_data, "bridge");
+    return 0;
+}
@@ -0,0 +1,175 @@
+/*
+ * uart-bridge link to the i.MX6ULL
+ *
+ * bridge.c owns the UART (async DMA receive with idle-line detection, or
+ * interrupt-driven where the driver has no async API), framing and the
+ * protocol thread. commands.c implements the command set on top of it.
+ */
+
+#ifndef RECOVERY_BRIDGE_H
+#define RECOVERY_BRIDGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/kernel.h>
+
+#include "uart-protocol.h"
+
+/* Link counters, written by the bridge only (pool_exhausted: any context) */
+struct bridge_stats {
+    uint32_t rx_bytes;          /* Bytes received from the UART */
+    uint32_t rx_dropped;        /* Bytes lost because the ring was full */
+    uint32_t rx_overruns;       /* Frames discarded for exceeding the buffer */
+    uint32_t rx_errors;         /* UART line errors (framing, parity, noise) */
+    uint32_t crc_errors;        /* Binary frames failing COBS / CRC checks */
+    uint32_t commands;          /* Commands dispatched */
+    uint32_t errors[UART_ERR_COUNT];    /* ERROR responses sent, by code */
+    atomic_t pool_exhausted[UART_STATUS_POOLS]; /* Allocations that found the pool empty */
+};
+
+/* A response held back instead of sent (BATCH sub-commands) */
+struct bridge_capture {
+    uint8_t opcode;
+    uint8_t nargs;
+    uint32_t args[MAX_FRAME_ARGS];
+};
+
+/* Start the bridge UART and the protocol thread */
+int bridge_init(void);
+
+const struct bridge_stats *bridge_get_stats(void);
+
+/* The bridge's threads, indexed by UART_STATUS_THREAD_* */
+void bridge_get_threads(k_tid_t threads[UART_STATUS_THREADS]);
+
+/* The fixed-block pools of the command path, indexed by UART_STATUS_POOL_* */
+void bridge_get_pools(struct k_mem_slab *pools[UART_STATUS_POOLS]);
+
+/* Count an allocation from a UART_STATUS_POOL_* that failed, ISR safe */
+void bridge_pool_exhausted(uint8_t pool);
+
+/* True once PROTO:1 switched the link to binary framing */
+bool bridge_is_binary(void);
+
+/* Select the framing of subsequent frames (both directions) */
+void bridge_set_binary(bool binary);
+
+uint32_t bridge_get_baudrate(void);
+
+/*
+ * Switch the line rate once the reply to SET_BAUD is out. The old rate
+ * comes back unless a valid command arrives within BAUD_VERIFY_TIMEOUT_MS.
+ */
+void bridge_change_baudrate(uint32_t rate);
+
+/* Send a response in the current framing */
+void bridge_reply(uint8_t opcode, uint16_t id, const uint32_t *args, size_t nargs);
+
+void bridge_reply_error(uint16_t id, uint32_t error);
+
+/* Send a data response (STATUS): raw frame payload, hex in ASCII */
+void bridge_reply_data(uint8_t opcode, uint16_t id, const uint8_t *data, size_t len);
+
+/* Send an unsolicited message: args, then data (hex in ASCII) */
+void bridge_push(uint8_t opcode, const uint32_t *args, size_t nargs,
+                 const uint8_t *data, size_t data_len);
+
+/* Have the protocol thread send pending unsolicited messages, ISR safe */
+void bridge_wake(void);
+
+/* Divert the calling bridge thread's bridge_reply*() into capture until called again
+ * with NULL; the protocol thread and the bulk queue each have their own
+ */
+void bridge_capture_replies(struct bridge_capture *capture);
+
+/* GPIO port device by letter (either case), NULL if none; in commands.c */
+const struct device *bridge_gpio_port(uint32_t port);
+
+/* One ADC conversion, in commands.c; 0, -EINVAL, -EBUSY (ADC_STREAM) or -errno */
+int bridge_adc_sample(uint32_t channel, uint32_t *value);
+
+/* Run one decoded command, implemented in commands.c */
+void bridge_dispatch(uint8_t opcode, uint16_t id, const uint32_t *args, int nargs);
+
+/* Run a binary BATCH payload, implemented in commands.c */
+void bridge_dispatch_batch(uint16_t id, const uint8_t *payload, size_t len);
+
+/* ADC_STREAM, implemented in adc_stream.c */
+int adc_stream_start(uint32_t channel, uint32_t rate, uint32_t count);
+void adc_stream_stop(void);
+bool adc_stream_active(void);
+
+/* Pool of sample blocks, NULL without an ADC */
+struct k_mem_slab *adc_stream_pool(void);
+
+/* Send the sample blocks completed so far, protocol thread only */
+void adc_stream_flush(void);
+
+/* GPIO_WATCH, implemented in gpio_events.c; returns 0 or -errno */
+int gpio_events_watch(uint32_t port, uint32_t pin, uint32_t edges);
+
+/* Also print events on the console (shell "gpio monitor") */
+void gpio_events_set_console(bool on);
+
+/* Send the captured events as EVT messages, protocol thread only */
+void gpio_events_flush(void);
+
+/* TELEMETRY, implemented in telemetry.c; ports and channels are bit masks */
+void telemetry_start(uint32_t period_ms, uint32_t ports, uint32_t channels, uint32_t deadband);
+void telemetry_stop(void);
+
+/* One thread, as THREADS and "recovery threads" report it */
+struct thread_usage {
+    const char *name;           /* "" without CONFIG_THREAD_NAME */
+    size_t stack_size;
+    size_t stack_used;          /* High-water mark */
+    uint64_t cycles;            /* CPU time since boot */
+};
+
+/* The system heap (k_malloc) */
+struct heap_usage {
+    size_t size;
+    size_t free;
+    size_t max_used;            /* Peak since boot */
+};
+
+/* THREADS, implemented in threads.c; index is the position in the kernel's list */
+uint32_t threads_count(void);
+int threads_get(uint32_t index, struct thread_usage *usage);    /* 0 or -ENOENT */
+
+/* CPU time of all threads together, idle included */
+uint64_t threads_total_cycles(void);
+
+void threads_heap(struct heap_usage *heap);
+
+/* One command's way through the UART_PROFILE_* phases, in cycles */
+struct profile_marks {
+    uint8_t opcode;             /* OP_NONE: not being timed */
+    uint8_t marked;             /* Bit per phase ended */
+    uint32_t start;             /* Frame complete */
+    uint32_t end[UART_PROFILE_PHASES];
+};
+
+#ifdef CONFIG_BRIDGE_PROFILE
+/* PROFILE, implemented in profile.c */
+void profile_start(struct profile_marks *marks);
+
+/* End a phase (marks may be NULL); ending UART_PROFILE_TX counts the command */
+void profile_mark(struct profile_marks *marks, uint8_t phase);
+
+/* Copy one histogram; false if opcode or phase is out of range */
+bool profile_get(uint8_t opcode, uint8_t phase, uint32_t *max,
+                 uint32_t buckets[UART_PROFILE_BUCKETS]);
+
+/* Bit per opcode with samples */
+uint32_t profile_opcodes(void);
+
+void profile_clear(void);
+uint32_t profile_cycles_per_sec(void);
+#else
+static inline void profile_start(struct profile_marks *marks) {}
+static inline void profile_mark(struct profile_marks *marks, uint8_t phase) {}
+#endif
+
+#endif /* RECOVERY_BRIDGE_H */
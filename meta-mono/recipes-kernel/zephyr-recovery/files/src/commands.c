@@ -0,0 +1,673 @@
+/*
+ * uart-bridge command set (CMD_* in uart-protocol.h)
+ *
+ * Commands arrive already decoded into an opcode and numeric arguments,
+ * whatever the framing. The dispatcher checks the argument count against
+ * the table below, so handlers only validate ranges.
+ *
+ * BATCH runs the handlers marked batchable back to back with the scheduler
+ * locked, collecting their replies, for one round trip. Handlers that do
+ * not block (GPIO, PWM, PING, GPIO_WATCH) run without another thread in
+ * between, so consecutive ones change their outputs within microseconds.
+ * I2C and ADC_READ wait for their transfer, and Zephyr switches threads
+ * while they do despite the lock: a blocking sub-command splits the batch
+ * there, and the other bridge thread may run commands in the gap.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/i2c.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/sys/reboot.h>
+#include <zephyr/drivers/hwinfo.h>
+#include <zephyr/init.h>
+#include <version.h>
+#include <string.h>
+
+#include "bridge.h"
+
+#if defined(CONFIG_ADC) && DT_NODE_HAS_STATUS(DT_NODELABEL(adc1), okay)
+#include <zephyr/drivers/adc.h>
+#define BRIDGE_HAS_ADC 1
+#endif
+
+/* TIM4 channels 1/2 on PB6/PB7 */
+#define BRIDGE_PWM_NODE DT_CHILD(DT_NODELABEL(timers4), pwm)
+#if defined(CONFIG_PWM) && DT_NODE_HAS_STATUS(BRIDGE_PWM_NODE, okay)
+#include <zephyr/drivers/pwm.h>
+#define BRIDGE_HAS_PWM 1
+#endif
+
+#define GPIO_PINS_PER_PORT  16
+#define I2C_ADDR_MAX        0x7f
+#define ADC_CHANNEL_MAX     18
+#define ADC_RESOLUTION      12
+#define PWM_CHANNEL_MAX     4
+#define PWM_PERIOD_US       1000        /* PWM_SET duty is in 1/1000 */
+
+typedef void (*bridge_cmd_handler_t)(uint16_t id, const uint32_t *args, int nargs);
+
+struct bridge_cmd {
+    bridge_cmd_handler_t handler;
+    uint8_t min_args;
+    uint8_t max_args;
+    bool batch;                 /* Allowed inside BATCH */
+};
+
+/* Indexed by port letter - 'A' */
+static const struct device *const gpio_ports[] = {
+    DEVICE_DT_GET_OR_NULL(DT_NODELABEL(gpioa)),
+    DEVICE_DT_GET_OR_NULL(DT_NODELABEL(gpiob)),
+    DEVICE_DT_GET_OR_NULL(DT_NODELABEL(gpioc)),
+    DEVICE_DT_GET_OR_NULL(DT_NODELABEL(gpiod)),
+    DEVICE_DT_GET_OR_NULL(DT_NODELABEL(gpioe)),
+    NULL,
+    NULL,
+    DEVICE_DT_GET_OR_NULL(DT_NODELABEL(gpioh)),
+};
+
+/* Indexed by bus number - 1 */
+static const struct device *const i2c_buses[] = {
+    DEVICE_DT_GET_OR_NULL(DT_NODELABEL(i2c1)),
+    DEVICE_DT_GET_OR_NULL(DT_NODELABEL(i2c2)),
+    DEVICE_DT_GET_OR_NULL(DT_NODELABEL(i2c3)),
+};
+
+const struct device *bridge_gpio_port(uint32_t port)
+{
+    if (port >= 'a' && port <= 'z') {
+        port -= 'a' - 'A';
+    }
+    if (port < 'A' || port - 'A' >= ARRAY_SIZE(gpio_ports)) {
+        return NULL;
+    }
+    return gpio_ports[port - 'A'];
+}
+
+static const struct device *i2c_bus(uint32_t bus)
+{
+    if (bus < 1 || bus > ARRAY_SIZE(i2c_buses)) {
+        return NULL;
+    }
+    return i2c_buses[bus - 1];
+}
+
+/* GPIO_SET:port,pin,value */
+static void proto_gpio_set(uint16_t id, const uint32_t *args, int nargs)
+{
+    const struct device *port = bridge_gpio_port(args[0]);
+
+    if (port == NULL || args[1] >= GPIO_PINS_PER_PORT || args[2] > 1) {
+        bridge_reply_error(id, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+    if (!device_is_ready(port) ||
+        gpio_pin_configure(port, args[1], args[2] ? GPIO_OUTPUT_HIGH : GPIO_OUTPUT_LOW) != 0) {
+        bridge_reply_error(id, UART_ERR_GPIO_FAIL);
+        return;
+    }
+    bridge_reply(OP_OK, id, NULL, 0);
+}
+
+/* GPIO_GET:port,pin -> OK:value */
+static void proto_gpio_get(uint16_t id, const uint32_t *args, int nargs)
+{
+    const struct device *port = bridge_gpio_port(args[0]);
+    uint32_t value;
+    int ret;
+
+    if (port == NULL || args[1] >= GPIO_PINS_PER_PORT) {
+        bridge_reply_error(id, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+    ret = device_is_ready(port) ? gpio_pin_get_raw(port, args[1]) : -ENODEV;
+    if (ret < 0) {
+        bridge_reply_error(id, UART_ERR_GPIO_FAIL);
+        return;
+    }
+    value = ret;
+    bridge_reply(OP_OK, id, &value, 1);
+}
+
+/* GPIO_WATCH:port,pin,edges (GPIO_WATCH_*, 0 stops) -> EVT:GPIO,... on each edge */
+static void proto_gpio_watch(uint16_t id, const uint32_t *args, int nargs)
+{
+    int err;
+
+    if (bridge_gpio_port(args[0]) == NULL || args[1] >= GPIO_PINS_PER_PORT ||
+        args[2] > GPIO_WATCH_BOTH) {
+        bridge_reply_error(id, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+    err = gpio_events_watch(args[0], args[1], args[2]);
+    if (err != 0) {
+        bridge_reply_error(id, UART_ERR_GPIO_FAIL);
+        return;
+    }
+    bridge_reply(OP_OK, id, NULL, 0);
+}
+
+/* I2C_READ:bus,addr,reg,len -> OK:byte,... */
+static void proto_i2c_read(uint16_t id, const uint32_t *args, int nargs)
+{
+    const struct device *bus = i2c_bus(args[0]);
+    uint8_t reg = args[2];
+    uint8_t data[MAX_FRAME_ARGS];
+    uint32_t values[MAX_FRAME_ARGS];
+    uint32_t len = args[3];
+
+    if (bus == NULL || args[1] > I2C_ADDR_MAX || args[2] > UINT8_MAX ||
+        len == 0 || len > ARRAY_SIZE(data)) {
+        bridge_reply_error(id, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+    if (!device_is_ready(bus) || i2c_write_read(bus, args[1], &reg, 1, data, len) != 0) {
+        bridge_reply_error(id, UART_ERR_I2C_FAIL);
+        return;
+    }
+
+    for (uint32_t i = 0; i < len; i++) {
+        values[i] = data[i];
+    }
+    bridge_reply(OP_OK, id, values, len);
+}
+
+/* I2C_WRITE:bus,addr,reg,data[,data...] */
+static void proto_i2c_write(uint16_t id, const uint32_t *args, int nargs)
+{
+    const struct device *bus = i2c_bus(args[0]);
+    uint8_t buf[MAX_FRAME_ARGS];
+    int len = 0;
+
+    if (bus == NULL || args[1] > I2C_ADDR_MAX) {
+        bridge_reply_error(id, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+    /* Register address followed by the data bytes */
+    for (int i = 2; i < nargs; i++) {
+        if (args[i] > UINT8_MAX) {
+            bridge_reply_error(id, UART_ERR_INVALID_PARAMS);
+            return;
+        }
+        buf[len++] = args[i];
+    }
+    if (!device_is_ready(bus) || i2c_write(bus, buf, len, args[1]) != 0) {
+        bridge_reply_error(id, UART_ERR_I2C_FAIL);
+        return;
+    }
+    bridge_reply(OP_OK, id, NULL, 0);
+}
+
+int bridge_adc_sample(uint32_t channel, uint32_t *value)
+{
+#ifdef BRIDGE_HAS_ADC
+    static K_MUTEX_DEFINE(adc_lock);    /* Channel setup and read belong together */
+    const struct device *adc = DEVICE_DT_GET(DT_NODELABEL(adc1));
+    struct adc_channel_cfg cfg = {
+        .gain = ADC_GAIN_1,
+        .reference = ADC_REF_INTERNAL,
+        .acquisition_time = ADC_ACQ_TIME_DEFAULT,
+        .channel_id = channel,
+    };
+    int16_t sample;
+    struct adc_sequence seq = {
+        .channels = BIT(channel),
+        .buffer = &sample,
+        .buffer_size = sizeof(sample),
+        .resolution = ADC_RESOLUTION,
+    };
+    int err;
+
+    if (channel > ADC_CHANNEL_MAX) {
+        return -EINVAL;
+    }
+    /* The stream owns the ADC until it is stopped */
+    if (adc_stream_active()) {
+        return -EBUSY;
+    }
+    if (!device_is_ready(adc)) {
+        return -ENODEV;
+    }
+    k_mutex_lock(&adc_lock, K_FOREVER);
+    err = adc_channel_setup(adc, &cfg);
+    if (err == 0) {
+        err = adc_read(adc, &seq);
+    }
+    k_mutex_unlock(&adc_lock);
+    if (err != 0) {
+        return err;
+    }
+    *value = (uint16_t)sample;
+    return 0;
+#else
+    return -ENODEV;
+#endif
+}
+
+/* ADC_READ:channel -> OK:raw (12 bit) */
+static void proto_adc_read(uint16_t id, const uint32_t *args, int nargs)
+{
+    uint32_t value;
+    int err = bridge_adc_sample(args[0], &value);
+
+    if (err != 0) {
+        bridge_reply_error(id, err == -EINVAL ? UART_ERR_INVALID_PARAMS :
+                               err == -EBUSY ? UART_ERR_BUSY : UART_ERR_ADC_FAIL);
+        return;
+    }
+    bridge_reply(OP_OK, id, &value, 1);
+}
+
+/* ADC_STREAM:channel,rate[,count] (rate 0 stops, count 0 runs until stopped) */
+static void proto_adc_stream(uint16_t id, const uint32_t *args, int nargs)
+{
+    uint32_t count = nargs > 2 ? args[2] : 0;
+
+    if (args[0] > ADC_CHANNEL_MAX || args[1] > ADC_STREAM_RATE_MAX) {
+        bridge_reply_error(id, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+    if (args[1] == 0) {
+        adc_stream_stop();
+        bridge_reply(OP_OK, id, NULL, 0);
+        return;
+    }
+    if (adc_stream_start(args[0], args[1], count) != 0) {
+        bridge_reply_error(id, UART_ERR_ADC_FAIL);
+        return;
+    }
+    bridge_reply(OP_OK, id, NULL, 0);
+}
+
+/* TELEMETRY:period_ms,ports,channels[,deadband] (period 0 stops) -> TLM:... */
+static void proto_telemetry(uint16_t id, const uint32_t *args, int nargs)
+{
+    uint32_t deadband = nargs > 3 ? args[3] : 0;
+
+    if ((args[0] != 0 && args[0] < TELEMETRY_PERIOD_MIN_MS) ||
+        args[1] >= BIT(TELEMETRY_PORTS_MAX) || args[2] >= BIT(ADC_CHANNEL_MAX + 1)) {
+        bridge_reply_error(id, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+    for (uint32_t i = 0; i < TELEMETRY_PORTS_MAX; i++) {
+        if ((args[1] & BIT(i)) && bridge_gpio_port('A' + i) == NULL) {
+            bridge_reply_error(id, UART_ERR_INVALID_PARAMS);
+            return;
+        }
+    }
+    if (args[0] == 0) {
+        telemetry_stop();
+    } else {
+        telemetry_start(args[0], args[1], args[2], deadband);
+    }
+    bridge_reply(OP_OK, id, NULL, 0);
+}
+
+/* PROFILE -> OK:cycles_per_sec,opcodes; PROFILE:opcode,phase -> OK:max,buckets...; PROFILE:0 clears */
+static void proto_profile(uint16_t id, const uint32_t *args, int nargs)
+{
+#ifdef CONFIG_BRIDGE_PROFILE
+    uint32_t values[1 + UART_PROFILE_BUCKETS];
+
+    if (nargs == 0) {
+        values[0] = profile_cycles_per_sec();
+        values[1] = profile_opcodes();
+        bridge_reply(OP_OK, id, values, 2);
+        return;
+    }
+    if (nargs == 1) {
+        if (args[0] != OP_NONE) {
+            bridge_reply_error(id, UART_ERR_INVALID_PARAMS);
+            return;
+        }
+        profile_clear();
+        bridge_reply(OP_OK, id, NULL, 0);
+        return;
+    }
+    if (args[0] > UINT8_MAX || args[1] > UINT8_MAX ||
+        !profile_get(args[0], args[1], &values[0], &values[1])) {
+        bridge_reply_error(id, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+    bridge_reply(OP_OK, id, values, ARRAY_SIZE(values));
+#else
+    bridge_reply_error(id, UART_ERR_INVALID_CMD);
+#endif
+}
+
+/* THREADS -> OK:count,time_us,heap...; THREADS:index -> OK:stack_size,stack_used,runtime_us,name... */
+static void proto_threads(uint16_t id, const uint32_t *args, int nargs)
+{
+    uint32_t values[UART_THREAD_VALUES + UART_THREAD_NAME_MAX];
+    struct thread_usage usage;
+    size_t n;
+
+    if (nargs == 0) {
+        struct heap_usage heap;
+
+        threads_heap(&heap);
+        values[0] = threads_count();
+        values[1] = (uint32_t)k_cyc_to_us_floor64(threads_total_cycles());
+        values[2] = heap.size;
+        values[3] = heap.free;
+        values[4] = heap.max_used;
+        bridge_reply(OP_OK, id, values, 5);
+        return;
+    }
+    if (threads_get(args[0], &usage) != 0) {
+        bridge_reply_error(id, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+    values[0] = usage.stack_size;
+    values[1] = usage.stack_used;
+    values[2] = (uint32_t)k_cyc_to_us_floor64(usage.cycles);
+    for (n = UART_THREAD_VALUES; n < ARRAY_SIZE(values) && *usage.name != '\0'; n++) {
+        values[n] = (uint8_t)*usage.name++;
+    }
+    bridge_reply(OP_OK, id, values, n);
+}
+
+/* PWM_SET:channel,duty (duty 0-1000) */
+static void proto_pwm_set(uint16_t id, const uint32_t *args, int nargs)
+{
+#ifdef BRIDGE_HAS_PWM
+    const struct device *pwm = DEVICE_DT_GET(BRIDGE_PWM_NODE);
+
+    if (args[0] < 1 || args[0] > PWM_CHANNEL_MAX || args[1] > PWM_PERIOD_US) {
+        bridge_reply_error(id, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+    if (!device_is_ready(pwm) ||
+        pwm_set(pwm, args[0], PWM_USEC(PWM_PERIOD_US), PWM_USEC(args[1]),
+                PWM_POLARITY_NORMAL) != 0) {
+        bridge_reply_error(id, UART_ERR_PWM_FAIL);
+        return;
+    }
+    bridge_reply(OP_OK, id, NULL, 0);
+#else
+    bridge_reply_error(id, UART_ERR_PWM_FAIL);
+#endif
+}
+
+static uint8_t status_reset_cause;
+
+/* Latch this boot's reset flags and clear them for the next one */
+static int status_init(void)
+{
+#ifdef CONFIG_HWINFO
+    static const struct {
+        uint32_t hwinfo;
+        uint8_t bit;
+    } causes[] = {
+        { RESET_POR,             UART_RESET_POWER_ON },
+        { RESET_PIN,             UART_RESET_PIN },
+        { RESET_BROWNOUT,        UART_RESET_BROWNOUT },
+        { RESET_SOFTWARE,        UART_RESET_SOFTWARE },
+        { RESET_WATCHDOG,        UART_RESET_WATCHDOG },
+        { RESET_LOW_POWER_WAKE,  UART_RESET_LOW_POWER },
+    };
+    uint32_t cause;
+
+    if (hwinfo_get_reset_cause(&cause) == 0) {
+        for (size_t i = 0; i < ARRAY_SIZE(causes); i++) {
+            if (cause & causes[i].hwinfo) {
+                status_reset_cause |= causes[i].bit;
+            }
+        }
+        hwinfo_clear_reset_cause();
+    }
+#endif
+    return 0;
+}
+
+SYS_INIT(status_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+
+#ifdef CONFIG_THREAD_RUNTIME_STATS
+static uint16_t status_permille(uint64_t part, uint64_t total)
+{
+    return total == 0 ? 0 : (uint16_t)MIN(part * 1000 / total, 1000);
+}
+#endif
+
+/* Heap use, stack high-water marks, and CPU shares since the previous STATUS */
+static void status_resources(uart_status_t *status)
+{
+    k_tid_t threads[UART_STATUS_THREADS];
+
+    bridge_get_threads(threads);
+
+    struct heap_usage heap;
+
+    threads_heap(&heap);
+    status->heap_size = heap.size;
+    status->heap_used = heap.size - heap.free;
+    status->heap_max_used = heap.max_used;
+
+#if defined(CONFIG_THREAD_STACK_INFO) && defined(CONFIG_INIT_STACKS)
+    for (int i = 0; i < UART_STATUS_THREADS; i++) {
+        size_t unused;
+
+        status->threads[i].stack_size = threads[i]->stack_info.size;
+        if (k_thread_stack_space_get(threads[i], &unused) == 0) {
+            status->threads[i].stack_used = threads[i]->stack_info.size - unused;
+        }
+    }
+#endif
+
+#ifdef CONFIG_THREAD_RUNTIME_STATS
+    /* A '!' STATUS may run on the protocol thread while another one runs here */
+    static uint64_t last_cycles, last_busy, last_thread[UART_STATUS_THREADS];
+    k_thread_runtime_stats_t all, rt;
+    uint64_t elapsed;
+
+    k_sched_lock();
+    if (k_thread_runtime_stats_all_get(&all) == 0) {
+        elapsed = all.execution_cycles - last_cycles;
+        status->cpu_permille = status_permille(all.total_cycles - last_busy, elapsed);
+        last_cycles = all.execution_cycles;
+        last_busy = all.total_cycles;
+
+        for (int i = 0; i < UART_STATUS_THREADS; i++) {
+            if (k_thread_runtime_stats_get(threads[i], &rt) == 0) {
+                status->threads[i].cpu_permille =
+                    status_permille(rt.execution_cycles - last_thread[i], elapsed);
+                last_thread[i] = rt.execution_cycles;
+            }
+        }
+    }
+    k_sched_unlock();
+#endif
+
+    struct k_mem_slab *pools[UART_STATUS_POOLS];
+    const struct bridge_stats *stats = bridge_get_stats();
+
+    bridge_get_pools(pools);
+    for (int i = 0; i < UART_STATUS_POOLS; i++) {
+        status->pools[i].exhausted = atomic_get(&stats->pool_exhausted[i]);
+        if (pools[i] == NULL) {
+            continue;
+        }
+        status->pools[i].blocks = k_mem_slab_num_used_get(pools[i]) +
+                                  k_mem_slab_num_free_get(pools[i]);
+#ifdef CONFIG_MEM_SLAB_TRACE_MAX_UTILIZATION
+        status->pools[i].max_used = k_mem_slab_max_used_get(pools[i]);
+#endif
+    }
+}
+
+/* STATUS -> uart_status_t snapshot */
+static void proto_status(uint16_t id, const uint32_t *args, int nargs)
+{
+    const struct bridge_stats *stats = bridge_get_stats();
+    uart_status_t status = {
+        .version = UART_STATUS_VERSION,
+        .size = sizeof(status),
+        .reset_cause = status_reset_cause,
+        .flags = bridge_is_binary() ? UART_STATUS_BINARY : 0,
+        .uptime_ms = k_uptime_get_32(),
+        .kernel_version = KERNEL_VERSION_NUMBER,
+        .sysclk_hz = sys_clock_hw_cycles_per_sec(),
+        .baudrate = bridge_get_baudrate(),
+        .rx_bytes = stats->rx_bytes,
+        .rx_dropped = stats->rx_dropped,
+        .rx_overruns = stats->rx_overruns,
+        .rx_errors = stats->rx_errors,
+        .crc_errors = stats->crc_errors,
+        .commands = stats->commands,
+        .gpio_errors = stats->errors[UART_ERR_GPIO_FAIL],
+        .i2c_errors = stats->errors[UART_ERR_I2C_FAIL],
+        .adc_errors = stats->errors[UART_ERR_ADC_FAIL],
+        .pwm_errors = stats->errors[UART_ERR_PWM_FAIL],
+    };
+
+    status_resources(&status);
+    bridge_reply_data(OP_STATUS_DATA, id, (const uint8_t *)&status, sizeof(status));
+}
+
+static void proto_ping(uint16_t id, const uint32_t *args, int nargs)
+{
+    bridge_reply(OP_PONG, id, NULL, 0);
+}
+
+static void proto_reset(uint16_t id, const uint32_t *args, int nargs)
+{
+    /* bridge_reply() returns once the answer is on the wire */
+    bridge_reply(OP_OK, id, NULL, 0);
+    sys_reboot(SYS_REBOOT_COLD);
+}
+
+/* SET_BAUD:rate */
+static void proto_set_baud(uint16_t id, const uint32_t *args, int nargs)
+{
+    if (!IS_ENABLED(CONFIG_UART_USE_RUNTIME_CONFIGURE)) {
+        bridge_reply_error(id, UART_ERR_INVALID_CMD);
+        return;
+    }
+    if (!uart_baudrate_supported(args[0])) {
+        bridge_reply_error(id, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+    /* Acknowledge at the old rate, then switch */
+    bridge_reply(OP_OK, id, NULL, 0);
+    bridge_change_baudrate(args[0]);
+}
+
+/* PROTO:mode */
+static void proto_proto(uint16_t id, const uint32_t *args, int nargs)
+{
+    if (args[0] > PROTO_BINARY) {
+        bridge_reply_error(id, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+    /* Acknowledge in the old framing, then switch */
+    bridge_reply(OP_OK, id, NULL, 0);
+    bridge_set_binary(args[0] == PROTO_BINARY);
+}
+
+static const struct bridge_cmd bridge_cmds[] = {
+    [OP_GPIO_SET]   = { proto_gpio_set,  3, 3,              true },
+    [OP_GPIO_GET]   = { proto_gpio_get,  2, 2,              true },
+    [OP_I2C_READ]   = { proto_i2c_read,  4, 4,              true },
+    [OP_I2C_WRITE]  = { proto_i2c_write, 4, MAX_FRAME_ARGS, true },
+    [OP_ADC_READ]   = { proto_adc_read,  1, 1,              true },
+    [OP_PWM_SET]    = { proto_pwm_set,   2, 2,              true },
+    [OP_STATUS]     = { proto_status,    0, 0,              false },
+    [OP_PING]       = { proto_ping,      0, 0,              true },
+    [OP_RESET]      = { proto_reset,     0, 0,              false },
+    [OP_PROTO]      = { proto_proto,     1, 1,              false },
+    [OP_SET_BAUD]   = { proto_set_baud,  1, 1,              false },
+    [OP_ADC_STREAM] = { proto_adc_stream, 2, 3,             false },
+    [OP_GPIO_WATCH] = { proto_gpio_watch, 3, 3,             true },
+    [OP_TELEMETRY]  = { proto_telemetry, 3, 4,              false },
+    [OP_PROFILE]    = { proto_profile,   0, 2,              false },
+    [OP_THREADS]    = { proto_threads,   0, 1,              false },
+};
+
+static const struct bridge_cmd *bridge_cmd(uint8_t opcode)
+{
+    if (opcode >= ARRAY_SIZE(bridge_cmds) || bridge_cmds[opcode].handler == NULL) {
+        return NULL;
+    }
+    return &bridge_cmds[opcode];
+}
+
+void bridge_dispatch(uint8_t opcode, uint16_t id, const uint32_t *args, int nargs)
+{
+    const struct bridge_cmd *cmd = bridge_cmd(opcode);
+
+    if (cmd == NULL) {
+        bridge_reply_error(id, UART_ERR_INVALID_CMD);
+        return;
+    }
+    if (nargs < cmd->min_args || nargs > cmd->max_args) {
+        bridge_reply_error(id, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+
+    cmd->handler(id, args, nargs);
+}
+
+/* BATCH:CMD[:args];... -> OK:values... or ERROR:code,index */
+void bridge_dispatch_batch(uint16_t id, const uint8_t *payload, size_t len)
+{
+    struct bridge_capture reply = { .opcode = OP_OK };
+    uint32_t values[MAX_FRAME_ARGS];
+    uint32_t args[MAX_FRAME_ARGS];
+    uint32_t index = 0;
+    size_t nvalues = 0;
+    size_t off = 0;
+    uint8_t opcode;
+    int nargs;
+
+    /* Nothing runs unless every sub-command is well-formed */
+    while (off < len) {
+        const struct bridge_cmd *cmd;
+
+        nargs = uart_batch_next(payload, len, &off, &opcode, args, MAX_FRAME_ARGS);
+        cmd = nargs < 0 ? NULL : bridge_cmd(opcode);
+        if (cmd == NULL || !cmd->batch || index == MAX_BATCH_COMMANDS ||
+            nargs < cmd->min_args || nargs > cmd->max_args) {
+            uint32_t error[2] = { UART_ERR_INVALID_PARAMS, index };
+
+            bridge_reply(OP_ERROR, id, error, ARRAY_SIZE(error));
+            return;
+        }
+        index++;
+    }
+    if (index == 0) {
+        bridge_reply_error(id, UART_ERR_INVALID_PARAMS);
+        return;
+    }
+
+    /* Held across blocking handlers too, but only until they wait */
+    k_sched_lock();
+    bridge_capture_replies(&reply);
+    for (off = 0, index = 0; off < len; index++) {
+        nargs = uart_batch_next(payload, len, &off, &opcode, args, MAX_FRAME_ARGS);
+        bridge_cmds[opcode].handler(id, args, nargs);
+
+        if (reply.opcode == OP_ERROR) {
+            break;
+        }
+        if (reply.opcode == OP_OK) {
+            if (nvalues + reply.nargs > ARRAY_SIZE(values)) {
+                reply.opcode = OP_ERROR;
+                reply.args[0] = UART_ERR_INVALID_PARAMS;
+                break;
+            }
+            memcpy(values + nvalues, reply.args, reply.nargs * sizeof(values[0]));
+            nvalues += reply.nargs;
+        }
+    }
+    bridge_capture_replies(NULL);
+    k_sched_unlock();
+
+    if (reply.opcode == OP_ERROR) {
+        uint32_t error[2] = { reply.args[0], index };
+
+        bridge_reply(OP_ERROR, id, error, ARRAY_SIZE(error));
+        return;
+    }
+    bridge_reply(OP_OK, id, values, nvalues);
+}
@@ -0,0 +1,167 @@
+/*
+ * GPIO_WATCH: interrupt-driven edge capture
+ *
+ * Watched pins raise an EXTI interrupt on the selected edges. The GPIO
+ * callback reads the pin level and the 64-bit SysTick cycle counter and
+ * appends a fixed-size record to a lock-free ring, nothing more; the
+ * protocol thread turns the records into EVT messages. All EXTI lines
+ * share one interrupt priority, so the producers never nest.
+ *
+ * A record that does not fit in the ring is dropped, but its seq is used
+ * up so the daemon sees the gap.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/sys/printk.h>
+
+#include "bridge.h"
+#include "ring.h"
+
+#define GPIO_EVENT_PORTS 8      /* 'A'..'H' */
+#define GPIO_EVENT_PINS  16
+
+/* One captured edge; a power-of-two size keeps records unsplit in the ring */
+struct gpio_event {
+    uint64_t cycles;
+    uint32_t seq;
+    uint8_t port;
+    uint8_t pin;
+    uint8_t level;
+    uint8_t reserved;
+};
+
+BUILD_ASSERT(sizeof(struct gpio_event) == 16, "gpio_event must stay 16 bytes");
+
+struct gpio_watch {
+    struct gpio_callback cb;
+    uint8_t letter;
+    bool added;                 /* cb registered with the driver */
+};
+
+RING_DEFINE(gpio_event_ring, CONFIG_BRIDGE_GPIO_EVENT_QUEUE * sizeof(struct gpio_event));
+
+static struct gpio_watch gpio_watches[GPIO_EVENT_PORTS];
+static K_MUTEX_DEFINE(gpio_watch_lock);        /* Protocol thread and shell */
+static uint32_t gpio_event_seq;         /* ISR only */
+static bool gpio_events_console;        /* Echo to the shell console too */
+
+static inline uint64_t gpio_event_now(void)
+{
+#ifdef CONFIG_TIMER_HAS_64BIT_CYCLE_COUNTER
+    return k_cycle_get_64();
+#else
+    /* Wraps within minutes, good enough where there is no 64-bit counter */
+    return k_cycle_get_32();
+#endif
+}
+
+/* EXTI interrupt */
+static void gpio_event_isr(const struct device *dev, struct gpio_callback *cb, uint32_t pins)
+{
+    struct gpio_watch *watch = CONTAINER_OF(cb, struct gpio_watch, cb);
+    struct gpio_event event = { .cycles = gpio_event_now(), .port = watch->letter };
+    gpio_port_value_t levels = 0;
+
+    gpio_port_get_raw(dev, &levels);
+    pins &= cb->pin_mask;
+
+    while (pins != 0) {
+        uint8_t pin = find_lsb_set(pins) - 1;
+
+        pins &= pins - 1;
+        event.pin = pin;
+        event.level = (levels >> pin) & 1;
+        event.seq = gpio_event_seq++;
+        if (ring_space(&gpio_event_ring) >= sizeof(event)) {
+            ring_put(&gpio_event_ring, (const uint8_t *)&event, sizeof(event));
+        }
+    }
+    bridge_wake();
+}
+
+int gpio_events_watch(uint32_t letter, uint32_t pin, uint32_t edges)
+{
+    static const gpio_flags_t edge_flags[] = {
+        [GPIO_WATCH_OFF]     = GPIO_INT_DISABLE,
+        [GPIO_WATCH_RISING]  = GPIO_INT_EDGE_RISING,
+        [GPIO_WATCH_FALLING] = GPIO_INT_EDGE_FALLING,
+        [GPIO_WATCH_BOTH]    = GPIO_INT_EDGE_BOTH,
+    };
+    const struct device *port = bridge_gpio_port(letter);
+    struct gpio_watch *watch;
+    int err;
+
+    if (port == NULL || pin >= GPIO_EVENT_PINS || edges >= ARRAY_SIZE(edge_flags)) {
+        return -EINVAL;
+    }
+    if (!device_is_ready(port)) {
+        return -ENODEV;
+    }
+    if (letter >= 'a') {
+        letter -= 'a' - 'A';
+    }
+    watch = &gpio_watches[letter - 'A'];
+
+    k_mutex_lock(&gpio_watch_lock, K_FOREVER);
+    if (edges == GPIO_WATCH_OFF) {
+        watch->cb.pin_mask &= ~BIT(pin);
+        err = gpio_pin_interrupt_configure(port, pin, GPIO_INT_DISABLE);
+        goto out;
+    }
+
+    if (!watch->added) {
+        gpio_init_callback(&watch->cb, gpio_event_isr, 0);
+        watch->letter = letter;
+        err = gpio_add_callback(port, &watch->cb);
+        if (err != 0) {
+            goto out;
+        }
+        watch->added = true;
+    }
+
+    err = gpio_pin_configure(port, pin, GPIO_INPUT);
+    if (err == 0) {
+        watch->cb.pin_mask |= BIT(pin);
+        /* Fails with -EBUSY if the EXTI line serves the same pin of another port */
+        err = gpio_pin_interrupt_configure(port, pin, edge_flags[edges]);
+    }
+    if (err != 0) {
+        watch->cb.pin_mask &= ~BIT(pin);
+    }
+out:
+    k_mutex_unlock(&gpio_watch_lock);
+    return err;
+}
+
+void gpio_events_set_console(bool on)
+{
+    gpio_events_console = on;
+}
+
+void gpio_events_flush(void)
+{
+    const uint8_t *data;
+    size_t len;
+
+    while ((len = ring_peek(&gpio_event_ring, &data)) >= sizeof(struct gpio_event)) {
+        struct gpio_event event;
+        uint32_t args[6];
+
+        memcpy(&event, data, sizeof(event));
+        args[0] = UART_EVT_GPIO;
+        args[1] = event.port;
+        args[2] = event.pin;
+        args[3] = event.level;
+        args[4] = (uint32_t)k_cyc_to_us_floor64(event.cycles);
+        args[5] = event.seq;
+
+        bridge_push(OP_EVT, args, ARRAY_SIZE(args), NULL, 0);
+        if (gpio_events_console) {
+            printk("[%u] GPIO%c.%u %s at %u us\n", event.seq, event.port, event.pin,
+                   event.level ? "HIGH" : "LOW", args[4]);
+        }
+        ring_consume(&gpio_event_ring, sizeof(event));
+    }
+}
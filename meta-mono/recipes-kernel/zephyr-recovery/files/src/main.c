@@ -3,6 +3,10 @@
  * 
  * This application provides recovery and diagnostic tools for STM32F411CEU6 (Black Pill)
  * All tools are implemented as Zephyr shell commands
+ *
+ * Commands from the i.MX6ULL uart-bridge daemon arrive on the bridge UART
+ * (chosen node mono,bridge-uart) and are served by the protocol thread in
+ * bridge.c / commands.c.
  */
 
 /* Correct include for the generated version file */
@@ -15,6 +19,10 @@
 #include <zephyr/drivers/spi.h>
 #include <zephyr/drivers/uart.h>
 #include <zephyr/sys/printk.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bridge.h"
 
 #define SLEEP_TIME_MS   1000
 
@@ -41,8 +49,23 @@ static int cmd_gpio_set(const struct shell *sh, size_t argc, char **argv)
 
 static int cmd_gpio_monitor(const struct shell *sh, size_t argc, char **argv)
 {
-    shell_print(sh, "GPIO Monitor - Monitoring GPIO state changes");
-    shell_print(sh, "TODO: Implement GPIO monitoring");
+    bool off = argc > 3 && strcmp(argv[3], "off") == 0;
+    int err;
+
+    if (argc < 3) {
+        shell_error(sh, "Usage: gpio monitor <port> <pin> [off]");
+        return -1;
+    }
+
+    /* Edges are captured by interrupt and printed by the bridge thread */
+    err = gpio_events_watch(argv[1][0], strtoul(argv[2], NULL, 10),
+                            off ? GPIO_WATCH_OFF : GPIO_WATCH_BOTH);
+    if (err != 0) {
+        shell_error(sh, "Cannot monitor GPIO%s.%s (%d)", argv[1], argv[2], err);
+        return err;
+    }
+    gpio_events_set_console(!off);
+    shell_print(sh, "%s GPIO%s.%s", off ? "Stopped monitoring" : "Monitoring", argv[1], argv[2]);
     return 0;
 }
 
@@ -123,11 +146,126 @@ static int cmd_system_info(const struct shell *sh, size_t argc, char **argv)
     return 0;
 }
 
+#ifdef CONFIG_BRIDGE_PROFILE
+static const char *const profile_phase_names[UART_PROFILE_PHASES] = {
+    [UART_PROFILE_PARSE]    = "parse",
+    [UART_PROFILE_DISPATCH] = "dispatch",
+    [UART_PROFILE_EXECUTE]  = "execute",
+    [UART_PROFILE_ENCODE]   = "encode",
+    [UART_PROFILE_TX]       = "tx",
+};
+
+/* Upper bound of the bucket reaching the given share of samples, at most max */
+static uint32_t profile_percentile(const uint32_t *buckets, uint32_t count, uint32_t max,
+                                   uint32_t permille)
+{
+    uint64_t seen = 0;
+
+    for (int i = 0; i < UART_PROFILE_BUCKETS - 1; i++) {
+        seen += buckets[i];
+        if (seen * 1000 >= (uint64_t)count * permille) {
+            return MIN(BIT(UART_PROFILE_SHIFT + i), max);
+        }
+    }
+    return max;
+}
+
+static int cmd_recovery_stats(const struct shell *sh, size_t argc, char **argv)
+{
+    uint32_t buckets[UART_PROFILE_BUCKETS];
+    uint32_t opcodes, max;
+
+    if (argc > 1 && strcmp(argv[1], "clear") == 0) {
+        profile_clear();
+        shell_print(sh, "Command profile cleared");
+        return 0;
+    }
+
+    opcodes = profile_opcodes();
+    if (opcodes == 0) {
+        shell_print(sh, "No commands profiled yet");
+        return 0;
+    }
+
+    shell_print(sh, "Cycles per phase (%u cycles/s)      p50        p99        max",
+                profile_cycles_per_sec());
+    for (int op = 0; op < 32; op++) {
+        uint32_t count = 0;
+
+        if (!(opcodes & BIT(op))) {
+            continue;
+        }
+        profile_get(op, UART_PROFILE_PARSE, &max, buckets);
+        for (int i = 0; i < UART_PROFILE_BUCKETS; i++) {
+            count += buckets[i];
+        }
+        shell_print(sh, "%s: %u commands", uart_opcode_name(op), count);
+
+        for (int phase = 0; phase < UART_PROFILE_PHASES; phase++) {
+            profile_get(op, phase, &max, buckets);
+            shell_print(sh, "  %-30s %10u %10u %10u", profile_phase_names[phase],
+                        profile_percentile(buckets, count, max, 500),
+                        profile_percentile(buckets, count, max, 990), max);
+        }
+    }
+    return 0;
+}
+#endif /* CONFIG_BRIDGE_PROFILE */
+
+/* Share of part in total, in tenths of a percent */
+static uint32_t threads_permille(uint64_t part, uint64_t total)
+{
+    return total == 0 ? 0 : (uint32_t)MIN(part * 1000 / total, 1000);
+}
+
+static int cmd_recovery_threads(const struct shell *sh, size_t argc, char **argv)
+{
+    uint64_t total = threads_total_cycles();
+    struct thread_usage usage;
+    struct heap_usage heap;
+    uint32_t cpu;
+
+    shell_print(sh, "%-16s %6s %17s", "Thread", "CPU", "Stack used/size");
+    for (uint32_t i = 0; threads_get(i, &usage) == 0; i++) {
+        cpu = threads_permille(usage.cycles, total);
+        shell_print(sh, "%-16s %3u.%u%% %10zu/%-6zu", usage.name[0] != '\0' ? usage.name : "?",
+                    cpu / 10, cpu % 10, usage.stack_used, usage.stack_size);
+    }
+    shell_print(sh, "CPU time since boot");
+
+    threads_heap(&heap);
+    if (heap.size > 0) {
+        shell_print(sh, "Heap: %zu of %zu bytes used, peak %zu since boot",
+                    heap.size - heap.free, heap.size, heap.max_used);
+    }
+
+    static const char *const pool_names[UART_STATUS_POOLS] = { "job", "tx", "adc" };
+    const struct bridge_stats *stats = bridge_get_stats();
+    struct k_mem_slab *pools[UART_STATUS_POOLS];
+
+    bridge_get_pools(pools);
+    for (int i = 0; i < UART_STATUS_POOLS; i++) {
+        if (pools[i] == NULL) {
+            continue;
+        }
+        shell_print(sh, "Pool %-4s %u of %u blocks used, peak %u, exhausted %u", pool_names[i],
+                    k_mem_slab_num_used_get(pools[i]),
+                    k_mem_slab_num_used_get(pools[i]) + k_mem_slab_num_free_get(pools[i]),
+#ifdef CONFIG_MEM_SLAB_TRACE_MAX_UTILIZATION
+                    k_mem_slab_max_used_get(pools[i]),
+#else
+                    0u,
+#endif
+                    (uint32_t)atomic_get(&stats->pool_exhausted[i]));
+    }
+    return 0;
+}
+
 /* Register shell commands */
 SHELL_STATIC_SUBCMD_SET_CREATE(gpio_cmds,
     SHELL_CMD(test, NULL, "Test GPIO functionality", cmd_gpio_test),
     SHELL_CMD(set, NULL, "Set GPIO pin <pin> <value>", cmd_gpio_set),
-    SHELL_CMD(monitor, NULL, "Monitor GPIO state changes", cmd_gpio_monitor),
+    SHELL_CMD(monitor, NULL, "Monitor GPIO state changes <port> <pin> [off]", cmd_gpio_monitor),
     SHELL_SUBCMD_SET_END
 );
 
@@ -142,6 +280,11 @@ SHELL_STATIC_SUBCMD_SET_CREATE(recovery_cmds,
     SHELL_CMD(flash, NULL, "Flash programming tool", cmd_flash_program),
     SHELL_CMD(memtest, NULL, "Memory test utility", cmd_memory_test),
     SHELL_CMD(sysinfo, NULL, "Display system information", cmd_system_info),
+    SHELL_COND_CMD(CONFIG_BRIDGE_PROFILE, stats, NULL,
+                   "Command cycles by phase, as PROFILE reports them [clear]",
+                   cmd_recovery_stats),
+    SHELL_CMD(threads, NULL, "Stack, CPU, heap and pool use, as THREADS and STATUS:pools report them",
+              cmd_recovery_threads),
     SHELL_SUBCMD_SET_END
 );
 
@@ -160,7 +303,9 @@ int main(void)
     printk("Type 'help' for available commands\n");
     printk("\n");
 
-    /* Main loop - Zephyr shell handles everything */
+    bridge_init();
+
+    /* Main loop - Zephyr shell handles the console, the bridge has its own thread */
     while (1) {
         k_msleep(SLEEP_TIME_MS);
     }
@@ -0,0 +1,150 @@
+/*
+ * PROFILE: cycle histograms of the command path
+ *
+ * bridge.c marks the end of each UART_PROFILE_* phase of a command with
+ * the DWT cycle counter, a single register read on the Cortex-M4. Once
+ * the reply is out, the five phase lengths are counted into log2
+ * histograms per opcode and phase (uart_profile_bucket()). Commands that
+ * skip a phase (rejected before they reach a handler) are not counted.
+ *
+ * Where the DWT is missing or does not count (QEMU), the kernel cycle
+ * counter stands in; it runs at the same rate, only its read costs more.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/init.h>
+#include <string.h>
+
+#ifdef CONFIG_CPU_CORTEX_M_HAS_DWT
+#include <cmsis_core.h>
+#endif
+
+#include "bridge.h"
+
+#define PROFILE_OPCODES (OP_THREADS + 1)
+
+BUILD_ASSERT(PROFILE_OPCODES <= 32, "PROFILE reports opcodes as a 32-bit mask");
+
+struct profile_hist {
+    uint32_t max;
+    uint32_t buckets[UART_PROFILE_BUCKETS];
+};
+
+static struct profile_hist profile_hists[PROFILE_OPCODES][UART_PROFILE_PHASES];
+static struct k_spinlock profile_lock;  /* Protocol thread, bulk queue and readers */
+static bool profile_dwt;
+
+static inline uint32_t profile_now(void)
+{
+#ifdef CONFIG_CPU_CORTEX_M_HAS_DWT
+    if (profile_dwt) {
+        return DWT->CYCCNT;
+    }
+#endif
+    return k_cycle_get_32();
+}
+
+static int profile_init(void)
+{
+#ifdef CONFIG_CPU_CORTEX_M_HAS_DWT
+    uint32_t before;
+
+    /* The counter also runs without a debugger once trace is enabled */
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    before = DWT->CYCCNT;
+    k_busy_wait(1);
+    profile_dwt = DWT->CYCCNT != before;
+#endif
+    return 0;
+}
+
+SYS_INIT(profile_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+
+static void profile_record(const struct profile_marks *marks)
+{
+    k_spinlock_key_t key = k_spin_lock(&profile_lock);
+    uint32_t from = marks->start;
+
+    for (int phase = 0; phase < UART_PROFILE_PHASES; phase++) {
+        struct profile_hist *hist = &profile_hists[marks->opcode][phase];
+        uint32_t cycles = marks->end[phase] - from;
+
+        hist->buckets[uart_profile_bucket(cycles)]++;
+        hist->max = MAX(hist->max, cycles);
+        from = marks->end[phase];
+    }
+    k_spin_unlock(&profile_lock, key);
+}
+
+void profile_start(struct profile_marks *marks)
+{
+    marks->opcode = OP_NONE;
+    marks->marked = 0;
+    marks->start = profile_now();
+}
+
+void profile_mark(struct profile_marks *marks, uint8_t phase)
+{
+    if (marks == NULL || marks->opcode == OP_NONE || marks->opcode >= PROFILE_OPCODES) {
+        return;
+    }
+    marks->end[phase] = profile_now();
+    marks->marked |= BIT(phase);
+
+    if (phase == UART_PROFILE_TX) {
+        if (marks->marked == BIT_MASK(UART_PROFILE_PHASES)) {
+            profile_record(marks);
+        }
+        marks->opcode = OP_NONE;
+    }
+}
+
+bool profile_get(uint8_t opcode, uint8_t phase, uint32_t *max,
+                 uint32_t buckets[UART_PROFILE_BUCKETS])
+{
+    k_spinlock_key_t key;
+
+    if (opcode >= PROFILE_OPCODES || phase >= UART_PROFILE_PHASES) {
+        return false;
+    }
+    key = k_spin_lock(&profile_lock);
+    *max = profile_hists[opcode][phase].max;
+    memcpy(buckets, profile_hists[opcode][phase].buckets, sizeof(profile_hists[0][0].buckets));
+    k_spin_unlock(&profile_lock, key);
+    return true;
+}
+
+uint32_t profile_opcodes(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&profile_lock);
+    uint32_t opcodes = 0;
+
+    for (int op = 0; op < PROFILE_OPCODES; op++) {
+        /* Every counted command has a parse sample */
+        for (int i = 0; i < UART_PROFILE_BUCKETS; i++) {
+            if (profile_hists[op][UART_PROFILE_PARSE].buckets[i] != 0) {
+                opcodes |= BIT(op);
+                break;
+            }
+        }
+    }
+    k_spin_unlock(&profile_lock, key);
+    return opcodes;
+}
+
+void profile_clear(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&profile_lock);
+
+    memset(profile_hists, 0, sizeof(profile_hists));
+    k_spin_unlock(&profile_lock, key);
+}
+
+uint32_t profile_cycles_per_sec(void)
+{
+    /* The DWT counts CPU cycles; SysTick runs at the CPU clock here too */
+    return sys_clock_hw_cycles_per_sec();
+}
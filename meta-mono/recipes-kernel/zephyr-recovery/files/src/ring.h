@@ -0,0 +1,71 @@
+/*
+ * Single-producer / single-consumer byte ring
+ *
+ * The producer (UART callback, ISR context) only writes head, the consumer
+ * (protocol thread) only writes tail, so neither side takes a lock or masks
+ * interrupts. Indices run freely and are masked on access; the size must be
+ * a power of two.
+ */
+
+#ifndef RECOVERY_RING_H
+#define RECOVERY_RING_H
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+#include <string.h>
+
+struct ring {
+    uint8_t *data;
+    uint32_t mask;
+    atomic_t head;      /* Next byte to write, producer only */
+    atomic_t tail;      /* Next byte to read, consumer only */
+};
+
+#define RING_DEFINE(name, size)                                             \
+    BUILD_ASSERT(IS_POWER_OF_TWO(size), "ring size must be a power of two"); \
+    static uint8_t name##_data[size];                                       \
+    static struct ring name = { .data = name##_data, .mask = (size) - 1 }
+
+/* Producer: copy up to len bytes in, return how many fit */
+static inline size_t ring_put(struct ring *r, const uint8_t *src, size_t len)
+{
+    uint32_t head = (uint32_t)atomic_get(&r->head);
+    uint32_t space = r->mask + 1 - (head - (uint32_t)atomic_get(&r->tail));
+    uint32_t offset = head & r->mask;
+    size_t first;
+
+    len = MIN(len, space);
+    first = MIN(len, r->mask + 1 - offset);
+    memcpy(r->data + offset, src, first);
+    memcpy(r->data, src + first, len - first);
+
+    /* Publish only after the bytes are in place */
+    atomic_set(&r->head, (atomic_val_t)(head + len));
+    return len;
+}
+
+/* Producer: bytes that can still be put */
+static inline size_t ring_space(struct ring *r)
+{
+    return r->mask + 1 - ((uint32_t)atomic_get(&r->head) - (uint32_t)atomic_get(&r->tail));
+}
+
+/* Consumer: contiguous readable bytes starting at *ptr, without consuming */
+static inline size_t ring_peek(struct ring *r, const uint8_t **ptr)
+{
+    uint32_t tail = (uint32_t)atomic_get(&r->tail);
+    uint32_t used = (uint32_t)atomic_get(&r->head) - tail;
+    uint32_t offset = tail & r->mask;
+
+    *ptr = r->data + offset;
+    return MIN(used, r->mask + 1 - offset);
+}
+
+/* Consumer: release len bytes returned by ring_peek() */
+static inline void ring_consume(struct ring *r, size_t len)
+{
+    atomic_add(&r->tail, (atomic_val_t)len);
+}
+
+#endif /* RECOVERY_RING_H */
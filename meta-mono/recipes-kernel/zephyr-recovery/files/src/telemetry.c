@@ -0,0 +1,165 @@
+/*
+ * TELEMETRY: periodic sampling, pushed as deltas
+ *
+ * A delayable work item on the system work queue samples the selected
+ * GPIO ports and ADC channels and the bridge's error counters once per
+ * period. Only fields whose value differs from the one last sent go out,
+ * as varint field/value pairs in TLM messages; ADC values have to move by
+ * more than the deadband. Every CONFIG_BRIDGE_TELEMETRY_KEYFRAME_MS all
+ * fields are sent again, so the daemon recovers from a lost message and
+ * can tell a quiet board from a dead link.
+ *
+ * Configuration changes cancel the work synchronously first, so the
+ * sampling code never sees a half-updated configuration.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/gpio.h>
+
+#include "bridge.h"
+
+#define TLM_PAIR_MAX    6       /* One-byte field, value up to 5 varint bytes */
+
+struct telemetry_config {
+    uint32_t period_ms;
+    uint32_t ports;             /* Bit n = port 'A' + n */
+    uint32_t channels;          /* Bit n = ADC channel n */
+    uint32_t deadband;
+};
+
+static void telemetry_work(struct k_work *work);
+
+static K_WORK_DELAYABLE_DEFINE(telemetry_dwork, telemetry_work);
+static struct telemetry_config telemetry_cfg;
+
+/* Work item only */
+static uint32_t tlm_value[UART_TLM_FIELDS];     /* Latest sample */
+static uint32_t tlm_sent[UART_TLM_FIELDS];      /* Value the daemon has */
+static uint64_t tlm_sampled;    /* Bit per field with a sample */
+static uint32_t tlm_seq;
+static int64_t tlm_keyframe_at;
+
+static inline uint32_t tlm_max_gap_ms(void)
+{
+    return MAX(telemetry_cfg.period_ms, CONFIG_BRIDGE_TELEMETRY_KEYFRAME_MS);
+}
+
+static void telemetry_set(uint8_t field, uint32_t value)
+{
+    tlm_value[field] = value;
+    tlm_sampled |= BIT64(field);
+}
+
+static void telemetry_sample(void)
+{
+    const struct bridge_stats *stats = bridge_get_stats();
+    const uint32_t counters[] = {
+        [UART_TLM_RX_ERRORS - UART_TLM_RX_ERRORS] = stats->rx_errors,
+        [UART_TLM_RX_OVERRUNS - UART_TLM_RX_ERRORS] = stats->rx_overruns,
+        [UART_TLM_CRC_ERRORS - UART_TLM_RX_ERRORS] = stats->crc_errors,
+        [UART_TLM_GPIO_ERRORS - UART_TLM_RX_ERRORS] = stats->errors[UART_ERR_GPIO_FAIL],
+        [UART_TLM_I2C_ERRORS - UART_TLM_RX_ERRORS] = stats->errors[UART_ERR_I2C_FAIL],
+        [UART_TLM_ADC_ERRORS - UART_TLM_RX_ERRORS] = stats->errors[UART_ERR_ADC_FAIL],
+        [UART_TLM_PWM_ERRORS - UART_TLM_RX_ERRORS] = stats->errors[UART_ERR_PWM_FAIL],
+    };
+    uint32_t value;
+
+    /* ADC first: a conversion sleeps, the port reads and counters do not */
+    for (uint32_t ch = 0; ch < UART_TLM_FIELDS - UART_TLM_ADC; ch++) {
+        /* Keep the last value while ADC_STREAM owns the converter */
+        if ((telemetry_cfg.channels & BIT(ch)) && bridge_adc_sample(ch, &value) == 0) {
+            telemetry_set(UART_TLM_ADC + ch, value);
+        }
+    }
+    for (uint32_t i = 0; i < TELEMETRY_PORTS_MAX; i++) {
+        const struct device *port = bridge_gpio_port('A' + i);
+        gpio_port_value_t levels;
+
+        if ((telemetry_cfg.ports & BIT(i)) && port != NULL && device_is_ready(port) &&
+            gpio_port_get_raw(port, &levels) == 0) {
+            telemetry_set(UART_TLM_GPIO + i, levels & 0xffff);
+        }
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(counters); i++) {
+        telemetry_set(UART_TLM_RX_ERRORS + i, counters[i]);
+    }
+}
+
+static bool telemetry_changed(uint8_t field)
+{
+    uint32_t now = tlm_value[field], sent = tlm_sent[field];
+
+    if (field >= UART_TLM_ADC) {
+        return (now > sent ? now - sent : sent - now) > telemetry_cfg.deadband;
+    }
+    return now != sent;
+}
+
+static void telemetry_push(uint32_t flags, const uint8_t *pairs, size_t len)
+{
+    uint32_t args[] = { tlm_seq++, flags, tlm_max_gap_ms() };
+
+    bridge_push(OP_TLM, args, ARRAY_SIZE(args), pairs, len);
+}
+
+/* Send the changed fields (all of them for a keyframe), split across messages */
+static void telemetry_send(bool keyframe)
+{
+    uint32_t flags = keyframe ? UART_TLM_KEYFRAME : 0;
+    uint8_t pairs[TLM_MAX_PAIRS_LENGTH];
+    size_t len = 0;
+
+    for (uint8_t field = 0; field < UART_TLM_FIELDS; field++) {
+        if (!(tlm_sampled & BIT64(field)) || (!keyframe && !telemetry_changed(field))) {
+            continue;
+        }
+        if (len + TLM_PAIR_MAX > sizeof(pairs)) {
+            telemetry_push(flags, pairs, len);
+            len = 0;
+        }
+        len += uart_varint_encode(field, pairs + len);
+        len += uart_varint_encode(tlm_value[field], pairs + len);
+        tlm_sent[field] = tlm_value[field];
+    }
+    if (len > 0) {
+        telemetry_push(flags, pairs, len);
+    }
+}
+
+static void telemetry_work(struct k_work *work)
+{
+    int64_t now = k_uptime_get();
+    bool keyframe = now >= tlm_keyframe_at;
+
+    telemetry_sample();
+    if (keyframe) {
+        /* The next keyframe goes out by max_gap_ms from now, not a period later */
+        tlm_keyframe_at = now + tlm_max_gap_ms() - telemetry_cfg.period_ms;
+    }
+    telemetry_send(keyframe);
+    k_work_schedule(&telemetry_dwork, K_MSEC(telemetry_cfg.period_ms));
+}
+
+void telemetry_stop(void)
+{
+    struct k_work_sync sync;
+
+    k_work_cancel_delayable_sync(&telemetry_dwork, &sync);
+    telemetry_cfg.period_ms = 0;
+}
+
+void telemetry_start(uint32_t period_ms, uint32_t ports, uint32_t channels, uint32_t deadband)
+{
+    telemetry_stop();
+    telemetry_cfg = (struct telemetry_config){
+        .period_ms = period_ms,
+        .ports = ports,
+        .channels = channels,
+        .deadband = deadband,
+    };
+    /* Start over with a keyframe of the new field set */
+    tlm_sampled = 0;
+    tlm_keyframe_at = k_uptime_get();
+    k_work_schedule(&telemetry_dwork, K_NO_WAIT);
+}
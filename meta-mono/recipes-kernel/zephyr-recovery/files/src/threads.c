@@ -0,0 +1,126 @@
+/*
+ * THREADS: stack, CPU and heap use of the whole firmware
+ *
+ * STATUS covers the bridge's own two threads; this walks every thread the
+ * kernel knows (CONFIG_THREAD_MONITOR), so stacks and the system heap can
+ * be sized from what they actually use. Threads are addressed by their
+ * position in the kernel's list, which only changes when a thread is
+ * created or exits.
+ *
+ * Stack high-water marks come from scanning for the fill pattern of
+ * CONFIG_INIT_STACKS, CPU time from CONFIG_SCHED_THREAD_USAGE. Heap use
+ * is the system heap's own runtime statistics, read but never reset or
+ * probed, so its peak is the peak since boot.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/sys_heap.h>
+
+#include "bridge.h"
+
+struct threads_walk {
+    uint32_t index;             /* Thread wanted */
+    uint32_t seen;              /* Threads passed so far */
+    k_tid_t found;
+};
+
+static void threads_visit(const struct k_thread *thread, void *user_data)
+{
+    struct threads_walk *walk = user_data;
+
+    if (walk->seen++ == walk->index) {
+        walk->found = (k_tid_t)thread;
+    }
+}
+
+/* Walk the kernel's thread list; index UINT32_MAX just counts */
+static k_tid_t threads_find(uint32_t index, uint32_t *count)
+{
+    struct threads_walk walk = { .index = index };
+
+#ifdef CONFIG_THREAD_MONITOR
+    k_thread_foreach_unlocked(threads_visit, &walk);
+#endif
+    if (count != NULL) {
+        *count = walk.seen;
+    }
+    return walk.found;
+}
+
+uint32_t threads_count(void)
+{
+    uint32_t count;
+
+    threads_find(UINT32_MAX, &count);
+    return count;
+}
+
+int threads_get(uint32_t index, struct thread_usage *usage)
+{
+    k_tid_t thread = threads_find(index, NULL);
+    const char *name;
+
+    if (thread == NULL) {
+        return -ENOENT;
+    }
+    *usage = (struct thread_usage){ 0 };
+
+    name = k_thread_name_get(thread);
+    usage->name = name != NULL ? name : "";
+
+#if defined(CONFIG_THREAD_STACK_INFO) && defined(CONFIG_INIT_STACKS)
+    size_t unused;
+
+    usage->stack_size = thread->stack_info.size;
+    if (k_thread_stack_space_get(thread, &unused) == 0) {
+        usage->stack_used = thread->stack_info.size - unused;
+    }
+#endif
+
+#ifdef CONFIG_THREAD_RUNTIME_STATS
+    k_thread_runtime_stats_t rt;
+
+    if (k_thread_runtime_stats_get(thread, &rt) == 0) {
+        usage->cycles = rt.execution_cycles;
+    }
+#endif
+    return 0;
+}
+
+uint64_t threads_total_cycles(void)
+{
+#ifdef CONFIG_THREAD_RUNTIME_STATS
+    k_thread_runtime_stats_t all;
+
+    if (k_thread_runtime_stats_all_get(&all) == 0) {
+        return all.execution_cycles;
+    }
+#endif
+    return 0;
+}
+
+#ifdef CONFIG_SYS_HEAP_RUNTIME_STATS
+extern struct k_heap _system_heap;
+#endif
+
+void threads_heap(struct heap_usage *heap)
+{
+    *heap = (struct heap_usage){ 0 };
+
+#ifdef CONFIG_SYS_HEAP_RUNTIME_STATS
+    struct sys_memory_stats stats;
+    k_spinlock_key_t key;
+    int err;
+
+    /* The heap's lock, so the three counters are from the same moment */
+    key = k_spin_lock(&_system_heap.lock);
+    err = sys_heap_runtime_stats_get(&_system_heap.heap, &stats);
+    k_spin_unlock(&_system_heap.lock, key);
+
+    if (err == 0) {
+        heap->size = stats.free_bytes + stats.allocated_bytes;
+        heap->free = stats.free_bytes;
+        heap->max_used = stats.max_allocated_bytes;
+    }
+#endif
+}
@@ -1,51 +1,131 @@
 /*
- * GPIO Monitor Utility for STM32F411 with HAL
- * Monitors GPIO pin states in real-time
+ * GPIO Monitor Utility for STM32F411
+ * Reports GPIO pin edges in real-time through the uart-bridge daemon
+ *
+ * The STM32 captures the edges by interrupt (GPIO_WATCH) and stamps them
+ * with its own clock; this tool subscribes to the resulting EVT messages
+ * instead of polling the pin.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <signal.h>
-#include "stm32f4xx_hal.h"
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define DEFAULT_SOCKET_PATH "/var/run/uart-bridge.sock"
+#define LINE_LENGTH 256
 
-static volatile int keep_running = 1;
+static volatile sig_atomic_t keep_running = 1;
 
 void signal_handler(int sig) {
     keep_running = 0;
 }
 
 void print_usage(const char *prog) {
-    printf("Usage: %s <port> <pin> [interval_ms]\n", prog);
+    printf("Usage: %s <port> <pin> [edges] [socket]\n", prog);
     printf("  port: A, B, C, D, E, or H\n");
     printf("  pin: 0-15\n");
-    printf("  interval_ms: monitoring interval in milliseconds (default: 100)\n");
+    printf("  edges: rising, falling or both (default: both)\n");
+    printf("  socket: uart-bridge socket (default: %s)\n", DEFAULT_SOCKET_PATH);
     printf("\nPress Ctrl+C to stop monitoring\n");
 }
 
-GPIO_TypeDef* get_gpio_port(char port) {
+int valid_port(char port) {
     switch(port) {
-        case 'A': case 'a': return GPIOA;
-        case 'B': case 'b': return GPIOB;
-        case 'C': case 'c': return GPIOC;
-        case 'D': case 'd': return GPIOD;
-        case 'E': case 'e': return GPIOE;
-        case 'H': case 'h': return GPIOH;
-        default: return NULL;
+        case 'A': case 'B': case 'C': case 'D': case 'E': case 'H':
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+int parse_edges(const char *name) {
+    if (strcmp(name, "rising") == 0) return 1;
+    if (strcmp(name, "falling") == 0) return 2;
+    if (strcmp(name, "both") == 0) return 3;
+    return -1;
+}
+
+int bridge_connect(const char *path) {
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
     }
+    return fd;
 }
 
-void GPIO_Init_Input(GPIO_TypeDef *gpio, uint16_t pin) {
-    GPIO_InitTypeDef GPIO_InitStruct = {0};
-    
-    GPIO_InitStruct.Pin = (1 << pin);
-    GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
-    GPIO_InitStruct.Pull = GPIO_PULLUP;
-    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
-    
-    HAL_GPIO_Init(gpio, &GPIO_InitStruct);
+/* Read one '\n'-terminated line, buffering whatever follows it */
+int read_line(int fd, char *line, size_t size) {
+    static char buf[LINE_LENGTH];
+    static size_t used;
+
+    for (;;) {
+        char *nl = memchr(buf, '\n', used);
+        ssize_t n;
+
+        if (nl) {
+            size_t len = nl - buf;
+            if (len >= size) {
+                len = size - 1;
+            }
+            memcpy(line, buf, len);
+            line[len] = '\0';
+            used -= nl + 1 - buf;
+            memmove(buf, nl + 1, used);
+            return 1;
+        }
+        if (used == sizeof(buf)) {
+            used = 0;                           /* Overlong line: drop it */
+        }
+        n = read(fd, buf + used, sizeof(buf) - used);
+        if (n <= 0) {
+            return n < 0 && errno == EINTR ? -1 : 0;
+        }
+        used += n;
+    }
+}
+
+/* Send a command and wait for its tagged reply; events in between are skipped */
+int bridge_command(int fd, const char *cmd, int id) {
+    char line[LINE_LENGTH];
+    char tag[16];
+    size_t tag_len;
+
+    snprintf(line, sizeof(line), "%s\n", cmd);
+    if (write(fd, line, strlen(line)) < 0) {
+        return -1;
+    }
+    tag_len = snprintf(tag, sizeof(tag), "#%d", id);
+    while (read_line(fd, line, sizeof(line)) > 0) {
+        char *hash = strchr(line, '#');
+
+        if (!hash || strncmp(hash, tag, tag_len) != 0 ||
+            (hash[tag_len] != '\0' && hash[tag_len] != ':')) {
+            continue;
+        }
+        if (strncmp(line, "OK", 2) != 0) {
+            fprintf(stderr, "%s: %s\n", cmd, line);
+            return -1;
+        }
+        return 0;
+    }
+    return -1;
 }
 
 int main(int argc, char *argv[]) {
@@ -56,52 +136,77 @@ int main(int argc, char *argv[]) {
 
     char port = argv[1][0];
     int pin = atoi(argv[2]);
-    int interval_ms = (argc > 3) ? atoi(argv[3]) : 100;
+    int edges = (argc > 3) ? parse_edges(argv[3]) : 3;
+    const char *socket_path = (argc > 4) ? argv[4] : DEFAULT_SOCKET_PATH;
+    char cmd[64];
+    char line[LINE_LENGTH];
 
+    if (port >= 'a' && port <= 'z') {
+        port -= 'a' - 'A';
+    }
     if (pin < 0 || pin > 15) {
         printf("Error: Pin must be between 0 and 15\n");
         return 1;
     }
-
-    GPIO_TypeDef *gpio = get_gpio_port(port);
-    if (!gpio) {
+    if (!valid_port(port)) {
         printf("Error: Invalid port '%c'\n", port);
         return 1;
     }
+    if (edges < 0) {
+        printf("Error: Invalid edges '%s'\n", argv[3]);
+        return 1;
+    }
+
+    int fd = bridge_connect(socket_path);
+    if (fd < 0) {
+        printf("Error: Cannot connect to %s: %s\n", socket_path, strerror(errno));
+        return 1;
+    }
 
-    /* Set up signal handler for Ctrl+C */
-    signal(SIGINT, signal_handler);
+    /* Set up signal handler for Ctrl+C; no SA_RESTART so read() returns */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = signal_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    /* Only this pin's events; the trailing ',' keeps pin 1 from matching 10-15 */
+    snprintf(cmd, sizeof(cmd), "SUBSCRIBE#1:EVT:GPIO,%c,%d,", port, pin);
+    if (bridge_command(fd, cmd, 1) < 0) {
+        close(fd);
+        return 1;
+    }
+    snprintf(cmd, sizeof(cmd), "GPIO_WATCH#2:%c,%d,%d", port, pin, edges);
+    if (bridge_command(fd, cmd, 2) < 0) {
+        close(fd);
+        return 1;
+    }
 
-    printf("GPIO Monitor for STM32F411 (HAL)\n");
-    printf("Monitoring GPIO%c Pin %d (interval: %dms)\n", port, pin, interval_ms);
+    printf("GPIO Monitor for STM32F411\n");
+    printf("Monitoring GPIO%c Pin %d (%s edges)\n", port, pin, argc > 3 ? argv[3] : "both");
     printf("Press Ctrl+C to stop\n\n");
 
-    /* Initialize HAL */
-    HAL_Init();
-    
-    /* Configure pin as input */
-    GPIO_Init_Input(gpio, pin);
-
-    GPIO_PinState last_state = GPIO_PIN_RESET;
-    last_state = (GPIO_PinState)2; /* Invalid state to force first print */
-    int count = 0;
-
-    while (keep_running) {
-        GPIO_PinState current_state = HAL_GPIO_ReadPin(gpio, (1 << pin));
-        
-        if (current_state != last_state) {
-            printf("[%d] GPIO%c.%d changed to %s\n", 
-                   count++, port, pin, current_state ? "HIGH" : "LOW");
-            last_state = current_state;
-        }
+    while (keep_running && read_line(fd, line, sizeof(line)) > 0) {
+        char evt_port;
+        unsigned int evt_pin, level, time_us, seq;
 
-        HAL_Delay(interval_ms);
+        /* EVT:GPIO,<port>,<pin>,<level>,<time_us>,<seq> */
+        if (sscanf(line, "EVT:GPIO,%c,%u,%u,%u,%u",
+                   &evt_port, &evt_pin, &level, &time_us, &seq) != 5 ||
+            evt_port != port || (int)evt_pin != pin) {
+            continue;
+        }
+        printf("[%u] GPIO%c.%d changed to %s at %u.%06u s\n",
+               seq, port, pin, level ? "HIGH" : "LOW", time_us / 1000000, time_us % 1000000);
+        fflush(stdout);
     }
 
     printf("\nMonitoring stopped.\n");
-    
-    /* Deinitialize */
-    HAL_GPIO_DeInit(gpio, (1 << pin));
-    
+
+    /* Stop the interrupt on the STM32 */
+    snprintf(cmd, sizeof(cmd), "GPIO_WATCH#3:%c,%d,0", port, pin);
+    bridge_command(fd, cmd, 3);
+    close(fd);
+
     return 0;
 }